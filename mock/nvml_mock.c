@@ -0,0 +1,941 @@
+// Fake NVML backend, so envyd can run (and be benchmarked) on machines without an NVIDIA GPU.
+//  Built as libnvidia-ml.so.1; either link against it w/ -DMOCK_NVML=ON, or drop it in front of the real
+//  library w/ LD_LIBRARY_PATH. Only the subset of the API that envyd calls is implemented.
+//
+// Configuration (environment, read once in nvmlInit_v2):
+//  ENVYD_MOCK_DEVICES      number of simulated devices (default 1, max MOCK_MAX_DEVICES)
+//  ENVYD_MOCK_SEED         0/unset: every metric is a fixed function of the device index;
+//                          otherwise metrics random-walk around those values, seeded w/ this value
+//  ENVYD_MOCK_LATENCY_US   injected latency for every device call, in microseconds (default 0)
+//  ENVYD_MOCK_JITTER_US    additional uniformly distributed latency, in microseconds (default 0)
+//  ENVYD_MOCK_FAIL         nvmlReturn_t to inject, e.g. GPU_IS_LOST, TIMEOUT or NVML_ERROR_GPU_IS_LOST
+//  ENVYD_MOCK_FAIL_RATE    probability in [0, 1] that a device call fails w/ ENVYD_MOCK_FAIL (default 1)
+//  ENVYD_MOCK_FAIL_DEVICES comma separated device indices that are affected by failures (default all)
+//  ENVYD_MOCK_HANG_FILE    path of a file; while it exists, every call to an affected device blocks, like a
+//                          device that fell off the bus (default none)
+//  ENVYD_MOCK_EVENT_INTERVAL_MS  0/unset: events are only raised by setters (clock/pstate);
+//                          otherwise a random supported event hits a random device every interval
+//  ENVYD_MOCK_PROCESSES    path of a file w/ one '<device index> <pid>' per line, re-read on every call;
+//                          those pids are reported as compute processes (default none)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <nvml.h>
+
+#define MOCK_MAX_DEVICES 1024
+#define MOCK_MAX_FANS 2
+#define MOCK_SUPPORTED_MEMORY_CLOCKS 4
+#define MOCK_SUPPORTED_GRAPHICS_CLOCKS 32
+#define MOCK_EVENT_QUEUE 256
+#define MOCK_SAMPLE_PERIOD_US 20000ULL  // driver-side sampling period of nvmlDeviceGetSamples
+#define MOCK_MAX_PROCESSES 1024  // per device
+#define MOCK_SAMPLE_BUFFER 120  // samples the driver keeps per type, i.e. the last 2.4 s
+#define MOCK_SUPPORTED_EVENTS (nvmlEventTypeSingleBitEccError | nvmlEventTypeDoubleBitEccError | nvmlEventTypePState \
+                               | nvmlEventTypeXidCriticalError | nvmlEventTypeClock | nvmlEventTypePowerSourceChange)
+
+struct nvmlDevice_st {
+    unsigned int index;
+    char uuid[NVML_DEVICE_UUID_V2_BUFFER_SIZE];
+    char name[NVML_DEVICE_NAME_V2_BUFFER_SIZE];
+    int fail_injected;
+    pthread_mutex_t lock;
+    uint64_t rng_state;
+
+    // settable state
+    unsigned int power_limit_mw;
+    unsigned int fan_speed[MOCK_MAX_FANS];
+    unsigned int fan_target[MOCK_MAX_FANS];
+    int fan_manual[MOCK_MAX_FANS];
+    unsigned int gpu_locked_min, gpu_locked_max;
+    unsigned int mem_locked_min, mem_locked_max;
+    unsigned int app_mem_clock, app_graphics_clock;
+    int clock_offset[NVML_CLOCK_COUNT];
+    unsigned int temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_COUNT];
+    nvmlEnableState_t api_restrictions[NVML_RESTRICTED_API_COUNT];
+
+    // simulated readings
+    unsigned int power_mw;
+    unsigned int temperature_c;
+    unsigned int gpu_clock_mhz;
+    unsigned int mem_clock_mhz;
+    unsigned long long memory_used;
+};
+
+typedef struct mockConfig_st {
+    unsigned int device_count;
+    uint64_t seed;
+    unsigned long long latency_ns;
+    unsigned long long jitter_ns;
+    nvmlReturn_t fail_code;
+    double fail_rate;
+    unsigned long long event_interval_ns;
+    const char *hang_path;
+} mockConfig_st;
+
+struct nvmlEventSet_st {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    unsigned long long *registered;  // event mask per device index
+    nvmlEventData_t queue[MOCK_EVENT_QUEUE];  // oldest events are overwritten when full
+    unsigned int head;
+    unsigned int count;
+    struct nvmlEventSet_st *next;
+};
+
+static const unsigned int memory_clocks[MOCK_SUPPORTED_MEMORY_CLOCKS] = {7001, 6801, 810, 405};
+static const unsigned long long memory_total = 8ULL * 1024 * 1024 * 1024;
+static const unsigned int power_min_mw = 125000;
+static const unsigned int power_max_mw = 250000;
+static const unsigned int power_default_mw = 215000;
+static const unsigned int gpu_max_clock_mhz = 2100;
+
+static mockConfig_st config;
+static struct nvmlDevice_st *devices = NULL;
+static int initialized = 0;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct nvmlEventSet_st *event_sets = NULL;
+static pthread_mutex_t event_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static int event_injector_running = 0;
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double uniform(uint64_t *state) {
+    return (double) (xorshift64(state) >> 11) / (double) (1ULL << 53);
+}
+
+static unsigned long long env_ull(const char *key, const unsigned long long fallback) {
+    const char *value = getenv(key);
+    if (value == NULL || *value == 0) return fallback;
+    return strtoull(value, NULL, 10);
+}
+
+static nvmlReturn_t parse_return_code(const char *s) {
+    static const struct { const char *name; nvmlReturn_t code; } codes[] = {
+        {"UNINITIALIZED", NVML_ERROR_UNINITIALIZED},
+        {"INVALID_ARGUMENT", NVML_ERROR_INVALID_ARGUMENT},
+        {"NOT_SUPPORTED", NVML_ERROR_NOT_SUPPORTED},
+        {"NO_PERMISSION", NVML_ERROR_NO_PERMISSION},
+        {"NOT_FOUND", NVML_ERROR_NOT_FOUND},
+        {"INSUFFICIENT_POWER", NVML_ERROR_INSUFFICIENT_POWER},
+        {"DRIVER_NOT_LOADED", NVML_ERROR_DRIVER_NOT_LOADED},
+        {"TIMEOUT", NVML_ERROR_TIMEOUT},
+        {"IRQ_ISSUE", NVML_ERROR_IRQ_ISSUE},
+        {"GPU_IS_LOST", NVML_ERROR_GPU_IS_LOST},
+        {"RESET_REQUIRED", NVML_ERROR_RESET_REQUIRED},
+        {"IN_USE", NVML_ERROR_IN_USE},
+        {"MEMORY", NVML_ERROR_MEMORY},
+        {"NO_DATA", NVML_ERROR_NO_DATA},
+        {"NOT_READY", NVML_ERROR_NOT_READY},
+        {"GPU_NOT_FOUND", NVML_ERROR_GPU_NOT_FOUND},
+        {"INVALID_STATE", NVML_ERROR_INVALID_STATE},
+        {"UNKNOWN", NVML_ERROR_UNKNOWN},
+    };
+    if (strncmp(s, "NVML_ERROR_", strlen("NVML_ERROR_")) == 0) s += strlen("NVML_ERROR_");
+    for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++i) {
+        if (strcmp(s, codes[i].name) == 0) return codes[i].code;
+    }
+    fprintf(stderr, "[nvml-mock] unknown ENVYD_MOCK_FAIL value '%s', using NVML_ERROR_UNKNOWN\n", s);
+    return NVML_ERROR_UNKNOWN;
+}
+
+static void load_config(void) {
+    config.device_count = (unsigned int) env_ull("ENVYD_MOCK_DEVICES", 1);
+    if (config.device_count > MOCK_MAX_DEVICES) config.device_count = MOCK_MAX_DEVICES;
+    config.seed = env_ull("ENVYD_MOCK_SEED", 0);
+    config.latency_ns = env_ull("ENVYD_MOCK_LATENCY_US", 0) * 1000ULL;
+    config.jitter_ns = env_ull("ENVYD_MOCK_JITTER_US", 0) * 1000ULL;
+    config.event_interval_ns = env_ull("ENVYD_MOCK_EVENT_INTERVAL_MS", 0) * 1000000ULL;
+
+    const char *fail = getenv("ENVYD_MOCK_FAIL");
+    config.fail_code = fail != NULL && *fail != 0 ? parse_return_code(fail) : NVML_SUCCESS;
+    const char *fail_rate = getenv("ENVYD_MOCK_FAIL_RATE");
+    config.fail_rate = fail_rate != NULL && *fail_rate != 0 ? strtod(fail_rate, NULL) : 1.0;
+    const char *hang = getenv("ENVYD_MOCK_HANG_FILE");
+    config.hang_path = hang != NULL && *hang != 0 ? hang : NULL;
+}
+
+static void init_device(struct nvmlDevice_st *device, const unsigned int index) {
+    memset(device, 0, sizeof(*device));
+    device->index = index;
+    snprintf(device->uuid, sizeof(device->uuid), "GPU-00000000-0000-4000-8000-%012x", index);
+    snprintf(device->name, sizeof(device->name), "NVIDIA Mock GPU %u", index);
+    pthread_mutex_init(&device->lock, NULL);
+    device->rng_state = (config.seed != 0 ? config.seed : 1) * 0x9E3779B97F4A7C15ULL + index + 1;
+
+    device->power_limit_mw = power_default_mw;
+    for (int fan = 0; fan < MOCK_MAX_FANS; ++fan) {
+        device->fan_speed[fan] = 30 + index % 20;
+        device->fan_target[fan] = device->fan_speed[fan];
+    }
+    device->app_mem_clock = memory_clocks[0];
+    device->app_graphics_clock = 1605;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_SHUTDOWN] = 98;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_SLOWDOWN] = 95;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_MEM_MAX] = 95;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_GPU_MAX] = 93;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MIN] = 65;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_CURR] = 83;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MAX] = 91;
+    device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_GPS_CURR] = 0;
+
+    device->power_mw = 50000 + (index * 7919) % 100000;
+    device->temperature_c = 40 + index % 30;
+    device->gpu_clock_mhz = 1200 + (index * 37) % 600;
+    device->mem_clock_mhz = memory_clocks[0];
+    device->memory_used = (memory_total / 64) * (1 + index % 32);
+}
+
+static void parse_fail_devices(void) {
+    const char *list = getenv("ENVYD_MOCK_FAIL_DEVICES");
+    for (unsigned int i = 0; i < config.device_count; ++i) devices[i].fail_injected = list == NULL || *list == 0;
+    if (list == NULL) return;
+
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+        const unsigned long idx = strtoul(tok, NULL, 10);
+        if (idx < config.device_count) devices[idx].fail_injected = 1;
+    }
+    free(copy);
+}
+
+static void sleep_ns(const unsigned long long ns) {
+    struct timespec ts = {.tv_sec = (time_t) (ns / 1000000000ULL), .tv_nsec = (long) (ns % 1000000000ULL)};
+    while (nanosleep(&ts, &ts) != 0) {}
+}
+
+/**
+ * Common prologue of every device call: latency injection, then failure injection.
+ * @return NVML_SUCCESS if the call should proceed
+ */
+static nvmlReturn_t mock_enter(struct nvmlDevice_st *device) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (device == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    // a device that fell off the bus: the call blocks until it's back
+    while (config.hang_path != NULL && device->fail_injected && access(config.hang_path, F_OK) == 0) sleep_ns(10000000ULL);
+
+    unsigned long long delay = config.latency_ns;
+    if (config.jitter_ns > 0 || config.fail_code != NVML_SUCCESS) {
+        pthread_mutex_lock(&device->lock);
+        if (config.jitter_ns > 0) delay += (unsigned long long) (uniform(&device->rng_state) * (double) config.jitter_ns);
+        const int fail = config.fail_code != NVML_SUCCESS && device->fail_injected
+                         && uniform(&device->rng_state) < config.fail_rate;
+        pthread_mutex_unlock(&device->lock);
+        if (delay > 0) sleep_ns(delay);
+        return fail ? config.fail_code : NVML_SUCCESS;
+    }
+    if (delay > 0) sleep_ns(delay);
+    return NVML_SUCCESS;
+}
+
+#define MOCK_ENTER(device) do { \
+        const nvmlReturn_t injected = mock_enter(device); \
+        if (injected != NVML_SUCCESS) return injected; \
+    } while (0)
+
+/**
+ * @return value, random-walked by up to +-step when a seed is configured
+ */
+static unsigned int drift(struct nvmlDevice_st *device, unsigned int *value, const unsigned int step,
+                          const unsigned int min, const unsigned int max) {
+    if (config.seed == 0) return *value;
+    pthread_mutex_lock(&device->lock);
+    const long long delta = (long long) (uniform(&device->rng_state) * (2.0 * step + 1)) - step;
+    long long next = (long long) *value + delta;
+    if (next < min) next = min;
+    if (next > max) next = max;
+    *value = (unsigned int) next;
+    pthread_mutex_unlock(&device->lock);
+    return *value;
+}
+
+/**
+ * Queues an event on every set that device registered type with.
+ */
+static void raise_event(struct nvmlDevice_st *device, const unsigned long long type, const unsigned long long data) {
+    pthread_mutex_lock(&event_sets_lock);
+    for (struct nvmlEventSet_st *set = event_sets; set != NULL; set = set->next) {
+        pthread_mutex_lock(&set->lock);
+        if ((set->registered[device->index] & type) != 0) {
+            const nvmlEventData_t event = {.device = device, .eventType = type, .eventData = data};
+            set->queue[(set->head + set->count) % MOCK_EVENT_QUEUE] = event;
+            if (set->count < MOCK_EVENT_QUEUE) ++set->count;
+            else set->head = (set->head + 1) % MOCK_EVENT_QUEUE;
+            pthread_cond_signal(&set->ready);
+        }
+        pthread_mutex_unlock(&set->lock);
+    }
+    pthread_mutex_unlock(&event_sets_lock);
+}
+
+/**
+ * ENVYD_MOCK_EVENT_INTERVAL_MS: runs while at least one event set exists.
+ */
+static void *event_injector(void *arg) {
+    (void) arg;
+    uint64_t rng = (config.seed != 0 ? config.seed : 1) * 0xD1B54A32D192ED03ULL;
+    static const unsigned long long types[] = {
+        nvmlEventTypeClock, nvmlEventTypePState, nvmlEventTypeSingleBitEccError, nvmlEventTypeXidCriticalError,
+    };
+    for (;;) {
+        sleep_ns(config.event_interval_ns);
+        pthread_mutex_lock(&init_lock);
+        pthread_mutex_lock(&event_sets_lock);
+        const int running = event_sets != NULL && initialized && config.device_count > 0;
+        if (!running) event_injector_running = 0;
+        pthread_mutex_unlock(&event_sets_lock);
+        if (!running) {
+            pthread_mutex_unlock(&init_lock);
+            return NULL;
+        }
+        const unsigned long long type = types[xorshift64(&rng) % (sizeof(types) / sizeof(types[0]))];
+        // XID 13 (graphics engine exception) rather than anything that would mean a lost GPU
+        raise_event(&devices[xorshift64(&rng) % config.device_count], type,
+                    type == nvmlEventTypeXidCriticalError ? 13 : 0);
+        pthread_mutex_unlock(&init_lock);
+    }
+}
+
+// ----------------------------- LIFECYCLE -----------------------------
+
+nvmlReturn_t nvmlInit_v2(void) {
+    pthread_mutex_lock(&init_lock);
+    if (!initialized) {
+        load_config();
+        devices = calloc(config.device_count > 0 ? config.device_count : 1, sizeof(struct nvmlDevice_st));
+        for (unsigned int i = 0; i < config.device_count; ++i) init_device(&devices[i], i);
+        parse_fail_devices();
+        initialized = 1;
+        fprintf(stderr, "[nvml-mock] %u device(s), seed %llu, latency %lluus (+%lluus), fail %d @ %.3f\n",
+                config.device_count, (unsigned long long) config.seed, config.latency_ns / 1000,
+                config.jitter_ns / 1000, config.fail_code, config.fail_rate);
+    }
+    pthread_mutex_unlock(&init_lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlShutdown(void) {
+    pthread_mutex_lock(&init_lock);
+    if (!initialized) {
+        pthread_mutex_unlock(&init_lock);
+        return NVML_ERROR_UNINITIALIZED;
+    }
+    for (unsigned int i = 0; i < config.device_count; ++i) pthread_mutex_destroy(&devices[i].lock);
+    free(devices);
+    devices = NULL;
+    initialized = 0;
+    pthread_mutex_unlock(&init_lock);
+    return NVML_SUCCESS;
+}
+
+const char *nvmlErrorString(nvmlReturn_t result) {
+    return result == NVML_SUCCESS ? "Success" : "Mock error";
+}
+
+// ----------------------------- DEVICE HANDLES -----------------------------
+
+nvmlReturn_t nvmlDeviceGetCount_v2(unsigned int *deviceCount) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (deviceCount == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *deviceCount = config.device_count;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByIndex_v2(unsigned int index, nvmlDevice_t *device) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (device == NULL || index >= config.device_count) return NVML_ERROR_INVALID_ARGUMENT;
+    *device = &devices[index];
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByUUID(const char *uuid, nvmlDevice_t *device) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (uuid == NULL || device == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    for (unsigned int i = 0; i < config.device_count; ++i) {
+        if (strcmp(devices[i].uuid, uuid) != 0) continue;
+        *device = &devices[i];
+        return NVML_SUCCESS;
+    }
+    return NVML_ERROR_NOT_FOUND;
+}
+
+nvmlReturn_t nvmlDeviceGetIndex(nvmlDevice_t device, unsigned int *index) {
+    MOCK_ENTER(device);
+    if (index == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *index = device->index;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetUUID(nvmlDevice_t device, char *uuid, unsigned int length) {
+    MOCK_ENTER(device);
+    if (uuid == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    if (strlen(device->uuid) + 1 > length) return NVML_ERROR_INSUFFICIENT_SIZE;
+    strcpy(uuid, device->uuid);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetName(nvmlDevice_t device, char *name, unsigned int length) {
+    MOCK_ENTER(device);
+    if (name == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    if (strlen(device->name) + 1 > length) return NVML_ERROR_INSUFFICIENT_SIZE;
+    strcpy(name, device->name);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetGspFirmwareVersion(nvmlDevice_t device, char *version) {
+    MOCK_ENTER(device);
+    if (version == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    snprintf(version, NVML_GSP_FIRMWARE_VERSION_BUF_SIZE, "560.35.03");
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetGspFirmwareMode(nvmlDevice_t device, unsigned int *isEnabled, unsigned int *defaultMode) {
+    MOCK_ENTER(device);
+    if (isEnabled == NULL || defaultMode == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *isEnabled = 1;
+    *defaultMode = 1;
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- CLOCKS -----------------------------
+
+nvmlReturn_t nvmlDeviceGetAdaptiveClockInfoStatus(nvmlDevice_t device, unsigned int *adaptiveClockStatus) {
+    MOCK_ENTER(device);
+    if (adaptiveClockStatus == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *adaptiveClockStatus = NVML_ADAPTIVE_CLOCKING_INFO_STATUS_ENABLED;
+    return NVML_SUCCESS;
+}
+
+static unsigned int current_clock(nvmlDevice_t device, const nvmlClockType_t type) {
+    switch (type) {
+        case NVML_CLOCK_GRAPHICS:
+        case NVML_CLOCK_SM: {
+            unsigned int clock = drift(device, &device->gpu_clock_mhz, 15, 300, gpu_max_clock_mhz);
+            if (device->gpu_locked_max != 0 && clock > device->gpu_locked_max) clock = device->gpu_locked_max;
+            if (device->gpu_locked_min != 0 && clock < device->gpu_locked_min) clock = device->gpu_locked_min;
+            return clock;
+        }
+        case NVML_CLOCK_MEM: {
+            unsigned int clock = device->mem_clock_mhz;
+            if (device->mem_locked_max != 0 && clock > device->mem_locked_max) clock = device->mem_locked_max;
+            return clock;
+        }
+        case NVML_CLOCK_VIDEO:
+            return 1500;
+        default:
+            return 0;
+    }
+}
+
+nvmlReturn_t nvmlDeviceGetClock(nvmlDevice_t device, nvmlClockType_t clockType, nvmlClockId_t clockId, unsigned int *clockMHz) {
+    MOCK_ENTER(device);
+    if (clockMHz == NULL || clockType >= NVML_CLOCK_COUNT || clockId >= NVML_CLOCK_ID_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    switch (clockId) {
+        case NVML_CLOCK_ID_CURRENT:
+            *clockMHz = current_clock(device, clockType);
+            break;
+        case NVML_CLOCK_ID_APP_CLOCK_TARGET:
+            *clockMHz = clockType == NVML_CLOCK_MEM ? device->app_mem_clock : device->app_graphics_clock;
+            break;
+        case NVML_CLOCK_ID_APP_CLOCK_DEFAULT:
+            *clockMHz = clockType == NVML_CLOCK_MEM ? memory_clocks[0] : 1605;
+            break;
+        default:
+            *clockMHz = clockType == NVML_CLOCK_MEM ? memory_clocks[0] : gpu_max_clock_mhz;
+            break;
+    }
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetClockInfo(nvmlDevice_t device, nvmlClockType_t type, unsigned int *clock) {
+    MOCK_ENTER(device);
+    if (clock == NULL || type >= NVML_CLOCK_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    *clock = current_clock(device, type);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetMaxClockInfo(nvmlDevice_t device, nvmlClockType_t type, unsigned int *clock) {
+    MOCK_ENTER(device);
+    if (clock == NULL || type >= NVML_CLOCK_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    *clock = type == NVML_CLOCK_MEM ? memory_clocks[0] : gpu_max_clock_mhz;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetApplicationsClock(nvmlDevice_t device, nvmlClockType_t clockType, unsigned int *clockMHz) {
+    MOCK_ENTER(device);
+    if (clockMHz == NULL || clockType >= NVML_CLOCK_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    *clockMHz = clockType == NVML_CLOCK_MEM ? device->app_mem_clock : device->app_graphics_clock;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetClockOffsets(nvmlDevice_t device, nvmlClockOffset_t *info) {
+    MOCK_ENTER(device);
+    if (info == NULL || info->type >= NVML_CLOCK_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    info->clockOffsetMHz = device->clock_offset[info->type];
+    info->minClockOffsetMHz = -1000;
+    info->maxClockOffsetMHz = 1000;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetClockOffsets(nvmlDevice_t device, nvmlClockOffset_t *info) {
+    MOCK_ENTER(device);
+    if (info == NULL || info->type >= NVML_CLOCK_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    if (info->clockOffsetMHz < -1000 || info->clockOffsetMHz > 1000) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->clock_offset[info->type] = info->clockOffsetMHz;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetSupportedMemoryClocks(nvmlDevice_t device, unsigned int *count, unsigned int *clocksMHz) {
+    MOCK_ENTER(device);
+    if (count == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    if (*count < MOCK_SUPPORTED_MEMORY_CLOCKS || clocksMHz == NULL) {
+        *count = MOCK_SUPPORTED_MEMORY_CLOCKS;
+        return NVML_ERROR_INSUFFICIENT_SIZE;
+    }
+    memcpy(clocksMHz, memory_clocks, sizeof(memory_clocks));
+    *count = MOCK_SUPPORTED_MEMORY_CLOCKS;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetSupportedGraphicsClocks(nvmlDevice_t device, unsigned int memoryClockMHz, unsigned int *count, unsigned int *clocksMHz) {
+    MOCK_ENTER(device);
+    if (count == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    int known = 0;
+    for (int i = 0; i < MOCK_SUPPORTED_MEMORY_CLOCKS; ++i) known |= memory_clocks[i] == memoryClockMHz;
+    if (!known) return NVML_ERROR_NOT_FOUND;
+    if (*count < MOCK_SUPPORTED_GRAPHICS_CLOCKS || clocksMHz == NULL) {
+        *count = MOCK_SUPPORTED_GRAPHICS_CLOCKS;
+        return NVML_ERROR_INSUFFICIENT_SIZE;
+    }
+    for (unsigned int i = 0; i < MOCK_SUPPORTED_GRAPHICS_CLOCKS; ++i) clocksMHz[i] = gpu_max_clock_mhz - i * 45;
+    *count = MOCK_SUPPORTED_GRAPHICS_CLOCKS;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetGpuLockedClocks(nvmlDevice_t device, unsigned int minGpuClockMHz, unsigned int maxGpuClockMHz) {
+    MOCK_ENTER(device);
+    if (minGpuClockMHz > maxGpuClockMHz) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->gpu_locked_min = minGpuClockMHz;
+    device->gpu_locked_max = maxGpuClockMHz;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetMemoryLockedClocks(nvmlDevice_t device, unsigned int minMemClockMHz, unsigned int maxMemClockMHz) {
+    MOCK_ENTER(device);
+    if (minMemClockMHz > maxMemClockMHz) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->mem_locked_min = minMemClockMHz;
+    device->mem_locked_max = maxMemClockMHz;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetApplicationsClocks(nvmlDevice_t device, unsigned int memClockMHz, unsigned int graphicsClockMHz) {
+    MOCK_ENTER(device);
+    if (graphicsClockMHz > gpu_max_clock_mhz) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->app_mem_clock = memClockMHz;
+    device->app_graphics_clock = graphicsClockMHz;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceResetApplicationsClocks(nvmlDevice_t device) {
+    MOCK_ENTER(device);
+    pthread_mutex_lock(&device->lock);
+    device->app_mem_clock = memory_clocks[0];
+    device->app_graphics_clock = 1605;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceResetGpuLockedClocks(nvmlDevice_t device) {
+    MOCK_ENTER(device);
+    pthread_mutex_lock(&device->lock);
+    device->gpu_locked_min = device->gpu_locked_max = 0;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceResetMemoryLockedClocks(nvmlDevice_t device) {
+    MOCK_ENTER(device);
+    pthread_mutex_lock(&device->lock);
+    device->mem_locked_min = device->mem_locked_max = 0;
+    pthread_mutex_unlock(&device->lock);
+    raise_event(device, nvmlEventTypeClock, 0);
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- POWER -----------------------------
+
+nvmlReturn_t nvmlDeviceGetPowerManagementDefaultLimit(nvmlDevice_t device, unsigned int *defaultLimit) {
+    MOCK_ENTER(device);
+    if (defaultLimit == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *defaultLimit = power_default_mw;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPowerManagementLimit(nvmlDevice_t device, unsigned int *limit) {
+    MOCK_ENTER(device);
+    if (limit == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *limit = device->power_limit_mw;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPowerManagementLimitConstraints(nvmlDevice_t device, unsigned int *minLimit, unsigned int *maxLimit) {
+    MOCK_ENTER(device);
+    if (minLimit == NULL || maxLimit == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *minLimit = power_min_mw;
+    *maxLimit = power_max_mw;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPowerUsage(nvmlDevice_t device, unsigned int *power) {
+    MOCK_ENTER(device);
+    if (power == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    const unsigned int usage = drift(device, &device->power_mw, 2500, 15000, power_max_mw);
+    *power = usage < device->power_limit_mw ? usage : device->power_limit_mw;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetPowerManagementLimit_v2(nvmlDevice_t device, nvmlPowerValue_v2_t *powerValue) {
+    MOCK_ENTER(device);
+    if (powerValue == NULL || powerValue->version != nvmlPowerValue_v2) return NVML_ERROR_ARGUMENT_VERSION_MISMATCH;
+    if (powerValue->powerScope != NVML_POWER_SCOPE_GPU) return NVML_ERROR_NOT_SUPPORTED;
+    if (powerValue->powerValueMw < power_min_mw || powerValue->powerValueMw > power_max_mw) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->power_limit_mw = powerValue->powerValueMw;
+    pthread_mutex_unlock(&device->lock);
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- FANS -----------------------------
+
+nvmlReturn_t nvmlDeviceGetNumFans(nvmlDevice_t device, unsigned int *numFans) {
+    MOCK_ENTER(device);
+    if (numFans == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *numFans = MOCK_MAX_FANS;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetFanSpeed_v2(nvmlDevice_t device, unsigned int fan, unsigned int *speed) {
+    MOCK_ENTER(device);
+    if (speed == NULL || fan >= MOCK_MAX_FANS) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    // fans spin towards their target a bit on every read
+    if (device->fan_speed[fan] < device->fan_target[fan]) ++device->fan_speed[fan];
+    if (device->fan_speed[fan] > device->fan_target[fan]) --device->fan_speed[fan];
+    *speed = device->fan_speed[fan];
+    pthread_mutex_unlock(&device->lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetFanSpeed(nvmlDevice_t device, unsigned int *speed) {
+    return nvmlDeviceGetFanSpeed_v2(device, 0, speed);
+}
+
+nvmlReturn_t nvmlDeviceGetTargetFanSpeed(nvmlDevice_t device, unsigned int fan, unsigned int *targetSpeed) {
+    MOCK_ENTER(device);
+    if (targetSpeed == NULL || fan >= MOCK_MAX_FANS) return NVML_ERROR_INVALID_ARGUMENT;
+    *targetSpeed = device->fan_target[fan];
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetMinMaxFanSpeed(nvmlDevice_t device, unsigned int *minSpeed, unsigned int *maxSpeed) {
+    MOCK_ENTER(device);
+    if (minSpeed == NULL || maxSpeed == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *minSpeed = 30;
+    *maxSpeed = 100;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetFanSpeed_v2(nvmlDevice_t device, unsigned int fan, unsigned int speed) {
+    MOCK_ENTER(device);
+    if (fan >= MOCK_MAX_FANS || speed < 30 || speed > 100) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->fan_target[fan] = speed;
+    device->fan_manual[fan] = 1;
+    pthread_mutex_unlock(&device->lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetDefaultFanSpeed_v2(nvmlDevice_t device, unsigned int fan) {
+    MOCK_ENTER(device);
+    if (fan >= MOCK_MAX_FANS) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&device->lock);
+    device->fan_target[fan] = 30 + device->index % 20;
+    device->fan_manual[fan] = 0;
+    pthread_mutex_unlock(&device->lock);
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- RESTRICTIONS -----------------------------
+
+nvmlReturn_t nvmlDeviceSetAPIRestriction(nvmlDevice_t device, nvmlRestrictedAPI_t apiType, nvmlEnableState_t isRestricted) {
+    MOCK_ENTER(device);
+    if (apiType >= NVML_RESTRICTED_API_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    device->api_restrictions[apiType] = isRestricted;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetAPIRestriction(nvmlDevice_t device, nvmlRestrictedAPI_t apiType, nvmlEnableState_t *isRestricted) {
+    MOCK_ENTER(device);
+    if (isRestricted == NULL || apiType >= NVML_RESTRICTED_API_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    *isRestricted = device->api_restrictions[apiType];
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- THERMALS -----------------------------
+
+nvmlReturn_t nvmlDeviceGetTemperature(nvmlDevice_t device, nvmlTemperatureSensors_t sensorType, unsigned int *temp) {
+    MOCK_ENTER(device);
+    if (temp == NULL || sensorType != NVML_TEMPERATURE_GPU) return NVML_ERROR_INVALID_ARGUMENT;
+    *temp = drift(device, &device->temperature_c, 1, 25, 92);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetTemperatureThreshold(nvmlDevice_t device, nvmlTemperatureThresholds_t thresholdType, unsigned int *temp) {
+    MOCK_ENTER(device);
+    if (temp == NULL || thresholdType >= NVML_TEMPERATURE_THRESHOLD_COUNT) return NVML_ERROR_INVALID_ARGUMENT;
+    if (thresholdType == NVML_TEMPERATURE_THRESHOLD_GPS_CURR) return NVML_ERROR_NOT_SUPPORTED;
+    *temp = device->temperature_thresholds[thresholdType];
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceSetTemperatureThreshold(nvmlDevice_t device, nvmlTemperatureThresholds_t thresholdType, int *temp) {
+    MOCK_ENTER(device);
+    if (temp == NULL || thresholdType != NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_CURR) return NVML_ERROR_INVALID_ARGUMENT;
+    if (*temp < (int) device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MIN]
+        || *temp > (int) device->temperature_thresholds[NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MAX]) {
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+    device->temperature_thresholds[thresholdType] = (unsigned int) *temp;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetThermalSettings(nvmlDevice_t device, unsigned int sensorIndex, nvmlGpuThermalSettings_t *pThermalSettings) {
+    MOCK_ENTER(device);
+    if (pThermalSettings == NULL || sensorIndex >= NVML_MAX_THERMAL_SENSORS_PER_GPU) return NVML_ERROR_INVALID_ARGUMENT;
+    memset(pThermalSettings, 0, sizeof(*pThermalSettings));
+    pThermalSettings->count = 1;
+    pThermalSettings->sensor[0].controller = NVML_THERMAL_CONTROLLER_GPU_INTERNAL;
+    pThermalSettings->sensor[0].target = NVML_THERMAL_TARGET_GPU;
+    pThermalSettings->sensor[0].currentTemp = (int) device->temperature_c;
+    pThermalSettings->sensor[0].defaultMinTemp = -273;
+    pThermalSettings->sensor[0].defaultMaxTemp = 127;
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- GENERIC -----------------------------
+
+nvmlReturn_t nvmlDeviceGetMemoryInfo_v2(nvmlDevice_t device, nvmlMemory_v2_t *memory) {
+    MOCK_ENTER(device);
+    if (memory == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    if (memory->version != nvmlMemory_v2) return NVML_ERROR_ARGUMENT_VERSION_MISMATCH;
+    memory->total = memory_total;
+    memory->reserved = 256ULL * 1024 * 1024;
+    memory->used = device->memory_used;
+    memory->free = memory->total - memory->reserved - memory->used;
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- PROCESSES -----------------------------
+
+static nvmlReturn_t running_processes(struct nvmlDevice_st *device, unsigned int *infoCount, nvmlProcessInfo_t *infos,
+                                      const int compute) {
+    MOCK_ENTER(device);
+    if (infoCount == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+
+    unsigned int pids[MOCK_MAX_PROCESSES];
+    unsigned int count = 0;
+    const char *path = getenv("ENVYD_MOCK_PROCESSES");
+    FILE *file = compute && path != NULL && *path != 0 ? fopen(path, "r") : NULL;
+    if (file != NULL) {
+        unsigned int index, pid;
+        while (count < MOCK_MAX_PROCESSES && fscanf(file, "%u %u", &index, &pid) == 2) {
+            if (index == device->index) pids[count++] = pid;
+        }
+        fclose(file);
+    }
+
+    if (*infoCount < count || (count > 0 && infos == NULL)) {
+        *infoCount = count;
+        return NVML_ERROR_INSUFFICIENT_SIZE;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        memset(&infos[i], 0, sizeof(infos[i]));
+        infos[i].pid = pids[i];
+        infos[i].usedGpuMemory = memory_total / 16;
+    }
+    *infoCount = count;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetComputeRunningProcesses_v3(nvmlDevice_t device, unsigned int *infoCount, nvmlProcessInfo_t *infos) {
+    return running_processes(device, infoCount, infos, 1);
+}
+
+nvmlReturn_t nvmlDeviceGetGraphicsRunningProcesses_v3(nvmlDevice_t device, unsigned int *infoCount, nvmlProcessInfo_t *infos) {
+    return running_processes(device, infoCount, infos, 0);
+}
+
+// ----------------------------- EVENTS -----------------------------
+
+nvmlReturn_t nvmlDeviceGetSupportedEventTypes(nvmlDevice_t device, unsigned long long *eventTypes) {
+    MOCK_ENTER(device);
+    if (eventTypes == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *eventTypes = MOCK_SUPPORTED_EVENTS;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlEventSetCreate(nvmlEventSet_t *set) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (set == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    struct nvmlEventSet_st *created = calloc(1, sizeof(struct nvmlEventSet_st));
+    if (created == NULL) return NVML_ERROR_MEMORY;
+    created->registered = calloc(config.device_count > 0 ? config.device_count : 1, sizeof(unsigned long long));
+    if (created->registered == NULL) {
+        free(created);
+        return NVML_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&created->lock, NULL);
+    pthread_cond_init(&created->ready, NULL);
+
+    pthread_mutex_lock(&event_sets_lock);
+    created->next = event_sets;
+    event_sets = created;
+    if (config.event_interval_ns > 0 && !event_injector_running) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, event_injector, NULL) == 0) {
+            pthread_detach(thread);
+            event_injector_running = 1;
+        }
+    }
+    pthread_mutex_unlock(&event_sets_lock);
+    *set = created;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceRegisterEvents(nvmlDevice_t device, unsigned long long eventTypes, nvmlEventSet_t set) {
+    MOCK_ENTER(device);
+    if (set == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    if ((eventTypes & ~MOCK_SUPPORTED_EVENTS) != 0) return NVML_ERROR_NOT_SUPPORTED;
+    pthread_mutex_lock(&set->lock);
+    set->registered[device->index] |= eventTypes;
+    pthread_mutex_unlock(&set->lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlEventSetWait_v2(nvmlEventSet_t set, nvmlEventData_t *data, unsigned int timeoutms) {
+    if (!initialized) return NVML_ERROR_UNINITIALIZED;
+    if (set == NULL || data == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutms / 1000;
+    deadline.tv_nsec += (long) (timeoutms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    while (set->count == 0) {
+        if (pthread_cond_timedwait(&set->ready, &set->lock, &deadline) != 0) break;
+    }
+    if (set->count == 0) {
+        pthread_mutex_unlock(&set->lock);
+        return NVML_ERROR_TIMEOUT;
+    }
+    *data = set->queue[set->head];
+    set->head = (set->head + 1) % MOCK_EVENT_QUEUE;
+    --set->count;
+    pthread_mutex_unlock(&set->lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlEventSetFree(nvmlEventSet_t set) {
+    if (set == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    pthread_mutex_lock(&event_sets_lock);
+    for (struct nvmlEventSet_st **link = &event_sets; *link != NULL; link = &(*link)->next) {
+        if (*link == set) {
+            *link = set->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_sets_lock);
+    pthread_cond_destroy(&set->ready);
+    pthread_mutex_destroy(&set->lock);
+    free(set->registered);
+    free(set);
+    return NVML_SUCCESS;
+}
+
+// ----------------------------- SAMPLES -----------------------------
+
+/**
+ * A stateless stand-in for the driver's sample buffers: the sample at t is a fixed function of device, type and t, so
+ * any two calls agree on overlapping samples.
+ */
+static unsigned int sample_at(const struct nvmlDevice_st *device, const nvmlSamplingType_t type, const unsigned long long t) {
+    uint64_t noise = (t / MOCK_SAMPLE_PERIOD_US) * 0x9E3779B97F4A7C15ULL + device->index * 0xBF58476D1CE4E5B9ULL + type;
+    const double jitter = uniform(&noise) - 0.5;
+    switch (type) {
+        case NVML_TOTAL_POWER_SAMPLES:
+        case NVML_MODULE_POWER_SAMPLES: {
+            const double power = device->power_mw + jitter * 20000.0;
+            return (unsigned int) (power < device->power_limit_mw ? power : device->power_limit_mw);
+        }
+        case NVML_PROCESSOR_CLK_SAMPLES:
+            return (unsigned int) (device->gpu_clock_mhz + jitter * 30.0);
+        case NVML_MEMORY_CLK_SAMPLES:
+            return device->mem_clock_mhz;
+        default:  // utilization, %
+            return (unsigned int) ((device->index * 13 + type * 7) % 60 + 20 + jitter * 10.0);
+    }
+}
+
+nvmlReturn_t nvmlDeviceGetSamples(nvmlDevice_t device, nvmlSamplingType_t type, unsigned long long lastSeenTimeStamp,
+                                  nvmlValueType_t *sampleValType, unsigned int *sampleCount, nvmlSample_t *samples) {
+    MOCK_ENTER(device);
+    if (type >= NVML_SAMPLINGTYPE_COUNT || sampleValType == NULL || sampleCount == NULL) return NVML_ERROR_INVALID_ARGUMENT;
+    *sampleValType = NVML_VALUE_TYPE_UNSIGNED_INT;
+    if (samples == NULL) {
+        *sampleCount = MOCK_SAMPLE_BUFFER;
+        return NVML_SUCCESS;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const unsigned long long now_us = (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    const unsigned long long newest = now_us - now_us % MOCK_SAMPLE_PERIOD_US;
+    unsigned long long t = newest - (MOCK_SAMPLE_BUFFER - 1) * MOCK_SAMPLE_PERIOD_US;
+    if (lastSeenTimeStamp >= t) t = lastSeenTimeStamp - lastSeenTimeStamp % MOCK_SAMPLE_PERIOD_US + MOCK_SAMPLE_PERIOD_US;
+
+    unsigned int count = 0;
+    for (; t <= newest && count < *sampleCount; t += MOCK_SAMPLE_PERIOD_US, ++count) {
+        samples[count].timeStamp = t;
+        samples[count].sampleValue.uiVal = sample_at(device, type, t);
+    }
+    *sampleCount = count;
+    return count > 0 ? NVML_SUCCESS : NVML_ERROR_NOT_FOUND;
+}
@@ -0,0 +1,60 @@
+#include "activation.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int activation_listen_fd(void) {
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    if (listen_pid == NULL || listen_fds == NULL) return -1;
+
+    const bool ours = strtol(listen_pid, NULL, 10) == (long) getpid();
+    const long count = strtol(listen_fds, NULL, 10);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (!ours || count < 1) return -1;
+    if (count > 1) LOG_WARNING("Got %ld sockets from the service manager, only listening on the first", count);
+
+    const int fd = ACTIVATION_LISTEN_FDS_START;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        LOG_ERROR("fd %d passed by the service manager isn't a socket", fd);
+        return -1;
+    }
+    // the passed fds don't have it, and mustn't leak into anything we exec
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+bool activation_notify(const char *state) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (path == NULL || *path == 0) return false;
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    const size_t length = strlen(path);
+    if (length >= sizeof(address.sun_path) || (path[0] != '/' && path[0] != '@')) {
+        LOG_ERROR("NOTIFY_SOCKET '%s' isn't a unix socket path", path);
+        return false;
+    }
+    memcpy(address.sun_path, path, length);
+    if (path[0] == '@') address.sun_path[0] = 0;  // abstract namespace, the length delimits it
+    const socklen_t address_length = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + length + (path[0] == '/'));
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("Couldn't create notification socket (%s)", strerror(errno));
+        return false;
+    }
+    const bool sent = sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *) &address, address_length) >= 0;
+    if (!sent) LOG_ERROR("Couldn't notify the service manager at %s (%s)", path, strerror(errno));
+    close(fd);
+    return sent;
+}
@@ -0,0 +1,24 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <stdbool.h>
+
+#define ACTIVATION_LISTEN_FDS_START 3  // SD_LISTEN_FDS_START
+
+/**
+ * Takes over the listening socket passed by the service manager (LISTEN_PID, LISTEN_FDS), so clients that connect while
+ * we start queue in the kernel instead of failing. Only the first passed fd is used; the variables are unset so children
+ * don't pick them up.
+ *
+ * @return the listening fd, -1 if none was passed (or it isn't a socket)
+ */
+int activation_listen_fd(void);
+
+/**
+ * Sends state (e.g. "READY=1\nSTATUS=...") to the service manager over NOTIFY_SOCKET, if set; '@' paths are abstract.
+ *
+ * @return true if sent
+ */
+bool activation_notify(const char *state);
+
+#endif
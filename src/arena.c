@@ -0,0 +1,174 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // fopencookie
+#endif
+#include "arena.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct arenaStream_st {
+    arena_st *arena;
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool open;
+    bool failed;  // an allocation failed since arena_stream_open
+} arenaStream_st;
+
+static _Thread_local arena_st request_arena = {NULL, NULL};
+static _Thread_local FILE *stream = NULL;
+static _Thread_local arenaStream_st stream_state;
+static _Thread_local bool registered = false;  // for release_thread
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Runs when a thread that used its arena exits; the main thread frees its own on shutdown instead.
+ */
+static void release_thread(void *arena) {
+    // first, flushing it may still allocate
+    if (stream != NULL) {
+        fclose(stream);
+        stream = NULL;
+    }
+    arena_free(arena);
+}
+
+static void create_thread_key(void) {
+    if (pthread_key_create(&thread_key, release_thread) != 0) abort();
+}
+
+static void register_thread(void) {
+    if (registered) return;
+    pthread_once(&thread_key_once, create_thread_key);
+    pthread_setspecific(thread_key, &request_arena);
+    registered = true;
+}
+
+arena_st *arena_request(void) {
+    register_thread();
+    return &request_arena;
+}
+
+static arenaChunk_st *new_chunk(const size_t size) {
+    arenaChunk_st *chunk = malloc(sizeof(arenaChunk_st) + size);
+    if (chunk == NULL) return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void *arena_alloc(arena_st *arena, const size_t size) {
+    const size_t aligned = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    if (arena->current != NULL && arena->current->size - arena->current->used >= aligned) {
+        void *memory = arena->current->data + arena->current->used;
+        arena->current->used += aligned;
+        return memory;
+    }
+
+    // move on to the next chunk kept from earlier requests, if it fits; otherwise put a fresh one in front of it
+    arenaChunk_st *next = arena->current != NULL ? arena->current->next : arena->first;
+    if (next == NULL || next->size < aligned) {
+        arenaChunk_st *chunk = new_chunk(aligned > ARENA_CHUNK_SIZE ? aligned : ARENA_CHUNK_SIZE);
+        if (chunk == NULL) return NULL;
+        chunk->next = next;
+        if (arena->current != NULL) arena->current->next = chunk;
+        else arena->first = chunk;
+        next = chunk;
+    }
+    next->used = aligned;
+    arena->current = next;
+    return next->data;
+}
+
+void *arena_calloc(arena_st *arena, const size_t count, const size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void *memory = arena_alloc(arena, count * size);
+    if (memory != NULL) memset(memory, 0, count * size);
+    return memory;
+}
+
+void arena_reset(arena_st *arena) {
+    // later chunks get their 'used' reset once arena_alloc moves on to them
+    arenaChunk_st **link = &arena->first;
+    size_t kept = 0;
+    while (*link != NULL && kept + (*link)->size <= ARENA_KEEP_SIZE) {
+        kept += (*link)->size;
+        link = &(*link)->next;
+    }
+    arenaChunk_st *chunk = *link;
+    *link = NULL;
+    while (chunk != NULL) {
+        arenaChunk_st *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->current = arena->first;
+    if (arena->first != NULL) arena->first->used = 0;
+}
+
+void arena_free(arena_st *arena) {
+    arenaChunk_st *chunk = arena->first;
+    while (chunk != NULL) {
+        arenaChunk_st *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first = arena->current = NULL;
+}
+
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size) {
+    arenaStream_st *state = cookie;
+    if (state->failed) return (ssize_t) size;  // swallowed, reported by arena_stream_close
+    // +1 for the terminator added on close
+    if (state->length + size + 1 > state->capacity) {
+        size_t capacity = state->capacity > 0 ? state->capacity * 2 : 1024;
+        while (capacity < state->length + size + 1) capacity *= 2;
+        // usually nothing was allocated after the buffer, so it grows in place w/o leaving a copy behind
+        arenaChunk_st *current = state->arena->current;
+        if (state->data != NULL && current != NULL && state->data + state->capacity == current->data + current->used
+            && current->size - current->used >= capacity - state->capacity) {
+            current->used += capacity - state->capacity;
+        } else {
+            char *data = arena_alloc(state->arena, capacity);
+            if (data == NULL) {
+                state->failed = true;
+                return (ssize_t) size;
+            }
+            // the old copy stays in the arena until the next reset
+            if (state->length > 0) memcpy(data, state->data, state->length);
+            state->data = data;
+        }
+        state->capacity = capacity;
+    }
+    memcpy(state->data + state->length, buffer, size);
+    state->length += size;
+    return (ssize_t) size;
+}
+
+FILE *arena_stream_open(void) {
+    register_thread();
+    if (stream == NULL) {
+        stream = fopencookie(&stream_state, "w", (cookie_io_functions_t) {.write = stream_write});
+        if (stream == NULL) return NULL;
+    }
+    assert(!stream_state.open); // sanity; one at a time
+    stream_state = (arenaStream_st) {.arena = &request_arena, .open = true};
+    return stream;
+}
+
+char *arena_stream_close(FILE *s, size_t *length) {
+    assert(s == stream && stream_state.open); // sanity
+    fflush(s);
+    stream_state.open = false;
+    if (stream_state.data == NULL && !stream_state.failed) stream_write(&stream_state, "", 0);
+    if (stream_state.failed || stream_state.data == NULL) return NULL;
+    stream_state.data[stream_state.length] = 0;
+    if (length != NULL) *length = stream_state.length;
+    return stream_state.data;
+}
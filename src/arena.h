@@ -0,0 +1,63 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_KEEP_SIZE (256 * 1024)  // chunks kept across resets, so one huge response doesn't pin its memory for good
+#define ARENA_ALIGNMENT 16
+
+typedef struct arenaChunk_st {
+    struct arenaChunk_st *next;
+    size_t size;  // of data
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} arenaChunk_st;
+
+/**
+ * Bump allocator for everything a request needs until its response is written. Chunks are added when a request needs
+ * more than any before it and kept across resets up to ARENA_KEEP_SIZE, so once the arena has grown to a typical
+ * request, serving requests doesn't call malloc/free at all.
+ */
+typedef struct arena_st {
+    arenaChunk_st *first;
+    arenaChunk_st *current;
+} arena_st;
+
+/**
+ * @return the calling thread's request arena; freed, w/ the thread's stream, when the thread exits
+ */
+arena_st *arena_request(void);
+
+/**
+ * @return ARENA_ALIGNMENT aligned memory that stays valid until the next arena_reset, NULL if out of memory
+ */
+void *arena_alloc(arena_st *arena, const size_t size);
+void *arena_calloc(arena_st *arena, const size_t count, const size_t size);
+
+/**
+ * Forgets every allocation; the first ARENA_KEEP_SIZE of chunks are reused by the next request, the rest are freed.
+ */
+void arena_reset(arena_st *arena);
+
+/**
+ * Gives the chunks back to the system.
+ */
+void arena_free(arena_st *arena);
+
+/**
+ * A stream that writes into the calling thread's request arena, a drop-in for open_memstream in handlers.
+ * The FILE is created once per thread and reused, so only one can be open at a time.
+ *
+ * @return NULL if the stream couldn't be created
+ */
+FILE *arena_stream_open(void);
+
+/**
+ * @return everything written since arena_stream_open, NUL-terminated and valid until the next arena_reset;
+ *  NULL if the arena ran out of memory meanwhile
+ */
+char *arena_stream_close(FILE *stream, size_t *length /*out, nullable*/);
+
+#endif
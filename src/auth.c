@@ -0,0 +1,403 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // struct ucred
+#endif
+#include "auth.h"
+#include "helpers.h"
+#include "trace.h"
+#include <grp.h>
+#include <nvdialog.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUTH_HASH_SIZE 32
+
+typedef struct authGrant_st {
+    bool allowed;  // a no is remembered too, so the same peer isn't asked again and again
+    bool by_token;  // else by uid
+    uid_t uid;
+    unsigned char hash[AUTH_HASH_SIZE];
+    time_t expires;
+} authGrant_st;
+
+typedef struct authMembership_st {
+    uid_t uid;
+    bool member;  // of one of the allowed groups, primary or supplementary
+    time_t expires;
+} authMembership_st;
+
+typedef struct authPrompt_st {
+    char api[96];
+    uid_t uid;
+    pid_t pid;
+    bool by_token;
+    unsigned char hash[AUTH_HASH_SIZE];
+} authPrompt_st;
+
+// read-only once auth_start returns
+static uid_t uids[AUTH_MAX_IDS];
+static unsigned int uid_count = 0;
+static gid_t gids[AUTH_MAX_IDS];
+static unsigned int gid_count = 0;
+static unsigned char tokens[AUTH_MAX_TOKENS][AUTH_HASH_SIZE];
+static unsigned int token_count = 0;
+static time_t grant_ttl_s = AUTH_DEFAULT_GRANT_TTL_S;
+
+// looked up on a peer's first check, so the group database isn't asked on every request
+static authMembership_st memberships[AUTH_MAX_MEMBERSHIPS];
+static unsigned int membership_count = 0;
+
+// written by the prompt thread
+static authGrant_st grants[AUTH_MAX_GRANTS];
+static unsigned int grant_count = 0;
+static authPrompt_st prompts[AUTH_MAX_PROMPTS];
+static unsigned int prompt_count = 0;
+
+static pthread_t prompt_thread;
+static bool prompt_running = false;
+static bool prompt_stop = false;
+static pthread_mutex_t auth_lock = PTHREAD_MUTEX_INITIALIZER;  // guards memberships, grants and prompts
+static pthread_cond_t prompt_wake = PTHREAD_COND_INITIALIZER;
+
+// ---- SHA-256 (FIPS 180-4) ----
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const unsigned char block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 | (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        const uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        const uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        const uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256(const unsigned char *data, const size_t length, unsigned char hash[AUTH_HASH_SIZE] /*out*/) {
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    size_t offset = 0;
+    for (; length - offset >= 64; offset += 64) sha256_block(state, data + offset);
+
+    unsigned char tail[128] = {0};
+    const size_t rest = length - offset;
+    memcpy(tail, data + offset, rest);
+    tail[rest] = 0x80;
+    const size_t tail_length = rest < 56 ? 64 : 128;
+    const uint64_t bits = (uint64_t) length * 8;
+    for (int i = 0; i < 8; ++i) tail[tail_length - 1 - i] = (unsigned char) (bits >> (8 * i));
+    sha256_block(state, tail);
+    if (tail_length == 128) sha256_block(state, tail + 64);
+
+    for (int i = 0; i < 8; ++i) {
+        hash[4 * i] = (unsigned char) (state[i] >> 24);
+        hash[4 * i + 1] = (unsigned char) (state[i] >> 16);
+        hash[4 * i + 2] = (unsigned char) (state[i] >> 8);
+        hash[4 * i + 3] = (unsigned char) state[i];
+    }
+}
+
+// ---- POLICY ----
+
+/**
+ * @return true if equal; takes as long for every mismatch, so timing doesn't leak how much of a hash was right
+ */
+static bool hash_equal(const unsigned char *a, const unsigned char *b) {
+    unsigned char difference = 0;
+    for (int i = 0; i < AUTH_HASH_SIZE; ++i) difference |= a[i] ^ b[i];
+    return difference == 0;
+}
+
+static bool parse_hash(const char *hex, unsigned char hash[AUTH_HASH_SIZE] /*out*/) {
+    for (int i = 0; i < AUTH_HASH_SIZE; ++i) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return false;
+        hash[i] = (unsigned char) byte;
+    }
+    const char end = hex[2 * AUTH_HASH_SIZE];
+    return end == 0 || end == '\n' || end == '\r' || end == ' ' || end == '\t';
+}
+
+static unsigned int parse_ids(const char *list, unsigned int *ids /*out*/) {
+    unsigned int count = 0;
+    for (const char *p = list; *p != 0 && count < AUTH_MAX_IDS;) {
+        char *end;
+        const unsigned long id = strtoul(p, &end, 10);
+        if (end == p) {
+            ++p;
+            continue;
+        }
+        ids[count++] = (unsigned int) id;
+        p = end;
+    }
+    return count;
+}
+
+static void load_tokens(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        LOG_ERROR("Couldn't open token file %s, no bearer tokens accepted", path);
+        return;
+    }
+    char line[256];
+    unsigned int number = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        ++number;
+        const char *hex = line + strspn(line, " \t");
+        if (*hex == '#' || *hex == '\n' || *hex == 0) continue;
+        if (token_count == AUTH_MAX_TOKENS) {
+            LOG_ERROR("More than %d tokens in %s, ignoring the rest", AUTH_MAX_TOKENS, path);
+            break;
+        }
+        if (!parse_hash(hex, tokens[token_count])) {
+            LOG_ERROR("%s:%u isn't a hex SHA-256, ignoring it", path, number);
+            continue;
+        }
+        ++token_count;
+    }
+    fclose(f);
+}
+
+static bool allowed_gid(const gid_t gid) {
+    for (unsigned int i = 0; i < gid_count; ++i) {
+        if (gids[i] == gid) return true;
+    }
+    return false;
+}
+
+/**
+ * Asks the user and group databases (which may be remote, e.g. LDAP) whether uid is in one of the allowed groups.
+ */
+static bool look_up_membership(const uid_t uid) {
+    struct passwd entry;
+    struct passwd *user = NULL;
+    char buffer[4096];
+    if (getpwuid_r(uid, &entry, buffer, sizeof(buffer), &user) != 0 || user == NULL) {
+        LOG_WARNING("Couldn't look up uid %u, only its primary gid is checked", (unsigned int) uid);
+        return false;
+    }
+    gid_t stack_groups[64];
+    gid_t *groups = stack_groups;
+    int count = (int) (sizeof(stack_groups) / sizeof(gid_t));
+    if (getgrouplist(user->pw_name, user->pw_gid, groups, &count) < 0) {
+        // count is now how many there are
+        groups = malloc((size_t) count * sizeof(gid_t));
+        if (groups == NULL || getgrouplist(user->pw_name, user->pw_gid, groups, &count) < 0) {
+            LOG_ERROR("Couldn't list the groups of uid %u, only its primary gid is checked", (unsigned int) uid);
+            free(groups);
+            return false;
+        }
+    }
+    bool member = false;
+    for (int i = 0; i < count && !member; ++i) member = allowed_gid(groups[i]);
+    if (groups != stack_groups) free(groups);
+    return member;
+}
+
+/**
+ * @return true if uid is in one of the allowed groups; cached for AUTH_MEMBERSHIP_TTL_S
+ */
+static bool allowed_member(const uid_t uid) {
+    pthread_mutex_lock(&auth_lock);
+    const time_t now = time(NULL);
+    for (unsigned int i = 0; i < membership_count; ++i) {
+        if (memberships[i].uid != uid || memberships[i].expires <= now) continue;
+        const bool member = memberships[i].member;
+        pthread_mutex_unlock(&auth_lock);
+        return member;
+    }
+    pthread_mutex_unlock(&auth_lock);
+
+    const bool member = look_up_membership(uid);
+
+    pthread_mutex_lock(&auth_lock);
+    unsigned int slot = 0;
+    while (slot < membership_count && memberships[slot].uid != uid) ++slot;
+    if (slot == membership_count) {
+        // the oldest entry makes room
+        if (membership_count == AUTH_MAX_MEMBERSHIPS) {
+            memmove(&memberships[0], &memberships[1], (--membership_count) * sizeof(authMembership_st));
+        }
+        slot = membership_count++;
+    }
+    memberships[slot] = (authMembership_st) {.uid = uid, .member = member, .expires = now + AUTH_MEMBERSHIP_TTL_S};
+    pthread_mutex_unlock(&auth_lock);
+    return member;
+}
+
+// ---- PROMPTS ----
+
+/**
+ * Shows a question dialog; blocks until the desktop user answered, so only the prompt thread calls it.
+ */
+static bool ask(const authPrompt_st *prompt) {
+    char question[512];
+    snprintf(question, sizeof(question), "Process %d (uid %u) is asking for access to %s%s.\nAllow it for %ld minutes?",
+             (int) prompt->pid, (unsigned int) prompt->uid, prompt->api, prompt->by_token ? " with an unknown token" : "",
+             (long) (grant_ttl_s / 60));
+    NvdQuestionBox *dialog = nvd_dialog_question_new("Authorization", question, NVD_YES_NO);
+    if (dialog == NULL) return false;
+    const NvdReply reply = nvd_get_reply(dialog);
+    nvd_free_object(dialog);
+    return reply == NVD_REPLY_OK;
+}
+
+static void *prompter(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&auth_lock);
+    while (!prompt_stop) {
+        if (prompt_count == 0) {
+            pthread_cond_wait(&prompt_wake, &auth_lock);
+            continue;
+        }
+        const authPrompt_st prompt = prompts[0];
+        pthread_mutex_unlock(&auth_lock);
+
+        const bool allowed = ask(&prompt);
+        LOG_INFO("Desktop user %s uid %u for %s", allowed ? "allowed" : "denied", (unsigned int) prompt.uid, prompt.api);
+
+        pthread_mutex_lock(&auth_lock);
+        memmove(&prompts[0], &prompts[1], (--prompt_count) * sizeof(authPrompt_st));
+        // the oldest grant makes room
+        if (grant_count == AUTH_MAX_GRANTS) memmove(&grants[0], &grants[1], (--grant_count) * sizeof(authGrant_st));
+        authGrant_st *grant = &grants[grant_count++];
+        grant->allowed = allowed;
+        grant->by_token = prompt.by_token;
+        grant->uid = prompt.uid;
+        memcpy(grant->hash, prompt.hash, AUTH_HASH_SIZE);
+        grant->expires = time(NULL) + grant_ttl_s;
+    }
+    pthread_mutex_unlock(&auth_lock);
+    return NULL;
+}
+
+/**
+ * Queues a prompt unless the same one is already queued; auth_lock must be held.
+ */
+static void queue_prompt(const char *api, const struct ucred *peer, const bool by_token, const unsigned char *hash) {
+    for (unsigned int i = 0; i < prompt_count; ++i) {
+        if (prompts[i].by_token == by_token
+            && (by_token ? hash_equal(prompts[i].hash, hash) : prompts[i].uid == peer->uid)) return;
+    }
+    if (prompt_count == AUTH_MAX_PROMPTS) return;
+    authPrompt_st *prompt = &prompts[prompt_count++];
+    snprintf(prompt->api, sizeof(prompt->api), "%s", api);
+    prompt->uid = peer->uid;
+    prompt->pid = peer->pid;
+    prompt->by_token = by_token;
+    if (by_token) memcpy(prompt->hash, hash, AUTH_HASH_SIZE);
+    pthread_cond_signal(&prompt_wake);
+}
+
+void auth_start(void) {
+#ifdef INSECURE
+    LOG_WARNING("Built w/ INSECURE, setters need no authorization");
+    return;
+#endif
+    const char *configured_uids = getenv("ENVYD_AUTH_UIDS");
+    if (configured_uids != NULL) {
+        uid_count = parse_ids(configured_uids, (unsigned int *) uids);
+    } else {
+        uids[uid_count++] = 0;
+        if (geteuid() != 0) uids[uid_count++] = geteuid();
+    }
+    const char *configured_gids = getenv("ENVYD_AUTH_GIDS");
+    if (configured_gids != NULL) gid_count = parse_ids(configured_gids, (unsigned int *) gids);
+    const char *token_path = getenv("ENVYD_AUTH_TOKENS");
+    if (token_path != NULL && *token_path != 0) load_tokens(token_path);
+    const char *ttl = getenv("ENVYD_AUTH_GRANT_TTL_S");
+    if (ttl != NULL && strtol(ttl, NULL, 10) > 0) grant_ttl_s = strtol(ttl, NULL, 10);
+    LOG_INFO("Authorization: %u uid(s), %u gid(s), %u token(s)", uid_count, gid_count, token_count);
+
+    const char *prompt = getenv("ENVYD_AUTH_PROMPT");
+    if (prompt == NULL || strcmp(prompt, "1") != 0) return;
+    if (nvd_init() != 0) {
+        LOG_ERROR("Couldn't initialize NvDialog, no authorization prompts");
+        return;
+    }
+    prompt_stop = false;
+    if (pthread_create(&prompt_thread, NULL, prompter, NULL) != 0) {
+        LOG_ERROR("Couldn't start prompt thread, no authorization prompts");
+        return;
+    }
+    prompt_running = true;
+}
+
+void auth_stop(void) {
+    if (!prompt_running) return;
+
+    pthread_mutex_lock(&auth_lock);
+    prompt_stop = true;
+    pthread_cond_signal(&prompt_wake);
+    pthread_mutex_unlock(&auth_lock);
+    // a dialog that's still open keeps the thread; nothing it holds needs cleaning up
+    pthread_detach(prompt_thread);
+    prompt_running = false;
+}
+
+bool auth_check(const int client_fd, const json_object *jobj, const char *api) {
+    struct ucred peer = {.pid = 0, .uid = (uid_t) -1, .gid = (gid_t) -1};
+    socklen_t length = sizeof(peer);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0) {
+        for (unsigned int i = 0; i < uid_count; ++i) {
+            if (uids[i] == peer.uid) return true;
+        }
+        if (allowed_gid(peer.gid)) return true;
+        if (gid_count > 0 && allowed_member(peer.uid)) return true;
+    } else {
+        LOG_ERROR("Couldn't get peer credentials of fd %d", client_fd);
+    }
+
+    unsigned char hash[AUTH_HASH_SIZE];
+    json_object *bearer_field = json_object_object_get(jobj, "bearer");
+    const char *bearer = bearer_field != NULL ? json_object_get_string(bearer_field) : NULL;
+    const bool by_token = bearer != NULL && *bearer != 0;
+    if (by_token) {
+        sha256((const unsigned char *) bearer, strlen(bearer), hash);
+        bool known = false;
+        // no early exit, every token is compared
+        for (unsigned int i = 0; i < token_count; ++i) known |= hash_equal(tokens[i], hash);
+        if (known) return true;
+    }
+
+    bool granted = false;
+    bool answered = false;
+    pthread_mutex_lock(&auth_lock);
+    const time_t now = time(NULL);
+    for (unsigned int i = grant_count; i-- > 0 && !answered;) {  // newest first
+        if (grants[i].expires <= now) continue;
+        answered = grants[i].by_token ? by_token && hash_equal(grants[i].hash, hash) : grants[i].uid == peer.uid;
+        granted = answered && grants[i].allowed;
+    }
+    if (!answered && prompt_running && peer.uid != (uid_t) -1) queue_prompt(api, &peer, by_token, hash);
+    pthread_mutex_unlock(&auth_lock);
+
+    if (!granted) LOG_WARNING("Denied %s to uid %u, pid %d", api, (unsigned int) peer.uid, (int) peer.pid);
+    return granted;
+}
@@ -0,0 +1,42 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+#include <stdbool.h>
+#include <json-c/json.h>
+
+#define AUTH_MAX_IDS 64  // uids and gids each
+#define AUTH_MAX_TOKENS 256
+#define AUTH_MAX_GRANTS 32
+#define AUTH_MAX_PROMPTS 8
+#define AUTH_MAX_MEMBERSHIPS 64  // uids whose groups are cached
+#define AUTH_MEMBERSHIP_TTL_S 60
+#define AUTH_DEFAULT_GRANT_TTL_S 600
+
+/**
+ * Loads the policy, once; every check afterwards is in memory:
+ * - ENVYD_AUTH_UIDS, ENVYD_AUTH_GIDS: comma separated peer uids/gids allowed w/o a token (default: root and our own uid);
+ *   a gid matches the peer's primary group and the supplementary groups of its user, looked up once per
+ *   AUTH_MEMBERSHIP_TTL_S
+ * - ENVYD_AUTH_TOKENS: file w/ one hex SHA-256 of an accepted bearer token per line, '#' starts a comment
+ * - ENVYD_AUTH_PROMPT=1: ask the desktop user about denied peers in a dialog, on a thread of its own; the answer holds for
+ *   the peer's uid (or its token) for ENVYD_AUTH_GRANT_TTL_S seconds (default AUTH_DEFAULT_GRANT_TTL_S)
+ * No-op if built w/ INSECURE.
+ */
+void auth_start(void);
+
+/**
+ * Stops the prompt thread, if any.
+ */
+void auth_stop(void);
+
+/**
+ * Checks the peer of client_fd (SO_PEERCRED) against the policy, then the optional 'bearer' of jobj against the tokens.
+ * Never waits for a prompt: if prompting is on, a denied peer is queued for a prompt and has to retry once it was answered.
+ * Only a peer's first check in a while may wait for the group database, and only if ENVYD_AUTH_GIDS is set.
+ *
+ * @param api what is being asked for, for the log and the prompt
+ * @return true if authorized
+ */
+bool auth_check(int client_fd, const json_object *jobj, const char *api);
+
+#endif
@@ -0,0 +1,392 @@
+#include "coalesce.h"
+#include "network.h"
+#include "helpers.h"
+#include "powerctl.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct coalesceEntry_st {
+    nvmlDevice_t device;
+    char uuid[96];
+    coalesceSetter_t setter;
+    nvmlPowerScopeType_t scope;
+
+    bool known;  // for setters NVML can't read back: what was last written through here
+    unsigned int known_a, known_b;
+    unsigned long long known_ns;  // when; anything outside envyd may have changed it since
+    unsigned long long last_write_ns;  // 0 if never written
+    unsigned int writing;  // claimed writes on their way to the device, w/o coalesce_lock
+    unsigned long long generation;  // bumped by coalesce_forget
+
+    bool pending;
+    int pending_fd;
+    unsigned int pending_a, pending_b;
+} coalesceEntry_st;
+
+static coalesceEntry_st entries[COALESCE_MAX_ENTRIES];
+static unsigned int entry_count = 0;
+static unsigned long long window_ns = COALESCE_DEFAULT_WINDOW_MS * 1000000ULL;
+
+static pthread_t coalesce_thread;
+static bool coalesce_running = false;
+static bool coalesce_stopping = false;
+// never held across NVML calls or answers, so a wedged device only holds up writes to itself
+static pthread_mutex_t coalesce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t coalesce_wake;
+
+static const char *setter_names[COALESCE_SETTER_COUNT] = {"power limit", "gpu locked clocks", "memory locked clocks", "applications clocks"};
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+/**
+ * @return NULL if the table is full
+ */
+static coalesceEntry_st *entry_for(const nvmlDevice_t device, const char *uuid, const coalesceSetter_t setter,
+                                   const nvmlPowerScopeType_t scope) {
+    for (unsigned int i = 0; i < entry_count; ++i) {
+        coalesceEntry_st *entry = &entries[i];
+        if (entry->device == device && entry->setter == setter && entry->scope == scope) return entry;
+    }
+    if (entry_count == COALESCE_MAX_ENTRIES) return NULL;
+    coalesceEntry_st *entry = &entries[entry_count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->device = device;
+    snprintf(entry->uuid, sizeof(entry->uuid), "%s", uuid);
+    entry->setter = setter;
+    entry->scope = scope;
+    entry->pending_fd = -1;
+    return entry;
+}
+
+// one write, claimed under coalesce_lock and carried out w/o it on the device's context; a copy of what it needs, so one
+//  that misses the deadline touches no entry
+typedef struct coalesceWrite_st {
+    int index;  // into entries, -1 if untracked
+    unsigned long long generation;  // of the entry when claimed
+    nvmlDevice_t device;
+    coalesceSetter_t setter;
+    nvmlPowerScopeType_t scope;
+    bool known;
+    unsigned int known_a, known_b;
+    unsigned long long known_ns;
+    unsigned int a, b;
+    // outcome
+    bool superseded;  // coalesce_forget ran before it got to the device
+    bool elided;
+    nvmlReturn_t result;
+} coalesceWrite_st;
+
+/**
+ * Reads what the device has right now where NVML can tell, falls back to what was last written through here within
+ * COALESCE_KNOWN_TTL_MS.
+ * @return false if unknown
+ */
+static bool current(const coalesceWrite_st *task, unsigned int *a /*out*/, unsigned int *b /*out*/) {
+    *b = 0;
+    switch (task->setter) {
+        case COALESCE_POWER_LIMIT:
+            // the getter only reports the GPU scope; the budget and profile controllers change it behind our back
+            if (task->scope == NVML_POWER_SCOPE_GPU) {
+                return NVML_CALL(nvmlDeviceGetPowerManagementLimit, task->device, a) == NVML_SUCCESS;
+            }
+            break;
+        case COALESCE_APPLICATIONS_CLOCKS:
+            return NVML_CALL(nvmlDeviceGetApplicationsClock, task->device, NVML_CLOCK_MEM, a) == NVML_SUCCESS
+                   && NVML_CALL(nvmlDeviceGetApplicationsClock, task->device, NVML_CLOCK_GRAPHICS, b) == NVML_SUCCESS;
+        default:
+            break;
+    }
+    *a = task->known_a;
+    *b = task->known_b;
+    return task->known && monotonic_ns() < task->known_ns + COALESCE_KNOWN_TTL_MS * 1000000ULL;
+}
+
+static nvmlReturn_t write_setter(const coalesceWrite_st *task) {
+    switch (task->setter) {
+        case COALESCE_POWER_LIMIT: {
+            if (powerctl_controls(task->device)) return NVML_ERROR_IN_USE;  // the budget took it over while held
+            nvmlPowerValue_v2_t power_value_s = {0};
+            power_value_s.version = nvmlPowerValue_v2;
+            power_value_s.powerScope = task->scope;
+            power_value_s.powerValueMw = task->a;
+            return NVML_CALL(nvmlDeviceSetPowerManagementLimit_v2, task->device, &power_value_s);
+        }
+        case COALESCE_GPU_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetGpuLockedClocks, task->device, task->a, task->b);
+        case COALESCE_MEMORY_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetMemoryLockedClocks, task->device, task->a, task->b);
+        case COALESCE_APPLICATIONS_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetApplicationsClocks, task->device, task->a, task->b);
+        default:
+            return NVML_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+/**
+ * Runs on the device's context; writes a, b unless the device already has them.
+ */
+static void write_task(void *arg) {
+    coalesceWrite_st *task = arg;
+    if (task->index >= 0) {
+        pthread_mutex_lock(&coalesce_lock);
+        task->superseded = entries[task->index].generation != task->generation;
+        pthread_mutex_unlock(&coalesce_lock);
+        if (task->superseded) return;
+    }
+    unsigned int current_a, current_b;
+    task->elided = current(task, &current_a, &current_b) && current_a == task->a && current_b == task->b;
+    if (!task->elided) task->result = write_setter(task);
+}
+
+/**
+ * Claims a write of a, b to entry; coalesce_lock must be held. Claimed writes are carried out by write_claimed, so
+ * neither the device nor the client is ever waited on w/ the lock.
+ */
+static coalesceWrite_st claim(coalesceEntry_st *entry, const unsigned int a, const unsigned int b) {
+    ++entry->writing;
+    return (coalesceWrite_st) {
+        .index = (int) (entry - entries), .generation = entry->generation, .device = entry->device,
+        .setter = entry->setter, .scope = entry->scope, .known = entry->known, .known_a = entry->known_a,
+        .known_b = entry->known_b, .known_ns = entry->known_ns, .a = a, .b = b,
+    };
+}
+
+/**
+ * Records the outcome of a claimed write in its entry; coalesce_lock must be held.
+ */
+static void finish(const coalesceWrite_st *task) {
+    if (task->index < 0) return;
+    coalesceEntry_st *entry = &entries[task->index];
+    --entry->writing;
+    if (task->superseded || task->elided) return;
+    entry->last_write_ns = monotonic_ns();
+    if (task->generation != entry->generation || task->result != NVML_SUCCESS) {
+        // a failed write may have changed something after all, a forgotten one is followed by a bypassing write
+        entry->known = false;
+    } else {
+        entry->known = true;
+        entry->known_a = task->a;
+        entry->known_b = task->b;
+        entry->known_ns = entry->last_write_ns;
+    }
+    if (coalesce_running) pthread_cond_signal(&coalesce_wake);  // the window of what's held behind it starts now
+}
+
+/**
+ * Carries out a claimed write and answers fd; call w/o coalesce_lock. Without the coalescing thread, whatever was held
+ * for the entry while writing is written right after.
+ */
+static void write_claimed(coalesceWrite_st task, const char *uuid, int fd, bool close_fd) {
+    for (;;) {
+        const nvmlReturn_t call_result = watchdog_device_call(task.device, write_task, &task, sizeof(task));
+        if (call_result != NVML_SUCCESS) task.result = call_result;
+
+        pthread_mutex_lock(&coalesce_lock);
+        finish(&task);
+        coalesceEntry_st *entry = task.index >= 0 ? &entries[task.index] : NULL;
+        const bool next = entry != NULL && entry->pending && entry->writing == 0 && !coalesce_running;
+        const int next_fd = next ? entry->pending_fd : -1;
+        coalesceWrite_st next_task = {0};
+        if (next) {
+            entry->pending = false;
+            entry->pending_fd = -1;
+            next_task = claim(entry, entry->pending_a, entry->pending_b);
+        }
+        pthread_mutex_unlock(&coalesce_lock);
+
+        if (task.superseded) {
+            RESPOND(fd, "{\"write\": \"coalesced\"}", map_nvmlReturn_t_to_string(NVML_SUCCESS), "Replaced by a later write before it was written.");
+        } else if (call_result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't set %s of %s to %u, %u (%s)", setter_names[task.setter], uuid, task.a, task.b, map_nvmlReturn_t_to_string(call_result));
+            const char *description = call_result == NVML_ERROR_TIMEOUT
+                                          ? "Device is degraded: a call to it missed its deadline, it's being re-probed"
+                                          : "Couldn't write the value";
+            RESPOND(fd, NULL, map_nvmlReturn_t_to_string(call_result), description);
+        } else if (task.elided) {
+            LOG_TRACE("Elided %s write of %s, already %u, %u", setter_names[task.setter], uuid, task.a, task.b);
+            RESPOND(fd, "{\"write\": \"elided\"}", map_nvmlReturn_t_to_string(NVML_SUCCESS), "Already set; nothing written.");
+        } else if (task.result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't set %s of %s to %u, %u (%s)", setter_names[task.setter], uuid, task.a, task.b, map_nvmlReturn_t_to_string(task.result));
+            RESPOND(fd, NULL, map_nvmlReturn_t_to_string(task.result), "Couldn't write the value");
+        } else {
+            RESPOND(fd, "{\"write\": \"applied\"}", map_nvmlReturn_t_to_string(NVML_SUCCESS), "Written.");
+        }
+        if (close_fd) close(fd);
+
+        if (!next) return;
+        task = next_task;
+        fd = next_fd;
+        close_fd = true;  // held fds are ours
+    }
+}
+
+/**
+ * Claims the held write of entry and hands over its connection, which write_claimed answers and closes; coalesce_lock
+ * must be held.
+ */
+static coalesceWrite_st claim_held(coalesceEntry_st *entry, int *fd /*out*/) {
+    *fd = entry->pending_fd;
+    entry->pending = false;
+    entry->pending_fd = -1;
+    return claim(entry, entry->pending_a, entry->pending_b);
+}
+
+static void *coalescer(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&coalesce_lock);
+    while (!coalesce_stopping) {
+        const unsigned long long now = monotonic_ns();
+        unsigned long long next = ULLONG_MAX;
+        for (unsigned int i = 0; i < entry_count; ++i) {
+            coalesceEntry_st *entry = &entries[i];
+            if (!entry->pending || entry->writing > 0) continue;  // finish wakes us once the write is done
+            const unsigned long long due = entry->last_write_ns + window_ns;
+            if (due <= now) {
+                int fd;
+                const coalesceWrite_st task = claim_held(entry, &fd);
+                pthread_mutex_unlock(&coalesce_lock);
+                write_claimed(task, entry->uuid, fd, true);
+                arena_reset(arena_request());
+                pthread_mutex_lock(&coalesce_lock);
+            } else if (due < next) {
+                next = due;
+            }
+        }
+
+        if (next == ULLONG_MAX) {
+            pthread_cond_wait(&coalesce_wake, &coalesce_lock);
+        } else {
+            const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+            pthread_cond_timedwait(&coalesce_wake, &coalesce_lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&coalesce_lock);
+    return NULL;
+}
+
+void coalesce_start(void) {
+    const char *configured = getenv("ENVYD_COALESCE_WINDOW_MS");
+    if (configured != NULL && *configured != 0) window_ns = strtoull(configured, NULL, 10) * 1000000ULL;
+    if (window_ns == 0) {
+        LOG_INFO("Setter coalescing disabled, only no-op writes are elided");
+        return;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&coalesce_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    coalesce_stopping = false;
+    if (pthread_create(&coalesce_thread, NULL, coalescer, NULL) != 0) {
+        LOG_ERROR("Couldn't start coalescing thread, setters are written right away");
+        pthread_cond_destroy(&coalesce_wake);
+        return;
+    }
+    coalesce_running = true;
+    LOG_INFO("Coalescing setter writes within %llu ms", window_ns / 1000000ULL);
+}
+
+void coalesce_stop(void) {
+    if (!coalesce_running) return;
+
+    pthread_mutex_lock(&coalesce_lock);
+    coalesce_stopping = true;
+    pthread_cond_signal(&coalesce_wake);
+    pthread_mutex_unlock(&coalesce_lock);
+    pthread_join(coalesce_thread, NULL);
+
+    // clients were promised these; writes still in flight elsewhere write what's held behind them themselves
+    pthread_mutex_lock(&coalesce_lock);
+    coalesce_running = false;
+    for (unsigned int i = 0; i < entry_count; ++i) {
+        coalesceEntry_st *entry = &entries[i];
+        if (!entry->pending || entry->writing > 0) continue;
+        int fd;
+        const coalesceWrite_st task = claim_held(entry, &fd);
+        pthread_mutex_unlock(&coalesce_lock);
+        write_claimed(task, entry->uuid, fd, true);
+        pthread_mutex_lock(&coalesce_lock);
+    }
+    pthread_mutex_unlock(&coalesce_lock);
+    pthread_cond_destroy(&coalesce_wake);
+}
+
+void coalesce_submit(const int client_fd, const nvmlDevice_t device, const char *uuid, const coalesceSetter_t setter,
+                     const nvmlPowerScopeType_t scope, const unsigned int a, const unsigned int b) {
+    pthread_mutex_lock(&coalesce_lock);
+    coalesceEntry_st *entry = entry_for(device, uuid, setter, scope);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&coalesce_lock);
+        LOG_ERROR("Too many setters to coalesce, writing %s of %s as is", setter_names[setter], uuid);
+        const coalesceWrite_st untracked = {.index = -1, .device = device, .setter = setter, .scope = scope, .a = a, .b = b};
+        write_claimed(untracked, uuid, client_fd, false);
+        return;
+    }
+
+    // one write per entry at a time, so they land in order; one submitted during another is held behind it
+    const unsigned long long now = monotonic_ns();
+    if (entry->writing == 0
+        && (!coalesce_running || (!entry->pending && (entry->last_write_ns == 0 || now >= entry->last_write_ns + window_ns)))) {
+        const coalesceWrite_st task = claim(entry, a, b);
+        pthread_mutex_unlock(&coalesce_lock);
+        write_claimed(task, entry->uuid, client_fd, false);
+        return;
+    }
+
+    // the caller closes client_fd once we return; the coalescing thread answers on (and closes) a duplicate
+    const int held_fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 0);
+    if (held_fd < 0) {
+        LOG_ERROR("Couldn't duplicate client fd %d (%s), writing right away", client_fd, strerror(errno));
+        const coalesceWrite_st task = claim(entry, a, b);
+        pthread_mutex_unlock(&coalesce_lock);
+        write_claimed(task, entry->uuid, client_fd, false);
+        return;
+    }
+    if (entry->pending) {
+        LOG_TRACE("Coalesced %s write of %s, %u, %u replaced by %u, %u", setter_names[setter], uuid, entry->pending_a,
+                  entry->pending_b, a, b);
+        RESPOND(entry->pending_fd, "{\"write\": \"coalesced\"}", map_nvmlReturn_t_to_string(NVML_SUCCESS), "Replaced by a later value before it was written.");
+        close(entry->pending_fd);
+    }
+    entry->pending = true;
+    entry->pending_fd = held_fd;
+    entry->pending_a = a;
+    entry->pending_b = b;
+    if (coalesce_running) pthread_cond_signal(&coalesce_wake);
+    pthread_mutex_unlock(&coalesce_lock);
+}
+
+void coalesce_forget(const nvmlDevice_t device) {
+    coalesceWrite_st writes[COALESCE_MAX_ENTRIES];
+    int fds[COALESCE_MAX_ENTRIES];
+    unsigned int count = 0;
+    pthread_mutex_lock(&coalesce_lock);
+    for (unsigned int i = 0; i < entry_count; ++i) {
+        coalesceEntry_st *entry = &entries[i];
+        if (entry->device != device) continue;
+        // writes in flight that haven't reached the device yet are dropped, the ones that have land before ours
+        ++entry->generation;
+        entry->known = false;
+        // held writes were submitted first, so they land first; the caller's write then overrides them
+        if (!entry->pending) continue;
+        writes[count] = claim_held(entry, &fds[count]);
+        ++count;
+    }
+    pthread_mutex_unlock(&coalesce_lock);
+    for (unsigned int i = 0; i < count; ++i) write_claimed(writes[i], entries[writes[i].index].uuid, fds[i], true);
+}
@@ -0,0 +1,48 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <nvml.h>
+
+#define COALESCE_MAX_ENTRIES 256  // device x setter x scope pairs tracked at once
+#define COALESCE_DEFAULT_WINDOW_MS 50
+#define COALESCE_KNOWN_TTL_MS 1000  // how long a write of a setter NVML can't read back is trusted for eliding
+
+typedef enum coalesceSetter_enum {
+    COALESCE_POWER_LIMIT = 0,  // a: mW, per power scope
+    COALESCE_GPU_LOCKED_CLOCKS,  // a, b: min, max MHz
+    COALESCE_MEMORY_LOCKED_CLOCKS,  // a, b: min, max MHz
+    COALESCE_APPLICATIONS_CLOCKS,  // a, b: memory, graphics MHz
+    COALESCE_SETTER_COUNT
+} coalesceSetter_t;
+
+/**
+ * Starts the thread that writes held values once their window closes; the window is ENVYD_COALESCE_WINDOW_MS
+ * (default COALESCE_DEFAULT_WINDOW_MS, 0 writes everything right away but still elides no-ops). NVML must be initialized.
+ */
+void coalesce_start(void);
+
+/**
+ * Stops the thread and writes (and answers) whatever is still held.
+ */
+void coalesce_stop(void);
+
+/**
+ * Sets setter of device to a, b and answers client_fd w/ {"write": "applied" | "coalesced" | "elided"}:
+ * - elided if the device already has that value (read back, or for setters NVML can't read, written through here within
+ *   COALESCE_KNOWN_TTL_MS); nothing is written
+ * - applied right away if setter of device wasn't written within the window, else held until the window closes
+ * - coalesced if a later submit replaced the held value before it was written
+ * A held write is answered (and its connection closed) by the coalescing thread; client_fd stays owned by the caller.
+ * Failed writes are answered w/ their NVML status and data null.
+ */
+void coalesce_submit(int client_fd, nvmlDevice_t device, const char *uuid, coalesceSetter_t setter,
+                     nvmlPowerScopeType_t scope, unsigned int a, unsigned int b);
+
+/**
+ * For writes that bypass coalescing (resets, apply, profiles); call right before them. Writes (and answers) whatever is
+ * held for device, so it can't land on top of the bypassing write, and forgets what was written to it. Writes on their
+ * way to the device that haven't reached it yet are dropped and answered as coalesced.
+ */
+void coalesce_forget(nvmlDevice_t device);
+
+#endif
@@ -0,0 +1,59 @@
+#include "cursors.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct cursor_st {
+    char subscriber[CURSORS_SUBSCRIBER_SIZE];  // empty if the slot is free
+    char uuid[96];
+    nvmlSamplingType_t type;
+    unsigned long long last_seen;
+    unsigned long long last_used;  // cursor_clock at the last get/set, for eviction
+} cursor_st;
+
+static cursor_st cursors[CURSORS_MAX];
+static unsigned long long cursor_clock = 0;
+static pthread_mutex_t cursors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * cursors_lock must be held.
+ */
+static cursor_st *find(const char *subscriber, const char *uuid, const nvmlSamplingType_t type) {
+    for (unsigned int i = 0; i < CURSORS_MAX; ++i) {
+        if (cursors[i].subscriber[0] != 0 && cursors[i].type == type
+            && strcmp(cursors[i].subscriber, subscriber) == 0 && strcmp(cursors[i].uuid, uuid) == 0) {
+            return &cursors[i];
+        }
+    }
+    return NULL;
+}
+
+unsigned long long cursors_get(const char *subscriber, const char *uuid, const nvmlSamplingType_t type) {
+    pthread_mutex_lock(&cursors_lock);
+    cursor_st *cursor = find(subscriber, uuid, type);
+    unsigned long long last_seen = 0;
+    if (cursor != NULL) {
+        cursor->last_used = ++cursor_clock;
+        last_seen = cursor->last_seen;
+    }
+    pthread_mutex_unlock(&cursors_lock);
+    return last_seen;
+}
+
+void cursors_set(const char *subscriber, const char *uuid, const nvmlSamplingType_t type, const unsigned long long last_seen) {
+    pthread_mutex_lock(&cursors_lock);
+    cursor_st *cursor = find(subscriber, uuid, type);
+    if (cursor == NULL) {
+        // a free slot never was used, so it's also the least recently used one
+        cursor = &cursors[0];
+        for (unsigned int i = 1; i < CURSORS_MAX && cursor->subscriber[0] != 0; ++i) {
+            if (cursors[i].subscriber[0] == 0 || cursors[i].last_used < cursor->last_used) cursor = &cursors[i];
+        }
+        snprintf(cursor->subscriber, sizeof(cursor->subscriber), "%s", subscriber);
+        snprintf(cursor->uuid, sizeof(cursor->uuid), "%s", uuid);
+        cursor->type = type;
+    }
+    cursor->last_seen = last_seen;
+    cursor->last_used = ++cursor_clock;
+    pthread_mutex_unlock(&cursors_lock);
+}
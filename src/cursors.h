@@ -0,0 +1,18 @@
+#ifndef CURSORS_H
+#define CURSORS_H
+
+#include <nvml.h>
+
+#define CURSORS_MAX 256
+#define CURSORS_SUBSCRIBER_SIZE 64  // including the terminator
+
+/**
+ * Server-side lastSeenTimeStamp per (subscriber, uuid, sampling type), so that nvmlDeviceGetSamples clients can poll
+ * w/o keeping state. The least recently used cursor is evicted once CURSORS_MAX are in use.
+ *
+ * @return 0 (everything NVML still buffers) for an unknown cursor
+ */
+unsigned long long cursors_get(const char *subscriber, const char *uuid, const nvmlSamplingType_t type);
+void cursors_set(const char *subscriber, const char *uuid, const nvmlSamplingType_t type, const unsigned long long last_seen);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef ENVYD_TELEMETRY_H
+#define ENVYD_TELEMETRY_H
+
+// Reader side of the shared-memory telemetry segment published by envyd (see telemetry.c).
+// Self-contained on purpose (no nvml.h / json-c), copy it into any C or C++ client.
+//
+// The daemon samples every device every `interval_us` and publishes the latest values into one slot per GPU.
+// Reading is a plain memory copy guarded by a seqlock: no syscalls, no JSON, no socket round trip.
+//
+//   envydTelemetry_st telemetry;
+//   if (envyd_telemetry_open(&telemetry) != 0) return;  // envyd not running, or telemetry disabled
+//   envydTelemetrySlot_st slot;
+//   for (uint32_t i = 0; i < telemetry.header->slot_count; ++i) {
+//       if (envyd_telemetry_read(&telemetry, i, &slot) != 0) continue;
+//       if (slot.valid & ENVYD_TELEMETRY_HAS_POWER) printf("%s: %u mW\n", slot.uuid, slot.power_mw);
+//   }
+//   envyd_telemetry_close(&telemetry);
+//
+// Link w/ -lrt on glibc < 2.34.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ENVYD_TELEMETRY_SHM_NAME "/envyd-telemetry"
+#define ENVYD_TELEMETRY_MAGIC 0x59564e45u  // "ENVY", little endian
+#define ENVYD_TELEMETRY_VERSION 1u  // bumped on any layout change; fields are only ever appended within a version
+#define ENVYD_TELEMETRY_READ_ATTEMPTS 1000  // a slot still mid-write after this many is given up on
+#define ENVYD_TELEMETRY_READ_SPINS 16  // attempts before the reader starts yielding to a preempted writer
+
+// bits of envydTelemetrySlot_st.valid; a field is only meaningful if its bit is set
+#define ENVYD_TELEMETRY_HAS_POWER (1u << 0)
+#define ENVYD_TELEMETRY_HAS_POWER_LIMIT (1u << 1)
+#define ENVYD_TELEMETRY_HAS_TEMPERATURE (1u << 2)
+#define ENVYD_TELEMETRY_HAS_GRAPHICS_CLOCK (1u << 3)
+#define ENVYD_TELEMETRY_HAS_SM_CLOCK (1u << 4)
+#define ENVYD_TELEMETRY_HAS_MEMORY_CLOCK (1u << 5)
+#define ENVYD_TELEMETRY_HAS_FAN_SPEED (1u << 6)
+#define ENVYD_TELEMETRY_HAS_MEMORY (1u << 7)
+
+typedef struct envydTelemetryHeader_st {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;  // sizeof(envydTelemetryHeader_st) of the publisher; slots start here
+    uint32_t slot_size;  // sizeof(envydTelemetrySlot_st) of the publisher
+    uint32_t slot_count;  // one per GPU, in NVML index order
+    uint32_t interval_us;  // sampling interval
+    int32_t pid;  // publishing daemon; changes when envyd restarts, reopen then
+    uint32_t reserved;
+    uint64_t started_ns;  // CLOCK_MONOTONIC
+} __attribute__((aligned(64))) envydTelemetryHeader_st;
+
+typedef struct envydTelemetrySlot_st {
+    uint32_t sequence;  // seqlock; odd while the daemon is writing the slot
+    uint32_t index;  // NVML device index
+    uint32_t valid;  // ENVYD_TELEMETRY_HAS_* of the last sample
+    int32_t last_error;  // nvmlReturn_t of the last failed call in the sample, 0 if none
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC of the last sample
+    uint64_t sample_count;
+    char uuid[96];
+    uint32_t power_mw;
+    uint32_t power_limit_mw;
+    uint32_t temperature_c;
+    uint32_t graphics_clock_mhz;
+    uint32_t sm_clock_mhz;
+    uint32_t memory_clock_mhz;
+    uint32_t fan_speed_percent;  // fan 0
+    uint32_t reserved;
+    uint64_t memory_total;  // bytes
+    uint64_t memory_used;  // bytes
+    uint64_t memory_free;  // bytes
+} __attribute__((aligned(64))) envydTelemetrySlot_st;
+
+typedef struct envydTelemetry_st {
+    const envydTelemetryHeader_st *header;
+    size_t size;
+} envydTelemetry_st;
+
+/**
+ * Maps the segment read-only.
+ * @return 0 on success, -1 if it doesn't exist (errno set) or its magic/version don't match this header
+ */
+static inline int envyd_telemetry_open(envydTelemetry_st *telemetry /*out*/) {
+    telemetry->header = NULL;
+    telemetry->size = 0;
+
+    const int fd = shm_open(ENVYD_TELEMETRY_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(envydTelemetryHeader_st)) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const envydTelemetryHeader_st *header = (const envydTelemetryHeader_st *) map;
+    if (header->magic != ENVYD_TELEMETRY_MAGIC || header->version != ENVYD_TELEMETRY_VERSION
+        || header->slot_size < sizeof(envydTelemetrySlot_st)
+        || header->header_size + (size_t) header->slot_count * header->slot_size > (size_t) st.st_size) {
+        munmap(map, (size_t) st.st_size);
+        return -1;
+    }
+
+    telemetry->header = header;
+    telemetry->size = (size_t) st.st_size;
+    return 0;
+}
+
+/**
+ * Copies a consistent snapshot of slot index into out; retries while the daemon is mid-write (a few ns), up to
+ * ENVYD_TELEMETRY_READ_ATTEMPTS times, so a daemon that died mid-write can't hang the reader.
+ * @return 0 on success, -1 if index is out of range (errno EINVAL) or the slot stayed mid-write (errno EAGAIN)
+ */
+static inline int envyd_telemetry_read(const envydTelemetry_st *telemetry, const uint32_t index,
+                                       envydTelemetrySlot_st *out /*out*/) {
+    if (telemetry->header == NULL || index >= telemetry->header->slot_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    const envydTelemetrySlot_st *slot = (const envydTelemetrySlot_st *) (
+        (const char *) telemetry->header + telemetry->header->header_size + (size_t) index * telemetry->header->slot_size);
+
+    for (unsigned int attempt = 0; attempt < ENVYD_TELEMETRY_READ_ATTEMPTS; ++attempt) {
+        if (attempt >= ENVYD_TELEMETRY_READ_SPINS) sched_yield();
+        const uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1u) continue;
+        __builtin_memcpy(out, (const void *) slot, sizeof(envydTelemetrySlot_st));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static inline void envyd_telemetry_close(envydTelemetry_st *telemetry) {
+    if (telemetry->header != NULL) munmap((void *) telemetry->header, telemetry->size);
+    telemetry->header = NULL;
+    telemetry->size = 0;
+}
+
+#endif
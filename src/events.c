@@ -0,0 +1,307 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // pthread_timedjoin_np
+#endif
+#include "events.h"
+#include "telemetry.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct eventsSubscriber_st {
+    int fd;
+    char uuid[96];  // empty for every device
+    unsigned long long types;
+    unsigned long long dropped;
+} eventsSubscriber_st;
+
+static nvmlEventSet_t event_set = NULL;
+static nvmlDevice_t *devices = NULL;
+static char (*uuids)[96] = NULL;
+static unsigned int device_count = 0;
+
+static eventsSubscriber_st subscribers[EVENTS_MAX_SUBSCRIBERS];
+static unsigned int subscriber_count = 0;
+static pthread_mutex_t subscribers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t waiter_thread;
+static bool waiter_running = false;
+static volatile bool waiter_stop = false;
+
+static const struct {
+    const char *name;
+    unsigned long long type;
+} event_names[] = {
+    {"clock", nvmlEventTypeClock},
+    {"pstate", nvmlEventTypePState},
+    {"xid", nvmlEventTypeXidCriticalError},
+    {"singleBitEcc", nvmlEventTypeSingleBitEccError},
+    {"doubleBitEcc", nvmlEventTypeDoubleBitEccError},
+    {"powerSource", nvmlEventTypePowerSourceChange},
+};
+
+static const char *event_name(const unsigned long long type) {
+    for (size_t i = 0; i < sizeof(event_names) / sizeof(event_names[0]); ++i) {
+        if (event_names[i].type == type) return event_names[i].name;
+    }
+    return "unknown";
+}
+
+unsigned long long events_type_from_string(const char *type) {
+    for (size_t i = 0; i < sizeof(event_names) / sizeof(event_names[0]); ++i) {
+        if (strcmp(event_names[i].name, type) == 0) return event_names[i].type;
+    }
+    return nvmlEventTypeNone;
+}
+
+bool events_can_subscribe(void) {
+    if (!waiter_running) return false;
+    pthread_mutex_lock(&subscribers_lock);
+    const bool full = subscriber_count == EVENTS_MAX_SUBSCRIBERS;
+    pthread_mutex_unlock(&subscribers_lock);
+    return !full;
+}
+
+/**
+ * Closes subscriber i and moves the last one into its place; subscribers_lock must be held.
+ */
+static void drop_subscriber(const unsigned int i) {
+    LOG_INFO("Dropping event subscriber fd %d (%llu event(s) dropped while it lagged)",
+             subscribers[i].fd, subscribers[i].dropped);
+    close(subscribers[i].fd);
+    subscribers[i] = subscribers[--subscriber_count];
+}
+
+static void notify(const nvmlEventData_t *event) {
+    unsigned int index = device_count;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (devices[i] == event->device) {
+            index = i;
+            break;
+        }
+    }
+    const char *uuid = index < device_count ? uuids[index] : "";
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    char line[EVENTS_LINE_SIZE];
+    const int len = snprintf(line, sizeof(line),
+                             "{\"event\": \"%s\", \"uuid\": \"%s\", \"index\": %d, \"eventData\": %llu, \"timestamp\": %lld}\n",
+                             event_name(event->eventType), uuid, index < device_count ? (int) index : -1,
+                             event->eventData, (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    LOG_INFO("NVML event: %.*s", len - 1, line);
+
+    pthread_mutex_lock(&subscribers_lock);
+    for (unsigned int i = 0; i < subscriber_count;) {
+        eventsSubscriber_st *subscriber = &subscribers[i];
+        if ((subscriber->types & event->eventType) == 0
+            || (subscriber->uuid[0] != 0 && strcmp(subscriber->uuid, uuid) != 0)) {
+            ++i;
+            continue;
+        }
+        // a full socket buffer takes nothing (the event is dropped) or part of the line; the rest of a line can't follow
+        // later w/o splicing into the next one, so a subscriber w/ a torn line is dropped rather than sent broken JSON
+        const ssize_t written = send(subscriber->fd, line, (size_t) len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ++subscriber->dropped;
+            ++i;
+            continue;
+        }
+        if (written != len) {
+            if (written >= 0) LOG_WARNING("Event subscriber fd %d took only %zd of %d bytes", subscriber->fd, written, len);
+            drop_subscriber(i);
+            continue;
+        }
+        ++i;
+    }
+    pthread_mutex_unlock(&subscribers_lock);
+}
+
+/**
+ * Subscribers never send anything after their request, so a hangup is the only thing poll can report.
+ */
+static void reap_subscribers(void) {
+    pthread_mutex_lock(&subscribers_lock);
+    for (unsigned int i = 0; i < subscriber_count;) {
+        struct pollfd pfd = {.fd = subscribers[i].fd, .events = 0};
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0) {
+            drop_subscriber(i);
+            continue;
+        }
+        ++i;
+    }
+    pthread_mutex_unlock(&subscribers_lock);
+}
+
+static void *waiter(void *arg) {
+    (void) arg;
+    while (!waiter_stop) {
+        nvmlEventData_t event;
+        const nvmlReturn_t result = NVML_CALL(nvmlEventSetWait_v2, event_set, &event, EVENTS_WAIT_TIMEOUT_MS);
+        if (result == NVML_ERROR_TIMEOUT) {
+            reap_subscribers();
+            continue;
+        }
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Waiting for NVML events failed (%s)", map_nvmlReturn_t_to_string(result));
+            // don't spin on a persistent error
+            struct timespec backoff = {.tv_sec = 0, .tv_nsec = EVENTS_WAIT_TIMEOUT_MS * 1000000L};
+            nanosleep(&backoff, NULL);
+            continue;
+        }
+
+        // whatever changed, the sampled values are stale now; don't make anyone wait for the next regular round
+        telemetry_refresh();
+        notify(&event);
+    }
+    return NULL;
+}
+
+void events_start(void) {
+    const char *enabled = getenv("ENVYD_EVENTS");
+    if (enabled != NULL && strcmp(enabled, "0") == 0) {
+        LOG_INFO("NVML events disabled via ENVYD_EVENTS=0");
+        return;
+    }
+
+    nvmlReturn_t result = NVML_CALL(nvmlEventSetCreate, &event_set);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't create NVML event set (%s), events disabled", map_nvmlReturn_t_to_string(result));
+        event_set = NULL;
+        return;
+    }
+
+    result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), events disabled", map_nvmlReturn_t_to_string(result));
+        events_stop();
+        return;
+    }
+    devices = calloc(device_count > 0 ? device_count : 1, sizeof(nvmlDevice_t));
+    uuids = calloc(device_count > 0 ? device_count : 1, sizeof(*uuids));
+    if (devices == NULL || uuids == NULL) {
+        LOG_ERROR("Couldn't allocate device handles, events disabled");
+        events_stop();
+        return;
+    }
+
+    unsigned int registered = 0;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &devices[i]);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device by index %d (%s), no events for it", i, map_nvmlReturn_t_to_string(result));
+            devices[i] = NULL;
+            continue;
+        }
+        result = NVML_CALL(nvmlDeviceGetUUID, devices[i], uuids[i], sizeof(uuids[i]));
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't get uuid by index %d (%s)", i, map_nvmlReturn_t_to_string(result));
+
+        unsigned long long supported = nvmlEventTypeNone;
+        result = NVML_CALL(nvmlDeviceGetSupportedEventTypes, devices[i], &supported);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't get supported events of device %d (%s)", i, map_nvmlReturn_t_to_string(result));
+            continue;
+        }
+        const unsigned long long types = supported & EVENTS_REGISTERED;
+        if (types == nvmlEventTypeNone) continue;
+        result = NVML_CALL(nvmlDeviceRegisterEvents, devices[i], types, event_set);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't register events 0x%llx of device %d (%s)", types, i, map_nvmlReturn_t_to_string(result));
+            continue;
+        }
+        ++registered;
+    }
+
+    if (registered == 0) {
+        LOG_WARNING("No device supports any NVML event, events disabled");
+        events_stop();
+        return;
+    }
+
+    waiter_stop = false;
+    if (pthread_create(&waiter_thread, NULL, waiter, NULL) != 0) {
+        LOG_ERROR("Couldn't start NVML event waiter thread");
+        events_stop();
+        return;
+    }
+    waiter_running = true;
+    LOG_INFO("Waiting for NVML events of %u/%u device(s)", registered, device_count);
+}
+
+void events_stop(void) {
+    bool stuck = false;
+    if (waiter_running) {
+        waiter_stop = true;
+        // the event set spans every device, so the wait can't go to one device's context; a wedged device may keep it
+        //  in the driver well past EVENTS_WAIT_TIMEOUT_MS, a healthy one returns within one wait (and a notify)
+        const unsigned long long timeout_ms = watchdog_deadline_ms() + 2 * EVENTS_WAIT_TIMEOUT_MS;
+        struct timespec at;
+        clock_gettime(CLOCK_REALTIME, &at);
+        at.tv_sec += (time_t) (timeout_ms / 1000ULL);
+        at.tv_nsec += (long) (timeout_ms % 1000ULL) * 1000000L;
+        if (at.tv_nsec >= 1000000000L) {
+            ++at.tv_sec;
+            at.tv_nsec -= 1000000000L;
+        }
+        stuck = pthread_timedjoin_np(waiter_thread, NULL, &at) != 0;
+        if (stuck) {
+            LOG_WARNING("Event waiter still stuck in the driver after %llu ms, leaving it behind", timeout_ms);
+            pthread_detach(waiter_thread);
+        }
+        waiter_running = false;
+    }
+
+    pthread_mutex_lock(&subscribers_lock);
+    // so subscribers can tell a shutdown or restart from a lost connection, and resubscribe
+    const char *last = "{\"event\": \"shutdown\"}\n";
+    while (subscriber_count > 0) {
+        if (send(subscribers[subscriber_count - 1].fd, last, strlen(last), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {}
+        drop_subscriber(subscriber_count - 1);
+    }
+    pthread_mutex_unlock(&subscribers_lock);
+
+    if (stuck) return;  // the waiter still uses the event set and devices
+    if (event_set != NULL) {
+        const nvmlReturn_t result = NVML_CALL(nvmlEventSetFree, event_set);
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't free NVML event set (%s)", map_nvmlReturn_t_to_string(result));
+        event_set = NULL;
+    }
+    if (devices != NULL) {
+        free(devices);
+        devices = NULL;
+    }
+    if (uuids != NULL) {
+        free(uuids);
+        uuids = NULL;
+    }
+}
+
+bool events_subscribe(const int fd, const char *uuid, const unsigned long long types) {
+    if (!waiter_running) return false;
+
+    pthread_mutex_lock(&subscribers_lock);
+    if (subscriber_count == EVENTS_MAX_SUBSCRIBERS) {
+        pthread_mutex_unlock(&subscribers_lock);
+        return false;
+    }
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    eventsSubscriber_st *subscriber = &subscribers[subscriber_count++];
+    memset(subscriber, 0, sizeof(*subscriber));
+    subscriber->fd = fd;
+    if (uuid != NULL) snprintf(subscriber->uuid, sizeof(subscriber->uuid), "%s", uuid);
+    subscriber->types = types != nvmlEventTypeNone ? types & EVENTS_REGISTERED : EVENTS_REGISTERED;
+    pthread_mutex_unlock(&subscribers_lock);
+    LOG_INFO("Event subscriber fd %d (uuid '%s', events 0x%llx)", fd, uuid != NULL ? uuid : "", subscriber->types);
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <nvml.h>
+
+#define EVENTS_MAX_SUBSCRIBERS 64
+#define EVENTS_WAIT_TIMEOUT_MS 250  // one wait of the waiter thread; events_stop gives it two plus the watchdog deadline
+#define EVENTS_LINE_SIZE 256
+
+// everything envyd registers for; devices only get the subset they support
+#define EVENTS_REGISTERED (nvmlEventTypeClock | nvmlEventTypePowerSourceChange | nvmlEventTypeXidCriticalError \
+                           | nvmlEventTypeSingleBitEccError | nvmlEventTypeDoubleBitEccError | nvmlEventTypePState)
+
+/**
+ * Registers EVENTS_REGISTERED of every device w/ one NVML event set and starts the waiter thread, which forces an
+ * immediate telemetry round (see telemetry_refresh) and notifies subscribers on every event. ENVYD_EVENTS=0 disables it.
+ * NVML must be initialized, telemetry should be started already.
+ */
+void events_start(void);
+
+/**
+ * Stops the waiter thread, sends every subscriber a last {"event": "shutdown"} line and closes it, and frees the event
+ * set; no-op if events were never started. A waiter stuck in the driver is left behind w/ the event set.
+ */
+void events_stop(void);
+
+/**
+ * @return false if events are disabled or EVENTS_MAX_SUBSCRIBERS is reached. Subscribers are only ever added by the
+ *  request loop, so a true holds until its next events_subscribe; check it before acknowledging a subscription.
+ */
+bool events_can_subscribe(void);
+
+/**
+ * @return the nvmlEventType* bit of "clock", "pstate", "xid", "singleBitEcc", "doubleBitEcc" or "powerSource";
+ *  nvmlEventTypeNone for anything else
+ */
+unsigned long long events_type_from_string(const char *type);
+
+/**
+ * Hands fd over to the waiter thread, which writes one JSON object per line to it for every matching event,
+ * {"event": "clock", "uuid": ..., "index": 0, "eventData": 0, "timestamp": <unix ms>}, until the peer hangs up.
+ * Events are dropped for subscribers that don't keep up, and a subscriber whose buffer only takes part of a line is
+ * closed, so every line it reads is whole; fd is made non-blocking and closed by the waiter.
+ *
+ * @param uuid NULL for every device
+ * @param types bitmask of nvmlEventType*, nvmlEventTypeNone for all of EVENTS_REGISTERED
+ * @return false (and fd stays owned by the caller) if events_can_subscribe doesn't hold
+ */
+bool events_subscribe(const int fd, const char *uuid, const unsigned long long types);
+
+#endif
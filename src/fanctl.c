@@ -0,0 +1,439 @@
+#include "fanctl.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct fanctlDevice_st {
+    nvmlDevice_t device;
+    char uuid[96];
+    unsigned int fan_count;
+    unsigned int min_speed;
+    unsigned int max_speed;
+
+    bool active;
+    fanctlCurve_st curve;
+    // controller state
+    bool has_temperature;
+    unsigned int temperature_c;  // last read
+    unsigned int effective_c;  // what the curve is evaluated at, after hysteresis
+    unsigned int target_speed;
+    double commanded_speed;  // after slew limiting
+    unsigned int set_speed;  // last one written to the fans, UINT_MAX before the first write
+    unsigned int read_failures;  // consecutive
+    nvmlReturn_t last_error;
+} fanctlDevice_st;
+
+static fanctlDevice_st *devices = NULL;
+static unsigned int device_count = 0;
+static unsigned long long interval_ms = FANCTL_DEFAULT_INTERVAL_MS;
+
+static pthread_t controller_thread;
+static bool controller_running = false;
+static bool controller_stop = false;
+// guards devices[] and controller_stop; never held across NVML calls, requests on the device contexts take it
+static pthread_mutex_t controller_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t controller_wake;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+unsigned int fanctl_curve_speed(const fanctlCurve_st *curve, const unsigned int temperature_c) {
+    assert(curve->point_count > 0); // sanity
+    const fanctlPoint_st *points = curve->points;
+    if (temperature_c <= points[0].temperature_c) return points[0].speed_percent;
+    for (unsigned int i = 1; i < curve->point_count; ++i) {
+        if (temperature_c > points[i].temperature_c) continue;
+        const double span = (double) (points[i].temperature_c - points[i - 1].temperature_c);
+        const double t = span > 0 ? (double) (temperature_c - points[i - 1].temperature_c) / span : 1.0;
+        return (unsigned int) (points[i - 1].speed_percent + t * ((double) points[i].speed_percent - points[i - 1].speed_percent) + 0.5);
+    }
+    return points[curve->point_count - 1].speed_percent;
+}
+
+static fanctlDevice_st *find_device(const char *uuid) {
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (devices[i].device != NULL && strcmp(devices[i].uuid, uuid) == 0) return &devices[i];
+    }
+    return NULL;
+}
+
+// what a task on a device's context gets; each device's curve is only ever changed and run on its context, one at a
+//  time, so a task only has to check that fan control didn't stop while it was waiting on the driver
+typedef struct fanctlTask_st {
+    unsigned int index;
+    nvmlDevice_t device;
+    fanctlCurve_st curve;  // fanctl_set_curve
+    nvmlReturn_t result;
+} fanctlTask_st;
+
+/**
+ * controller_lock must be held.
+ * @return the device task was submitted for, NULL if fan control stopped since
+ */
+static fanctlDevice_st *device_of(const fanctlTask_st *task) {
+    if (devices == NULL || task->index >= device_count || devices[task->index].device != task->device) return NULL;
+    return &devices[task->index];
+}
+
+/**
+ * Called w/o controller_lock.
+ */
+static nvmlReturn_t restore_default(const nvmlDevice_t device, const char *uuid, const unsigned int fan_count) {
+    nvmlReturn_t last = NVML_SUCCESS;
+    for (unsigned int fan = 0; fan < fan_count; ++fan) {
+        const nvmlReturn_t result = NVML_CALL(nvmlDeviceSetDefaultFanSpeed_v2, device, fan);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't restore default speed of fan %u of %s (%s)", fan, uuid, map_nvmlReturn_t_to_string(result));
+            last = result;
+        }
+    }
+    return last;
+}
+
+/**
+ * Hands the fans of the task's device back to the driver; runs on its context.
+ */
+static void clear_task(void *arg) {
+    fanctlTask_st *task = arg;
+    pthread_mutex_lock(&controller_lock);
+    const fanctlDevice_st *device = device_of(task);
+    char uuid[96];
+    const unsigned int fan_count = device != NULL ? device->fan_count : 0;
+    snprintf(uuid, sizeof(uuid), "%s", device != NULL ? device->uuid : "");
+    pthread_mutex_unlock(&controller_lock);
+    if (device == NULL) {
+        task->result = NVML_ERROR_UNINITIALIZED;
+        return;
+    }
+
+    task->result = restore_default(task->device, uuid, fan_count);
+    pthread_mutex_lock(&controller_lock);
+    fanctlDevice_st *still = device_of(task);
+    if (still != NULL) still->active = false;
+    pthread_mutex_unlock(&controller_lock);
+}
+
+/**
+ * One controller period for the task's device; runs on its context.
+ */
+static void step_task(void *arg) {
+    fanctlTask_st *task = arg;
+    pthread_mutex_lock(&controller_lock);
+    fanctlDevice_st *device = device_of(task);
+    if (device == NULL || !device->active) {
+        pthread_mutex_unlock(&controller_lock);
+        return;
+    }
+    char uuid[96];
+    snprintf(uuid, sizeof(uuid), "%s", device->uuid);
+    const unsigned int fan_count = device->fan_count;
+    pthread_mutex_unlock(&controller_lock);
+
+    unsigned int temperature_c;
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetTemperature, task->device, NVML_TEMPERATURE_GPU, &temperature_c);
+    pthread_mutex_lock(&controller_lock);
+    device = device_of(task);
+    if (device == NULL) {
+        pthread_mutex_unlock(&controller_lock);
+        return;
+    }
+    if (result != NVML_SUCCESS) {
+        // keep the fans where they are rather than guess, but not for long: the GPU may be heating up meanwhile
+        device->last_error = result;
+        const unsigned int read_failures = ++device->read_failures;
+        pthread_mutex_unlock(&controller_lock);
+        if (read_failures < FANCTL_MAX_READ_FAILURES) return;
+        LOG_ERROR("Couldn't read temperature of %s %u times in a row (%s), handing its fans back to the driver",
+                  uuid, read_failures, map_nvmlReturn_t_to_string(result));
+        clear_task(task);
+        return;
+    }
+    device->read_failures = 0;
+    device->temperature_c = temperature_c;
+
+    // follow rising temperatures right away, falling ones only once they dropped past the hysteresis band
+    if (!device->has_temperature || temperature_c > device->effective_c
+        || temperature_c + device->curve.hysteresis_c <= device->effective_c) {
+        device->effective_c = temperature_c;
+    }
+    device->has_temperature = true;
+
+    unsigned int target = fanctl_curve_speed(&device->curve, device->effective_c);
+    if (target < device->min_speed) target = device->min_speed;
+    if (target > device->max_speed) target = device->max_speed;
+    device->target_speed = target;
+
+    double commanded = target;
+    if (device->curve.slew_rate > 0) {
+        const double max_step = device->curve.slew_rate * (double) interval_ms / 1000.0;
+        if (commanded > device->commanded_speed + max_step) commanded = device->commanded_speed + max_step;
+        if (commanded < device->commanded_speed - max_step) commanded = device->commanded_speed - max_step;
+    }
+    device->commanded_speed = commanded;
+
+    const unsigned int speed = (unsigned int) (commanded + 0.5);
+    const bool unchanged = speed == device->set_speed;
+    pthread_mutex_unlock(&controller_lock);
+    if (unchanged) return;
+
+    for (unsigned int fan = 0; fan < fan_count && result == NVML_SUCCESS; ++fan) {
+        result = NVML_CALL(nvmlDeviceSetFanSpeed_v2, task->device, fan, speed);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't set fan %u of %s to %u%% (%s)", fan, uuid, speed, map_nvmlReturn_t_to_string(result));
+        }
+    }
+    pthread_mutex_lock(&controller_lock);
+    device = device_of(task);
+    if (device != NULL) {
+        device->last_error = result;
+        if (result == NVML_SUCCESS) device->set_speed = speed;
+    }
+    pthread_mutex_unlock(&controller_lock);
+    if (result == NVML_ERROR_NO_PERMISSION || result == NVML_ERROR_NOT_SUPPORTED) {
+        // won't get better by retrying every period; give the fans back instead of leaving some of them manual
+        LOG_WARNING("Deactivating fan curve of %s", uuid);
+        clear_task(task);
+    }
+}
+
+static void *controller(void *arg) {
+    (void) arg;
+    const unsigned long long interval_ns = interval_ms * 1000000ULL;
+    unsigned long long next = monotonic_ns();
+
+    pthread_mutex_lock(&controller_lock);
+    while (!controller_stop) {
+        for (unsigned int i = 0; i < device_count; ++i) {
+            if (!devices[i].active) continue;
+            // on the device's context, so a wedged device only stalls its own curve; degraded ones are skipped
+            fanctlTask_st task = {.index = i, .device = devices[i].device};
+            pthread_mutex_unlock(&controller_lock);
+            const nvmlReturn_t result = watchdog_device_call(task.device, step_task, &task, sizeof(task));
+            pthread_mutex_lock(&controller_lock);
+            if (result != NVML_SUCCESS) devices[i].last_error = result;
+        }
+
+        // fixed rate; if a period overran, skip ahead instead of bursting to catch up
+        const unsigned long long now = monotonic_ns();
+        next += interval_ns;
+        if (next < now) next = now + interval_ns;
+        const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+        while (!controller_stop && pthread_cond_timedwait(&controller_wake, &controller_lock, &deadline) != ETIMEDOUT) {}
+    }
+    pthread_mutex_unlock(&controller_lock);
+    return NULL;
+}
+
+void fanctl_start(void) {
+    const char *configured = getenv("ENVYD_FANCTL_INTERVAL_MS");
+    if (configured != NULL && strtoull(configured, NULL, 10) > 0) interval_ms = strtoull(configured, NULL, 10);
+
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), fan control disabled", map_nvmlReturn_t_to_string(result));
+        device_count = 0;
+        return;
+    }
+    devices = calloc(device_count > 0 ? device_count : 1, sizeof(fanctlDevice_st));
+    if (devices == NULL) {
+        LOG_ERROR("Couldn't allocate device handles, fan control disabled");
+        device_count = 0;
+        return;
+    }
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        fanctlDevice_st *device = &devices[i];
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &device->device);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device by index %d (%s), no fan control for it", i, map_nvmlReturn_t_to_string(result));
+            device->device = NULL;
+            continue;
+        }
+        result = NVML_CALL(nvmlDeviceGetUUID, device->device, device->uuid, sizeof(device->uuid));
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't get uuid by index %d (%s)", i, map_nvmlReturn_t_to_string(result));
+
+        result = NVML_CALL(nvmlDeviceGetNumFans, device->device, &device->fan_count);
+        if (result != NVML_SUCCESS) device->fan_count = 0;
+        result = NVML_CALL(nvmlDeviceGetMinMaxFanSpeed, device->device, &device->min_speed, &device->max_speed);
+        if (result != NVML_SUCCESS) {
+            device->min_speed = 0;
+            device->max_speed = 100;
+        }
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&controller_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    controller_stop = false;
+    if (pthread_create(&controller_thread, NULL, controller, NULL) != 0) {
+        LOG_ERROR("Couldn't start fan controller thread, fan control disabled");
+        pthread_cond_destroy(&controller_wake);
+        free(devices);
+        devices = NULL;
+        device_count = 0;
+        return;
+    }
+    controller_running = true;
+    LOG_INFO("Fan controller runs every %llu ms", interval_ms);
+}
+
+void fanctl_stop(void) {
+    if (!controller_running) return;
+
+    pthread_mutex_lock(&controller_lock);
+    controller_stop = true;
+    pthread_cond_signal(&controller_wake);
+    pthread_mutex_unlock(&controller_lock);
+    pthread_join(controller_thread, NULL);
+    controller_running = false;
+    pthread_cond_destroy(&controller_wake);
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        pthread_mutex_lock(&controller_lock);
+        const bool active = devices[i].active;
+        pthread_mutex_unlock(&controller_lock);
+        if (!active) continue;
+        fanctlTask_st task = {.index = i, .device = devices[i].device};
+        const nvmlReturn_t result = watchdog_device_call(task.device, clear_task, &task, sizeof(task));
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't hand the fans of %s back to the driver (%s)", devices[i].uuid, map_nvmlReturn_t_to_string(result));
+        }
+    }
+    // tasks that missed their deadline check devices before touching them
+    pthread_mutex_lock(&controller_lock);
+    fanctlDevice_st *stopped = devices;
+    devices = NULL;
+    device_count = 0;
+    pthread_mutex_unlock(&controller_lock);
+    free(stopped);
+}
+
+static void set_curve_task(void *arg) {
+    fanctlTask_st *task = arg;
+    pthread_mutex_lock(&controller_lock);
+    fanctlDevice_st *device = device_of(task);
+    const bool was_active = device != NULL && device->active;
+    pthread_mutex_unlock(&controller_lock);
+    if (device == NULL) {
+        task->result = NVML_ERROR_UNINITIALIZED;
+        return;
+    }
+
+    // slew from wherever the driver left the fans
+    unsigned int speed = 0;
+    task->result = was_active ? NVML_SUCCESS : NVML_CALL(nvmlDeviceGetFanSpeed_v2, task->device, 0, &speed);
+    if (task->result != NVML_SUCCESS) return;
+    pthread_mutex_lock(&controller_lock);
+    device = device_of(task);
+    if (device == NULL) {
+        task->result = NVML_ERROR_UNINITIALIZED;
+    } else {
+        if (!was_active) {
+            device->commanded_speed = speed;
+            device->set_speed = UINT_MAX;
+            device->has_temperature = false;
+            device->read_failures = 0;
+            device->last_error = NVML_SUCCESS;
+        }
+        device->curve = task->curve;
+        device->active = true;
+    }
+    pthread_mutex_unlock(&controller_lock);
+}
+
+/**
+ * Resolves uuid into a task for its device's context.
+ */
+static nvmlReturn_t task_for(const char *uuid, fanctlTask_st *task /*out*/) {
+    pthread_mutex_lock(&controller_lock);
+    const fanctlDevice_st *device = find_device(uuid);
+    nvmlReturn_t result = NVML_SUCCESS;
+    if (device == NULL) result = NVML_ERROR_NOT_FOUND;
+    else if (device->fan_count == 0) result = NVML_ERROR_NOT_SUPPORTED;
+    else *task = (fanctlTask_st) {.index = (unsigned int) (device - devices), .device = device->device};
+    pthread_mutex_unlock(&controller_lock);
+    return result;
+}
+
+nvmlReturn_t fanctl_set_curve(const char *uuid, const fanctlCurve_st *curve) {
+    if (!controller_running) return NVML_ERROR_UNINITIALIZED;
+
+    fanctlTask_st task;
+    nvmlReturn_t result = task_for(uuid, &task);
+    if (result != NVML_SUCCESS) return result;
+    task.curve = *curve;
+    result = watchdog_device_call(task.device, set_curve_task, &task, sizeof(task));
+    if (result != NVML_SUCCESS || task.result != NVML_SUCCESS) return result != NVML_SUCCESS ? result : task.result;
+    LOG_INFO("Fan curve of %s set (%u point(s), hysteresis %u C, slew %u %%/s)", uuid, curve->point_count,
+             curve->hysteresis_c, curve->slew_rate);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t fanctl_clear_curve(const char *uuid) {
+    if (!controller_running) return NVML_ERROR_UNINITIALIZED;
+
+    fanctlTask_st task;
+    nvmlReturn_t result = task_for(uuid, &task);
+    if (result == NVML_ERROR_NOT_SUPPORTED) return NVML_SUCCESS;  // no fans, no curve
+    if (result != NVML_SUCCESS) return result;
+    result = watchdog_device_call(task.device, clear_task, &task, sizeof(task));
+    if (result == NVML_SUCCESS) result = task.result;
+    LOG_INFO("Fan curve of %s cleared", uuid);
+    return result;
+}
+
+unsigned int fanctl_get_curves(fanctlDeviceCurve_st *curves, const unsigned int capacity) {
+    unsigned int count = 0;
+    pthread_mutex_lock(&controller_lock);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (!devices[i].active) continue;
+        if (count < capacity) {
+            snprintf(curves[count].uuid, sizeof(curves[count].uuid), "%s", devices[i].uuid);
+            curves[count].curve = devices[i].curve;
+        }
+        ++count;
+    }
+    pthread_mutex_unlock(&controller_lock);
+    return count;
+}
+
+void fanctl_status(FILE *out) {
+    fprintf(out, "{\"intervalMs\": %llu, \"devices\": [", interval_ms);
+    pthread_mutex_lock(&controller_lock);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        const fanctlDevice_st *device = &devices[i];
+        fprintf(out, "%s{\"uuid\": \"%s\", \"active\": %s, \"fans\": %u, \"minSpeed\": %u, \"maxSpeed\": %u",
+                i == 0 ? "" : ", ", device->uuid, device->active ? "true" : "false", device->fan_count,
+                device->min_speed, device->max_speed);
+        if (device->active) {
+            fprintf(out, ", \"points\": [");
+            for (unsigned int p = 0; p < device->curve.point_count; ++p) {
+                fprintf(out, "%s[%u, %u]", p == 0 ? "" : ", ", device->curve.points[p].temperature_c,
+                        device->curve.points[p].speed_percent);
+            }
+            fprintf(out, "], \"hysteresis\": %u, \"slewRate\": %u", device->curve.hysteresis_c, device->curve.slew_rate);
+            if (device->has_temperature) {
+                fprintf(out, ", \"temperature\": %u, \"targetSpeed\": %u", device->temperature_c, device->target_speed);
+            }
+            if (device->set_speed != UINT_MAX) fprintf(out, ", \"speed\": %u", device->set_speed);
+            fprintf(out, ", \"lastError\": \"%s\"", map_nvmlReturn_t_to_string(device->last_error));
+        }
+        fputc('}', out);
+    }
+    pthread_mutex_unlock(&controller_lock);
+    fputs("]}", out);
+}
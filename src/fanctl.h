@@ -0,0 +1,75 @@
+#ifndef FANCTL_H
+#define FANCTL_H
+
+#include <stdio.h>
+#include <nvml.h>
+
+#define FANCTL_MAX_POINTS 8
+#define FANCTL_DEFAULT_INTERVAL_MS 250
+#define FANCTL_DEFAULT_HYSTERESIS_C 3
+#define FANCTL_DEFAULT_SLEW_RATE 10  // % per second
+#define FANCTL_MAX_READ_FAILURES 8  // consecutive periods w/o a temperature before the fans go back to the driver
+
+typedef struct fanctlPoint_st {
+    unsigned int temperature_c;
+    unsigned int speed_percent;
+} fanctlPoint_st;
+
+// piecewise linear, flat beyond the first and last point
+typedef struct fanctlCurve_st {
+    fanctlPoint_st points[FANCTL_MAX_POINTS];  // ascending temperature
+    unsigned int point_count;
+    unsigned int hysteresis_c;  // a falling temperature only counts once it dropped by at least this much
+    unsigned int slew_rate;  // max change of the commanded speed in % per second, 0 for unlimited
+} fanctlCurve_st;
+
+typedef struct fanctlDeviceCurve_st {
+    char uuid[96];
+    fanctlCurve_st curve;
+} fanctlDeviceCurve_st;
+
+/**
+ * Resolves every device and starts the controller thread, which runs every active curve each ENVYD_FANCTL_INTERVAL_MS
+ * (default FANCTL_DEFAULT_INTERVAL_MS). No curve is active until fanctl_set_curve. NVML must be initialized.
+ */
+void fanctl_start(void);
+
+/**
+ * Stops the controller thread and hands every controlled fan back to the driver (nvmlDeviceSetDefaultFanSpeed_v2).
+ * No-op if the controller was never started.
+ */
+void fanctl_stop(void);
+
+/**
+ * @return the speed the curve maps temperature_c to, before clamping to the device's min/max
+ */
+unsigned int fanctl_curve_speed(const fanctlCurve_st *curve, const unsigned int temperature_c);
+
+/**
+ * Activates (or replaces) the curve of uuid; the controller starts from the current fan speed.
+ *
+ * @return NVML_ERROR_UNINITIALIZED if the controller isn't running, NVML_ERROR_NOT_FOUND for unknown uuids,
+ *  NVML_ERROR_TIMEOUT if the device is degraded, whatever reading the fan speed returned otherwise
+ */
+nvmlReturn_t fanctl_set_curve(const char *uuid, const fanctlCurve_st *curve);
+
+/**
+ * Deactivates the curve of uuid and hands its fans back to the driver.
+ *
+ * @return like fanctl_set_curve, or what nvmlDeviceSetDefaultFanSpeed_v2 returned
+ */
+nvmlReturn_t fanctl_clear_curve(const char *uuid);
+
+/**
+ * Copies the active curves, for handing them to the next process on restart.
+ *
+ * @return how many curves are active, which may exceed capacity
+ */
+unsigned int fanctl_get_curves(fanctlDeviceCurve_st *curves /*out*/, unsigned int capacity);
+
+/**
+ * Writes {"intervalMs": ..., "devices": [...]} w/ the curve and controller state of every device to out.
+ */
+void fanctl_status(FILE *out);
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // close_range
+#endif
+#include "handoff.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HANDOFF_ENV "ENVYD_HANDOFF_FD"
+#define HANDOFF_VERSION 2u
+
+extern char **environ;
+
+// precedes every handoffState_st on the socket pair
+typedef struct handoffHeader_st {
+    unsigned int version;  // of handoffState_st; on a mismatch the socket is still used, the state isn't
+    unsigned int size;  // of the handoffState_st that follows
+} handoffHeader_st;
+
+static volatile sig_atomic_t requested = 0;
+static int predecessor_fd = -1;  // in the new process, until it took over
+static bool handed_over = false;  // in the new process, if it got its socket from an old one
+
+void handoff_request(void) {
+    requested = 1;
+}
+
+bool handoff_requested(void) {
+    if (!requested) return false;
+    requested = 0;
+    return true;
+}
+
+/**
+ * @return our binary's path, w/o the " (deleted)" an upgrade that replaced the file leaves in /proc/self/exe
+ */
+static bool executable_path(char path[PATH_MAX] /*out*/) {
+    const ssize_t length = readlink("/proc/self/exe", path, PATH_MAX - 1);
+    if (length <= 0) return false;
+    path[length] = 0;
+    const char *deleted = " (deleted)";
+    const size_t deleted_length = strlen(deleted);
+    if ((size_t) length > deleted_length && strcmp(path + length - deleted_length, deleted) == 0) {
+        path[length - deleted_length] = 0;
+    }
+    return true;
+}
+
+/**
+ * @return environ w/o HANDOFF_ENV plus HANDOFF_ENV=fd, malloc'd (strings aren't copied except ours), NULL if out of memory
+ */
+static char **handoff_environment(const int fd, char *variable, const size_t variable_size) {
+    size_t count = 0;
+    while (environ[count] != NULL) ++count;
+    char **environment = malloc((count + 2) * sizeof(char *));
+    if (environment == NULL) return NULL;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (strncmp(environ[i], HANDOFF_ENV "=", strlen(HANDOFF_ENV "=")) != 0) environment[kept++] = environ[i];
+    }
+    snprintf(variable, variable_size, HANDOFF_ENV "=%d", fd);
+    environment[kept++] = variable;
+    environment[kept] = NULL;
+    return environment;
+}
+
+/**
+ * Sends header and state, w/ fd as SCM_RIGHTS unless it's -1; blocks until everything is out.
+ */
+static bool send_state(const int socket_fd, const handoffState_st *state, const int fd) {
+    handoffHeader_st header = {.version = HANDOFF_VERSION, .size = sizeof(handoffState_st)};
+    struct iovec iov[2] = {{.iov_base = &header, .iov_len = sizeof(header)},
+                           {.iov_base = (void *) state, .iov_len = sizeof(handoffState_st)}};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {0};
+    struct msghdr message = {.msg_iov = iov, .msg_iovlen = 2};
+    if (fd != -1) {
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    ssize_t sent;
+    while ((sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    if (sent <= 0) return false;
+
+    // the rest of a state that didn't fit the socket buffer at once; the descriptor went w/ the first byte
+    size_t done = (size_t) sent;
+    while (done < sizeof(header) + sizeof(handoffState_st)) {
+        const bool in_header = done < sizeof(header);
+        const char *from = in_header ? (const char *) &header + done : (const char *) state + (done - sizeof(header));
+        const size_t left = in_header ? sizeof(header) - done : sizeof(handoffState_st) - (done - sizeof(header));
+        sent = send(socket_fd, from, left, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        done += (size_t) sent;
+    }
+    return true;
+}
+
+/**
+ * Reads exactly size bytes, waiting up to timeout_ms in total (-1 for ever).
+ *
+ * @return false on EOF, errors and timeouts
+ */
+static bool receive_exact(const int socket_fd, void *buffer /*out*/, const size_t size, const int timeout_ms) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t done = 0;
+    while (done < size) {
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const long long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed_ms >= timeout_ms) return false;
+            wait_ms = (int) (timeout_ms - elapsed_ms);
+        }
+        struct pollfd pfd = {.fd = socket_fd, .events = POLLIN};
+        const int rc = poll(&pfd, 1, wait_ms);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) return false;
+        const ssize_t received = read(socket_fd, (char *) buffer + done, size - done);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        done += (size_t) received;
+    }
+    return true;
+}
+
+/**
+ * Reads the handoffState_st after header into state, or skips it if it's from another version.
+ *
+ * @return false if the socket broke meanwhile
+ */
+static bool receive_state(const int socket_fd, const handoffHeader_st *header, handoffState_st *state /*out*/, const int timeout_ms) {
+    if (header->version == HANDOFF_VERSION && header->size == sizeof(handoffState_st)) {
+        return receive_exact(socket_fd, state, sizeof(handoffState_st), timeout_ms);
+    }
+    *state = (handoffState_st) {0};
+    // version 1 sent just {version, socket_activated}, which ends where our header does
+    if (header->version == 1) {
+        memcpy(&state->socket_activated, &header->size, sizeof(bool));
+        return true;
+    }
+    // a different layout of ours: skip it
+    LOG_WARNING("Handoff from an incompatible version (%u), using the socket but none of its state", header->version);
+    char skipped[4096];
+    for (size_t left = header->size; left > 0;) {
+        const size_t chunk = left < sizeof(skipped) ? left : sizeof(skipped);
+        if (!receive_exact(socket_fd, skipped, chunk, timeout_ms)) return false;
+        left -= chunk;
+    }
+    return true;
+}
+
+int handoff_start(const int listen_fd, const handoffState_st *state, char *argv[], pid_t *pid) {
+    char path[PATH_MAX];
+    if (!executable_path(path)) {
+        LOG_ERROR("Couldn't resolve our executable (%s), not restarting", strerror(errno));
+        return -1;
+    }
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        LOG_ERROR("Couldn't create handoff socket pair (%s), not restarting", strerror(errno));
+        return -1;
+    }
+    char variable[64];
+    char **environment = handoff_environment(pair[1], variable, sizeof(variable));
+    if (environment == NULL) {
+        LOG_ERROR("Couldn't allocate environment, not restarting");
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    *pid = fork();
+    if (*pid == 0) {
+        // only async-signal-safe calls until exec, other threads may have held locks when we forked
+        // held clients and whatever NVML opened w/o O_CLOEXEC stay here; the listening socket goes over the pair
+        close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+        fcntl(pair[1], F_SETFD, 0);
+        execve(path, argv, environment);
+        _exit(127);
+    }
+    free(environment);
+    close(pair[1]);
+    if (*pid < 0) {
+        LOG_ERROR("Couldn't fork (%s), not restarting", strerror(errno));
+        close(pair[0]);
+        return -1;
+    }
+
+    if (!send_state(pair[0], state, listen_fd)) {
+        // it reads EOF and exits
+        LOG_ERROR("Couldn't pass listening socket to pid %d (%s), not restarting", (int) *pid, strerror(errno));
+        close(pair[0]);
+        return -1;
+    }
+    LOG_INFO("Started pid %d from %s, serving until it's warm", (int) *pid, path);
+    return pair[0];
+}
+
+int handoff_receive(handoffState_st *state) {
+    const char *variable = getenv(HANDOFF_ENV);
+    if (variable == NULL) return -1;
+    const int fd = (int) strtol(variable, NULL, 10);
+    unsetenv(HANDOFF_ENV);
+    if (fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        LOG_ERROR("%s isn't an open fd, the old process keeps serving", HANDOFF_ENV);
+        exit(EXIT_FAILURE);
+    }
+
+    handoffHeader_st header = {0};
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {0};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+    ssize_t received;
+    while ((received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&message) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        // binding anew would take the socket path from the old process, which keeps serving
+        LOG_ERROR("Got no listening socket from the old process, leaving it serving");
+        exit(EXIT_FAILURE);
+    }
+    int listen_fd;
+    memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+    if (!receive_exact(fd, (char *) &header + received, sizeof(header) - (size_t) received, -1)
+        || !receive_state(fd, &header, state, -1)) {
+        LOG_ERROR("Handoff socket broke before the state arrived, leaving the old process serving");
+        exit(EXIT_FAILURE);
+    }
+    state->has_controllers = false;  // they follow once we're warm
+    predecessor_fd = fd;
+    handed_over = true;
+    return listen_fd;
+}
+
+void handoff_pass_controllers(const int successor_fd, const bool socket_activated) {
+    handoffState_st *state = calloc(1, sizeof(handoffState_st));
+    if (state == NULL) {
+        LOG_WARNING("Couldn't allocate the handoff state, fan curves, the power budget and profiles aren't carried over");
+        return;
+    }
+    state->socket_activated = socket_activated;
+    state->has_controllers = true;
+
+    const unsigned int curve_count = fanctl_get_curves(state->curves, HANDOFF_MAX_CURVES);
+    state->curve_count = curve_count < HANDOFF_MAX_CURVES ? curve_count : HANDOFF_MAX_CURVES;
+    if (curve_count > HANDOFF_MAX_CURVES) {
+        LOG_WARNING("%u fan curve(s) beyond the first %d aren't carried over", curve_count - HANDOFF_MAX_CURVES, HANDOFF_MAX_CURVES);
+    }
+    state->has_budget = powerctl_get_budget(&state->budget);
+    profiles_get(state->profiles, &state->profile_count, state->rules, &state->rule_count);
+
+    if (send_state(successor_fd, state, -1)) {
+        LOG_INFO("Passed %u fan curve(s), %s power budget, %u profile(s) and %u rule(s) to the new process", state->curve_count,
+                 state->has_budget ? "the" : "no", state->profile_count, state->rule_count);
+    } else {
+        LOG_WARNING("Couldn't pass fan curves, the power budget and profiles to the new process (%s), they're dropped",
+                    strerror(errno));
+    }
+    free(state);
+}
+
+void handoff_take_over(handoffState_st *state) {
+    if (predecessor_fd == -1) return;
+    const char warm = 1;
+    if (write(predecessor_fd, &warm, 1) != 1) {
+        LOG_ERROR("Couldn't tell the old process to shut down (%s), taking over anyway", strerror(errno));
+    } else {
+        // older versions send nothing and just exit
+        const bool socket_activated = state->socket_activated;
+        handoffHeader_st header = {0};
+        if (!receive_exact(predecessor_fd, &header, sizeof(header), HANDOFF_TAKEOVER_TIMEOUT_MS)
+            || !receive_state(predecessor_fd, &header, state, HANDOFF_TAKEOVER_TIMEOUT_MS)) {
+            state->has_controllers = false;
+        }
+        state->socket_activated = socket_activated;
+        // it holds nothing we write to this socket, so EOF means it exited
+        struct pollfd pfd = {.fd = predecessor_fd, .events = POLLIN};
+        char ignored;
+        int rc;
+        while ((rc = poll(&pfd, 1, HANDOFF_TAKEOVER_TIMEOUT_MS)) < 0 && errno == EINTR) {}
+        if (rc == 0) LOG_WARNING("Old process didn't shut down within %d ms, taking over anyway", HANDOFF_TAKEOVER_TIMEOUT_MS);
+        else if (read(predecessor_fd, &ignored, 1) != 0) LOG_WARNING("Unexpected data from the old process, taking over");
+    }
+    close(predecessor_fd);
+    predecessor_fd = -1;
+}
+
+void handoff_restore_controllers(const handoffState_st *state) {
+    if (!handed_over) return;
+    if (!state->has_controllers) {
+        LOG_WARNING("Got no fan curves, power budget or profiles from the old process, the devices keep the driver's defaults");
+        return;
+    }
+
+    for (unsigned int i = 0; i < state->curve_count; ++i) {
+        const nvmlReturn_t result = fanctl_set_curve(state->curves[i].uuid, &state->curves[i].curve);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't carry over the fan curve of %s (%s), its fans stay w/ the driver", state->curves[i].uuid,
+                        map_nvmlReturn_t_to_string(result));
+        }
+    }
+    if (state->has_budget) {
+        const char *error = NULL;
+        const nvmlReturn_t result = powerctl_set_budget(&state->budget, &error);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't carry over the power budget (%s: %s), the devices keep their limits",
+                        map_nvmlReturn_t_to_string(result), error != NULL ? error : "");
+        }
+    }
+    for (unsigned int i = 0; i < state->profile_count; ++i) {
+        const nvmlReturn_t result = profiles_set(&state->profiles[i]);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't carry over profile '%s' (%s)", state->profiles[i].name, map_nvmlReturn_t_to_string(result));
+        }
+    }
+    if (state->rule_count > 0) {
+        const nvmlReturn_t result = profiles_set_rules(state->rules, state->rule_count);
+        if (result != NVML_SUCCESS) {
+            LOG_WARNING("Couldn't carry over the profile rules (%s), no profile gets applied", map_nvmlReturn_t_to_string(result));
+        }
+    }
+    LOG_INFO("Took over %u fan curve(s), %s power budget, %u profile(s) and %u rule(s)", state->curve_count,
+             state->has_budget ? "the" : "no", state->profile_count, state->rule_count);
+}
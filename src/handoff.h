@@ -0,0 +1,76 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "fanctl.h"
+#include "powerctl.h"
+#include "profiles.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define HANDOFF_TAKEOVER_TIMEOUT_MS 30000
+#define HANDOFF_MAX_CURVES 64
+
+/**
+ * What the old process passes along: w/ the listening socket, then once it stopped accepting, again w/ its controllers.
+ */
+typedef struct handoffState_st {
+    bool socket_activated;  // the service manager owns the socket file
+    // background controllers; the old process hands their devices back to the driver on its way out
+    bool has_controllers;  // false in the first message, or if the old process couldn't send them
+    unsigned int curve_count;
+    fanctlDeviceCurve_st curves[HANDOFF_MAX_CURVES];
+    bool has_budget;
+    powerctlBudget_st budget;
+    unsigned int profile_count;
+    profile_st profiles[PROFILES_MAX];
+    unsigned int rule_count;
+    profileRule_st rules[PROFILES_MAX_RULES];
+} handoffState_st;
+
+/**
+ * Asks the accept loop to hand the listening socket to a fresh envyd; async-signal-safe, for SIGHUP and 'restart'.
+ */
+void handoff_request(void);
+
+/**
+ * @return true once, after handoff_request
+ */
+bool handoff_requested(void);
+
+/**
+ * Re-executes the binary at our path (so an upgraded one is picked up) and passes it listen_fd and state over a
+ * socket pair (SCM_RIGHTS). We keep accepting while it initializes NVML and warms up; both share the kernel's queue.
+ *
+ * @return fd that becomes readable once the new process is warm (one byte) or died (EOF), -1 if it couldn't be started
+ */
+int handoff_start(int listen_fd, const handoffState_st *state, char *argv[], pid_t *pid /*out*/);
+
+/**
+ * In the new process: takes the listening socket passed by the old one (ENVYD_HANDOFF_FD); exits if that fails, the old
+ * one keeps serving.
+ *
+ * @return the listening fd, -1 if we weren't started by a handoff
+ */
+int handoff_receive(handoffState_st *state /*out*/);
+
+/**
+ * In the old process, once the new one is warm and we stopped accepting: sends it our fan curves, power budget,
+ * profiles and rules, so it can take them over once we handed the devices back to the driver.
+ */
+void handoff_pass_controllers(int successor_fd, bool socket_activated);
+
+/**
+ * In the new process, once warm: tells the old one to stop accepting and shut down, takes its controllers into
+ * state, then waits (up to HANDOFF_TAKEOVER_TIMEOUT_MS) until it exited, so fan control, the metrics listener, the
+ * telemetry segment and the store are never owned by both. Clients connecting meanwhile queue in the kernel. No-op if
+ * we weren't handed a socket.
+ */
+void handoff_take_over(handoffState_st *state /*in,out*/);
+
+/**
+ * In the new process, once fan control, the power budget and profiles run: re-activates what handoff_take_over got,
+ * logging a warning for each controller that can't be.
+ */
+void handoff_restore_controllers(const handoffState_st *state);
+
+#endif
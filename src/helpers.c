@@ -8,6 +8,7 @@
 #include <nvml.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <pthread.h>
 
 int is_whitespace(const char c) {
     return c == ' ';
@@ -44,10 +45,15 @@ void rstrip(char *src) {
     memset(modifiable_src, 0, size - filler_idx);
 }
 
+// log_buffer is shared, and lines from different threads must not interleave
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void _logl(const logLevel_t level, const char *filename, const int lc, const char *fn, const char *fmt, ...) {
-    if (log_buffer == NULL) log_buffer = malloc(sizeof(char) * LOG_BUFFER_SIZE);
     if (current_log_level < level) return;
 
+    pthread_mutex_lock(&log_lock);
+    if (log_buffer == NULL) log_buffer = malloc(sizeof(char) * LOG_BUFFER_SIZE);
+
     memset(log_buffer, 0, sizeof(char) * LOG_BUFFER_SIZE);
     char *slvl = NULL;
     char *ansi_clr = NULL;
@@ -80,8 +86,10 @@ void _logl(const logLevel_t level, const char *filename, const int lc, const cha
     va_start(args, fmt);
     printf("%s[%s:%d][%s][%s]\033[0m ", ansi_clr, filename, lc, fn, slvl);
     vsnprintf(log_buffer, sizeof(char) * LOG_BUFFER_SIZE - 1, fmt, args);
-    printf(log_buffer);
+    va_end(args);
+    fputs(log_buffer, stdout);
     printf("\n");
+    pthread_mutex_unlock(&log_lock);
 }
 
 double bytes_to_denominator(const sizeDenominator_t denominator, const unsigned long long byteCount) {
@@ -224,6 +232,40 @@ nvmlTemperatureThresholds_t map_nvmlTemperatureThresholds_t_to_enum(const char *
     return NVML_TEMPERATURE_THRESHOLD_COUNT;
 }
 
+nvmlSamplingType_t map_nvmlSamplingType_t_to_enum(const char *sampling_type_s) {
+    if (strcmp("NVML_TOTAL_POWER_SAMPLES", sampling_type_s) == 0) {
+        return NVML_TOTAL_POWER_SAMPLES;
+    }
+    if (strcmp("NVML_GPU_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_GPU_UTILIZATION_SAMPLES;
+    }
+    if (strcmp("NVML_MEMORY_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_MEMORY_UTILIZATION_SAMPLES;
+    }
+    if (strcmp("NVML_ENC_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_ENC_UTILIZATION_SAMPLES;
+    }
+    if (strcmp("NVML_DEC_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_DEC_UTILIZATION_SAMPLES;
+    }
+    if (strcmp("NVML_PROCESSOR_CLK_SAMPLES", sampling_type_s) == 0) {
+        return NVML_PROCESSOR_CLK_SAMPLES;
+    }
+    if (strcmp("NVML_MEMORY_CLK_SAMPLES", sampling_type_s) == 0) {
+        return NVML_MEMORY_CLK_SAMPLES;
+    }
+    if (strcmp("NVML_MODULE_POWER_SAMPLES", sampling_type_s) == 0) {
+        return NVML_MODULE_POWER_SAMPLES;
+    }
+    if (strcmp("NVML_JPG_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_JPG_UTILIZATION_SAMPLES;
+    }
+    if (strcmp("NVML_OFA_UTILIZATION_SAMPLES", sampling_type_s) == 0) {
+        return NVML_OFA_UTILIZATION_SAMPLES;
+    }
+    return NVML_SAMPLINGTYPE_COUNT;
+}
+
 char *map_nvmlReturn_t_to_string(const nvmlReturn_t nvmlReturn) {
     switch (nvmlReturn) {
         case NVML_SUCCESS:
@@ -358,3 +400,22 @@ char *map_nvmlThermalTarget_t_to_string(const nvmlThermalTarget_t nvml_thermal_t
             return "NVML_THERMAL_TARGET_UNKNOWN";
     }
 }
+
+char *map_nvmlValueType_t_to_string(const nvmlValueType_t nvml_value_type) {
+    switch (nvml_value_type) {
+        case NVML_VALUE_TYPE_DOUBLE:
+            return "NVML_VALUE_TYPE_DOUBLE";
+        case NVML_VALUE_TYPE_UNSIGNED_INT:
+            return "NVML_VALUE_TYPE_UNSIGNED_INT";
+        case NVML_VALUE_TYPE_UNSIGNED_LONG:
+            return "NVML_VALUE_TYPE_UNSIGNED_LONG";
+        case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG:
+            return "NVML_VALUE_TYPE_UNSIGNED_LONG_LONG";
+        case NVML_VALUE_TYPE_SIGNED_LONG_LONG:
+            return "NVML_VALUE_TYPE_SIGNED_LONG_LONG";
+        case NVML_VALUE_TYPE_SIGNED_INT:
+            return "NVML_VALUE_TYPE_SIGNED_INT";
+        default:
+            return "NVML_VALUE_TYPE_UNKNOWN";
+    }
+}
@@ -15,7 +15,7 @@ typedef enum logLevel_enum: unsigned char {
 
 extern logLevel_t current_log_level; // global; use for logging
 extern char *log_buffer;
-extern nvmlReturn_t gl_nvml_result; // global; use for panics
+extern _Thread_local nvmlReturn_t gl_nvml_result; // per thread, so handlers can also run on the job executor
 
 #define OK(nvmlReturn) nvmlReturn == NVML_SUCCESS
 #define ERROR(nvmlReturn) nvmlReturn == NVML_ERROR_INVALID_ARGUMENT \
@@ -73,8 +73,10 @@ nvmlClockType_t map_nvmlClockType_t_to_enum(const char *clock_type_s);
 nvmlPstates_t map_nvmlPstates_t_to_enum(const char *pstate_s);
 nvmlPowerScopeType_t map_nvmlPowerScopeType_t_to_enum(const char *power_scope);
 nvmlTemperatureThresholds_t map_nvmlTemperatureThresholds_t_to_enum(const char *temperature_thresholds);
+nvmlSamplingType_t map_nvmlSamplingType_t_to_enum(const char *sampling_type_s);
 char *map_nvmlReturn_t_to_string(const nvmlReturn_t nvmlReturn);
 char *map_nvmlThermalController_t_to_string(const nvmlThermalController_t nvml_thermal_controller);
 char *map_nvmlThermalTarget_t_to_string(const nvmlThermalTarget_t nvml_thermal_target);
+char *map_nvmlValueType_t_to_string(const nvmlValueType_t nvml_value_type);
 
 #endif
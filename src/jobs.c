@@ -0,0 +1,426 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // pthread_timedjoin_np
+#endif
+#include "jobs.h"
+#include "network.h"
+#include "watchdog.h"
+#include "helpers.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum jobState_enum {
+    JOB_FREE = 0,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE
+} jobState_t;
+
+typedef struct jobsEntry_st {
+    unsigned long long id;
+    jobState_t state;
+    char action[64];
+    jobHandler_t handler;
+    char *request;  // serialized, until it runs
+    unsigned long long request_id;  // trace id of the request that queued it
+    char *result;  // what the handler responded, NULL if nothing
+} jobsEntry_st;
+
+typedef struct jobsWaiter_st {
+    int fd;
+    unsigned long long id;
+    unsigned long long deadline_ns;
+    unsigned long long request_id;  // trace id of its jobWait
+} jobsWaiter_st;
+
+// an answer put together under jobs_lock and written after releasing it, so a slow client can't stall the others
+typedef struct jobsReply_st {
+    int fd;
+    const char *data;  // in the calling thread's arena
+    const char *status;
+    const char *description;
+    unsigned long long request_id;  // trace id of the request answered
+} jobsReply_st;
+
+// job id lives in slot id % JOBS_MAX
+static jobsEntry_st jobs[JOBS_MAX];
+static unsigned long long next_id = 1;  // of the next job submitted
+static unsigned long long next_run = 1;  // of the next job the executor runs
+static jobsWaiter_st waiters[JOBS_MAX_WAITERS];
+static unsigned int waiter_count = 0;
+
+static pthread_t executor_thread;
+static bool executor_running = false;
+static bool executor_stop = false;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;  // never held while a job runs or a client is answered
+static pthread_cond_t jobs_wake;  // a job was queued, or the executor should stop
+// answers waiters once their job is done or their timeout passed, independent of how long the running job takes
+static pthread_t waiter_thread;
+static bool waiter_running = false;
+static bool waiter_stop = false;
+static pthread_cond_t waiters_wake;  // a waiter was added, a job finished, or the waiter thread should stop
+
+static const char *state_names[] = {"free", "queued", "running", "done"};
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static jobsEntry_st *find(const unsigned long long id) {
+    jobsEntry_st *job = &jobs[id % JOBS_MAX];
+    return job->state != JOB_FREE && job->id == id ? job : NULL;
+}
+
+/**
+ * Puts together the answer to fd w/ the state of job (NULL if it was forgotten); jobs_lock must be held.
+ */
+static jobsReply_st describe(const int fd, const jobsEntry_st *job, const char *status, const char *description) {
+    jobsReply_st answer = {.fd = fd, .request_id = trace_current_request()};
+    if (job == NULL) {
+        answer.status = map_nvmlReturn_t_to_string(NVML_ERROR_NOT_FOUND);
+        answer.description = "Job was forgotten";
+        return answer;
+    }
+    answer.status = map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY);
+    answer.description = "Couldn't allocate response";
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't open response stream");
+        return answer;
+    }
+    fprintf(stream, "{\"jobId\": %llu, \"action\": \"%s\", \"state\": \"%s\", \"result\": %s}", job->id, job->action,
+            state_names[job->state], job->result != NULL ? job->result : "null");
+    answer.data = arena_stream_close(stream, NULL);
+    if (answer.data == NULL) {
+        LOG_ERROR("Couldn't allocate response");
+        return answer;
+    }
+    answer.status = status;
+    answer.description = description;
+    return answer;
+}
+
+/**
+ * jobs_lock must not be held.
+ */
+static void reply(const jobsReply_st *answer) {
+    RESPOND(answer->fd, answer->data, answer->status, answer->description);
+}
+
+/**
+ * Removes waiter i and puts together its answer; jobs_lock must be held. The caller answers and closes it.
+ */
+static jobsReply_st take_waiter(const unsigned int i, const char *status, const char *description) {
+    jobsReply_st answer = describe(waiters[i].fd, find(waiters[i].id), status, description);
+    answer.request_id = waiters[i].request_id;
+    waiters[i] = waiters[--waiter_count];
+    return answer;
+}
+
+/**
+ * Answers and closes every reply; jobs_lock must not be held.
+ */
+static void reply_and_close(const jobsReply_st *replies, const unsigned int count) {
+    const unsigned long long request_id = trace_current_request();
+    for (unsigned int i = 0; i < count; ++i) {
+        trace_request_set(replies[i].request_id);
+        reply(&replies[i]);
+        close(replies[i].fd);
+    }
+    trace_request_set(request_id);
+    arena_reset(arena_request());
+}
+
+/**
+ * Runs handler against a socket pair and collects what it responds; setter responses are small, so they fit the
+ * socket buffer and the handler never blocks on us reading only afterward.
+ * @return malloc'd response, NULL if there was none
+ */
+static char *run(const char *action, const jobHandler_t handler, char *request) {
+    json_object *jobj = json_tokener_parse(request);
+    free(request);
+    if (jobj == NULL) {
+        LOG_ERROR("Couldn't parse queued request");
+        return NULL;
+    }
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        LOG_ERROR("Couldn't create socket pair for job (%s)", strerror(errno));
+        json_object_put(jobj);
+        return NULL;
+    }
+
+    // on the device's context, so a call stuck in the driver costs the executor the watchdog deadline, not the rest of
+    //  the queue; a timed out job's result is that timeout
+    if (watchdog_call(pair[0], action, handler, jobj)) json_object_put(jobj);
+    // coalesced writes answer on a duplicate later; reading until EOF waits for those too
+    close(pair[0]);
+    arena_reset(arena_request());
+
+    char *result = NULL;
+    size_t length = 0, capacity = 0;
+    for (;;) {
+        if (capacity - length < 1024) {
+            char *grown = realloc(result, capacity + 4096);
+            if (grown == NULL) break;
+            result = grown;
+            capacity += 4096;
+        }
+        const ssize_t bytes = read(pair[1], result + length, capacity - length - 1);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) break;
+        length += (size_t) bytes;
+    }
+    close(pair[1]);
+    if (result == NULL || length == 0) {
+        free(result);
+        return NULL;
+    }
+    result[length] = 0;
+    return result;
+}
+
+static void *executor(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&jobs_lock);
+    while (!executor_stop) {
+        if (next_run == next_id) {
+            pthread_cond_wait(&jobs_wake, &jobs_lock);
+            continue;
+        }
+        jobsEntry_st *job = &jobs[next_run++ % JOBS_MAX];
+        job->state = JOB_RUNNING;
+        char action[sizeof(job->action)];
+        snprintf(action, sizeof(action), "%s", job->action);
+        const jobHandler_t handler = job->handler;
+        char *request = job->request;
+        job->request = NULL;
+        trace_request_set(job->request_id);  // its spans belong to the request that queued it
+        LOG_INFO("Running job %llu (%s)", job->id, action);
+        pthread_mutex_unlock(&jobs_lock);
+
+        char *result = run(action, handler, request);
+        trace_request_set(0);
+
+        pthread_mutex_lock(&jobs_lock);
+        // running jobs keep their slot, so job is still this one
+        job->result = result;
+        job->state = JOB_DONE;
+        pthread_cond_signal(&waiters_wake);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    return NULL;
+}
+
+static void *waiter(void *arg) {
+    (void) arg;
+    jobsReply_st replies[JOBS_MAX_WAITERS];
+    pthread_mutex_lock(&jobs_lock);
+    while (!waiter_stop) {
+        const unsigned long long now = monotonic_ns();
+        unsigned long long next = ULLONG_MAX;
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < waiter_count;) {
+            const jobsEntry_st *job = find(waiters[i].id);
+            if (job == NULL || job->state == JOB_DONE) {
+                replies[count++] = take_waiter(i, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Job done.");
+                continue;
+            }
+            if (waiters[i].deadline_ns <= now) {
+                replies[count++] = take_waiter(i, WAIT_TIMEOUT, "Job isn't done yet");
+                continue;
+            }
+            if (waiters[i].deadline_ns < next) next = waiters[i].deadline_ns;
+            ++i;
+        }
+        if (count > 0) {
+            pthread_mutex_unlock(&jobs_lock);
+            reply_and_close(replies, count);
+            pthread_mutex_lock(&jobs_lock);
+            continue;
+        }
+
+        if (next == ULLONG_MAX) {
+            pthread_cond_wait(&waiters_wake, &jobs_lock);
+        } else {
+            const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+            pthread_cond_timedwait(&waiters_wake, &jobs_lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    return NULL;
+}
+
+void jobs_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&jobs_wake, &attr);
+    pthread_cond_init(&waiters_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    executor_stop = false;
+    if (pthread_create(&executor_thread, NULL, executor, NULL) != 0) {
+        LOG_ERROR("Couldn't start job executor, async setters disabled");
+        pthread_cond_destroy(&waiters_wake);
+        pthread_cond_destroy(&jobs_wake);
+        return;
+    }
+    executor_running = true;
+    waiter_stop = false;
+    if (pthread_create(&waiter_thread, NULL, waiter, NULL) != 0) {
+        LOG_ERROR("Couldn't start job waiter thread, jobWait only answers right away");
+        return;
+    }
+    waiter_running = true;
+}
+
+void jobs_stop(void) {
+    if (!executor_running) return;
+
+    pthread_mutex_lock(&jobs_lock);
+    executor_stop = true;
+    waiter_stop = true;
+    pthread_cond_signal(&jobs_wake);
+    pthread_cond_signal(&waiters_wake);
+    pthread_mutex_unlock(&jobs_lock);
+    if (waiter_running) pthread_join(waiter_thread, NULL);
+    waiter_running = false;
+
+    // jobs on a device context return within the watchdog deadline; others may still be stuck in the driver
+    const unsigned long long timeout_ms = watchdog_deadline_ms() + JOBS_STOP_TIMEOUT_MS;
+    struct timespec at;
+    clock_gettime(CLOCK_REALTIME, &at);
+    at.tv_sec += (time_t) (timeout_ms / 1000ULL);
+    at.tv_nsec += (long) (timeout_ms % 1000ULL) * 1000000L;
+    if (at.tv_nsec >= 1000000000L) {
+        ++at.tv_sec;
+        at.tv_nsec -= 1000000000L;
+    }
+    const bool stuck = pthread_timedjoin_np(executor_thread, NULL, &at) != 0;
+    if (stuck) {
+        LOG_WARNING("Job executor still stuck in the driver after %llu ms, leaving it behind", timeout_ms);
+        pthread_detach(executor_thread);
+    }
+    executor_running = false;
+
+    jobsReply_st replies[JOBS_MAX_WAITERS];
+    unsigned int count = 0;
+    pthread_mutex_lock(&jobs_lock);
+    while (waiter_count > 0) replies[count++] = take_waiter(waiter_count - 1, SHUTTING_DOWN, "envyd is shutting down or restarting");
+    pthread_mutex_unlock(&jobs_lock);
+    reply_and_close(replies, count);
+
+    // a stuck executor still owns its job, and signals once it returns
+    if (stuck) return;
+    pthread_cond_destroy(&waiters_wake);
+    pthread_cond_destroy(&jobs_wake);
+    for (unsigned int i = 0; i < JOBS_MAX; ++i) {
+        free(jobs[i].request);
+        free(jobs[i].result);
+        memset(&jobs[i], 0, sizeof(jobs[i]));
+    }
+}
+
+bool jobs_requested(const json_object *jobj) {
+    json_object *async_field = json_object_object_get(jobj, "async");
+    return async_field != NULL && json_object_get_boolean(async_field);
+}
+
+void jobs_submit(const int client_fd, const char *action, const jobHandler_t handler, const json_object *jobj) {
+    pthread_mutex_lock(&jobs_lock);
+    jobsEntry_st *job = &jobs[next_id % JOBS_MAX];
+    if (!executor_running || job->state == JOB_QUEUED || job->state == JOB_RUNNING) {
+        pthread_mutex_unlock(&jobs_lock);
+        LOG_ERROR("Couldn't queue %s, executor isn't running or %d jobs are unfinished", action, JOBS_MAX);
+        RESPOND(client_fd, NULL, JOBS_UNAVAILABLE, "Too many unfinished jobs, or the executor isn't running");
+        return;
+    }
+    // it was authorized on submission, the token needn't sit in memory until the job runs
+    char *request = strdup(request_without_bearer((json_object *) jobj, false));
+    if (request == NULL) {
+        pthread_mutex_unlock(&jobs_lock);
+        LOG_ERROR("Couldn't copy request");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't copy request");
+        return;
+    }
+
+    // the oldest finished job makes room
+    free(job->result);
+    job->result = NULL;
+    job->id = next_id++;
+    job->state = JOB_QUEUED;
+    snprintf(job->action, sizeof(job->action), "%s", action);
+    job->handler = handler;
+    job->request = request;
+    job->request_id = trace_current_request();
+    const unsigned long long id = job->id;
+    pthread_cond_signal(&jobs_wake);
+    pthread_mutex_unlock(&jobs_lock);
+
+    char data[48];
+    snprintf(data, sizeof(data), "{\"jobId\": %llu}", id);
+    RESPOND(client_fd, data, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Queued.");
+}
+
+void jobs_status(const int client_fd, const unsigned long long id) {
+    pthread_mutex_lock(&jobs_lock);
+    const jobsEntry_st *job = find(id);
+    if (job == NULL) {
+        pthread_mutex_unlock(&jobs_lock);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_NOT_FOUND), "Unknown job, or it was forgotten");
+        return;
+    }
+    const jobsReply_st answer = describe(client_fd, job, map_nvmlReturn_t_to_string(NVML_SUCCESS), NULL);
+    pthread_mutex_unlock(&jobs_lock);
+    reply(&answer);
+}
+
+void jobs_wait(const int client_fd, const unsigned long long id, const unsigned int timeout_ms) {
+    pthread_mutex_lock(&jobs_lock);
+    const jobsEntry_st *job = find(id);
+    if (job == NULL) {
+        pthread_mutex_unlock(&jobs_lock);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_NOT_FOUND), "Unknown job, or it was forgotten");
+        return;
+    }
+    if (job->state == JOB_DONE || timeout_ms == 0) {
+        const jobsReply_st answer = describe(client_fd, job,
+                                             job->state == JOB_DONE ? map_nvmlReturn_t_to_string(NVML_SUCCESS) : WAIT_TIMEOUT,
+                                             job->state == JOB_DONE ? "Job done." : "Job isn't done yet");
+        pthread_mutex_unlock(&jobs_lock);
+        reply(&answer);
+        return;
+    }
+    if (!waiter_running || waiter_count == JOBS_MAX_WAITERS) {
+        pthread_mutex_unlock(&jobs_lock);
+        RESPOND(client_fd, NULL, JOBS_UNAVAILABLE, "Too many waiting clients, or the executor isn't running");
+        return;
+    }
+
+    // the caller closes client_fd once we return; the waiter thread answers on (and closes) a duplicate
+    const int wait_fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 0);
+    if (wait_fd < 0) {
+        pthread_mutex_unlock(&jobs_lock);
+        LOG_ERROR("Couldn't duplicate client fd %d (%s)", client_fd, strerror(errno));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_UNKNOWN), "Couldn't keep the connection open");
+        return;
+    }
+    waiters[waiter_count++] = (jobsWaiter_st) {
+        .fd = wait_fd,
+        .id = id,
+        .deadline_ns = monotonic_ns() + (unsigned long long) timeout_ms * 1000000ULL,
+        .request_id = trace_current_request()
+    };
+    pthread_cond_signal(&waiters_wake);
+    pthread_mutex_unlock(&jobs_lock);
+}
@@ -0,0 +1,52 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <json-c/json.h>
+
+#define JOBS_MAX 256  // queued, running and finished jobs remembered at once; the oldest finished ones make room
+#define JOBS_MAX_WAITERS 64
+#define JOBS_DEFAULT_WAIT_TIMEOUT_MS 60000
+#define JOBS_MAX_WAIT_TIMEOUT_MS (24 * 60 * 60 * 1000)
+#define JOBS_STOP_TIMEOUT_MS 5000  // on top of the watchdog deadline, for the running job to return on shutdown
+
+typedef void (*jobHandler_t)(int client_fd, const json_object *jobj);
+
+/**
+ * Starts the executor thread and the thread that answers jobWait; jobs run one at a time, in the order they were
+ * submitted, each on its device's watchdog context (see watchdog_call).
+ */
+void jobs_start(void);
+
+/**
+ * Stops the executor after the job it's running, or leaves it behind if that job doesn't return within the watchdog
+ * deadline plus JOBS_STOP_TIMEOUT_MS; queued jobs are dropped and waiters answered w/ SHUTTING_DOWN (and the state so
+ * far). Must run before watchdog_stop.
+ */
+void jobs_stop(void);
+
+/**
+ * @return true if jobj asks for "async": true
+ */
+bool jobs_requested(const json_object *jobj);
+
+/**
+ * Queues handler(jobj) for the executor and answers client_fd w/ {"jobId": ...}, or JOBS_UNAVAILABLE if the executor
+ * isn't running or JOBS_MAX jobs are unfinished. The executor runs handler against a socket pair and keeps what it
+ * responds as the job's result. jobj is copied, the caller keeps it.
+ */
+void jobs_submit(int client_fd, const char *action, jobHandler_t handler, const json_object *jobj);
+
+/**
+ * Answers client_fd w/ {"jobId": ..., "action": ..., "state": "queued" | "running" | "done", "result": <response or null>},
+ * NVML_ERROR_NOT_FOUND if id is unknown or was forgotten.
+ */
+void jobs_status(int client_fd, unsigned long long id);
+
+/**
+ * Like jobs_status, but holds the connection until the job is done; WAIT_TIMEOUT (w/ the state so far) once timeout_ms
+ * passed, even while a job runs. client_fd stays owned by the caller; a held connection is answered on a duplicate.
+ */
+void jobs_wait(int client_fd, unsigned long long id, unsigned int timeout_ms);
+
+#endif
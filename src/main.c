@@ -1,70 +1,232 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // accept4
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <nvml.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
-#include <nvdialog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "network.h"
 #include "helpers.h"
+#include "trace.h"
+#include "probes.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "store.h"
+#include "series.h"
+#include "events.h"
+#include "waits.h"
+#include "fanctl.h"
+#include "auth.h"
+#include "watchdog.h"
+#include "powerctl.h"
+#include "profiles.h"
+#include "coalesce.h"
+#include "jobs.h"
+#include "activation.h"
+#include "warmup.h"
+#include "handoff.h"
 
 #define SERVER_UNIX_PATH "/tmp/envyd.socket"
 
 char *so_buffer = NULL;  // global; use for socket IO
 int server_fd = -1;  // global; use to close fd gracefully upon death
-nvmlReturn_t gl_nvml_result; // global; use for panics
+static bool socket_activated = false;  // the service manager owns the socket file
+static bool handed_off = false;  // a new envyd took over the socket
+_Thread_local nvmlReturn_t gl_nvml_result; // per thread, so handlers can also run on the job executor
 logLevel_t current_log_level; // global; use for logging
 char *log_buffer = NULL;  // global; use for logging
 
-void die_gracefully(const int signal_code) {
-    LOG_INFO("Received signal '%s', closing gracefully...", strsignal(signal_code));
+static void shut_down(void) {
+    if (!handed_off) activation_notify("STOPPING=1");
     if (server_fd != -1) {
         LOG_WARNING("Closing server socket fd %d", server_fd);
         close(server_fd);
-        unlink(SERVER_UNIX_PATH);
+        if (!socket_activated && !handed_off) unlink(SERVER_UNIX_PATH);
     }
 
+    metrics_stop();
+    fanctl_stop();  // fans and power limits back to the driver before anything else can go wrong
+    powerctl_stop();
+    profiles_stop();
+    jobs_stop();  // before coalescing, a running job may wait on a held write; before the contexts jobs run on
+    coalesce_stop();
+    waits_stop();
+    events_stop();
+    telemetry_stop();
+    watchdog_stop();  // after everything that calls devices on its contexts
+    store_stop();
+    series_stop();
+    auth_stop();
     gl_nvml_result = nvmlShutdown();
     if (FATAL(gl_nvml_result)) WTF("Failed to shutdown NVML");
     if (so_buffer != NULL) free(so_buffer);
+    arena_free(arena_request());
     if (log_buffer != NULL) free(log_buffer);
     exit(EXIT_SUCCESS);
 }
 
+static volatile sig_atomic_t stop_signal = 0;  // SIGINT or SIGTERM, once received
+static int wake_pipe[2] = {-1, -1};  // self-pipe: handlers write, the accept loop polls, so no signal is missed while idle
+
+/**
+ * Only sets flags; whatever the loop was holding (log_lock, module locks) is released before it acts on them.
+ */
+static void on_signal(const int signal_code) {
+    const int saved_errno = errno;
+    if (signal_code == SIGHUP) handoff_request();
+    else stop_signal = signal_code;
+    if (wake_pipe[1] != -1) {
+        const char wake = 1;
+        if (write(wake_pipe[1], &wake, 1) < 0) {}  // full means a wake-up is already pending
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Blocks until a client connects, a signal arrived or the new envyd (if any) is warm or died.
+ */
+static void wait_for_events(const int successor_fd) {
+    struct pollfd fds[3] = {
+        {.fd = server_fd, .events = POLLIN},
+        {.fd = wake_pipe[0], .events = POLLIN},
+        {.fd = successor_fd, .events = POLLIN},
+    };
+    if (poll(fds, 3, -1) <= 0 || fds[1].revents == 0) return;
+    char drained[64];
+    while (read(wake_pipe[0], drained, sizeof(drained)) > 0) {}
+}
+
+/**
+ * Checks, w/o blocking, whether the new envyd is warm; forgets it if it died instead.
+ * @return true if it's warm and waits for us to shut down
+ */
+static bool successor_warm(int *successor_fd) {
+    struct pollfd pfd = {.fd = *successor_fd, .events = POLLIN};
+    if (poll(&pfd, 1, 0) <= 0) return false;
+    char warm = 0;
+    if (read(*successor_fd, &warm, 1) == 1) return true;
+    LOG_ERROR("New process exited before it was warm, still serving");
+    close(*successor_fd);
+    *successor_fd = -1;
+    return false;
+}
+
 int main(int argc, char *argv[]) {
     current_log_level = TRACE;
+    trace_init();
 
     sigaction(SIGPIPE, &(struct sigaction){SIG_IGN}, NULL);
-    signal(SIGINT, die_gracefully);
-    signal(SIGTERM, die_gracefully);
+    if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) WTF("Couldn't create signal pipe!");
+    // SA_RESTART: a signal mustn't fail the read of a request in flight, the pipe wakes the idle loop
+    const struct sigaction flag_signal = {.sa_handler = on_signal, .sa_flags = SA_RESTART};
+    sigaction(SIGINT, &flag_signal, NULL);
+    sigaction(SIGTERM, &flag_signal, NULL);
+    sigaction(SIGHUP, &flag_signal, NULL);
+
+    // listening before anything slow, clients that connect while we start queue in the kernel
+    handoffState_st handoff_state = {0};
+    server_fd = handoff_receive(&handoff_state);
+    if (server_fd != -1) {
+        socket_activated = handoff_state.socket_activated;
+        LOG_INFO("Listening on fd %d handed over by the old process", server_fd);
+    } else {
+        server_fd = activation_listen_fd();
+        socket_activated = server_fd != -1;
+        if (socket_activated) {
+            LOG_INFO("Listening on fd %d passed by the service manager", server_fd);
+        } else {
+            server_fd = bind_socket_with_address(SERVER_UNIX_PATH);
+            // only our own socket; a passed one already listens w/ the backlog its owner configured (Backlog=)
+            if (listen(server_fd, 15) < 0) WTF("Listen failed!");
+        }
+    }
+    // so a new envyd taking over during a restart can't leave us blocked in accept; accepted fds don't inherit it
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
 
     gl_nvml_result = nvmlInit_v2();
     if (ERROR(gl_nvml_result) || FATAL(gl_nvml_result)) WTF("Failed to initialize NVML!");
-    if (nvd_init() != 0) WTF("Failed to initialize NvDialog!");
+    activation_notify("STATUS=Warming up devices");
+
+    // worker threads inherit the mask, so every signal lands on this thread and its pipe
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    sigaddset(&shutdown_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+    const unsigned int device_count = warmup_devices();
+    handoff_take_over(&handoff_state);
+    watchdog_start();  // before everything that calls devices on its contexts
+    auth_start();
+    metrics_start();
+    store_start();
+    series_start();
+    telemetry_start();
+    events_start();
+    waits_start();
+    fanctl_start();
+    powerctl_start();
+    profiles_start();
+    coalesce_start();
+    jobs_start();
+    handoff_restore_controllers(&handoff_state);
+    pthread_sigmask(SIG_UNBLOCK, &shutdown_signals, NULL);
 
     // timeout
     struct timeval tv;
     tv.tv_sec = 10;
     tv.tv_usec = 0;
 
-    server_fd = bind_socket_with_address(SERVER_UNIX_PATH);
     LOG_INFO("Server started on 'envyd'!");
-    LOG_INFO("Stop via SIGTERM or SIGINT (CTRL+C)");
-    // ReSharper disable once CppDFAEndlessLoop
+    LOG_INFO("Stop via SIGTERM or SIGINT (CTRL+C), restart w/o dropping clients via SIGHUP");
+    char status[128];
+    snprintf(status, sizeof(status), "READY=1\nSTATUS=Serving %u device(s)", device_count);
+    activation_notify(status);
+    int successor_fd = -1;  // a new envyd warming up w/ our socket
+    pid_t successor_pid = 0;
     for (;;) {
-        if (listen(server_fd, 15) < 0) WTF("Listen failed!");
+        if (stop_signal != 0) {
+            LOG_INFO("Received signal '%s', closing gracefully...", strsignal(stop_signal));
+            shut_down();
+        }
+        if (handoff_requested() && successor_fd == -1) {
+            const handoffState_st state = {.socket_activated = socket_activated};
+            successor_fd = handoff_start(server_fd, &state, argv, &successor_pid);
+        }
+        if (successor_fd != -1 && successor_warm(&successor_fd)) break;
         LOG_INFO("Waiting for connection...");
 
-        const int client_fd = accept(server_fd, NULL, NULL);
+        const unsigned long long accept_start = trace_begin();
+        const int client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
         if (client_fd < 0) {
-            LOG_ERROR("Accept failed!");
+            if (errno == EAGAIN || errno == EWOULDBLOCK) wait_for_events(successor_fd);
+            else if (errno != EINTR) LOG_ERROR("Accept failed!");
             continue;
         }
+        PROBE_ACCEPT(client_fd);
+        trace_request_begin();
+        if (trace_enabled) trace_end("accept", "io", accept_start);
 
         LOG_INFO("Connection established on fd %d!", client_fd);
+        const unsigned long long request_start = trace_begin();
         process(client_fd, &tv);
         close(client_fd);
+        if (trace_enabled) trace_end("request", "request", request_start);
     }
+
+    // nothing is in flight on this thread; shut_down answers held waits, job waiters, coalesced writes and subscribers
+    LOG_INFO("pid %d is warm, handing over", (int) successor_pid);
+    handoff_pass_controllers(successor_fd, socket_activated);
+    handed_off = true;
+    snprintf(status, sizeof(status), "MAINPID=%d", (int) successor_pid);
+    activation_notify(status);
+    shut_down();
 }
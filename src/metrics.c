@@ -0,0 +1,298 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // accept4
+#endif
+#include "metrics.h"
+#include "telemetry.h"
+#include "helpers.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_LISTEN_BACKLOG 16
+#define METRICS_REQUEST_BUFFER_SIZE 4096
+
+static metricsSnapshot_st *current = NULL;
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listen_fd = -1;
+static char *listen_path = NULL;  // unlinked on stop; NULL for TCP
+static pthread_t listener_thread;
+
+metricsSnapshot_st *metrics_acquire(void) {
+    pthread_mutex_lock(&current_lock);
+    metricsSnapshot_st *snapshot = current;
+    if (snapshot != NULL) ++snapshot->refs;
+    pthread_mutex_unlock(&current_lock);
+    return snapshot;
+}
+
+void metrics_release(metricsSnapshot_st *snapshot) {
+    if (snapshot == NULL) return;
+    pthread_mutex_lock(&current_lock);
+    const bool last = --snapshot->refs == 0;
+    pthread_mutex_unlock(&current_lock);
+    if (!last) return;
+
+    free(snapshot->text);
+    free(snapshot->json);
+    free(snapshot);
+}
+
+/**
+ * One metric family; only devices whose sample has valid_flag set get a line.
+ * value converts the sample's raw field to the base unit of the family.
+ */
+static void render_family(FILE *stream, const envydTelemetrySlot_st *samples, const unsigned int count,
+                          const char *name, const char *unit, const char *help, const unsigned int valid_flag,
+                          double (*value)(const envydTelemetrySlot_st *sample)) {
+    fprintf(stream, "# TYPE envyd_%s gauge\n", name);
+    if (unit != NULL) fprintf(stream, "# UNIT envyd_%s %s\n", name, unit);
+    fprintf(stream, "# HELP envyd_%s %s\n", name, help);
+    for (unsigned int i = 0; i < count; ++i) {
+        if (!(samples[i].valid & valid_flag)) continue;
+        fprintf(stream, "envyd_%s{gpu=\"%u\",uuid=\"%s\"} %.10g\n",
+                name, samples[i].index, samples[i].uuid, value(&samples[i]));
+    }
+}
+
+static double power_watts(const envydTelemetrySlot_st *sample) { return sample->power_mw / 1000.0; }
+static double power_limit_watts(const envydTelemetrySlot_st *sample) { return sample->power_limit_mw / 1000.0; }
+static double temperature_celsius(const envydTelemetrySlot_st *sample) { return sample->temperature_c; }
+static double graphics_clock_hertz(const envydTelemetrySlot_st *sample) { return sample->graphics_clock_mhz * 1e6; }
+static double sm_clock_hertz(const envydTelemetrySlot_st *sample) { return sample->sm_clock_mhz * 1e6; }
+static double memory_clock_hertz(const envydTelemetrySlot_st *sample) { return sample->memory_clock_mhz * 1e6; }
+static double fan_speed_ratio(const envydTelemetrySlot_st *sample) { return sample->fan_speed_percent / 100.0; }
+static double memory_total_bytes(const envydTelemetrySlot_st *sample) { return (double) sample->memory_total; }
+static double memory_used_bytes(const envydTelemetrySlot_st *sample) { return (double) sample->memory_used; }
+static double memory_free_bytes(const envydTelemetrySlot_st *sample) { return (double) sample->memory_free; }
+
+static char *render_text(const envydTelemetrySlot_st *samples, const unsigned int count, size_t *len /*out*/) {
+    char *text = NULL;
+    FILE *stream = open_memstream(&text, len);
+    if (stream == NULL) return NULL;
+
+    render_family(stream, samples, count, "power_watts", "watts", "Current power draw.",
+                  ENVYD_TELEMETRY_HAS_POWER, power_watts);
+    render_family(stream, samples, count, "power_limit_watts", "watts", "Current power management limit.",
+                  ENVYD_TELEMETRY_HAS_POWER_LIMIT, power_limit_watts);
+    render_family(stream, samples, count, "temperature_celsius", "celsius", "GPU core temperature.",
+                  ENVYD_TELEMETRY_HAS_TEMPERATURE, temperature_celsius);
+
+    // one family, three clock domains
+    fprintf(stream, "# TYPE envyd_clock_hertz gauge\n# UNIT envyd_clock_hertz hertz\n# HELP envyd_clock_hertz Current clock.\n");
+    for (unsigned int i = 0; i < count; ++i) {
+        const struct { unsigned int flag; const char *domain; double (*value)(const envydTelemetrySlot_st *); } clocks[] = {
+            {ENVYD_TELEMETRY_HAS_GRAPHICS_CLOCK, "graphics", graphics_clock_hertz},
+            {ENVYD_TELEMETRY_HAS_SM_CLOCK, "sm", sm_clock_hertz},
+            {ENVYD_TELEMETRY_HAS_MEMORY_CLOCK, "memory", memory_clock_hertz},
+        };
+        for (size_t c = 0; c < sizeof(clocks) / sizeof(clocks[0]); ++c) {
+            if (!(samples[i].valid & clocks[c].flag)) continue;
+            fprintf(stream, "envyd_clock_hertz{gpu=\"%u\",uuid=\"%s\",clock=\"%s\"} %.10g\n",
+                    samples[i].index, samples[i].uuid, clocks[c].domain, clocks[c].value(&samples[i]));
+        }
+    }
+
+    render_family(stream, samples, count, "fan_speed_ratio", "ratio", "Speed of fan 0, relative to its maximum.",
+                  ENVYD_TELEMETRY_HAS_FAN_SPEED, fan_speed_ratio);
+    render_family(stream, samples, count, "memory_total_bytes", "bytes", "Total device memory.",
+                  ENVYD_TELEMETRY_HAS_MEMORY, memory_total_bytes);
+    render_family(stream, samples, count, "memory_used_bytes", "bytes", "Allocated device memory.",
+                  ENVYD_TELEMETRY_HAS_MEMORY, memory_used_bytes);
+    render_family(stream, samples, count, "memory_free_bytes", "bytes", "Unallocated device memory.",
+                  ENVYD_TELEMETRY_HAS_MEMORY, memory_free_bytes);
+    fprintf(stream, "# EOF\n");
+
+    if (fclose(stream) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+/**
+ * Quotes text as a JSON string; only '"', '\' and control characters need escaping in what render_text produces.
+ */
+static char *quote_json(const char *text, const size_t text_len, size_t *len /*out*/) {
+    char *json = malloc(text_len * 2 + 3);
+    if (json == NULL) return NULL;
+
+    size_t out = 0;
+    json[out++] = '"';
+    for (size_t idx = 0; idx < text_len; ++idx) {
+        const char c = text[idx];
+        if (c == '\n') {
+            json[out++] = '\\';
+            json[out++] = 'n';
+        } else if (c == '"' || c == '\\') {
+            json[out++] = '\\';
+            json[out++] = c;
+        } else if ((unsigned char) c >= 0x20) {
+            json[out++] = c;
+        }
+    }
+    json[out++] = '"';
+    json[out] = 0;
+    *len = out;
+    return json;
+}
+
+/**
+ * Telemetry listener; renders once per sampling round and swaps the snapshot in.
+ */
+static void render(const envydTelemetrySlot_st *samples, const unsigned int count) {
+    metricsSnapshot_st *snapshot = calloc(1, sizeof(metricsSnapshot_st));
+    if (snapshot == NULL) return;
+    snapshot->refs = 1;  // held by current
+    snapshot->text = render_text(samples, count, &snapshot->text_len);
+    if (snapshot->text != NULL) snapshot->json = quote_json(snapshot->text, snapshot->text_len, &snapshot->json_len);
+    if (snapshot->text == NULL || snapshot->json == NULL) {
+        LOG_ERROR("Couldn't render metrics, keeping the previous snapshot");
+        free(snapshot->text);
+        free(snapshot);
+        return;
+    }
+
+    pthread_mutex_lock(&current_lock);
+    metricsSnapshot_st *previous = current;
+    current = snapshot;
+    pthread_mutex_unlock(&current_lock);
+    metrics_release(previous);
+}
+
+static void write_all(const int fd, const char *data, size_t len) {
+    while (len > 0) {
+        const ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        data += written;
+        len -= (size_t) written;
+    }
+}
+
+/**
+ * HTTP if the client sent a request line (Prometheus, curl), otherwise the bare exposition (nc -N).
+ */
+static void serve(const int client_fd) {
+    const struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_REQUEST_BUFFER_SIZE];
+    size_t received = 0;
+    bool http = false;
+    while (received < sizeof(request) - 1) {
+        const ssize_t bytes = read(client_fd, request + received, sizeof(request) - 1 - received);
+        if (bytes <= 0) break;
+        received += (size_t) bytes;
+        request[received] = 0;
+        http = strncmp(request, "GET ", received < 4 ? received : 4) == 0;
+        if (!http || strstr(request, "\r\n\r\n") != NULL) break;
+    }
+
+    metricsSnapshot_st *snapshot = metrics_acquire();
+    if (http) {
+        char header[256];
+        const int header_len = snapshot != NULL
+            ? snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                       "Content-Length: %zu\r\nConnection: close\r\n\r\n", snapshot->text_len)
+            : snprintf(header, sizeof(header), "HTTP/1.1 503 Service Unavailable\r\n"
+                       "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        write_all(client_fd, header, (size_t) header_len);
+    }
+    if (snapshot != NULL) write_all(client_fd, snapshot->text, snapshot->text_len);
+    metrics_release(snapshot);
+}
+
+static void *listener(void *arg) {
+    (void) arg;
+    for (;;) {
+        const int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;  // listen_fd closed by metrics_stop
+        }
+        serve(client_fd);
+        close(client_fd);
+    }
+    return NULL;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        LOG_ERROR("Metrics socket path '%s' is too long", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    listen_path = strdup(path);
+    return fd;
+}
+
+static int listen_loopback(const unsigned short port) {
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    const int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void metrics_start(void) {
+    telemetry_add_listener(render);
+
+    const char *path = getenv("ENVYD_METRICS_SOCKET");
+    const char *port = getenv("ENVYD_METRICS_PORT");
+    if (path != NULL && *path == 0) path = NULL;
+    if (path != NULL) listen_fd = listen_unix(path);
+    else if (port != NULL && atoi(port) > 0 && atoi(port) < 65536) listen_fd = listen_loopback((unsigned short) atoi(port));
+    else return;  // 'metrics' action only
+
+    if (listen_fd < 0 || listen(listen_fd, METRICS_LISTEN_BACKLOG) != 0) {
+        LOG_ERROR("Couldn't listen for metrics scrapes on %s: %s", path != NULL ? path : port, strerror(errno));
+        metrics_stop();
+        return;
+    }
+    if (pthread_create(&listener_thread, NULL, listener, NULL) != 0) {
+        LOG_ERROR("Couldn't start metrics listener thread");
+        metrics_stop();
+        return;
+    }
+    pthread_detach(listener_thread);
+    LOG_INFO("Serving metrics on %s%s", path != NULL ? "" : "127.0.0.1:", path != NULL ? path : port);
+}
+
+void metrics_stop(void) {
+    if (listen_fd >= 0) {
+        shutdown(listen_fd, SHUT_RDWR);  // wakes the listener out of accept
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (listen_path != NULL) {
+        unlink(listen_path);
+        free(listen_path);
+        listen_path = NULL;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+/**
+ * A rendered OpenMetrics exposition of every device, refreshed once per sampling interval.
+ * Shared between all concurrent scrapers; hold it w/ metrics_acquire and give it back w/ metrics_release.
+ */
+typedef struct metricsSnapshot_st {
+    int refs;
+    char *text;  // application/openmetrics-text
+    size_t text_len;
+    char *json;  // text as a quoted JSON string, for the 'metrics' action
+    size_t json_len;
+} metricsSnapshot_st;
+
+/**
+ * Registers the renderer w/ the telemetry sampler (so before telemetry_start) and, if ENVYD_METRICS_SOCKET (unix
+ * socket path) or ENVYD_METRICS_PORT (TCP port on 127.0.0.1) is set, starts the plain-text/HTTP listener thread.
+ */
+void metrics_start(void);
+void metrics_stop(void);
+
+/**
+ * @return the latest snapshot, NULL before the first sampling round completed
+ */
+metricsSnapshot_st *metrics_acquire(void);
+void metrics_release(metricsSnapshot_st *snapshot);
+
+#endif
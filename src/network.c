@@ -1,14 +1,29 @@
 #include "network.h"
 #include "helpers.h"
-#include <nvdialog.h>
+#include "metrics.h"
+#include "store.h"
+#include "series.h"
+#include "events.h"
+#include "cursors.h"
+#include "waits.h"
+#include "fanctl.h"
+#include "powerctl.h"
+#include "profiles.h"
+#include "setters.h"
+#include "coalesce.h"
+#include "jobs.h"
+#include "watchdog.h"
+#include "handoff.h"
+#include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 
-extern nvmlReturn_t gl_nvml_result; // global; use for panics
+extern _Thread_local nvmlReturn_t gl_nvml_result; // per thread, so handlers can also run on the job executor
 extern char *so_buffer;             // global; use for socket io
 
 ssize_t sso_read(const int socket_fd, char *buffer /*out*/, const size_t size);
-void assign_task(const int client_fd, const char *action, const json_object *jobj);
 
 // handlers
 // clocks
@@ -48,41 +63,45 @@ void nvmlDeviceSetTemperatureThreshold_handler(const int client_fd, const json_o
 // generic
 void nvmlDeviceGetMemoryInfo_handler(const int client_fd, const json_object *jobj);
 void nvmlDeviceGetDetailsAll_handler(const int client_fd, const json_object *jobj);
-
-/**
- * @return 0 on authorized, != 0 on non-authorized
- */
-int is_authorized(const char* token) {
-    WTF("Not implemented!");  // TODO implement
-    exit(1);
-}
-
-/**
- * @return NVD_REPLY_CANCEL in case of errors, NVD_REPLY_YES or NVD_REPLY_NO for user choices.
- */
-NvdReply authorize(const char* api, const char* token) {
-    const size_t buff_size = 8192;
-    char* buff = calloc(sizeof(char), buff_size);
-    snprintf(buff, buff_size, "Client is asking for access to %s.\n Authorize with token %s?", api, token);
-    const NvdQuestionButton question_button = NVD_YES_NO;
-    NvdQuestionBox* dialog = nvd_dialog_question_new(
-        "Authorization",
-        buff,
-        question_button
-    );
-    if (!dialog) return NVD_REPLY_CANCEL;
-
-    const NvdReply reply = nvd_get_reply(dialog);
-    nvd_free_object(dialog);
-    free(buff);
-    // cascade options to YES, NO; CANCEL is reserved for error handling
-    return reply == NVD_REPLY_OK ? NVD_REPLY_OK : NVD_REPLY_NO;
+void nvmlDeviceGetSamples_handler(const int client_fd, const json_object *jobj);
+// envyd
+void traceDump_handler(const int client_fd, const json_object *jobj);
+void metrics_handler(const int client_fd, const json_object *jobj);
+void storeQuery_handler(const int client_fd, const json_object *jobj);
+void seriesQuery_handler(const int client_fd, const json_object *jobj);
+void seriesStats_handler(const int client_fd, const json_object *jobj);
+void subscribeEvents_handler(const int client_fd, const json_object *jobj);
+void waitFor_handler(const int client_fd, const json_object *jobj);
+void fanCurveSet_handler(const int client_fd, const json_object *jobj);
+void fanCurveClear_handler(const int client_fd, const json_object *jobj);
+void fanCurveStatus_handler(const int client_fd, const json_object *jobj);
+void powerBudgetSet_handler(const int client_fd, const json_object *jobj);
+void powerBudgetClear_handler(const int client_fd, const json_object *jobj);
+void powerBudgetStatus_handler(const int client_fd, const json_object *jobj);
+void profileSet_handler(const int client_fd, const json_object *jobj);
+void profileDelete_handler(const int client_fd, const json_object *jobj);
+void profileRulesSet_handler(const int client_fd, const json_object *jobj);
+void profilesStatus_handler(const int client_fd, const json_object *jobj);
+void apply_handler(const int client_fd, const json_object *jobj);
+void jobStatus_handler(const int client_fd, const json_object *jobj);
+void jobWait_handler(const int client_fd, const json_object *jobj);
+void restart_handler(const int client_fd, const json_object *jobj);
+
+const char *request_without_bearer(json_object *jobj, const bool placeholder) {
+    json_object *bearer = json_object_object_get(jobj, "bearer");
+    if (bearer == NULL) return json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+    json_object_get(bearer);  // survives being replaced
+    if (placeholder) json_object_object_add(jobj, "bearer", json_object_new_string("<redacted>"));
+    else json_object_object_del(jobj, "bearer");
+    const char *serialized = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+    json_object_object_add(jobj, "bearer", bearer);
+    return serialized;
 }
 
 int bind_socket_with_address(const char *address) {
     assert(address != NULL); // sanity
 
-    const int fd_server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    const int fd_server_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (fd_server_socket < 0)
         WTF("Could not create socket!");
     struct sockaddr_un sock_addr;
@@ -96,30 +115,84 @@ int bind_socket_with_address(const char *address) {
 }
 
 
-void process(const int client_fd, const struct timeval *tv_timeout) {
+static size_t max_request_size(void) {
+    static size_t max_size = 0;
+    if (max_size == 0) {
+        max_size = REQUEST_DEFAULT_MAX_SIZE;
+        const char *configured = getenv("ENVYD_MAX_REQUEST_SIZE");
+        if (configured != NULL && strtoull(configured, NULL, 10) > 0) max_size = strtoull(configured, NULL, 10);
+    }
+    return max_size;
+}
+
+void process_request(const int client_fd, const struct timeval *tv_timeout) {
     assert(client_fd >= 0); // sanity
     assert(tv_timeout != NULL); // sanity
 
     // the lifecycle of this object is that this will live until the program closes, whereupon everything
-    //  will be freed by the OS (hopefully, lol)
+    //  will be freed by the OS (hopefully, lol); it only ever holds the chunk currently being fed to the tokener
     if (so_buffer == NULL) so_buffer = malloc(SO_INPUT_BUFFER_SIZE);
-    memset(so_buffer, 0, SO_INPUT_BUFFER_SIZE);
+    if (so_buffer == NULL) {
+        LOG_ERROR("Couldn't allocate socket buffer! Returning early...");
+        return;
+    }
 
     if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, tv_timeout, sizeof(struct timeval)) < 0) {
         LOG_ERROR("Failed to set socket timeout! Returning early...");
         return;
     }
 
-    const ssize_t bytes_received = sso_read(client_fd, so_buffer, SO_INPUT_BUFFER_SIZE - 1);
-    if (bytes_received < 0) {
-        LOG_ERROR("Failed to read from socket! Returning early...");
+    // json-c has no allocator hook, so the object tree is still malloc'd; reusing the tokener (and its buffers) at least
+    //  saves the per-request tokener that json_tokener_parse_verbose allocates and frees
+    static _Thread_local json_tokener *tokener = NULL;
+    if (tokener == NULL) tokener = json_tokener_new();
+    if (tokener == NULL) {
+        LOG_ERROR("Couldn't allocate JSON tokener! Returning early...");
+        RESPOND(client_fd, NULL, JSON_PARSING_FAILED, "Couldn't allocate JSON tokener");
         return;
     }
+    json_tokener_reset(tokener);
 
-    rstrip(so_buffer);
-    LOG_TRACE("Received body %s", so_buffer);
-    enum json_tokener_error error;
-    json_object *jobj = json_tokener_parse_verbose(so_buffer, &error);
+    // feed every chunk to the tokener as it arrives: the request ends w/ its root object, not w/ the peer half-closing,
+    //  and its size is only bounded by ENVYD_MAX_REQUEST_SIZE
+    json_object *jobj = NULL;
+    enum json_tokener_error error = json_tokener_continue;
+    size_t total_bytes = 0;
+    while (jobj == NULL && error == json_tokener_continue) {
+        const unsigned long long read_start = trace_begin();
+        const ssize_t bytes_received = sso_read(client_fd, so_buffer, SO_INPUT_BUFFER_SIZE);
+        if (trace_enabled) trace_end("sso_read", "io", read_start);
+        if (bytes_received < 0) {
+            LOG_ERROR("Failed to read from socket! Returning early...");
+            return;
+        }
+
+        const unsigned long long parse_start = trace_begin();
+        if (bytes_received == 0) {
+            // EOF; a bare top level number only ends w/ the terminating nul
+            jobj = json_tokener_parse_ex(tokener, "", 1);
+            error = json_tokener_get_error(tokener);
+            if (trace_enabled) trace_end("parse", "json", parse_start);
+            break;
+        }
+
+        total_bytes += bytes_received;
+        if (total_bytes > max_request_size()) {
+            LOG_ERROR("Request exceeds %zu bytes (ENVYD_MAX_REQUEST_SIZE)! Writing to client_fd out, and returning early...",
+                      max_request_size());
+            RESPOND(client_fd, NULL, REQUEST_TOO_LARGE, "Request is larger than ENVYD_MAX_REQUEST_SIZE");
+            return;
+        }
+
+        LOG_TRACE("Received chunk of %zd bytes", bytes_received);  // may hold the bearer, logged once parsed and redacted
+        jobj = json_tokener_parse_ex(tokener, so_buffer, (int) bytes_received);
+        error = json_tokener_get_error(tokener);
+        if (trace_enabled) trace_end("parse", "json", parse_start);
+    }
+    if (error != json_tokener_success && jobj != NULL) {
+        json_object_put(jobj);
+        jobj = NULL;
+    }
     if (jobj == NULL) {
         LOG_ERROR("Failed to parse JSON object w/ json-c w/ err %d ! Writing to client_fd out, and returning early...",error);
         RESPOND(client_fd, NULL, JSON_PARSING_FAILED, "Failed parsing of JSON, view daemon logs for error code...");
@@ -143,10 +216,33 @@ void process(const int client_fd, const struct timeval *tv_timeout) {
         return;
     }
 
-    assign_task(client_fd, action, jobj);
+    if (current_log_level >= TRACE) LOG_TRACE("Received request %s", request_without_bearer(jobj, true));
+    PROBE_REQUEST_PARSED(client_fd, action);
+    const unsigned long long task_start = trace_begin();
+    PROBE_HANDLER_ENTRY(client_fd, action);
+    if (!watchdog_run(client_fd, action, jobj)) {
+        // handed to a stuck device context along w/ action
+        PROBE_HANDLER_EXIT(client_fd, "");
+        if (trace_enabled) trace_end("assign_task", "dispatch", task_start);
+        return;
+    }
+    PROBE_HANDLER_EXIT(client_fd, action);
+    if (trace_enabled) trace_end("assign_task", "dispatch", task_start);
     json_object_put(jobj);
 }
 
+void process(const int client_fd, const struct timeval *tv_timeout) {
+    process_request(client_fd, tv_timeout);
+    // every response has been written by now
+    arena_reset(arena_request());
+}
+
+// setters w/ "async": true are queued for the job executor, which answers w/ a job id right away
+#define RUN_OR_QUEUE(handler, client_fd, jobj) do { \
+        if (jobs_requested(jobj)) jobs_submit(client_fd, action, handler, jobj); \
+        else handler(client_fd, jobj); \
+    } while (0)
+
 void assign_task(const int client_fd, const char *action, const json_object *jobj) {
     assert(jobj != NULL); // sanity
     LOG_TRACE("Got action '%s', length %lu", action, strlen(action));
@@ -175,34 +271,34 @@ void assign_task(const int client_fd, const char *action, const json_object *job
     } else if (strcmp(action, "nvmlDeviceSetClockOffsets") == 0) {
         LOG_TRACE("nvmlDeviceSetClockOffsets_handler");
         CHECK_AUTHORIZATION("setting clock offsets", jobj);
-        nvmlDeviceSetClockOffsets_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetClockOffsets_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceSetMemoryLockedClocks") == 0) {
         LOG_TRACE("nvmlDeviceSetMemoryLockedClocks_handler");
         CHECK_AUTHORIZATION("setting memory locked clocks", jobj);
-        nvmlDeviceSetMemoryLockedClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetMemoryLockedClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceSetApplicationsClocks") == 0) {
         LOG_TRACE("nvmlDeviceSetApplicationsClocks_handler");
         CHECK_AUTHORIZATION("setting application locked clocks", jobj);
-        nvmlDeviceSetApplicationsClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetApplicationsClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceSetGpuLockedClocks") == 0) {
         LOG_TRACE("nvmlDeviceSetMemoryLockedClocks_handler");
         CHECK_AUTHORIZATION("setting gpu locked clocks", jobj);
-        nvmlDeviceSetGpuLockedClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetGpuLockedClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceResetApplicationsClocks") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1gbe6c0458851b3db68fa9d1717b32acd1
         LOG_TRACE("nvmlDeviceResetApplicationsClocks_handler");
         CHECK_AUTHORIZATION("resetting application clocks", jobj);
-        nvmlDeviceResetApplicationsClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceResetApplicationsClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceResetGpuLockedClocks") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1g51a3ca282a33471fe50c19751a99ead2
         LOG_TRACE("nvmlDeviceResetGpuLockedClocks_handler");
         CHECK_AUTHORIZATION("resetting gpu locked clocks", jobj);
-        nvmlDeviceResetGpuLockedClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceResetGpuLockedClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceResetMemoryLockedClocks") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1gc131dbdbebe753f63b254e0ec76f7154
         LOG_TRACE("nvmlDeviceResetMemoryLockedClocks_handler");
         CHECK_AUTHORIZATION("resetting memory locked clocks", jobj);
-        nvmlDeviceResetMemoryLockedClocks_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceResetMemoryLockedClocks_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceGetPowerManagementDefaultLimit") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1gd3ffb56cd39d079013dbfaba941eb31b
         LOG_TRACE("nvmlDeviceGetPowerManagementDefaultLimit_handler");
@@ -223,7 +319,7 @@ void assign_task(const int client_fd, const char *action, const json_object *job
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1gd10040f340986af6cda91e71629edb2b
         LOG_TRACE("nvmlDeviceSetPowerManagementLimit_handler");
         CHECK_AUTHORIZATION("setting power management limit", jobj);
-        nvmlDeviceSetPowerManagementLimit_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetPowerManagementLimit_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceGetNumFans") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1g49dfc28b9d0c68f487f9321becbcad3e
         LOG_TRACE("nvmlDeviceGetNumFans_handler");
@@ -244,7 +340,7 @@ void assign_task(const int client_fd, const char *action, const json_object *job
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1g49dfc28b9d0c68f487f9321becbcad3e
         LOG_TRACE("nvmlDeviceSetAPIRestriction_handler");
         CHECK_AUTHORIZATION("setting api restrictions", jobj);
-        nvmlDeviceSetAPIRestriction_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetAPIRestriction_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceGetAPIRestriction") == 0) {
         // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1g49dfc28b9d0c68f487f9321becbcad3e
         LOG_TRACE("nvmlDeviceGetAPIRestriction_handler");
@@ -270,14 +366,110 @@ void assign_task(const int client_fd, const char *action, const json_object *job
         LOG_TRACE("nvmlDeviceSetTemperatureThreshold_handler");
         // FIXME this needs to be checked; I couldn't set it even with sudo rights (failed w/ INVALID_ARGUMENT)
         CHECK_AUTHORIZATION("setting temperature threshold", jobj);
-        nvmlDeviceSetTemperatureThreshold_handler(client_fd, jobj);
+        RUN_OR_QUEUE(nvmlDeviceSetTemperatureThreshold_handler, client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceGetMemoryInfo") == 0){
         LOG_TRACE("nvmlDeviceGetMemoryInfo_handler");
         nvmlDeviceGetMemoryInfo_handler(client_fd, jobj);
+    } else if (strcmp(action, "nvmlDeviceGetSamples") == 0){
+        LOG_TRACE("nvmlDeviceGetSamples_handler");
+        nvmlDeviceGetSamples_handler(client_fd, jobj);
     } else if (strcmp(action, "nvmlDeviceGetDetailsAll") == 0) {
         // custom 'action'; this will get all the important details required
         LOG_TRACE("nvmlDeviceGetDetailsAll_handler");
         nvmlDeviceGetDetailsAll_handler(client_fd, jobj);
+    } else if (strcmp(action, "traceDump") == 0) {
+        // custom 'action'; dumps recorded spans as Chrome trace-event JSON, see trace.h
+        LOG_TRACE("traceDump_handler");
+        traceDump_handler(client_fd, jobj);
+    } else if (strcmp(action, "metrics") == 0) {
+        // custom 'action'; every device in OpenMetrics text format, rendered once per sampling interval
+        LOG_TRACE("metrics_handler");
+        metrics_handler(client_fd, jobj);
+    } else if (strcmp(action, "storeQuery") == 0) {
+        // custom 'action'; history of one metric from the persistent telemetry store
+        LOG_TRACE("storeQuery_handler");
+        storeQuery_handler(client_fd, jobj);
+    } else if (strcmp(action, "seriesQuery") == 0) {
+        // custom 'action'; recent full-rate history of one metric from the compressed in-memory series
+        LOG_TRACE("seriesQuery_handler");
+        seriesQuery_handler(client_fd, jobj);
+    } else if (strcmp(action, "seriesStats") == 0) {
+        // custom 'action'; memory footprint of the in-memory series
+        LOG_TRACE("seriesStats_handler");
+        seriesStats_handler(client_fd, jobj);
+    } else if (strcmp(action, "subscribeEvents") == 0) {
+        // custom 'action'; keeps the connection open and streams NVML events as they happen, one JSON object per line
+        LOG_TRACE("subscribeEvents_handler");
+        subscribeEvents_handler(client_fd, jobj);
+    } else if (strcmp(action, "waitFor") == 0) {
+        // custom 'action'; holds the request until a metric of a device satisfies a condition, checked by the daemon
+        LOG_TRACE("waitFor_handler");
+        waitFor_handler(client_fd, jobj);
+    } else if (strcmp(action, "fanCurveSet") == 0) {
+        // custom 'action'; the daemon drives the fans of a device along a temperature curve until cleared
+        LOG_TRACE("fanCurveSet_handler");
+        CHECK_AUTHORIZATION("setting fan curves", jobj);
+        fanCurveSet_handler(client_fd, jobj);
+    } else if (strcmp(action, "fanCurveClear") == 0) {
+        // custom 'action'; hands the fans back to the driver
+        LOG_TRACE("fanCurveClear_handler");
+        CHECK_AUTHORIZATION("clearing fan curves", jobj);
+        fanCurveClear_handler(client_fd, jobj);
+    } else if (strcmp(action, "fanCurveStatus") == 0) {
+        // custom 'action'
+        LOG_TRACE("fanCurveStatus_handler");
+        fanCurveStatus_handler(client_fd, jobj);
+    } else if (strcmp(action, "powerBudgetSet") == 0) {
+        // custom 'action'; the daemon keeps the power limits of the given devices within a node budget until cleared
+        LOG_TRACE("powerBudgetSet_handler");
+        CHECK_AUTHORIZATION("setting a node power budget", jobj);
+        powerBudgetSet_handler(client_fd, jobj);
+    } else if (strcmp(action, "powerBudgetClear") == 0) {
+        // custom 'action'; restores the power limits from before the budget
+        LOG_TRACE("powerBudgetClear_handler");
+        CHECK_AUTHORIZATION("clearing the node power budget", jobj);
+        powerBudgetClear_handler(client_fd, jobj);
+    } else if (strcmp(action, "powerBudgetStatus") == 0) {
+        // custom 'action'
+        LOG_TRACE("powerBudgetStatus_handler");
+        powerBudgetStatus_handler(client_fd, jobj);
+    } else if (strcmp(action, "profileSet") == 0) {
+        // custom 'action'; defines (or replaces) a named set of clocks and power limit for profileRulesSet to apply
+        LOG_TRACE("profileSet_handler");
+        CHECK_AUTHORIZATION("setting a profile", jobj);
+        profileSet_handler(client_fd, jobj);
+    } else if (strcmp(action, "profileDelete") == 0) {
+        // custom 'action'
+        LOG_TRACE("profileDelete_handler");
+        CHECK_AUTHORIZATION("deleting a profile", jobj);
+        profileDelete_handler(client_fd, jobj);
+    } else if (strcmp(action, "profileRulesSet") == 0) {
+        // custom 'action'; the daemon applies the profile of the first rule matching a process running on a device
+        LOG_TRACE("profileRulesSet_handler");
+        CHECK_AUTHORIZATION("setting profile rules", jobj);
+        profileRulesSet_handler(client_fd, jobj);
+    } else if (strcmp(action, "profilesStatus") == 0) {
+        // custom 'action'
+        LOG_TRACE("profilesStatus_handler");
+        profilesStatus_handler(client_fd, jobj);
+    } else if (strcmp(action, "apply") == 0) {
+        // custom 'action'; several setters as one transaction, rolled back if any of them fails
+        LOG_TRACE("apply_handler");
+        CHECK_AUTHORIZATION("applying settings", jobj);
+        RUN_OR_QUEUE(apply_handler, client_fd, jobj);
+    } else if (strcmp(action, "jobStatus") == 0) {
+        // custom 'action'; state and result of a setter sent w/ "async": true
+        LOG_TRACE("jobStatus_handler");
+        jobStatus_handler(client_fd, jobj);
+    } else if (strcmp(action, "jobWait") == 0) {
+        // custom 'action'; like jobStatus, but answers once the job is done
+        LOG_TRACE("jobWait_handler");
+        jobWait_handler(client_fd, jobj);
+    } else if (strcmp(action, "restart") == 0) {
+        // custom 'action'; like SIGHUP, re-executes envyd w/o dropping clients
+        LOG_TRACE("restart_handler");
+        CHECK_AUTHORIZATION("restarting envyd", jobj);
+        restart_handler(client_fd, jobj);
     } else {
         LOG_TRACE("Got erroneous action %s, couldn't resolve provided action to any valid action!", action);
         RESPOND(client_fd, NULL, UNDEFINED_INVALID_ACTION, "Couldn't resolve provided action to any valid envyd or NVML action.");
@@ -302,7 +494,7 @@ void nvmlDeviceGetAdaptiveClockInfoStatus_handler(const int client_fd, const jso
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -311,7 +503,7 @@ void nvmlDeviceGetAdaptiveClockInfoStatus_handler(const int client_fd, const jso
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int status;
-    gl_nvml_result = nvmlDeviceGetAdaptiveClockInfoStatus(device, &status);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetAdaptiveClockInfoStatus, device, &status);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve get adaptive clock info status for device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't reset adaptive clock info status for device!");
@@ -382,7 +574,7 @@ void nvmlDeviceGetClock_handler(const int client_fd, const json_object *jobj) {
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -391,7 +583,7 @@ void nvmlDeviceGetClock_handler(const int client_fd, const json_object *jobj) {
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int clock_mhz = 1;
-    gl_nvml_result = nvmlDeviceGetClock(device, clock_type, clock_id, &clock_mhz);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetClock, device, clock_type, clock_id, &clock_mhz);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't get clock for device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get clock for device!");
@@ -444,7 +636,7 @@ void nvmlDeviceGetClockInfo_handler(const int client_fd, const json_object *jobj
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -453,7 +645,7 @@ void nvmlDeviceGetClockInfo_handler(const int client_fd, const json_object *jobj
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int clock = 1;
-    gl_nvml_result = nvmlDeviceGetClockInfo(device, clock_type, &clock);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetClockInfo, device, clock_type, &clock);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't get clock for device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get clock for device!");
@@ -529,7 +721,7 @@ void nvmlDeviceGetClockOffsets_handler(const int client_fd, const json_object *j
     // clockType
     // pstate
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -541,7 +733,7 @@ void nvmlDeviceGetClockOffsets_handler(const int client_fd, const json_object *j
     info.version = NVML_STRUCT_VERSION(ClockOffset, 1);
     info.type = clock_type;
     info.pstate = pstate;
-    gl_nvml_result = nvmlDeviceGetClockOffsets(device, &info);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetClockOffsets, device, &info);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve get offsets for device %s", uuid);
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve get offsets for device!");
@@ -596,7 +788,7 @@ void nvmlDeviceGetMaxClockInfo_handler(const int client_fd, const json_object *j
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -605,7 +797,7 @@ void nvmlDeviceGetMaxClockInfo_handler(const int client_fd, const json_object *j
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int clock = 1;
-    gl_nvml_result = nvmlDeviceGetMaxClockInfo(device, clock_type, &clock);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetMaxClockInfo, device, clock_type, &clock);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't get max clock for device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get max clock for device!");
@@ -657,7 +849,7 @@ void nvmlDeviceGetSupportedGraphicsClocks_handler(const int client_fd, const jso
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -666,16 +858,25 @@ void nvmlDeviceGetSupportedGraphicsClocks_handler(const int client_fd, const jso
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int count = 1024;
-    unsigned int* clocksMHZ = calloc(sizeof(unsigned int), count);
-    gl_nvml_result = nvmlDeviceGetSupportedGraphicsClocks(device, memoryClockMHZ, &count, clocksMHZ);
+    unsigned int* clocksMHZ = arena_calloc(arena_request(), count, sizeof(unsigned int));
+    if (clocksMHZ == NULL) {
+        LOG_ERROR("Couldn't allocate clock list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate clock list");
+        return;
+    }
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetSupportedGraphicsClocks, device, memoryClockMHZ, &count, clocksMHZ);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
-        free(clocksMHZ);
         LOG_ERROR("Couldn't resolve get supported graphics clocks for device w/ count %u!", count);
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve get supported graphics clocks for device!");
         return;
     }
 
-    char* buff = calloc(sizeof(char), count*16);
+    char* buff = arena_calloc(arena_request(), count*16 + 2, sizeof(char));
+    if (buff == NULL) {
+        LOG_ERROR("Couldn't allocate clock list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate clock list");
+        return;
+    }
     sprintf(buff, "[");
     for (int i = 0; i < count; ++i) {
         char supported_clock[72];
@@ -684,8 +885,6 @@ void nvmlDeviceGetSupportedGraphicsClocks_handler(const int client_fd, const jso
     }
     buff[strlen(buff)] = ']';
     RESPOND(client_fd, buff, map_nvmlReturn_t_to_string(gl_nvml_result), NULL);
-    free(clocksMHZ);
-    free(buff);
 }
 
 void nvmlDeviceGetSupportedMemoryClocks_handler(const int client_fd, const json_object *jobj) {
@@ -704,7 +903,7 @@ void nvmlDeviceGetSupportedMemoryClocks_handler(const int client_fd, const json_
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -713,16 +912,25 @@ void nvmlDeviceGetSupportedMemoryClocks_handler(const int client_fd, const json_
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int count = 1024;
-    unsigned int* clocksMHZ = calloc(sizeof(unsigned int), count);
-    gl_nvml_result = nvmlDeviceGetSupportedMemoryClocks(device, &count, clocksMHZ);
+    unsigned int* clocksMHZ = arena_calloc(arena_request(), count, sizeof(unsigned int));
+    if (clocksMHZ == NULL) {
+        LOG_ERROR("Couldn't allocate clock list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate clock list");
+        return;
+    }
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetSupportedMemoryClocks, device, &count, clocksMHZ);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
-        free(clocksMHZ);
         LOG_ERROR("Couldn't resolve get supported memory clocks for device w/ count %u!", count);
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve get supported memory clocks for device!");
         return;
     }
 
-    char* buff = calloc(sizeof(char), 8192);
+    char* buff = arena_calloc(arena_request(), 8192, sizeof(char));
+    if (buff == NULL) {
+        LOG_ERROR("Couldn't allocate clock list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate clock list");
+        return;
+    }
     sprintf(buff, "[");
     for (int i = 0; i < count; ++i) {
         char supported_clock[72];
@@ -731,28 +939,306 @@ void nvmlDeviceGetSupportedMemoryClocks_handler(const int client_fd, const json_
     }
     buff[strlen(buff)] = ']';
     RESPOND(client_fd, buff, map_nvmlReturn_t_to_string(gl_nvml_result), NULL);
-    free(clocksMHZ);
-    free(buff);
 }
 
 void nvmlDeviceSetClockOffsets_handler(const int client_fd, const json_object *jobj) {
     // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceQueries.html#group__nvmlDeviceQueries_1g7a0bb4cb513396b7f42be81ac2ea4428
-    // TODO impl
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *clock_type_field = json_object_object_get(jobj, "clockType");
+    if (clock_type_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'clockType' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'clockType' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *clock_type_s = json_object_get_string(clock_type_field);
+    if (clock_type_s == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'clockType' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'clockType' field does have a valid value");
+        return;
+    }
+
+    const nvmlClockType_t clock_type = map_nvmlClockType_t_to_enum(clock_type_s);
+    if (clock_type == NVML_CLOCK_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'clockType' field did not evaluate to anything within the nvmlClockType_t (value %s must be a string of the enum value)", clock_type_s);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'clockType' field did not evaluate to anything within the nvmlClockType_t (value must be a string of the enum value)");
+        return;
+    }
+
+    json_object *pstate_type_field = json_object_object_get(jobj, "pstate");
+    if (pstate_type_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'pstate' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'pstate' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *pstate_s = json_object_get_string(pstate_type_field);
+    if (pstate_s == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'pstate' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'pstate' field does have a valid value");
+        return;
+    }
+
+    const nvmlPstates_t pstate = map_nvmlPstates_t_to_enum(pstate_s);
+    if (pstate == NVML_PSTATE_UNKNOWN) {
+        LOG_ERROR("Invalid JSON schema: 'pstate' field did not evaluate to anything within the nvmlPstates_t (value %s must be a string of the enum value)", pstate_s);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'pstate' field did not evaluate to anything within the nvmlPstates_t (value must be a string of the enum value)");
+        return;
+    }
+
+    const json_object *offset_field = json_object_object_get(jobj, "clockOffsetMHz");
+    if (offset_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'clockOffsetMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'clockOffsetMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(offset_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'clockOffsetMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'clockOffsetMHz' field is not an int");
+        return;
+    }
+
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    nvmlClockOffset_t info = {0};
+    info.version = NVML_STRUCT_VERSION(ClockOffset, 1);
+    info.type = clock_type;
+    info.pstate = pstate;
+    info.clockOffsetMHz = json_object_get_int(offset_field);
+    gl_nvml_result = NVML_CALL(nvmlDeviceSetClockOffsets, device, &info);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't set clock offset for uuid %s, type %d, pstate %d to %d", uuid, clock_type, pstate, info.clockOffsetMHz);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set clock offset!");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when setting clock offset for uuid %s", uuid);
+
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Successfully set clock offset!");
 }
 
 void nvmlDeviceSetMemoryLockedClocks_handler(const int client_fd, const json_object *jobj) {
     // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1g3cab0aaf0e46aa76469f18707e5867f1
-    // TODO impl
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    const json_object *min_mem_clock_mhz_field = json_object_object_get(jobj, "minMemClockMHz");
+    if (min_mem_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'minMemClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minMemClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(min_mem_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'minMemClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minMemClockMHz' field is not an int");
+        return;
+    }
+
+    const int min_mem_clock_mhz = json_object_get_int(min_mem_clock_mhz_field);
+    if (min_mem_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'minMemClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minMemClockMHz' field is not >= 0");
+        return;
+    }
+
+    const json_object *max_mem_clock_mhz_field = json_object_object_get(jobj, "maxMemClockMHz");
+    if (max_mem_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'maxMemClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxMemClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(max_mem_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'maxMemClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxMemClockMHz' field is not an int");
+        return;
+    }
+
+    const int max_mem_clock_mhz = json_object_get_int(max_mem_clock_mhz_field);
+    if (max_mem_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'maxMemClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxMemClockMHz' field is not >= 0");
+        return;
+    }
+
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    coalesce_submit(client_fd, device, uuid, COALESCE_MEMORY_LOCKED_CLOCKS, NVML_POWER_SCOPE_GPU, (unsigned int) min_mem_clock_mhz, (unsigned int) max_mem_clock_mhz);
 }
 
 void nvmlDeviceSetApplicationsClocks_handler(const int client_fd, const json_object *jobj) {
     // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1gc2a9a8db6fffb2604d27fd67e8d5d87f
-    // TODO impl
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    const json_object *mem_clock_mhz_field = json_object_object_get(jobj, "memClockMHz");
+    if (mem_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'memClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'memClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(mem_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'memClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'memClockMHz' field is not an int");
+        return;
+    }
+
+    const int mem_clock_mhz = json_object_get_int(mem_clock_mhz_field);
+    if (mem_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'memClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'memClockMHz' field is not >= 0");
+        return;
+    }
+
+    const json_object *graphics_clock_mhz_field = json_object_object_get(jobj, "graphicsClockMHz");
+    if (graphics_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'graphicsClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'graphicsClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(graphics_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'graphicsClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'graphicsClockMHz' field is not an int");
+        return;
+    }
+
+    const int graphics_clock_mhz = json_object_get_int(graphics_clock_mhz_field);
+    if (graphics_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'graphicsClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'graphicsClockMHz' field is not >= 0");
+        return;
+    }
+
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    coalesce_submit(client_fd, device, uuid, COALESCE_APPLICATIONS_CLOCKS, NVML_POWER_SCOPE_GPU, (unsigned int) mem_clock_mhz, (unsigned int) graphics_clock_mhz);
 }
 
 void nvmlDeviceSetGpuLockedClocks_handler(const int client_fd, const json_object *jobj) {
     // https://docs.nvidia.com/deploy/nvml-api/group__nvmlDeviceCommands.html#group__nvmlDeviceCommands_1gc9b58cd685f4deee575400e2e6ac76cb
-    // TODO impl
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    const json_object *min_gpu_clock_mhz_field = json_object_object_get(jobj, "minGpuClockMHz");
+    if (min_gpu_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'minGpuClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minGpuClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(min_gpu_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'minGpuClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minGpuClockMHz' field is not an int");
+        return;
+    }
+
+    const int min_gpu_clock_mhz = json_object_get_int(min_gpu_clock_mhz_field);
+    if (min_gpu_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'minGpuClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'minGpuClockMHz' field is not >= 0");
+        return;
+    }
+
+    const json_object *max_gpu_clock_mhz_field = json_object_object_get(jobj, "maxGpuClockMHz");
+    if (max_gpu_clock_mhz_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'maxGpuClockMHz' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxGpuClockMHz' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    if (!json_object_is_type(max_gpu_clock_mhz_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'maxGpuClockMHz' field is not an int");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxGpuClockMHz' field is not an int");
+        return;
+    }
+
+    const int max_gpu_clock_mhz = json_object_get_int(max_gpu_clock_mhz_field);
+    if (max_gpu_clock_mhz < 0) {
+        LOG_ERROR("Invalid JSON schema: 'maxGpuClockMHz' field is not >= 0");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'maxGpuClockMHz' field is not >= 0");
+        return;
+    }
+
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    coalesce_submit(client_fd, device, uuid, COALESCE_GPU_LOCKED_CLOCKS, NVML_POWER_SCOPE_GPU, (unsigned int) min_gpu_clock_mhz, (unsigned int) max_gpu_clock_mhz);
 }
 
 void nvmlDeviceResetApplicationsClocks_handler(const int client_fd, const json_object *jobj) {
@@ -771,7 +1257,7 @@ void nvmlDeviceResetApplicationsClocks_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -779,7 +1265,8 @@ void nvmlDeviceResetApplicationsClocks_handler(const int client_fd, const json_o
     }
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
-    gl_nvml_result = nvmlDeviceResetApplicationsClocks(device);
+    coalesce_forget(device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceResetApplicationsClocks, device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve reset applications clocks to device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't reset applications clocks to device!");
@@ -805,7 +1292,7 @@ void nvmlDeviceResetGpuLockedClocks_handler(const int client_fd, const json_obje
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -813,7 +1300,8 @@ void nvmlDeviceResetGpuLockedClocks_handler(const int client_fd, const json_obje
     }
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
-    gl_nvml_result = nvmlDeviceResetGpuLockedClocks(device);
+    coalesce_forget(device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceResetGpuLockedClocks, device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve reset gpu clocks to device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't reset gpu clocks to device!");
@@ -839,7 +1327,7 @@ void nvmlDeviceResetMemoryLockedClocks_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -847,7 +1335,8 @@ void nvmlDeviceResetMemoryLockedClocks_handler(const int client_fd, const json_o
     }
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
-    gl_nvml_result = nvmlDeviceResetMemoryLockedClocks(device);
+    coalesce_forget(device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceResetMemoryLockedClocks, device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve reset memory clocks to device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't reset memory clocks to device!");
@@ -875,7 +1364,7 @@ void nvmlDeviceGetPowerManagementDefaultLimit_handler(const int client_fd, const
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -884,7 +1373,7 @@ void nvmlDeviceGetPowerManagementDefaultLimit_handler(const int client_fd, const
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int default_limit;
-    gl_nvml_result = nvmlDeviceGetPowerManagementDefaultLimit(device, &default_limit);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetPowerManagementDefaultLimit, device, &default_limit);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get default limit!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get default limit!");
@@ -912,7 +1401,7 @@ void nvmlDeviceGetPowerManagementLimit_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -921,7 +1410,7 @@ void nvmlDeviceGetPowerManagementLimit_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int limit;
-    gl_nvml_result = nvmlDeviceGetPowerManagementLimit(device, &limit);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetPowerManagementLimit, device, &limit);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get limit!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get limit!");
@@ -949,7 +1438,7 @@ void nvmlDeviceGetPowerManagementLimitConstraints_handler(const int client_fd, c
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -959,7 +1448,7 @@ void nvmlDeviceGetPowerManagementLimitConstraints_handler(const int client_fd, c
 
     unsigned int min_limit;
     unsigned int max_limit;
-    gl_nvml_result = nvmlDeviceGetPowerManagementLimitConstraints(device, &min_limit, &max_limit);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetPowerManagementLimitConstraints, device, &min_limit, &max_limit);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get fan min/max limit!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get fan min/max limit");
@@ -987,7 +1476,7 @@ void nvmlDeviceGetPowerUsage_handler(const int client_fd, const json_object *job
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -996,7 +1485,7 @@ void nvmlDeviceGetPowerUsage_handler(const int client_fd, const json_object *job
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int power;
-    gl_nvml_result = nvmlDeviceGetPowerUsage(device, &power);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetPowerUsage, device, &power);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get power usage!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get power usage!");
@@ -1065,7 +1554,7 @@ void nvmlDeviceSetPowerManagementLimit_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1073,20 +1562,14 @@ void nvmlDeviceSetPowerManagementLimit_handler(const int client_fd, const json_o
     }
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
-    nvmlPowerValue_v2_t power_value_s = {0};
-    power_value_s.version = nvmlPowerValue_v2;
-    // powerScope NVML_POWER_SCOPE_GPU or NVML_POWER_SCOPE_MODULE or NVML_POWER_SCOPE_MEMORY
-    power_value_s.powerScope = scope_type;
-    power_value_s.powerValueMw = power_value;
-    gl_nvml_result = nvmlDeviceSetPowerManagementLimit_v2(device, &power_value_s);
-    if (ERROR(gl_nvml_result)) {
-        LOG_ERROR("Couldn't set power management limit w/ uuid %s and version %u, type %d, mw %u", uuid, power_value_s.version, power_value_s.powerScope, power_value_s.powerValueMw);
-        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set power management limit");
+    if (powerctl_controls(device)) {
+        LOG_ERROR("Power limit of %s belongs to the node power budget", uuid);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_IN_USE), "Device's power limit belongs to the node power budget");
         return;
     }
-    if (FATAL(gl_nvml_result)) WTF("Couldn't set power management limit w/ uuid %s and version %u, type %d, mw %u", uuid, power_value_s.version, power_value_s.powerScope, power_value_s.powerValueMw);
 
-    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), NULL);
+    // sliders send many of these; coalescing writes only the latest within its window, and none if nothing changes
+    coalesce_submit(client_fd, device, uuid, COALESCE_POWER_LIMIT, scope_type, (unsigned int) power_value, 0);
 }
 
 // ----------------------------- FANS -----------------------------
@@ -1107,7 +1590,7 @@ void nvmlDeviceGetNumFans_handler(const int client_fd, const json_object *jobj)
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1116,7 +1599,7 @@ void nvmlDeviceGetNumFans_handler(const int client_fd, const json_object *jobj)
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int num_fans;
-    gl_nvml_result = nvmlDeviceGetNumFans(device, &num_fans);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetNumFans, device, &num_fans);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get count of fans!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get count of fans");
@@ -1164,7 +1647,7 @@ void nvmlDeviceGetFanSpeed_handler(const int client_fd, const json_object *jobj)
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1173,7 +1656,7 @@ void nvmlDeviceGetFanSpeed_handler(const int client_fd, const json_object *jobj)
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int num_speed;
-    gl_nvml_result = nvmlDeviceGetFanSpeed_v2(device, fan_index, &num_speed);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetFanSpeed_v2, device, fan_index, &num_speed);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get fan speed!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get fan speed");
@@ -1201,7 +1684,7 @@ void nvmlDeviceGetMinMaxFanSpeed_handler(const int client_fd, const json_object
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1211,7 +1694,7 @@ void nvmlDeviceGetMinMaxFanSpeed_handler(const int client_fd, const json_object
 
     unsigned int min_speed;
     unsigned int max_speed;
-    gl_nvml_result = nvmlDeviceGetMinMaxFanSpeed(device, &min_speed, &max_speed);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetMinMaxFanSpeed, device, &min_speed, &max_speed);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get fan min/max speed!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get fan min/max speed");
@@ -1259,7 +1742,7 @@ void nvmlDeviceGetTargetFanSpeed_handler(const int client_fd, const json_object
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1268,7 +1751,7 @@ void nvmlDeviceGetTargetFanSpeed_handler(const int client_fd, const json_object
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int num_speed;
-    gl_nvml_result = nvmlDeviceGetTargetFanSpeed(device, fan_index, &num_speed);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTargetFanSpeed, device, fan_index, &num_speed);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't get fan speed!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get fan speed");
@@ -1334,7 +1817,7 @@ void nvmlDeviceSetAPIRestriction_handler(const int client_fd, const json_object
     const json_bool is_restricted = json_object_get_boolean(isRestricted_field);
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1343,7 +1826,7 @@ void nvmlDeviceSetAPIRestriction_handler(const int client_fd, const json_object
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     const nvmlEnableState_t nvmlRestricted = is_restricted == 1;
-    gl_nvml_result = nvmlDeviceSetAPIRestriction(device, api_type, nvmlRestricted);
+    gl_nvml_result = NVML_CALL(nvmlDeviceSetAPIRestriction, device, api_type, nvmlRestricted);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't set API restriction!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set API restriction");
@@ -1391,7 +1874,7 @@ void nvmlDeviceGetAPIRestriction_handler(const int client_fd, const json_object
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1400,7 +1883,7 @@ void nvmlDeviceGetAPIRestriction_handler(const int client_fd, const json_object
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     nvmlEnableState_t is_restricted;
-    gl_nvml_result = nvmlDeviceGetAPIRestriction(device, api_type, &is_restricted);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetAPIRestriction, device, api_type, &is_restricted);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve API restriction!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve API restriction");
@@ -1431,7 +1914,7 @@ void nvmlDeviceGetTemperature_handler(const int client_fd, const json_object *jo
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1440,7 +1923,7 @@ void nvmlDeviceGetTemperature_handler(const int client_fd, const json_object *jo
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     unsigned int temperature;
-    gl_nvml_result = nvmlDeviceGetTemperature(device, NVML_TEMPERATURE_GPU, &temperature);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperature, device, NVML_TEMPERATURE_GPU, &temperature);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_UNKNOWN) {
         LOG_ERROR("Couldn't get temperature!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get temperature");
@@ -1469,7 +1952,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1479,7 +1962,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
 
     unsigned int shutdown;
     nvmlReturn_t lo_nvml_result = gl_nvml_result;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_SHUTDOWN, &shutdown);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_SHUTDOWN, &shutdown);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? shutdown = UINT_MAX : 0; // noop
@@ -1488,7 +1971,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int slowdown;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_SLOWDOWN, &slowdown);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_SLOWDOWN, &slowdown);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? slowdown = UINT_MAX : 0; // noop
@@ -1497,7 +1980,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int mem_max;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_MEM_MAX, &mem_max);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_MEM_MAX, &mem_max);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? mem_max = UINT_MAX : 0; // noop
@@ -1506,7 +1989,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int gpu_max;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_GPU_MAX, &gpu_max);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_GPU_MAX, &gpu_max);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? gpu_max = UINT_MAX : 0; // noop
@@ -1515,7 +1998,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int acoustic_min;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MIN, &acoustic_min);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MIN, &acoustic_min);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? acoustic_min = UINT_MAX : 0; // noop
@@ -1524,7 +2007,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int acoustic_curr;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_CURR, &acoustic_curr);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_CURR, &acoustic_curr);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? acoustic_curr = UINT_MAX : 0;
@@ -1533,7 +2016,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int acoustic_max;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MAX, &acoustic_max);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_ACOUSTIC_MAX, &acoustic_max);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? acoustic_max = UINT_MAX : 0; // noop
@@ -1542,7 +2025,7 @@ void nvmlDeviceGetTemperatureThreshold_handler(const int client_fd, const json_o
     if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting temperature threshold for uuid %s", uuid);
 
     unsigned int gps_curr;
-    gl_nvml_result = nvmlDeviceGetTemperatureThreshold(device, NVML_TEMPERATURE_THRESHOLD_GPS_CURR, &gps_curr);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, device, NVML_TEMPERATURE_THRESHOLD_GPS_CURR, &gps_curr);
     if (ERROR(gl_nvml_result)) {
         LOG_ERROR("Couldn't resolve temperature threshold info to device!");
         gl_nvml_result == NVML_ERROR_NOT_SUPPORTED ? gps_curr = UINT_MAX : 0; // noop
@@ -1592,7 +2075,7 @@ void nvmlDeviceGetThermalSettings_handler(const int client_fd, const json_object
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1601,7 +2084,7 @@ void nvmlDeviceGetThermalSettings_handler(const int client_fd, const json_object
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
     nvmlGpuThermalSettings_t gpu_thermal_settings = {0};
-    gl_nvml_result = nvmlDeviceGetThermalSettings(device, NVML_TEMPERATURE_GPU, &gpu_thermal_settings);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetThermalSettings, device, NVML_TEMPERATURE_GPU, &gpu_thermal_settings);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_UNKNOWN) {
         LOG_ERROR("Couldn't match sensor!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't match sensor");
@@ -1693,7 +2176,7 @@ void nvmlDeviceSetTemperatureThreshold_handler(const int client_fd, const json_o
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1701,7 +2184,7 @@ void nvmlDeviceSetTemperatureThreshold_handler(const int client_fd, const json_o
     }
     if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
 
-    gl_nvml_result = nvmlDeviceSetTemperatureThreshold(device, threshold_type_t, &temp);
+    gl_nvml_result = NVML_CALL(nvmlDeviceSetTemperatureThreshold, device, threshold_type_t, &temp);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't set temperature threshold for uuid %s, type %d, temp %d", uuid, threshold_type_t, temp);
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set temperature threshold! If this error is an INVALID_ARGUMENT type error, this might be a 'bug': https://forums.developer.nvidia.com/t/nvmldevicesettemperaturethreshold-api-returns-invalid-argument-error/279650/3");
@@ -1730,7 +2213,7 @@ void nvmlDeviceGetMemoryInfo_handler(const int client_fd, const json_object *job
     }
 
     nvmlDevice_t device;
-    gl_nvml_result = nvmlDeviceGetHandleByUUID(uuid, &device);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve UUID to any device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
@@ -1740,7 +2223,7 @@ void nvmlDeviceGetMemoryInfo_handler(const int client_fd, const json_object *job
 
     nvmlMemory_v2_t nvml_memory = {0};
     nvml_memory.version = NVML_STRUCT_VERSION(Memory, 2);
-    gl_nvml_result = nvmlDeviceGetMemoryInfo_v2(device, &nvml_memory);
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetMemoryInfo_v2, device, &nvml_memory);
     if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
         LOG_ERROR("Couldn't resolve memory info to device!");
         RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve memory info to device!");
@@ -1765,133 +2248,1308 @@ void nvmlDeviceGetMemoryInfo_handler(const int client_fd, const json_object *job
     RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(gl_nvml_result), NULL);
 }
 
-void nvmlDeviceGetDetailsAll_handler(const int client_fd, const json_object *jobj) {
-    // half a meg will literally handle even small clusters, I'd hope lol (should fit about 400 devices, counting overhead)
-    char* buffer = calloc(sizeof(char), 524288);
-    unsigned int device_count;
-    gl_nvml_result = nvmlDeviceGetCount_v2(&device_count);
-    if (ERROR(gl_nvml_result)) {
-        LOG_ERROR("Couldn't get count of devices!");
-        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get count of devices");
-        return;
+void write_sample_value(FILE *stream, const nvmlValueType_t type, const nvmlValue_t value) {
+    switch (type) {
+        case NVML_VALUE_TYPE_DOUBLE:
+            fprintf(stream, "%.10g", value.dVal);
+            break;
+        case NVML_VALUE_TYPE_UNSIGNED_INT:
+            fprintf(stream, "%u", value.uiVal);
+            break;
+        case NVML_VALUE_TYPE_UNSIGNED_LONG:
+            fprintf(stream, "%lu", value.ulVal);
+            break;
+        case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG:
+            fprintf(stream, "%llu", value.ullVal);
+            break;
+        case NVML_VALUE_TYPE_SIGNED_LONG_LONG:
+            fprintf(stream, "%lld", value.sllVal);
+            break;
+        case NVML_VALUE_TYPE_SIGNED_INT:
+            fprintf(stream, "%d", value.siVal);
+            break;
+        default:
+            fprintf(stream, "null");
     }
-    if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when grabbing device count! Is NVML instance up?");
+}
 
-    sprintf(buffer, "{\"count\": %d, \"devices\": [", device_count);
-    int failure_count = 0;
-    for (int i = 0; i < device_count; ++i) {
-        nvmlDevice_t device;
-        gl_nvml_result = nvmlDeviceGetHandleByIndex_v2(i, &device);
-        if (ERROR(gl_nvml_result)) {
-            LOG_ERROR("Couldn't get device by index %d!", i);
-            ++failure_count;
-            continue;
+void nvmlDeviceGetSamples_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *sampling_type_field = json_object_object_get(jobj, "samplingType");
+    if (sampling_type_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'samplingType' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'samplingType' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *sampling_type_s = json_object_get_string(sampling_type_field);
+    if (sampling_type_s == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'samplingType' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'samplingType' field does have a valid value");
+        return;
+    }
+
+    const nvmlSamplingType_t sampling_type = map_nvmlSamplingType_t_to_enum(sampling_type_s);
+    if (sampling_type == NVML_SAMPLINGTYPE_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'samplingType' field did not evaluate to anything within the nvmlSamplingType_t (value %s must be a string of the enum value)", sampling_type_s);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'samplingType' field did not evaluate to anything within the nvmlSamplingType_t (value must be a string of the enum value)");
+        return;
+    }
+
+    // optional; a server-side cursor, so that polling clients don't have to carry lastSeenTimeStamp around
+    const char *subscriber = NULL;
+    json_object *subscriber_field = json_object_object_get(jobj, "subscriber");
+    if (subscriber_field != NULL) {
+        subscriber = json_object_get_string(subscriber_field);
+        if (subscriber == NULL || *subscriber == 0 || strlen(subscriber) >= CURSORS_SUBSCRIBER_SIZE) {
+            LOG_ERROR("Invalid JSON schema: 'subscriber' field must be a non-empty string shorter than %d", CURSORS_SUBSCRIBER_SIZE);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'subscriber' field must be a non-empty string of at most 63 characters");
+            return;
         }
-        if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting device handle by index %d!", i);
+    }
 
-        char uuid[128];
-        gl_nvml_result = nvmlDeviceGetUUID(device, uuid, 256);
-        if (ERROR(gl_nvml_result)) {
-            LOG_ERROR("Couldn't get uuid by index %d!", i);
-            ++failure_count;
-            continue;
+    // optional; an explicit timestamp (in microseconds, as returned by NVML) wins over the cursor
+    unsigned long long last_seen = subscriber != NULL ? cursors_get(subscriber, uuid, sampling_type) : 0;
+    json_object *last_seen_field = json_object_object_get(jobj, "lastSeenTimeStamp");
+    if (last_seen_field != NULL) {
+        if (!json_object_is_type(last_seen_field, json_type_int) || json_object_get_int64(last_seen_field) < 0) {
+            LOG_ERROR("Invalid JSON schema: 'lastSeenTimeStamp' field is not a non-negative integer");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'lastSeenTimeStamp' field is not a non-negative integer");
+            return;
         }
-        if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting uuid by index %d!", i);
+        last_seen = (unsigned long long) json_object_get_int64(last_seen_field);
+    }
 
-        char name[128];
-        gl_nvml_result = nvmlDeviceGetName(device, name, 256);
-        if (ERROR(gl_nvml_result)) {
-            LOG_ERROR("Couldn't get device name by index %d!", i);
-            ++failure_count;
-            continue;
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    // NVML fills in how many samples its buffer holds (an upper bound for what's newer than last_seen) for a NULL array
+    nvmlValueType_t value_type = NVML_VALUE_TYPE_COUNT;
+    unsigned int sample_count = 0;
+    nvmlSample_t *samples = NULL;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetSamples, device, sampling_type, last_seen, &value_type, &sample_count, NULL);
+    if (gl_nvml_result == NVML_SUCCESS && sample_count > 0) {
+        samples = arena_calloc(arena_request(), sample_count, sizeof(nvmlSample_t));
+        if (samples == NULL) {
+            LOG_ERROR("Couldn't allocate %u samples!", sample_count);
+            RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate sample buffer");
+            return;
         }
-        if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting device name by index %d!", i);
+        gl_nvml_result = NVML_CALL(nvmlDeviceGetSamples, device, sampling_type, last_seen, &value_type, &sample_count, samples);
+    }
+    // nothing newer than last_seen isn't an error for a poller
+    if (gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        gl_nvml_result = NVML_SUCCESS;
+        sample_count = 0;
+    }
+    if (ERROR(gl_nvml_result)) {
+        LOG_ERROR("Couldn't get samples for device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get samples for device!");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when getting samples for uuid %s", uuid);
 
-        char gsp_version[64];
-        gl_nvml_result = nvmlDeviceGetGspFirmwareVersion(device, gsp_version);
-        if (ERROR(gl_nvml_result)) {
-            LOG_ERROR("Couldn't get gsp version by index %d!", i);
-            ++failure_count;
-            continue;
+    unsigned long long newest = last_seen;
+    for (unsigned int i = 0; i < sample_count; ++i) {
+        if (samples[i].timeStamp > newest) newest = samples[i].timeStamp;
+    }
+    if (subscriber != NULL) cursors_set(subscriber, uuid, sampling_type, newest);
+
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't allocate sample buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate sample buffer");
+        return;
+    }
+    fprintf(stream, "{\"sampleValType\": \"%s\", \"lastSeenTimeStamp\": %llu, \"samples\": [",
+            map_nvmlValueType_t_to_string(value_type), newest);
+    for (unsigned int i = 0; i < sample_count; ++i) {
+        fprintf(stream, "%s[%llu, ", i > 0 ? ", " : "", samples[i].timeStamp);
+        write_sample_value(stream, value_type, samples[i].sampleValue);
+        fputc(']', stream);
+    }
+    fputs("]}", stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate sample buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate sample buffer");
+        return;
+    }
+
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(gl_nvml_result), NULL);
+}
+
+typedef struct detailsWork_st {
+    deviceDetails_st *details;
+    unsigned int device_count;
+    unsigned int fields;
+    unsigned int next;  // next index to claim, shared by the workers
+    unsigned long long request_id;  // for the trace
+} detailsWork_st;
+
+// what query_device_details hands to the device's context
+typedef struct detailsTask_st {
+    nvmlDevice_t device;
+    unsigned int index;
+    unsigned int fields;
+    deviceDetails_st details;
+} detailsTask_st;
+
+void query_device_details_task(void *arg) {
+    detailsTask_st *task = arg;
+    const nvmlDevice_t device = task->device;
+    const unsigned int index = task->index;
+    const unsigned int fields = task->fields;
+    deviceDetails_st *details = &task->details;
+    nvmlReturn_t result;
+    if (fields & DETAILS_FIELD_UUID) {
+        result = NVML_CALL(nvmlDeviceGetUUID, device, details->uuid, sizeof(details->uuid));
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get uuid by index %u!", index);
+            details->result = result;
+            return;
+        }
+    }
+    if (fields & DETAILS_FIELD_NAME) {
+        result = NVML_CALL(nvmlDeviceGetName, device, details->name, sizeof(details->name));
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device name by index %u!", index);
+            details->result = result;
+            return;
+        }
+    }
+    if (fields & DETAILS_FIELD_GSP_VERSION) {
+        result = NVML_CALL(nvmlDeviceGetGspFirmwareVersion, device, details->gsp_version);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get gsp version by index %u!", index);
+            details->result = result;
+            return;
+        }
+    }
+    if (fields & DETAILS_FIELD_GSP_MODE) {
+        result = NVML_CALL(nvmlDeviceGetGspFirmwareMode, device, &details->gsp_mode, &details->default_mode);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get gsp mode by index %u!", index);
+            details->result = result;
+            return;
         }
-        if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting gsp version by index %d!", i);
+    }
+}
 
-        unsigned int gsp_mode;
-        unsigned int default_mode;
-        gl_nvml_result = nvmlDeviceGetGspFirmwareMode(device, &gsp_mode, &default_mode);
-        if (ERROR(gl_nvml_result)) {
-            LOG_ERROR("Couldn't get gsp mode by index %d!", i);
+/**
+ * On the device's context, so a device that doesn't answer costs the deadline once and is skipped while degraded.
+ */
+void query_device_details(const unsigned int index, const unsigned int fields, deviceDetails_st *details /*out*/) {
+    memset(details, 0, sizeof(*details));
+    detailsTask_st task = {.index = index, .fields = fields};
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, index, &task.device);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get device by index %u!", index);
+        details->result = result;
+        return;
+    }
+    result = watchdog_device_call(task.device, query_device_details_task, &task, sizeof(task));
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Device by index %u is degraded or didn't answer in time, skipped", index);
+        details->result = result;
+        return;
+    }
+    *details = task.details;
+}
+
+void *details_worker(void *arg) {
+    detailsWork_st *work = arg;
+    trace_request_set(work->request_id);
+    for (;;) {
+        const unsigned int index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+        if (index >= work->device_count) return NULL;
+        query_device_details(index, work->fields, &work->details[index]);
+    }
+}
+
+void collect_device_details(deviceDetails_st *details /*out*/, const unsigned int device_count, const unsigned int fields,
+                            const unsigned int max_workers) {
+    detailsWork_st work = {.details = details, .device_count = device_count, .fields = fields, .next = 0,
+                           .request_id = trace_current_request()};
+    unsigned int worker_count = (device_count + DETAILS_DEVICES_PER_WORKER - 1) / DETAILS_DEVICES_PER_WORKER;
+    if (worker_count > max_workers) worker_count = max_workers;
+
+    // the calling thread is a worker too; it only has to wait for the others once it runs out of devices
+    pthread_t workers[DETAILS_MAX_WORKERS];
+    unsigned int started = 0;
+    while (started + 1 < worker_count && started < DETAILS_MAX_WORKERS) {
+        if (pthread_create(&workers[started], NULL, details_worker, &work) != 0) break;
+        ++started;
+    }
+    details_worker(&work);
+    for (unsigned int i = 0; i < started; ++i) pthread_join(workers[i], NULL);
+}
+
+void write_device_details(FILE *stream, const deviceDetails_st *details, const unsigned int fields, const bool first) {
+    fputs(first ? "{" : ",{", stream);
+    const char *separator = "";
+    if (fields & DETAILS_FIELD_UUID) {
+        fprintf(stream, "%s\"uuid\":\"%s\"", separator, details->uuid);
+        separator = ",";
+    }
+    if (fields & DETAILS_FIELD_NAME) {
+        fprintf(stream, "%s\"name\":\"%s\"", separator, details->name);
+        separator = ",";
+    }
+    if (fields & DETAILS_FIELD_GSP_VERSION) {
+        fprintf(stream, "%s\"gsp_version\":\"%s\"", separator, details->gsp_version);
+        separator = ",";
+    }
+    if (fields & DETAILS_FIELD_GSP_MODE) {
+        fprintf(stream, "%s\"gsp_mode\":%u,\"gsp_default-mode\":%u", separator, details->gsp_mode, details->default_mode);
+    }
+    fputc('}', stream);
+}
+
+void nvmlDeviceGetDetailsAll_handler(const int client_fd, const json_object *jobj) {
+    // optional; every field
+    unsigned int fields = DETAILS_FIELDS_ALL;
+    json_object *fields_field = json_object_object_get(jobj, "fields");
+    if (fields_field != NULL) {
+        if (!json_object_is_type(fields_field, json_type_array) || json_object_array_length(fields_field) == 0) {
+            LOG_ERROR("Invalid JSON schema: 'fields' field is not a non-empty array");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'fields' field is not a non-empty array");
+            return;
+        }
+        fields = 0;
+        for (size_t i = 0; i < json_object_array_length(fields_field); ++i) {
+            const char *field = json_object_get_string(json_object_array_get_idx(fields_field, i));
+            if (field != NULL && strcmp(field, "uuid") == 0) fields |= DETAILS_FIELD_UUID;
+            else if (field != NULL && strcmp(field, "name") == 0) fields |= DETAILS_FIELD_NAME;
+            else if (field != NULL && strcmp(field, "gsp_version") == 0) fields |= DETAILS_FIELD_GSP_VERSION;
+            else if (field != NULL && strcmp(field, "gsp_mode") == 0) fields |= DETAILS_FIELD_GSP_MODE;
+            else {
+                LOG_ERROR("Invalid JSON schema: 'fields' field contains an unknown field");
+                RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'fields' field must only contain uuid, name, gsp_version, gsp_mode");
+                return;
+            }
+        }
+    }
+
+    unsigned int device_count;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (ERROR(gl_nvml_result)) {
+        LOG_ERROR("Couldn't get count of devices!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't get count of devices");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Catastrophic failure when grabbing device count! Is NVML instance up?");
+
+    deviceDetails_st *details = arena_calloc(arena_request(), device_count > 0 ? device_count : 1, sizeof(deviceDetails_st));
+    FILE *stream = details != NULL ? arena_stream_open() : NULL;
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't allocate device list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate device list");
+        return;
+    }
+    collect_device_details(details, device_count, fields, DETAILS_MAX_WORKERS);
+
+    fprintf(stream, "{\"count\": %u, \"devices\": [", device_count);
+    int failure_count = 0;
+    unsigned int written = 0;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (details[i].result != NVML_SUCCESS) {
+            gl_nvml_result = details[i].result;
+            if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting details by index %u!", i);
             ++failure_count;
             continue;
         }
-        if (FATAL(gl_nvml_result)) WTF("Catastrophic failure while getting gsp mode by index %d!", i);
-
-        char device_buff[512];
-        sprintf(
-            device_buff,
-            "%s{"
-                "\"uuid\":" "\"%s\","
-                "\"name\":" "\"%s\","
-                "\"gsp_version\":" "\"%s\","
-                "\"gsp_mode\":" "%d,"
-                "\"gsp_default-mode\":" "%d"
-            "}",
-            i > 0 ? "," : "",
-            uuid,
-            name,
-            gsp_version,
-            gsp_mode,
-            default_mode);
-
-        strcat(buffer, device_buff);
-    }
-
-    // nvmlDeviceGetCount_v2
-    // nvmlDeviceGetHandleByIndex_v2
-    // nvmlDeviceGetUUID
-    // nvmlDeviceGetGspFirmwareVersion
-    // nvmlDeviceGetGspFirmwareMode
-    const size_t len = strlen(buffer);  // close the array
-    buffer[len] = ']';
-    buffer[len + 1] = '}';
+        write_device_details(stream, &details[i], fields, written++ == 0);
+    }
+    fputs("]}", stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate device list!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate device list");
+        return;
+    }
 
     const int status = failure_count > 0 ? NVML_ERROR_UNKNOWN : NVML_SUCCESS;
     const char* desc = failure_count > 0 ? "Failed to get details for some GPUs." : "Successfully successfully generated device list.";
     RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(status), desc);
-    free(buffer);
+}
+
+// ----------------------------- ENVYD -----------------------------
+
+void traceDump_handler(const int client_fd, const json_object *jobj) {
+    if (!trace_enabled) {
+        LOG_ERROR("Tracing is disabled; start envyd with ENVYD_TRACE=1");
+        RESPOND(client_fd, NULL, TRACING_DISABLED, "Tracing is disabled; start envyd with ENVYD_TRACE=1");
+        return;
+    }
+
+    // optional; defaults to keeping the buffers intact
+    bool clear = false;
+    json_object *clear_field = json_object_object_get(jobj, "clear");
+    if (clear_field != NULL) clear = json_object_get_boolean(clear_field);
+
+    char *trace = trace_dump(clear);
+    if (trace == NULL) {
+        LOG_ERROR("Couldn't serialize trace buffers!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't serialize trace buffers");
+        return;
+    }
+
+    RESPOND(client_fd, trace, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully dumped trace buffers.");
+    free(trace);
+}
+
+void metrics_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    metricsSnapshot_st *snapshot = metrics_acquire();
+    if (snapshot == NULL) {
+        LOG_ERROR("No metrics snapshot rendered yet");
+        RESPOND(client_fd, NULL, METRICS_UNAVAILABLE, "No metrics sampled yet; is telemetry running?");
+        return;
+    }
+
+    RESPOND(client_fd, snapshot->json, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully rendered metrics.");
+    metrics_release(snapshot);
+}
+
+void storeQuery_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *metric_field = json_object_object_get(jobj, "metric");
+    if (metric_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *metric_s = json_object_get_string(metric_field);
+    if (metric_s == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field does have a valid value");
+        return;
+    }
+
+    const storeMetric_t metric = store_metric_from_string(metric_s);
+    if (metric == STORE_METRIC_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field did not evaluate to any stored metric (value %s)", metric_s);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field did not evaluate to any stored metric (power, powerLimit, temperature, graphicsClock, smClock, memoryClock, fanSpeed, memoryUsed)");
+        return;
+    }
+
+    // optional; the last hour, at the finest resolution that covers it
+    const int64_t now = time(NULL);
+    int64_t to = now;
+    int64_t from = now - 60 * 60;
+    storeTier_t tier = STORE_TIER_COUNT;
+    json_object *to_field = json_object_object_get(jobj, "to");
+    if (to_field != NULL) to = json_object_get_int64(to_field);
+    json_object *from_field = json_object_object_get(jobj, "from");
+    if (from_field != NULL) from = json_object_get_int64(from_field);
+    json_object *tier_field = json_object_object_get(jobj, "tier");
+    if (tier_field != NULL) {
+        const char *tier_s = json_object_get_string(tier_field);
+        tier = tier_s != NULL ? store_tier_from_string(tier_s) : STORE_TIER_COUNT;
+        if (tier == STORE_TIER_COUNT) {
+            LOG_ERROR("Invalid JSON schema: 'tier' field must be one of raw, minute, hour");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'tier' field must be one of raw, minute, hour");
+            return;
+        }
+    }
+
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't allocate query buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate query buffer");
+        return;
+    }
+    const int found = store_query(uuid, metric, from, to, tier, stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (found != 0) {
+        LOG_ERROR("No stored telemetry for uuid %s", uuid);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_NOT_FOUND), "No stored telemetry for uuid; is the store enabled?");
+        return;
+    }
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate query buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate query buffer");
+        return;
+    }
+
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully queried telemetry store.");
+}
+
+void seriesQuery_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *metric_field = json_object_object_get(jobj, "metric");
+    if (metric_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *metric = json_object_get_string(metric_field);
+    if (metric == NULL || store_metric_from_string(metric) == STORE_METRIC_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field did not evaluate to any sampled metric");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field did not evaluate to any sampled metric (power, powerLimit, temperature, graphicsClock, smClock, memoryClock, fanSpeed, memoryUsed)");
+        return;
+    }
+
+    // optional; the last 5 minutes, every sample
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const int64_t now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    int64_t to = now;
+    int64_t from = now - 5 * 60 * 1000;
+    int64_t step = 0;
+    json_object *to_field = json_object_object_get(jobj, "to");
+    if (to_field != NULL) to = json_object_get_int64(to_field);
+    json_object *from_field = json_object_object_get(jobj, "from");
+    if (from_field != NULL) from = json_object_get_int64(from_field);
+    json_object *step_field = json_object_object_get(jobj, "step");
+    if (step_field != NULL) step = json_object_get_int64(step_field);
+
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't allocate query buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate query buffer");
+        return;
+    }
+    const int found = series_query(uuid, metric, from, to, step, stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (found != 0) {
+        LOG_ERROR("No series for uuid %s", uuid);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_NOT_FOUND), "No series for uuid; are series enabled?");
+        return;
+    }
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate query buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate query buffer");
+        return;
+    }
+
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully queried series.");
+}
+
+void seriesStats_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't allocate stats buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate stats buffer");
+        return;
+    }
+    series_stats(stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate stats buffer!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate stats buffer");
+        return;
+    }
+
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully gathered series stats.");
+}
+
+void subscribeEvents_handler(const int client_fd, const json_object *jobj) {
+    // optional; every device
+    const char *uuid = NULL;
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field != NULL) {
+        uuid = json_object_get_string(uuid_field);
+        if (uuid == NULL) {
+            LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+            return;
+        }
+    }
+
+    // optional; every event type
+    unsigned long long types = nvmlEventTypeNone;
+    json_object *types_field = json_object_object_get(jobj, "types");
+    if (types_field != NULL) {
+        if (!json_object_is_type(types_field, json_type_array)) {
+            LOG_ERROR("Invalid JSON schema: 'types' field is not an array");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'types' field is not an array");
+            return;
+        }
+        for (size_t i = 0; i < json_object_array_length(types_field); ++i) {
+            const char *type_s = json_object_get_string(json_object_array_get_idx(types_field, i));
+            const unsigned long long type = type_s != NULL ? events_type_from_string(type_s) : nvmlEventTypeNone;
+            if (type == nvmlEventTypeNone) {
+                LOG_ERROR("Invalid JSON schema: 'types' field contains an unknown event type");
+                RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'types' field must only contain clock, pstate, xid, singleBitEcc, doubleBitEcc, powerSource");
+                return;
+            }
+            types |= type;
+        }
+    }
+
+    if (!events_can_subscribe()) {
+        LOG_ERROR("NVML events are disabled or there are too many subscribers");
+        RESPOND(client_fd, NULL, EVENTS_UNAVAILABLE, "NVML events are disabled (ENVYD_EVENTS=0, or no device supports them) or there are too many subscribers");
+        return;
+    }
+
+    // the caller closes client_fd once we return; the waiter thread keeps (and eventually closes) a duplicate
+    const int subscriber_fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 0);
+    if (subscriber_fd < 0) {
+        LOG_ERROR("Couldn't duplicate client fd %d (%s)", client_fd, strerror(errno));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_UNKNOWN), "Couldn't keep the connection open");
+        return;
+    }
+
+    // acknowledged before subscribing so that it's always the first line on the stream
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Subscribed to NVML events; one JSON object per line follows.");
+    if (write(client_fd, "\n", 1) < 0) LOG_ERROR("Couldn't write to fd %d", client_fd);
+    if (!events_subscribe(subscriber_fd, uuid, types)) close(subscriber_fd);
+}
+
+void waitFor_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *metric_field = json_object_object_get(jobj, "metric");
+    if (metric_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *metric_s = json_object_get_string(metric_field);
+    const storeMetric_t metric = metric_s != NULL ? store_metric_from_string(metric_s) : STORE_METRIC_COUNT;
+    if (metric == STORE_METRIC_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'metric' field did not evaluate to any sampled metric (value %s)", STRINGIFY_NULLABLE(metric_s));
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'metric' field did not evaluate to any sampled metric (power, powerLimit, temperature, graphicsClock, smClock, memoryClock, fanSpeed, memoryUsed)");
+        return;
+    }
+
+    json_object *comparison_field = json_object_object_get(jobj, "comparison");
+    if (comparison_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'comparison' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'comparison' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *comparison_s = json_object_get_string(comparison_field);
+    const waitComparison_t comparison = comparison_s != NULL ? waits_comparison_from_string(comparison_s) : WAIT_COMPARISON_COUNT;
+    if (comparison == WAIT_COMPARISON_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'comparison' field did not evaluate to any comparison (value %s)", STRINGIFY_NULLABLE(comparison_s));
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'comparison' field must be one of <, <=, >, >=, ==, !=");
+        return;
+    }
+
+    json_object *threshold_field = json_object_object_get(jobj, "threshold");
+    if (threshold_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'threshold' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'threshold' field does not exist in $ (root) jobj");
+        return;
+    }
+    if (!json_object_is_type(threshold_field, json_type_int)) {
+        LOG_ERROR("Invalid JSON schema: 'threshold' field is not an integer");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'threshold' field is not an integer");
+        return;
+    }
+    const long long threshold = json_object_get_int64(threshold_field);
+
+    // optional
+    long long interval_ms = WAITS_DEFAULT_INTERVAL_MS;
+    json_object *interval_field = json_object_object_get(jobj, "intervalMs");
+    if (interval_field != NULL) interval_ms = json_object_get_int64(interval_field);
+    if (interval_ms < WAITS_MIN_INTERVAL_MS) {
+        LOG_ERROR("Invalid JSON schema: 'intervalMs' field is below %d", WAITS_MIN_INTERVAL_MS);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'intervalMs' field must be at least 10");
+        return;
+    }
+
+    // optional
+    long long timeout_ms = WAITS_DEFAULT_TIMEOUT_MS;
+    json_object *timeout_field = json_object_object_get(jobj, "timeoutMs");
+    if (timeout_field != NULL) timeout_ms = json_object_get_int64(timeout_field);
+    if (timeout_ms < 0 || timeout_ms > WAITS_MAX_TIMEOUT_MS) {
+        LOG_ERROR("Invalid JSON schema: 'timeoutMs' field is out of range (value %lld)", timeout_ms);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'timeoutMs' field must be between 0 and a day");
+        return;
+    }
+    if (interval_ms > timeout_ms && timeout_ms > 0) interval_ms = timeout_ms;
+
+    nvmlDevice_t device;
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (ERROR(gl_nvml_result) || gl_nvml_result == NVML_ERROR_NOT_FOUND) {
+        LOG_ERROR("Couldn't resolve UUID to any device!");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID");
+        return;
+    }
+    if (FATAL(gl_nvml_result)) WTF("Couldn't get device handle w/ uuid %s", uuid);
+
+    if (!waits_can_add()) {
+        LOG_ERROR("Too many pending waits");
+        RESPOND(client_fd, NULL, WAITS_UNAVAILABLE, "Too many pending waits, or the wait thread isn't running");
+        return;
+    }
+
+    // the caller closes client_fd once we return; the wait thread answers on (and closes) a duplicate
+    const int wait_fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 0);
+    if (wait_fd < 0) {
+        LOG_ERROR("Couldn't duplicate client fd %d (%s)", client_fd, strerror(errno));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_UNKNOWN), "Couldn't keep the connection open");
+        return;
+    }
+    if (!waits_add(wait_fd, device, metric, comparison, threshold, (unsigned int) interval_ms, (unsigned int) timeout_ms)) {
+        close(wait_fd);
+        RESPOND(client_fd, NULL, WAITS_UNAVAILABLE, "Too many pending waits, or the wait thread isn't running");
+    }
+}
+
+void fanCurveSet_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    json_object *points_field = json_object_object_get(jobj, "points");
+    if (points_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'points' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'points' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const size_t point_count = json_object_is_type(points_field, json_type_array) ? json_object_array_length(points_field) : 0;
+    if (point_count == 0 || point_count > FANCTL_MAX_POINTS) {
+        LOG_ERROR("Invalid JSON schema: 'points' field is not an array of 1 to %d points", FANCTL_MAX_POINTS);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'points' field must be an array of 1 to 8 [temperature, speed] pairs");
+        return;
+    }
+
+    fanctlCurve_st curve = {0};
+    curve.point_count = (unsigned int) point_count;
+    for (size_t i = 0; i < point_count; ++i) {
+        json_object *point = json_object_array_get_idx(points_field, i);
+        json_object *temperature = json_object_is_type(point, json_type_array) && json_object_array_length(point) == 2
+                                       ? json_object_array_get_idx(point, 0) : NULL;
+        json_object *speed = temperature != NULL ? json_object_array_get_idx(point, 1) : NULL;
+        if (temperature == NULL || speed == NULL
+            || !json_object_is_type(temperature, json_type_int) || !json_object_is_type(speed, json_type_int)) {
+            LOG_ERROR("Invalid JSON schema: 'points' field has a malformed point at %zu", i);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'points' field must only contain [temperature, speed] integer pairs");
+            return;
+        }
+        const int64_t temperature_c = json_object_get_int64(temperature);
+        const int64_t speed_percent = json_object_get_int64(speed);
+        if (temperature_c < 0 || temperature_c > 150 || speed_percent < 0 || speed_percent > 100
+            || (i > 0 && temperature_c <= curve.points[i - 1].temperature_c)) {
+            LOG_ERROR("Invalid JSON schema: 'points' field has an out of range or unordered point at %zu", i);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'points' field must have strictly ascending temperatures (0-150) and speeds of 0-100");
+            return;
+        }
+        curve.points[i].temperature_c = (unsigned int) temperature_c;
+        curve.points[i].speed_percent = (unsigned int) speed_percent;
+    }
+
+    // optional
+    int64_t hysteresis_c = FANCTL_DEFAULT_HYSTERESIS_C;
+    json_object *hysteresis_field = json_object_object_get(jobj, "hysteresis");
+    if (hysteresis_field != NULL) hysteresis_c = json_object_get_int64(hysteresis_field);
+    // optional
+    int64_t slew_rate = FANCTL_DEFAULT_SLEW_RATE;
+    json_object *slew_field = json_object_object_get(jobj, "slewRate");
+    if (slew_field != NULL) slew_rate = json_object_get_int64(slew_field);
+    if (hysteresis_c < 0 || hysteresis_c > 50 || slew_rate < 0 || slew_rate > 100) {
+        LOG_ERROR("Invalid JSON schema: 'hysteresis' or 'slewRate' field is out of range");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'hysteresis' must be 0-50 (C), 'slewRate' 0-100 (% per second, 0 for unlimited)");
+        return;
+    }
+    curve.hysteresis_c = (unsigned int) hysteresis_c;
+    curve.slew_rate = (unsigned int) slew_rate;
+
+    gl_nvml_result = fanctl_set_curve(uuid, &curve);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't set fan curve of %s (%s)", uuid, map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set fan curve; unknown UUID, no fans, or fan control isn't running");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Fan curve set.");
+}
+
+void fanCurveClear_handler(const int client_fd, const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    if (uuid_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does not exist in $ (root) jobj");
+        return;
+    }
+
+    const char *uuid = json_object_get_string(uuid_field);
+    if (uuid == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'uuid' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'uuid' field does have a valid value");
+        return;
+    }
+
+    gl_nvml_result = fanctl_clear_curve(uuid);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't clear fan curve of %s (%s)", uuid, map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't hand the fans back to the driver");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Fan curve cleared.");
+}
+
+void fanCurveStatus_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't open response stream");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    fanctl_status(stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate response");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Fan controller state.");
+}
+
+void powerBudgetSet_handler(const int client_fd, const json_object *jobj) {
+    json_object *budget_field = json_object_object_get(jobj, "budget");
+    if (budget_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'budget' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'budget' field does not exist in $ (root) jobj");
+        return;
+    }
+    if (!json_object_is_type(budget_field, json_type_int) || json_object_get_int64(budget_field) <= 0) {
+        LOG_ERROR("Invalid JSON schema: 'budget' field is not a positive integer");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'budget' field must be a positive integer (mW)");
+        return;
+    }
+
+    json_object *devices_field = json_object_object_get(jobj, "devices");
+    if (devices_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'devices' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'devices' field does not exist in $ (root) jobj");
+        return;
+    }
+    const size_t share_count = json_object_is_type(devices_field, json_type_array) ? json_object_array_length(devices_field) : 0;
+    if (share_count == 0 || share_count > POWERCTL_MAX_DEVICES) {
+        LOG_ERROR("Invalid JSON schema: 'devices' field is not an array of 1 to %d devices", POWERCTL_MAX_DEVICES);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'devices' field must be a non-empty array of {uuid, weight, minLimit, maxLimit}");
+        return;
+    }
+
+    // large; keep it off the stack
+    powerctlBudget_st *budget = arena_calloc(arena_request(), 1, sizeof(powerctlBudget_st));
+    if (budget == NULL) {
+        LOG_ERROR("Couldn't allocate budget");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate budget");
+        return;
+    }
+    budget->budget_mw = (unsigned long long) json_object_get_int64(budget_field);
+    budget->share_count = (unsigned int) share_count;
+    for (size_t i = 0; i < share_count; ++i) {
+        json_object *device = json_object_array_get_idx(devices_field, i);
+        json_object *uuid_field = json_object_is_type(device, json_type_object) ? json_object_object_get(device, "uuid") : NULL;
+        const char *uuid = uuid_field != NULL ? json_object_get_string(uuid_field) : NULL;
+        if (uuid == NULL) {
+            LOG_ERROR("Invalid JSON schema: 'devices' field has no uuid at %zu", i);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: every element of 'devices' needs a 'uuid'");
+            return;
+        }
+        powerctlShare_st *share = &budget->shares[i];
+        snprintf(share->uuid, sizeof(share->uuid), "%s", uuid);
+
+        // optional
+        share->weight = 1.0;
+        json_object *weight_field = json_object_object_get(device, "weight");
+        if (weight_field != NULL) share->weight = json_object_get_double(weight_field);
+        // optional
+        int64_t min_limit = 0;
+        json_object *min_field = json_object_object_get(device, "minLimit");
+        if (min_field != NULL) min_limit = json_object_get_int64(min_field);
+        // optional
+        int64_t max_limit = 0;
+        json_object *max_field = json_object_object_get(device, "maxLimit");
+        if (max_field != NULL) max_limit = json_object_get_int64(max_field);
+        if (!(share->weight > 0) || min_limit < 0 || max_limit < 0 || min_limit > UINT32_MAX || max_limit > UINT32_MAX) {
+            LOG_ERROR("Invalid JSON schema: 'devices' field has an out of range weight or limit at %zu", i);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'weight' must be positive, 'minLimit' and 'maxLimit' non-negative (mW)");
+            return;
+        }
+        share->min_limit_mw = (unsigned int) min_limit;
+        share->max_limit_mw = (unsigned int) max_limit;
+    }
+
+    // optional
+    budget->kp = POWERCTL_DEFAULT_KP;
+    json_object *kp_field = json_object_object_get(jobj, "kp");
+    if (kp_field != NULL) budget->kp = json_object_get_double(kp_field);
+    // optional
+    budget->ki = POWERCTL_DEFAULT_KI;
+    json_object *ki_field = json_object_object_get(jobj, "ki");
+    if (ki_field != NULL) budget->ki = json_object_get_double(ki_field);
+    if (budget->kp < 0 || budget->kp > 10 || budget->ki < 0 || budget->ki > 10) {
+        LOG_ERROR("Invalid JSON schema: 'kp' or 'ki' field is out of range");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'kp' and 'ki' must be between 0 and 10");
+        return;
+    }
+
+    const char *error = NULL;
+    gl_nvml_result = powerctl_set_budget(budget, &error);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't set power budget (%s): %s", map_nvmlReturn_t_to_string(gl_nvml_result), STRINGIFY_NULLABLE(error));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), error);
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Power budget set.");
+}
+
+void powerBudgetClear_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    gl_nvml_result = powerctl_clear_budget();
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't restore every power limit (%s)", map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't restore every power limit");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Power budget cleared.");
+}
+
+void powerBudgetStatus_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't open response stream");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    powerctl_status(stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate response");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Power budget controller state.");
+}
+
+/**
+ * Reads an optional [a, b] pair of clocks (MHz) into a, b
+ * @return false if the field is there but malformed
+ */
+static bool profile_clock_pair(const json_object *jobj, const char *field, const unsigned int flag, unsigned int *fields /*out*/,
+                               unsigned int *a /*out*/, unsigned int *b /*out*/) {
+    json_object *pair_field = json_object_object_get(jobj, field);
+    if (pair_field == NULL) return true;
+    if (!json_object_is_type(pair_field, json_type_array) || json_object_array_length(pair_field) != 2) return false;
+    json_object *first = json_object_array_get_idx(pair_field, 0);
+    json_object *second = json_object_array_get_idx(pair_field, 1);
+    if (!json_object_is_type(first, json_type_int) || !json_object_is_type(second, json_type_int)) return false;
+    const int64_t first_mhz = json_object_get_int64(first);
+    const int64_t second_mhz = json_object_get_int64(second);
+    if (first_mhz < 0 || second_mhz < 0 || first_mhz > UINT32_MAX || second_mhz > UINT32_MAX) return false;
+    *a = (unsigned int) first_mhz;
+    *b = (unsigned int) second_mhz;
+    *fields |= flag;
+    return true;
+}
+
+void profileSet_handler(const int client_fd, const json_object *jobj) {
+    json_object *name_field = json_object_object_get(jobj, "name");
+    if (name_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'name' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'name' field does not exist in $ (root) jobj");
+        return;
+    }
+    const char *name = json_object_get_string(name_field);
+    if (name == NULL || name[0] == 0 || strlen(name) >= PROFILES_NAME_SIZE || strpbrk(name, "\"\\") != NULL) {
+        LOG_ERROR("Invalid JSON schema: 'name' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'name' field must be a non-empty string shorter than 64 characters without quotes or backslashes");
+        return;
+    }
+
+    profile_st profile = {0};
+    snprintf(profile.name, sizeof(profile.name), "%s", name);
+
+    // optional
+    json_object *power_field = json_object_object_get(jobj, "powerLimit");
+    if (power_field != NULL) {
+        if (!json_object_is_type(power_field, json_type_int) || json_object_get_int64(power_field) <= 0
+            || json_object_get_int64(power_field) > UINT32_MAX) {
+            LOG_ERROR("Invalid JSON schema: 'powerLimit' field is not a positive integer");
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'powerLimit' field must be a positive integer (mW)");
+            return;
+        }
+        profile.power_limit_mw = (unsigned int) json_object_get_int64(power_field);
+        profile.fields |= PROFILE_HAS_POWER_LIMIT;
+    }
+    // optional
+    if (!profile_clock_pair(jobj, "gpuLockedClocks", PROFILE_HAS_GPU_LOCKED_CLOCKS, &profile.fields,
+                            &profile.gpu_locked_min_mhz, &profile.gpu_locked_max_mhz)
+        // optional
+        || !profile_clock_pair(jobj, "memoryLockedClocks", PROFILE_HAS_MEMORY_LOCKED_CLOCKS, &profile.fields,
+                               &profile.memory_locked_min_mhz, &profile.memory_locked_max_mhz)
+        // optional
+        || !profile_clock_pair(jobj, "applicationsClocks", PROFILE_HAS_APPLICATIONS_CLOCKS, &profile.fields,
+                               &profile.applications_memory_mhz, &profile.applications_graphics_mhz)) {
+        LOG_ERROR("Invalid JSON schema: a clocks field is not a pair of non-negative integers");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'gpuLockedClocks', 'memoryLockedClocks' and 'applicationsClocks' must be [integer, integer] (MHz)");
+        return;
+    }
+
+    gl_nvml_result = profiles_set(&profile);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't set profile '%s' (%s)", name, map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set profile; too many profiles, or profiles aren't running");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Profile set.");
+}
+
+void profileDelete_handler(const int client_fd, const json_object *jobj) {
+    json_object *name_field = json_object_object_get(jobj, "name");
+    if (name_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'name' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'name' field does not exist in $ (root) jobj");
+        return;
+    }
+    const char *name = json_object_get_string(name_field);
+    if (name == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'name' field does have a valid value");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'name' field does have a valid value");
+        return;
+    }
+
+    gl_nvml_result = profiles_delete(name);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't delete profile '%s' (%s)", name, map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't delete profile; unknown, or still used by a rule");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Profile deleted.");
+}
+
+void profileRulesSet_handler(const int client_fd, const json_object *jobj) {
+    json_object *rules_field = json_object_object_get(jobj, "rules");
+    if (rules_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'rules' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'rules' field does not exist in $ (root) jobj");
+        return;
+    }
+    if (!json_object_is_type(rules_field, json_type_array) || json_object_array_length(rules_field) > PROFILES_MAX_RULES) {
+        LOG_ERROR("Invalid JSON schema: 'rules' field is not an array of at most %d rules", PROFILES_MAX_RULES);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'rules' field must be an array of at most 32 {process|cgroup, profile}");
+        return;
+    }
+    const size_t rule_count = json_object_array_length(rules_field);
+
+    profileRule_st *rules = arena_calloc(arena_request(), rule_count > 0 ? rule_count : 1, sizeof(profileRule_st));
+    if (rules == NULL) {
+        LOG_ERROR("Couldn't allocate rules");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate rules");
+        return;
+    }
+    for (size_t i = 0; i < rule_count; ++i) {
+        json_object *rule = json_object_array_get_idx(rules_field, i);
+        const bool is_object = json_object_is_type(rule, json_type_object);
+        json_object *process_field = is_object ? json_object_object_get(rule, "process") : NULL;
+        json_object *cgroup_field = is_object ? json_object_object_get(rule, "cgroup") : NULL;
+        json_object *profile_field = is_object ? json_object_object_get(rule, "profile") : NULL;
+        const char *pattern = json_object_get_string(process_field != NULL ? process_field : cgroup_field);
+        const char *profile = profile_field != NULL ? json_object_get_string(profile_field) : NULL;
+        if ((process_field == NULL) == (cgroup_field == NULL) || pattern == NULL || pattern[0] == 0 || profile == NULL
+            || strlen(pattern) >= PROFILES_PATTERN_SIZE || strlen(profile) >= PROFILES_NAME_SIZE || strpbrk(pattern, "\"\\") != NULL) {
+            LOG_ERROR("Invalid JSON schema: 'rules' field has a malformed rule at %zu", i);
+            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: every rule needs exactly one of 'process' or 'cgroup' (no quotes or backslashes) and a 'profile'");
+            return;
+        }
+        rules[i].match = process_field != NULL ? PROFILE_MATCH_PROCESS : PROFILE_MATCH_CGROUP;
+        snprintf(rules[i].pattern, sizeof(rules[i].pattern), "%s", pattern);
+        snprintf(rules[i].profile, sizeof(rules[i].profile), "%s", profile);
+    }
+
+    gl_nvml_result = profiles_set_rules(rules, (unsigned int) rule_count);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't set profile rules (%s)", map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't set rules; a rule names an unknown profile, or profiles aren't running");
+        return;
+    }
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Profile rules set.");
+}
+
+void profilesStatus_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't open response stream");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    profiles_status(stream);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate response");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Profile switching state.");
+}
+
+/**
+ * Reads the integer field name of obj into out
+ * @return false if it's missing, not an integer or outside [min, max]
+ */
+static bool apply_int_field(const json_object *obj, const char *name, const int64_t min, const int64_t max, int64_t *out /*out*/) {
+    json_object *field = json_object_object_get(obj, name);
+    if (field == NULL || !json_object_is_type(field, json_type_int)) return false;
+    *out = json_object_get_int64(field);
+    return *out >= min && *out <= max;
+}
+
+/**
+ * Parses operation i into op; responds and returns false on a malformed one.
+ */
+static bool apply_parse_operation(const int client_fd, const json_object *operation, const size_t i, setterOperation_st *op /*out*/) {
+    json_object *op_field = json_object_is_type(operation, json_type_object) ? json_object_object_get(operation, "op") : NULL;
+    json_object *uuid_field = json_object_is_type(operation, json_type_object) ? json_object_object_get(operation, "uuid") : NULL;
+    const char *kind = op_field != NULL ? json_object_get_string(op_field) : NULL;
+    const char *uuid = uuid_field != NULL ? json_object_get_string(uuid_field) : NULL;
+    if (kind == NULL || uuid == NULL || (op->kind = setters_kind_from_string(kind)) == SETTER_KIND_COUNT) {
+        LOG_ERROR("Invalid JSON schema: 'operations' field has no valid op or uuid at %zu", i);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: every operation needs a 'uuid' and an 'op' of powerLimit, gpuLockedClocks, memoryLockedClocks, applicationsClocks, clockOffset, temperatureThreshold");
+        return false;
+    }
+    snprintf(op->uuid, sizeof(op->uuid), "%s", uuid);
+
+    int64_t a = 0, b = 0;
+    bool valid = true;
+    switch (op->kind) {
+        case SETTER_POWER_LIMIT:
+            valid = apply_int_field(operation, "powerValueMw", 0, UINT32_MAX, &a);
+            break;
+        case SETTER_GPU_LOCKED_CLOCKS:
+        case SETTER_MEMORY_LOCKED_CLOCKS:
+            valid = apply_int_field(operation, "minClockMHz", 0, UINT32_MAX, &a) && apply_int_field(operation, "maxClockMHz", 0, UINT32_MAX, &b);
+            break;
+        case SETTER_APPLICATIONS_CLOCKS:
+            valid = apply_int_field(operation, "memClockMHz", 0, UINT32_MAX, &a) && apply_int_field(operation, "graphicsClockMHz", 0, UINT32_MAX, &b);
+            break;
+        case SETTER_CLOCK_OFFSET: {
+            json_object *clock_type_field = json_object_object_get(operation, "clockType");
+            json_object *pstate_field = json_object_object_get(operation, "pstate");
+            const char *clock_type = clock_type_field != NULL ? json_object_get_string(clock_type_field) : NULL;
+            const char *pstate = pstate_field != NULL ? json_object_get_string(pstate_field) : NULL;
+            valid = clock_type != NULL && pstate != NULL
+                    && (op->clock_type = map_nvmlClockType_t_to_enum(clock_type)) != NVML_CLOCK_COUNT
+                    && (op->pstate = map_nvmlPstates_t_to_enum(pstate)) != NVML_PSTATE_UNKNOWN
+                    && apply_int_field(operation, "clockOffsetMHz", INT32_MIN, INT32_MAX, &a);
+            break;
+        }
+        case SETTER_TEMPERATURE_THRESHOLD: {
+            json_object *threshold_field = json_object_object_get(operation, "thresholdType");
+            const char *threshold = threshold_field != NULL ? json_object_get_string(threshold_field) : NULL;
+            valid = threshold != NULL
+                    && (op->threshold = map_nvmlTemperatureThresholds_t_to_enum(threshold)) != NVML_TEMPERATURE_THRESHOLD_COUNT
+                    && apply_int_field(operation, "temp", 0, INT32_MAX, &a);
+            break;
+        }
+        default:
+            valid = false;
+            break;
+    }
+    if (!valid) {
+        LOG_ERROR("Invalid JSON schema: 'operations' field has a malformed %s at %zu", kind, i);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: an operation is missing or has out of range arguments for its op (see README)");
+        return false;
+    }
+    op->a = (unsigned int) a;
+    op->b = (unsigned int) b;
+    op->value = (int) a;
+
+    gl_nvml_result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &op->device);
+    if (gl_nvml_result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't resolve UUID %s of operation %zu (%s)", uuid, i, map_nvmlReturn_t_to_string(gl_nvml_result));
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(gl_nvml_result), "Couldn't resolve UUID; nothing applied");
+        return false;
+    }
+    return true;
+}
+
+void apply_handler(const int client_fd, const json_object *jobj) {
+    json_object *operations_field = json_object_object_get(jobj, "operations");
+    if (operations_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'operations' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'operations' field does not exist in $ (root) jobj");
+        return;
+    }
+    const size_t count = json_object_is_type(operations_field, json_type_array) ? json_object_array_length(operations_field) : 0;
+    if (count == 0 || count > SETTERS_MAX_OPERATIONS) {
+        LOG_ERROR("Invalid JSON schema: 'operations' field is not an array of 1 to %d operations", SETTERS_MAX_OPERATIONS);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'operations' field must be an array of 1 to 64 operations");
+        return;
+    }
+
+    setterOperation_st *operations = arena_calloc(arena_request(), count, sizeof(setterOperation_st));
+    if (operations == NULL) {
+        LOG_ERROR("Couldn't allocate operations");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate operations");
+        return;
+    }
+    // everything is validated before the first change
+    for (size_t i = 0; i < count; ++i) {
+        if (!apply_parse_operation(client_fd, json_object_array_get_idx(operations_field, i), i, &operations[i])) return;
+    }
+
+    for (size_t i = 0; i < count; ++i) coalesce_forget(operations[i].device);
+    gl_nvml_result = setters_apply(operations, (unsigned int) count);
+
+    FILE *stream = arena_stream_open();
+    if (stream == NULL) {
+        LOG_ERROR("Couldn't open response stream");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    setters_write_results(stream, operations, (unsigned int) count);
+    const char *buffer = arena_stream_close(stream, NULL);
+    if (buffer == NULL) {
+        LOG_ERROR("Couldn't allocate response");
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_MEMORY), "Couldn't allocate response");
+        return;
+    }
+    const char *description = gl_nvml_result == NVML_SUCCESS ? "Applied." : "An operation failed; everything before it was rolled back.";
+    RESPOND(client_fd, buffer, map_nvmlReturn_t_to_string(gl_nvml_result), description);
+}
+
+/**
+ * Reads the 'jobId' field; responds and returns false if it's missing or malformed.
+ */
+static bool job_id_field(const int client_fd, const json_object *jobj, unsigned long long *id /*out*/) {
+    json_object *id_field = json_object_object_get(jobj, "jobId");
+    if (id_field == NULL) {
+        LOG_ERROR("Invalid JSON schema: 'jobId' field does not exist in $ (root) jobj");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'jobId' field does not exist in $ (root) jobj");
+        return false;
+    }
+    if (!json_object_is_type(id_field, json_type_int) || json_object_get_int64(id_field) <= 0) {
+        LOG_ERROR("Invalid JSON schema: 'jobId' field is not a positive integer");
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'jobId' field must be a positive integer");
+        return false;
+    }
+    *id = (unsigned long long) json_object_get_int64(id_field);
+    return true;
+}
+
+void jobStatus_handler(const int client_fd, const json_object *jobj) {
+    unsigned long long id;
+    if (!job_id_field(client_fd, jobj, &id)) return;
+    jobs_status(client_fd, id);
+}
+
+void jobWait_handler(const int client_fd, const json_object *jobj) {
+    unsigned long long id;
+    if (!job_id_field(client_fd, jobj, &id)) return;
+
+    // optional
+    long long timeout_ms = JOBS_DEFAULT_WAIT_TIMEOUT_MS;
+    json_object *timeout_field = json_object_object_get(jobj, "timeoutMs");
+    if (timeout_field != NULL) timeout_ms = json_object_get_int64(timeout_field);
+    if (timeout_ms < 0 || timeout_ms > JOBS_MAX_WAIT_TIMEOUT_MS) {
+        LOG_ERROR("Invalid JSON schema: 'timeoutMs' field is out of range (value %lld)", timeout_ms);
+        RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'timeoutMs' field must be between 0 and a day");
+        return;
+    }
+    jobs_wait(client_fd, id, (unsigned int) timeout_ms);
+}
+
+void restart_handler(const int client_fd, const json_object *jobj) {
+    (void) jobj;
+    // the accept loop picks it up once this request is answered
+    handoff_request();
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Restarting; this process serves until the new one is warm, which takes over fan curves, the power budget and profiles");
 }
 
 // ----------------------------- NETWORK STUFF -----------------------------
 
 /**
- * S-afe SO-cket read
+ * S-afe SO-cket read; returns as soon as anything arrived
  * @param socket_fd client_fd
  * @param buffer output
  * @param size   size of buffer
- * @return
+ * @return bytes read, 0 once the peer half-closed, -1 on errors (incl. the receive timeout)
  */
 ssize_t sso_read(const int socket_fd, char *buffer /*out*/, const size_t size) {
     assert(buffer != NULL); // sanity
-    ssize_t total_bytes = 0;
 
     LOG_TRACE("Will read from fd (%d) into buffer of size %llu", socket_fd, size);
-    while (total_bytes < size) {
-        const ssize_t bytes_received = read(socket_fd, buffer + total_bytes, size - total_bytes);
-
-        if (bytes_received == 0) {
-            LOG_TRACE("No more data to receive (received <= 0 len bytes), read total bytes %llu...", total_bytes);
-            break;
-        }
+    while (true) {
+        const ssize_t bytes_received = read(socket_fd, buffer, size);
+        if (bytes_received == -1 && errno == EINTR) continue;
 
-        if (bytes_received == -1) {
-            LOG_ERROR("Error reading from socket; memsetting buffer to 0 (deleting data), and returning early w/ -1!");
-            memset(buffer, 0, size);
-            total_bytes = -1;
-            break;
-        }
-
-        total_bytes += bytes_received;
+        if (bytes_received == 0) LOG_TRACE("No more data to receive (received <= 0 len bytes)...");
+        if (bytes_received == -1) LOG_ERROR("Error reading from socket; returning early w/ -1!");
+        return bytes_received;
     }
-
-    return total_bytes;
 }
@@ -2,6 +2,7 @@
 #define NETWORK_H
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -12,13 +13,26 @@
 #include <nvml.h>
 #include <json-c/json.h>
 #include "helpers.h"
+#include "trace.h"
+#include "probes.h"
+#include "arena.h"
+#include "auth.h"
 
-#define SO_INPUT_BUFFER_SIZE 8192
+#define SO_INPUT_BUFFER_SIZE 8192  // per read; requests are parsed incrementally
+#define REQUEST_DEFAULT_MAX_SIZE (1024 * 1024)  // ENVYD_MAX_REQUEST_SIZE overrides
 
 #define JSON_PARSING_FAILED "JSON_PARSING_FAILED"
 #define INVALID_JSON_SCHEMA "INVALID_JSON_SCHEMA"
 #define AUTHORIZATION_FAILED "AUTHORIZATION_FAILED"
 #define UNDEFINED_INVALID_ACTION "UNDEFINED_INVALID_ACTION"
+#define TRACING_DISABLED "TRACING_DISABLED"
+#define METRICS_UNAVAILABLE "METRICS_UNAVAILABLE"
+#define EVENTS_UNAVAILABLE "EVENTS_UNAVAILABLE"
+#define REQUEST_TOO_LARGE "REQUEST_TOO_LARGE"
+#define WAIT_TIMEOUT "WAIT_TIMEOUT"
+#define WAITS_UNAVAILABLE "WAITS_UNAVAILABLE"
+#define JOBS_UNAVAILABLE "JOBS_UNAVAILABLE"
+#define SHUTTING_DOWN "SHUTTING_DOWN"
 
 typedef struct networkError_st {
     char* status_line;
@@ -37,38 +51,34 @@ typedef struct networkResponse_st {
     size_t status_len = status != NULL ? strlen(status) : 4; \
     size_t desc_len = desc != NULL ? strlen(desc) : 4; \
     size_t len = datum_len + status_len + desc_len + 96; \
-    char* send_buffer = calloc(sizeof(char), len); \
+    const unsigned long long serialize_start = trace_begin(); \
+    /* lives until the request arena is reset, after the response is written */ \
+    char* send_buffer = arena_alloc(arena_request(), len); \
+    if (send_buffer == NULL) { \
+        LOG_ERROR("Couldn't allocate response for fd %d", client_fd); \
+        break; \
+    } \
     unsigned long long bytes_to_send = snprintf(send_buffer, len - 1, "{ \"data\": %s, \"status\": %s%s%s, \"description\": %s%s%s}", \
         STRINGIFY_NULLABLE(datum), \
         status == NULL ? "" : "\"", STRINGIFY_NULLABLE(status), status == NULL ? "" : "\"", \
         desc == NULL   ? "" : "\"", STRINGIFY_NULLABLE(desc), desc == NULL     ? "" : "\""  \
     ); \
+    if (trace_enabled) trace_end("serialize", "io", serialize_start); \
+    const unsigned long long write_start = trace_begin(); \
     ssize_t written = write(client_fd, send_buffer, bytes_to_send); \
+    if (trace_enabled) trace_end("write", "io", write_start); \
+    PROBE_RESPONSE_WRITTEN(client_fd, written); \
     LOG_INFO("Writing to client_fd %d: %s", client_fd, send_buffer); \
     if (written < 0) LOG_ERROR("Couldn't write to fd %d", client_fd); \
-    free(send_buffer); \
     } while (0)
 
 #ifdef INSECURE
 #define CHECK_AUTHORIZATION(api, jobj) do {} while(0)  // no-op
 #else
 #define CHECK_AUTHORIZATION(api, jobj) do { \
-        json_object *bearer_field = json_object_object_get(jobj, "bearer"); \
-        if (bearer_field == NULL) { \
-            PRINTLN_SO("Invalid JSON schema: 'bearer' field does not exist in $ (root) jobj"); \
-            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'bearer' field does not exist in $ (root) jobj"); \
-            return; \
-        } \
-        \
-        const char *bearer = json_object_get_string(bearer_field); \
-        if (bearer == NULL) { \
-            PRINTLN_SO("Invalid JSON schema: 'bearer' field does have a valid value"); \
-            RESPOND(client_fd, NULL, INVALID_JSON_SCHEMA, "Invalid JSON schema: 'bearer' field does have a valid value"); \
-            return; \
-        } \
-        if (is_authorized(bearer)) break; \
-        PRINTLN_SO(AUTHORIZATION_FAILED, api); \
-        RESPOND(client_fd, NULL, AUTHORIZATION_FAILED, AUTHORIZATION_FAILED); \
+        if (auth_check(client_fd, jobj, api)) break; \
+        RESPOND(client_fd, NULL, AUTHORIZATION_FAILED, "Not authorized, retry once the prompt (if any) was answered"); \
+        return; \
     } while (0)
 #endif
 
@@ -78,7 +88,50 @@ typedef struct networkRequest_st {
     char* arguments[];
 } networkRequest_st;
 
+/**
+ * Reads and parses one request chunk by chunk (at most ENVYD_MAX_REQUEST_SIZE bytes, the root JSON object ends it, so
+ *  the peer doesn't have to half-close) and answers it; everything it allocated from the request arena is released afterwards.
+ */
 void process(const int client_fd, const struct timeval* tv_timeout);
+void assign_task(const int client_fd, const char *action, const json_object *jobj);
+
+// field selection of nvmlDeviceGetDetailsAll; GSP_MODE covers both gsp_mode and gsp_default-mode
+#define DETAILS_FIELD_UUID (1u << 0)
+#define DETAILS_FIELD_NAME (1u << 1)
+#define DETAILS_FIELD_GSP_VERSION (1u << 2)
+#define DETAILS_FIELD_GSP_MODE (1u << 3)
+#define DETAILS_FIELDS_ALL (DETAILS_FIELD_UUID | DETAILS_FIELD_NAME | DETAILS_FIELD_GSP_VERSION | DETAILS_FIELD_GSP_MODE)
+#define DETAILS_MAX_WORKERS 16
+#define DETAILS_DEVICES_PER_WORKER 8  // below this, starting a thread costs more than it saves
+
+typedef struct deviceDetails_st {
+    nvmlReturn_t result;  // of the first call that failed, NVML_SUCCESS if every requested field was read
+    char uuid[NVML_DEVICE_UUID_V2_BUFFER_SIZE];
+    char name[NVML_DEVICE_NAME_V2_BUFFER_SIZE];
+    char gsp_version[NVML_GSP_FIRMWARE_VERSION_BUF_SIZE];
+    unsigned int gsp_mode;
+    unsigned int default_mode;
+} deviceDetails_st;
+
+/**
+ * Reads the requested fields of device_count devices into details (in index order), spreading them over up to
+ * max_workers threads. Leaves gl_nvml_result alone; check every details[i].result instead.
+ */
+void collect_device_details(deviceDetails_st *details /*out*/, const unsigned int device_count, const unsigned int fields,
+                            const unsigned int max_workers);
+
+/**
+ * Writes a single device entry of nvmlDeviceGetDetailsAll w/ only the requested fields, prefixed w/ a comma unless first.
+ */
+void write_device_details(FILE *stream, const deviceDetails_st *details, const unsigned int fields, const bool first);
+
+/**
+ * Serializes jobj w/o the secret in its 'bearer', which is replaced by "<redacted>" if placeholder, else left out; jobj
+ * is as it was afterward. For logs and queued jobs, whose requester was already authorized.
+ *
+ * @return owned by jobj, valid until it's serialized again or freed
+ */
+const char *request_without_bearer(json_object *jobj, bool placeholder);
 
 int bind_socket_with_address(const char *address);
 
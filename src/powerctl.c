@@ -0,0 +1,524 @@
+#include "powerctl.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct powerctlDevice_st {
+    nvmlDevice_t device;
+    char uuid[96];
+
+    bool controlled;
+    double weight;
+    unsigned int min_mw;  // share clamped to the constraints
+    unsigned int max_mw;
+    unsigned int original_limit_mw;  // restored once the device leaves the budget
+    // controller state
+    double integral_mw;  // PI integrator, starts at the limit the device had
+    double request_mw;  // PI output: what the device would use w/ POWERCTL_HEADROOM to spare
+    double allocation_mw;
+    unsigned int usage_mw;
+    unsigned int limit_mw;  // last one written
+    nvmlReturn_t last_error;
+} powerctlDevice_st;
+
+static powerctlDevice_st *devices = NULL;
+static unsigned int device_count = 0;
+static unsigned long long interval_ms = POWERCTL_DEFAULT_INTERVAL_MS;
+
+static bool active = false;
+static unsigned long long budget_mw = 0;
+static double kp = POWERCTL_DEFAULT_KP;
+static double ki = POWERCTL_DEFAULT_KI;
+
+// who owns each device's limit, for setters and profiles; owners[i] is devices[i], kept past powerctl_stop
+typedef struct powerctlOwner_st {
+    nvmlDevice_t device;
+    bool controlled;
+    unsigned int baseline_mw;  // from before a profile changed the limit, 0 for none
+} powerctlOwner_st;
+
+static powerctlOwner_st owners[POWERCTL_MAX_DEVICES];
+static unsigned int owner_count = 0;
+static pthread_mutex_t owners_lock = PTHREAD_MUTEX_INITIALIZER;  // taken last, never held across NVML calls
+
+static pthread_t controller_thread;
+static bool controller_running = false;
+static bool controller_stop = false;
+static pthread_mutex_t controller_lock = PTHREAD_MUTEX_INITIALIZER;  // guards everything above
+static pthread_cond_t controller_wake;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+typedef enum powerctlQuery_t {
+    POWERCTL_GET_CONSTRAINTS,
+    POWERCTL_GET_LIMIT,
+    POWERCTL_GET_DEFAULT_LIMIT,
+    POWERCTL_GET_USAGE,
+    POWERCTL_SET_LIMIT,
+} powerctlQuery_t;
+
+// one NVML call on a device's context; everything it needs is copied in, so one that misses the deadline touches
+//  nothing of ours (controller_lock stays held across it, no task takes that)
+typedef struct powerctlTask_st {
+    nvmlDevice_t device;
+    powerctlQuery_t query;
+    unsigned int a;  // constraints: min, else the limit or usage
+    unsigned int b;  // constraints: max
+    nvmlReturn_t result;
+} powerctlTask_st;
+
+static void run_query(void *arg) {
+    powerctlTask_st *task = arg;
+    switch (task->query) {
+        case POWERCTL_GET_CONSTRAINTS:
+            task->result = NVML_CALL(nvmlDeviceGetPowerManagementLimitConstraints, task->device, &task->a, &task->b);
+            break;
+        case POWERCTL_GET_LIMIT:
+            task->result = NVML_CALL(nvmlDeviceGetPowerManagementLimit, task->device, &task->a);
+            break;
+        case POWERCTL_GET_DEFAULT_LIMIT:
+            task->result = NVML_CALL(nvmlDeviceGetPowerManagementDefaultLimit, task->device, &task->a);
+            break;
+        case POWERCTL_GET_USAGE:
+            task->result = NVML_CALL(nvmlDeviceGetPowerUsage, task->device, &task->a);
+            break;
+        case POWERCTL_SET_LIMIT: {
+            nvmlPowerValue_v2_t power_value_s = {0};
+            power_value_s.version = nvmlPowerValue_v2;
+            power_value_s.powerScope = NVML_POWER_SCOPE_GPU;
+            power_value_s.powerValueMw = task->a;
+            task->result = NVML_CALL(nvmlDeviceSetPowerManagementLimit_v2, task->device, &power_value_s);
+            break;
+        }
+    }
+}
+
+/**
+ * Runs query on the device's context, the budget spans devices and a wedged one mustn't stall it for the others.
+ *
+ * @return what NVML returned, NVML_ERROR_TIMEOUT if the device is degraded or didn't answer in time
+ */
+static nvmlReturn_t on_device(const nvmlDevice_t device, const powerctlQuery_t query, unsigned int *a, unsigned int *b) {
+    powerctlTask_st task = {.device = device, .query = query, .a = a != NULL ? *a : 0};
+    const nvmlReturn_t result = watchdog_device_call(device, run_query, &task, sizeof(task));
+    if (result != NVML_SUCCESS) return result;
+    if (a != NULL) *a = task.a;
+    if (b != NULL) *b = task.b;
+    return task.result;
+}
+
+static nvmlReturn_t set_limit(powerctlDevice_st *device, unsigned int limit_mw) {
+    const nvmlReturn_t result = on_device(device->device, POWERCTL_SET_LIMIT, &limit_mw, NULL);
+    if (result == NVML_SUCCESS) device->limit_mw = limit_mw;
+    else LOG_ERROR("Couldn't set power limit of %s to %u mW (%s)", device->uuid, limit_mw, map_nvmlReturn_t_to_string(result));
+    return result;
+}
+
+/**
+ * controller_lock must be held.
+ */
+static void set_controlled(powerctlDevice_st *device, const bool controlled) {
+    device->controlled = controlled;
+    pthread_mutex_lock(&owners_lock);
+    owners[device - devices].controlled = controlled;
+    pthread_mutex_unlock(&owners_lock);
+}
+
+/**
+ * controller_lock must be held.
+ */
+static nvmlReturn_t release(powerctlDevice_st *device) {
+    set_controlled(device, false);
+    return set_limit(device, device->original_limit_mw);
+}
+
+/**
+ * Hands out remaining in proportion to the weights of the devices that still want some (want[i] > 0), each capped at
+ * what it wants; whatever a capped device doesn't take goes to the others in the next round.
+ *
+ * @return what's left once every device got what it wants
+ */
+static double water_fill(double *want, double remaining) {
+    for (unsigned int round = 0; round < device_count && remaining > 0.5; ++round) {
+        double weights = 0;
+        for (unsigned int i = 0; i < device_count; ++i) {
+            if (devices[i].controlled && want[i] > 0) weights += devices[i].weight;
+        }
+        if (weights <= 0) break;
+
+        double handed_out = 0;
+        for (unsigned int i = 0; i < device_count; ++i) {
+            if (!devices[i].controlled || want[i] <= 0) continue;
+            double share = remaining * devices[i].weight / weights;
+            if (share > want[i]) share = want[i];
+            devices[i].allocation_mw += share;
+            want[i] -= share;
+            handed_out += share;
+        }
+        remaining -= handed_out;
+    }
+    return remaining;
+}
+
+/**
+ * Every device gets its minimum, then the rest of the budget follows the requests (by weight once they don't all fit),
+ * and whatever nobody requested is spread by weight up to the maxima, so an uncontended budget throttles nobody.
+ */
+static void allocate(void) {
+    double want[POWERCTL_MAX_DEVICES] = {0};
+    double remaining = (double) budget_mw;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (!devices[i].controlled) continue;
+        devices[i].allocation_mw = devices[i].min_mw;
+        remaining -= devices[i].min_mw;
+        want[i] = devices[i].request_mw - devices[i].min_mw;
+    }
+    remaining = water_fill(want, remaining);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (devices[i].controlled) want[i] = devices[i].max_mw - devices[i].allocation_mw;
+    }
+    water_fill(want, remaining);
+}
+
+/**
+ * One controller period; controller_lock must be held.
+ */
+static void step(void) {
+    const double dt = (double) interval_ms / 1000.0;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        powerctlDevice_st *device = &devices[i];
+        if (!device->controlled) continue;
+        unsigned int usage_mw = 0;
+        const nvmlReturn_t result = on_device(device->device, POWERCTL_GET_USAGE, &usage_mw, NULL);
+        if (result != NVML_SUCCESS) {
+            // keep requesting what it did before rather than guess
+            device->last_error = result;
+            continue;
+        }
+        device->usage_mw = usage_mw;
+
+        // PI tracking of demand; a device pinned at its limit draws (almost) all of it, so it asks for more each period
+        //  until it either gets what it uses or runs into what the budget allows it
+        const double error = usage_mw * (1.0 + POWERCTL_HEADROOM) - device->integral_mw;
+        device->integral_mw += ki * dt * error;
+        if (device->integral_mw < device->min_mw) device->integral_mw = device->min_mw;
+        if (device->integral_mw > device->max_mw) device->integral_mw = device->max_mw;
+        double request = device->integral_mw + kp * error;
+        if (request < device->min_mw) request = device->min_mw;
+        if (request > device->max_mw) request = device->max_mw;
+        device->request_mw = request;
+    }
+
+    allocate();
+
+    // small changes are skipped, unless the limits would then add up to more than the budget: the allocations never do,
+    //  and a skipped raise only leaves a limit below its allocation, so writing every decrease is always enough
+    unsigned long long planned_mw = 0;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        const powerctlDevice_st *device = &devices[i];
+        if (!device->controlled) continue;
+        const unsigned int limit_mw = (unsigned int) device->allocation_mw;
+        const unsigned int change = limit_mw > device->limit_mw ? limit_mw - device->limit_mw : device->limit_mw - limit_mw;
+        planned_mw += change < POWERCTL_MIN_CHANGE_MW ? device->limit_mw : limit_mw;
+    }
+    const bool all_decreases = planned_mw > budget_mw;
+
+    // lower limits first, so that the sum of limits never exceeds the budget in between; raise only once every decrease
+    //  went through, else the sum may exceed the budget until the next period
+    bool lowered = true;
+    for (int raising = 0; raising <= 1 && lowered; ++raising) {
+        for (unsigned int i = 0; i < device_count; ++i) {
+            powerctlDevice_st *device = &devices[i];
+            if (!device->controlled) continue;
+            const unsigned int limit_mw = (unsigned int) device->allocation_mw;
+            if (limit_mw == device->limit_mw || raising != (limit_mw > device->limit_mw)) continue;
+            const unsigned int change = limit_mw > device->limit_mw ? limit_mw - device->limit_mw : device->limit_mw - limit_mw;
+            if (change < POWERCTL_MIN_CHANGE_MW && (raising || !all_decreases)) continue;
+            device->last_error = set_limit(device, limit_mw);
+            if (!raising && device->last_error != NVML_SUCCESS) lowered = false;
+        }
+    }
+    if (!lowered) LOG_WARNING("Not raising any power limit this period, lowering one failed");
+}
+
+static void *controller(void *arg) {
+    (void) arg;
+    const unsigned long long interval_ns = interval_ms * 1000000ULL;
+    unsigned long long next = monotonic_ns();
+
+    pthread_mutex_lock(&controller_lock);
+    while (!controller_stop) {
+        if (active) step();
+
+        // fixed rate; if a period overran, skip ahead instead of bursting to catch up
+        const unsigned long long now = monotonic_ns();
+        next += interval_ns;
+        if (next < now) next = now + interval_ns;
+        const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+        while (!controller_stop && pthread_cond_timedwait(&controller_wake, &controller_lock, &deadline) != ETIMEDOUT) {}
+    }
+    pthread_mutex_unlock(&controller_lock);
+    return NULL;
+}
+
+void powerctl_start(void) {
+    const char *configured = getenv("ENVYD_POWERCTL_INTERVAL_MS");
+    if (configured != NULL && strtoull(configured, NULL, 10) > 0) interval_ms = strtoull(configured, NULL, 10);
+
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), power budget disabled", map_nvmlReturn_t_to_string(result));
+        device_count = 0;
+        return;
+    }
+    if (device_count > POWERCTL_MAX_DEVICES) {
+        LOG_WARNING("Only the first %d of %u devices can share a power budget", POWERCTL_MAX_DEVICES, device_count);
+        device_count = POWERCTL_MAX_DEVICES;
+    }
+    devices = calloc(device_count > 0 ? device_count : 1, sizeof(powerctlDevice_st));
+    if (devices == NULL) {
+        LOG_ERROR("Couldn't allocate device handles, power budget disabled");
+        device_count = 0;
+        return;
+    }
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &devices[i].device);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device by index %d (%s), it can't share the budget", i, map_nvmlReturn_t_to_string(result));
+            devices[i].device = NULL;
+            continue;
+        }
+        result = NVML_CALL(nvmlDeviceGetUUID, devices[i].device, devices[i].uuid, sizeof(devices[i].uuid));
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't get uuid by index %d (%s)", i, map_nvmlReturn_t_to_string(result));
+    }
+    pthread_mutex_lock(&owners_lock);
+    for (unsigned int i = 0; i < device_count; ++i) owners[i] = (powerctlOwner_st) {.device = devices[i].device};
+    owner_count = device_count;
+    pthread_mutex_unlock(&owners_lock);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&controller_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    controller_stop = false;
+    if (pthread_create(&controller_thread, NULL, controller, NULL) != 0) {
+        LOG_ERROR("Couldn't start power budget controller thread, power budget disabled");
+        pthread_cond_destroy(&controller_wake);
+        free(devices);
+        devices = NULL;
+        device_count = 0;
+        return;
+    }
+    controller_running = true;
+    LOG_INFO("Power budget controller runs every %llu ms", interval_ms);
+}
+
+void powerctl_stop(void) {
+    if (!controller_running) return;
+
+    pthread_mutex_lock(&controller_lock);
+    controller_stop = true;
+    pthread_cond_signal(&controller_wake);
+    pthread_mutex_unlock(&controller_lock);
+    pthread_join(controller_thread, NULL);
+    controller_running = false;
+    pthread_cond_destroy(&controller_wake);
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (devices[i].controlled) release(&devices[i]);
+    }
+    active = false;
+    free(devices);
+    devices = NULL;
+    device_count = 0;
+}
+
+nvmlReturn_t powerctl_set_budget(const powerctlBudget_st *budget, const char **error /*out*/) {
+    *error = NULL;
+    if (!controller_running) {
+        *error = "The power budget controller isn't running";
+        return NVML_ERROR_UNINITIALIZED;
+    }
+
+    // validate everything before touching any device
+    int index[POWERCTL_MAX_DEVICES];
+    unsigned int min_mw[POWERCTL_MAX_DEVICES];
+    unsigned int max_mw[POWERCTL_MAX_DEVICES];
+    unsigned long long min_total_mw = 0;
+    pthread_mutex_lock(&controller_lock);
+    for (unsigned int s = 0; s < budget->share_count; ++s) {
+        const powerctlShare_st *share = &budget->shares[s];
+        index[s] = -1;
+        for (unsigned int i = 0; i < device_count; ++i) {
+            if (devices[i].device != NULL && strcmp(devices[i].uuid, share->uuid) == 0) index[s] = (int) i;
+        }
+        if (index[s] < 0) {
+            pthread_mutex_unlock(&controller_lock);
+            *error = "Couldn't resolve UUID";
+            return NVML_ERROR_NOT_FOUND;
+        }
+        for (unsigned int other = 0; other < s; ++other) {
+            if (index[other] == index[s]) {
+                pthread_mutex_unlock(&controller_lock);
+                *error = "A device appears more than once";
+                return NVML_ERROR_INVALID_ARGUMENT;
+            }
+        }
+
+        unsigned int constraint_min_mw = 0, constraint_max_mw = 0;
+        const nvmlReturn_t result = on_device(devices[index[s]].device, POWERCTL_GET_CONSTRAINTS, &constraint_min_mw,
+                                          &constraint_max_mw);
+        if (result != NVML_SUCCESS) {
+            pthread_mutex_unlock(&controller_lock);
+            *error = result == NVML_ERROR_TIMEOUT ? "The device is degraded, it didn't answer in time"
+                                                  : "Couldn't get power management limit constraints";
+            return result;
+        }
+        min_mw[s] = share->min_limit_mw > constraint_min_mw ? share->min_limit_mw : constraint_min_mw;
+        max_mw[s] = share->max_limit_mw > 0 && share->max_limit_mw < constraint_max_mw ? share->max_limit_mw : constraint_max_mw;
+        if (min_mw[s] > max_mw[s]) {
+            pthread_mutex_unlock(&controller_lock);
+            *error = "minLimit is above maxLimit, or outside of the device's constraints";
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        min_total_mw += min_mw[s];
+    }
+    if (min_total_mw > budget->budget_mw) {
+        pthread_mutex_unlock(&controller_lock);
+        *error = "The minimum limits alone exceed the budget";
+        return NVML_ERROR_INVALID_ARGUMENT;
+    }
+
+    // devices the new budget doesn't cover go back to where they were
+    for (unsigned int i = 0; i < device_count; ++i) {
+        bool kept = false;
+        for (unsigned int s = 0; s < budget->share_count; ++s) kept |= index[s] == (int) i;
+        if (devices[i].controlled && !kept) release(&devices[i]);
+    }
+
+    for (unsigned int s = 0; s < budget->share_count; ++s) {
+        powerctlDevice_st *device = &devices[index[s]];
+        if (!device->controlled) {
+            pthread_mutex_lock(&owners_lock);
+            unsigned int limit_mw = owners[index[s]].baseline_mw;  // rather than what a profile set
+            pthread_mutex_unlock(&owners_lock);
+            const nvmlReturn_t result = limit_mw > 0
+                                            ? NVML_SUCCESS
+                                            : on_device(device->device, POWERCTL_GET_LIMIT, &limit_mw, NULL);
+            if (result != NVML_SUCCESS) {
+                LOG_ERROR("Couldn't get power limit of %s (%s), restoring its default later", device->uuid,
+                          map_nvmlReturn_t_to_string(result));
+                if (on_device(device->device, POWERCTL_GET_DEFAULT_LIMIT, &limit_mw, NULL) != NVML_SUCCESS) limit_mw = max_mw[s];
+            }
+            device->original_limit_mw = limit_mw;
+            device->limit_mw = limit_mw;
+            device->integral_mw = limit_mw;  // bumpless: start out asking for what it has
+            device->usage_mw = 0;
+            device->last_error = NVML_SUCCESS;
+            set_controlled(device, true);
+        }
+        device->weight = budget->shares[s].weight;
+        device->min_mw = min_mw[s];
+        device->max_mw = max_mw[s];
+        if (device->integral_mw < device->min_mw) device->integral_mw = device->min_mw;
+        if (device->integral_mw > device->max_mw) device->integral_mw = device->max_mw;
+        device->request_mw = device->integral_mw;
+    }
+    budget_mw = budget->budget_mw;
+    kp = budget->kp;
+    ki = budget->ki;
+    active = true;
+    // apply the new split right away instead of a period later
+    step();
+    pthread_mutex_unlock(&controller_lock);
+    LOG_INFO("Power budget of %llu mW set over %u device(s)", budget->budget_mw, budget->share_count);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t powerctl_clear_budget(void) {
+    if (!controller_running) return NVML_ERROR_UNINITIALIZED;
+
+    nvmlReturn_t last = NVML_SUCCESS;
+    pthread_mutex_lock(&controller_lock);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (!devices[i].controlled) continue;
+        const nvmlReturn_t result = release(&devices[i]);
+        if (result != NVML_SUCCESS) last = result;
+    }
+    active = false;
+    pthread_mutex_unlock(&controller_lock);
+    LOG_INFO("Power budget cleared");
+    return last;
+}
+
+bool powerctl_get_budget(powerctlBudget_st *budget) {
+    *budget = (powerctlBudget_st) {0};
+    pthread_mutex_lock(&controller_lock);
+    if (active) {
+        budget->budget_mw = budget_mw;
+        budget->kp = kp;
+        budget->ki = ki;
+        for (unsigned int i = 0; i < device_count && budget->share_count < POWERCTL_MAX_DEVICES; ++i) {
+            const powerctlDevice_st *device = &devices[i];
+            if (!device->controlled) continue;
+            powerctlShare_st *share = &budget->shares[budget->share_count++];
+            snprintf(share->uuid, sizeof(share->uuid), "%s", device->uuid);
+            share->weight = device->weight;
+            share->min_limit_mw = device->min_mw;
+            share->max_limit_mw = device->max_mw;
+        }
+    }
+    const bool was_active = active;
+    pthread_mutex_unlock(&controller_lock);
+    return was_active;
+}
+
+void powerctl_status(FILE *out) {
+    pthread_mutex_lock(&controller_lock);
+    fprintf(out, "{\"intervalMs\": %llu, \"active\": %s", interval_ms, active ? "true" : "false");
+    if (active) fprintf(out, ", \"budget\": %llu, \"kp\": %.3f, \"ki\": %.3f", budget_mw, kp, ki);
+    fputs(", \"devices\": [", out);
+    bool first = true;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        const powerctlDevice_st *device = &devices[i];
+        if (!device->controlled) continue;
+        fprintf(out, "%s{\"uuid\": \"%s\", \"weight\": %.3f, \"minLimit\": %u, \"maxLimit\": %u, \"usage\": %u, "
+                "\"request\": %.0f, \"limit\": %u, \"originalLimit\": %u, \"lastError\": \"%s\"}",
+                first ? "" : ", ", device->uuid, device->weight, device->min_mw, device->max_mw, device->usage_mw,
+                device->request_mw, device->limit_mw, device->original_limit_mw, map_nvmlReturn_t_to_string(device->last_error));
+        first = false;
+    }
+    pthread_mutex_unlock(&controller_lock);
+    fputs("]}", out);
+}
+
+bool powerctl_controls(const nvmlDevice_t device) {
+    bool controlled = false;
+    pthread_mutex_lock(&owners_lock);
+    for (unsigned int i = 0; i < owner_count; ++i) {
+        if (owners[i].device == device) controlled = owners[i].controlled;
+    }
+    pthread_mutex_unlock(&owners_lock);
+    return controlled;
+}
+
+void powerctl_set_baseline(const nvmlDevice_t device, const unsigned int limit_mw) {
+    pthread_mutex_lock(&owners_lock);
+    for (unsigned int i = 0; i < owner_count; ++i) {
+        if (owners[i].device == device) owners[i].baseline_mw = limit_mw;
+    }
+    pthread_mutex_unlock(&owners_lock);
+}
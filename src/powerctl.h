@@ -0,0 +1,82 @@
+#ifndef POWERCTL_H
+#define POWERCTL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <nvml.h>
+
+#define POWERCTL_MAX_DEVICES 64
+#define POWERCTL_DEFAULT_INTERVAL_MS 1000
+#define POWERCTL_DEFAULT_KP 0.5
+#define POWERCTL_DEFAULT_KI 0.2  // per second
+#define POWERCTL_HEADROOM 0.10  // a device is asked for 10% more than it draws, so one pinned at its limit can grow
+#define POWERCTL_MIN_CHANGE_MW 1000  // smaller changes aren't written, to spare the driver, unless the budget needs them
+
+typedef struct powerctlShare_st {
+    char uuid[96];
+    double weight;  // relative claim on the budget once it's contended
+    unsigned int min_limit_mw;  // 0 for the device's minimum constraint
+    unsigned int max_limit_mw;  // 0 for the device's maximum constraint
+} powerctlShare_st;
+
+typedef struct powerctlBudget_st {
+    unsigned long long budget_mw;  // shared by the power limits of shares
+    powerctlShare_st shares[POWERCTL_MAX_DEVICES];
+    unsigned int share_count;
+    double kp;
+    double ki;
+} powerctlBudget_st;
+
+/**
+ * Resolves every device and starts the controller thread, which redistributes the budget every ENVYD_POWERCTL_INTERVAL_MS
+ * (default POWERCTL_DEFAULT_INTERVAL_MS) once one is set. NVML must be initialized.
+ */
+void powerctl_start(void);
+
+/**
+ * Stops the controller thread and restores the limits the devices had before the budget was set.
+ * No-op if the controller was never started.
+ */
+void powerctl_stop(void);
+
+/**
+ * Activates (or replaces) the node budget. Every share is clamped to its device's limit constraints; devices not in
+ * budget keep their limit. Devices dropped by a replacement get their original limit back.
+ *
+ * @param error out, a human readable reason if this returns anything but NVML_SUCCESS
+ * @return NVML_ERROR_UNINITIALIZED if the controller isn't running, NVML_ERROR_NOT_FOUND for unknown uuids,
+ *  NVML_ERROR_INVALID_ARGUMENT if the minimum limits alone exceed the budget, or what reading the constraints returned
+ */
+nvmlReturn_t powerctl_set_budget(const powerctlBudget_st *budget, const char **error /*out*/);
+
+/**
+ * Deactivates the budget and restores the limits the devices had before it was set.
+ */
+nvmlReturn_t powerctl_clear_budget(void);
+
+/**
+ * Copies the active budget, w/ every share's limits as clamped to its device, for handing it to the next process on
+ * restart.
+ *
+ * @return false if no budget is active
+ */
+bool powerctl_get_budget(powerctlBudget_st *budget /*out*/);
+
+/**
+ * Writes {"intervalMs": ..., "active": ..., "budget": ..., "devices": [...]} to out.
+ */
+void powerctl_status(FILE *out);
+
+/**
+ * The budget owns the limit of its devices: setters and profiles leave it alone (NVML_ERROR_IN_USE) while this is true.
+ * Never waits for the controller, so it can be asked from any thread.
+ */
+bool powerctl_controls(nvmlDevice_t device);
+
+/**
+ * Tells the controller what device's limit was before a profile changed it, 0 once the profile is reverted. A budget
+ * taking the device over meanwhile restores that limit once it lets go, not the profile's.
+ */
+void powerctl_set_baseline(nvmlDevice_t device, unsigned int limit_mw);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT (SystemTap/DTrace-style) static probes on the request path, provider 'envyd'.
+// An unattached probe is a single nop in the instruction stream, so these stay compiled in for production builds;
+// attach w/o restarting the daemon, e.g.:
+//   bpftrace -e 'usdt:/usr/bin/envyd:envyd:nvml__exit { printf("%s -> %d\n", str(arg0), arg1); }'
+//   perf probe -x /usr/bin/envyd sdt_envyd:handler__entry
+//
+// probes (arguments in order):
+//   accept            (client_fd)
+//   request__parsed   (client_fd, action)
+//   handler__entry    (client_fd, action)
+//   handler__exit     (client_fd, action)
+//   nvml__entry       (function name)
+//   nvml__exit        (function name, nvmlReturn_t)
+//   response__written (client_fd, bytes written; -1 on failure)
+//
+// Compiled out when <sys/sdt.h> (systemtap-sdt-devel / systemtap-sdt-dev) is missing, or w/ -DNO_USDT_PROBES.
+
+#if !defined(NO_USDT_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ENVYD_HAS_USDT_PROBES 1
+#endif
+#endif
+
+#ifdef ENVYD_HAS_USDT_PROBES
+#define PROBE_ACCEPT(client_fd) DTRACE_PROBE1(envyd, accept, client_fd)
+#define PROBE_REQUEST_PARSED(client_fd, action) DTRACE_PROBE2(envyd, request__parsed, client_fd, action)
+#define PROBE_HANDLER_ENTRY(client_fd, action) DTRACE_PROBE2(envyd, handler__entry, client_fd, action)
+#define PROBE_HANDLER_EXIT(client_fd, action) DTRACE_PROBE2(envyd, handler__exit, client_fd, action)
+#define PROBE_NVML_ENTRY(fn_name) DTRACE_PROBE1(envyd, nvml__entry, fn_name)
+#define PROBE_NVML_EXIT(fn_name, nvml_return) DTRACE_PROBE2(envyd, nvml__exit, fn_name, nvml_return)
+#define PROBE_RESPONSE_WRITTEN(client_fd, bytes) DTRACE_PROBE2(envyd, response__written, client_fd, bytes)
+#else
+#define PROBE_ACCEPT(client_fd) do {} while (0)  // no-op
+#define PROBE_REQUEST_PARSED(client_fd, action) do {} while (0)  // no-op
+#define PROBE_HANDLER_ENTRY(client_fd, action) do {} while (0)  // no-op
+#define PROBE_HANDLER_EXIT(client_fd, action) do {} while (0)  // no-op
+#define PROBE_NVML_ENTRY(fn_name) do {} while (0)  // no-op
+#define PROBE_NVML_EXIT(fn_name, nvml_return) do {} while (0)  // no-op
+#define PROBE_RESPONSE_WRITTEN(client_fd, bytes) do {} while (0)  // no-op
+#endif
+
+#endif
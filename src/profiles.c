@@ -0,0 +1,546 @@
+#include "profiles.h"
+#include "coalesce.h"
+#include "powerctl.h"
+#include "arena.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROFILES_CGROUP_SIZE 4096
+
+typedef struct profilesEntry_st {
+    profile_st profile;
+    unsigned long long generation;  // bumped on every profiles_set, so devices pick up changed settings
+} profilesEntry_st;
+
+typedef struct profilesDevice_st {
+    nvmlDevice_t device;
+    char uuid[96];
+
+    char applied[PROFILES_NAME_SIZE];  // empty for none
+    unsigned long long applied_generation;
+    unsigned int applied_fields;  // what has to be undone once the device reverts; w/o a limit the budget took over
+    unsigned int baseline_power_limit_mw;  // from before a profile first changed it
+
+    unsigned int *pids;  // malloc'd, grown as needed
+    unsigned int pid_count;
+    unsigned int pid_capacity;
+    nvmlReturn_t last_error;
+} profilesDevice_st;
+
+// what the rules look at, read once per process and round
+typedef struct profilesProcess_st {
+    char comm[64];
+    char argv0[256];  // basename
+    char cgroup[PROFILES_CGROUP_SIZE];
+} profilesProcess_st;
+
+static profilesDevice_st *devices = NULL;
+static unsigned int device_count = 0;
+static unsigned long long interval_ms = PROFILES_DEFAULT_INTERVAL_MS;
+
+static profilesEntry_st profiles[PROFILES_MAX];
+static unsigned int profile_count = 0;
+static unsigned long long generation = 0;
+static profileRule_st rules[PROFILES_MAX_RULES];
+static unsigned int rule_count = 0;
+
+static pthread_t watcher_thread;
+static bool watcher_running = false;
+static bool watcher_stop = false;
+// guards everything above; held across calls on the device contexts, so tasks there never take it
+static pthread_mutex_t watcher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watcher_wake;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static const profilesEntry_st *find_profile(const char *name) {
+    for (unsigned int i = 0; i < profile_count; ++i) {
+        if (strcmp(profiles[i].profile.name, name) == 0) return &profiles[i];
+    }
+    return NULL;
+}
+
+/**
+ * @return bytes read into buffer (always nul terminated), 0 if the process is gone
+ */
+static size_t read_proc(const unsigned int pid, const char *file, char *buffer /*out*/, const size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/%s", pid, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        buffer[0] = 0;
+        return 0;
+    }
+    const size_t read = fread(buffer, 1, size - 1, f);
+    fclose(f);
+    buffer[read] = 0;
+    return read;
+}
+
+static void describe_process(const unsigned int pid, profilesProcess_st *process /*out*/) {
+    read_proc(pid, "comm", process->comm, sizeof(process->comm));
+    process->comm[strcspn(process->comm, "\n")] = 0;
+
+    // argv[0] is the first nul terminated string; comm is cut at 15 characters, this isn't
+    char cmdline[sizeof(process->argv0)];
+    read_proc(pid, "cmdline", cmdline, sizeof(cmdline));
+    const char *slash = strrchr(cmdline, '/');
+    snprintf(process->argv0, sizeof(process->argv0), "%s", slash != NULL ? slash + 1 : cmdline);
+
+    read_proc(pid, "cgroup", process->cgroup, sizeof(process->cgroup));
+}
+
+static bool matches(const profileRule_st *rule, const profilesProcess_st *process) {
+    switch (rule->match) {
+        case PROFILE_MATCH_PROCESS:
+            return strcmp(rule->pattern, process->comm) == 0 || strcmp(rule->pattern, process->argv0) == 0;
+        case PROFILE_MATCH_CGROUP:
+            return strstr(process->cgroup, rule->pattern) != NULL;
+        default:
+            return false;
+    }
+}
+
+// what the listing task gets: the device's pid buffer, handed back once it's done
+typedef struct profilesList_st {
+    nvmlDevice_t device;
+    unsigned int *pids;  // malloc'd, grown as needed
+    unsigned int pid_count;
+    unsigned int pid_capacity;
+    nvmlReturn_t result;
+} profilesList_st;
+
+static bool add_pid(profilesList_st *list, const unsigned int pid) {
+    for (unsigned int j = 0; j < list->pid_count; ++j) {
+        if (list->pids[j] == pid) return true;
+    }
+    if (list->pid_count == list->pid_capacity) {
+        const unsigned int capacity = list->pid_capacity > 0 ? 2 * list->pid_capacity : 2 * PROFILES_MAX_PROCESSES;
+        unsigned int *pids = realloc(list->pids, capacity * sizeof(unsigned int));
+        if (pids == NULL) return false;
+        list->pids = pids;
+        list->pid_capacity = capacity;
+    }
+    list->pids[list->pid_count++] = pid;
+    return true;
+}
+
+/**
+ * Lists compute and graphics processes into list->pids; a process can show up in both. Busy devices w/ more than
+ * PROFILES_MAX_PROCESSES are listed into the arena. Runs on the device's context.
+ */
+static void list_processes(void *arg) {
+    profilesList_st *list = arg;
+    nvmlProcessInfo_t stack_infos[PROFILES_MAX_PROCESSES];
+    list->pid_count = 0;
+    list->result = NVML_SUCCESS;
+    for (int graphics = 0; graphics <= 1; ++graphics) {
+        nvmlProcessInfo_t *infos = stack_infos;
+        unsigned int count = PROFILES_MAX_PROCESSES;
+        nvmlReturn_t result = NVML_ERROR_INSUFFICIENT_SIZE;
+        for (int attempt = 0; attempt < PROFILES_LIST_ATTEMPTS && result == NVML_ERROR_INSUFFICIENT_SIZE; ++attempt) {
+            if (attempt > 0) {
+                // count is how many there were; room for a few more that start meanwhile
+                count += PROFILES_MAX_PROCESSES;
+                infos = arena_alloc(arena_request(), count * sizeof(nvmlProcessInfo_t));
+                if (infos == NULL) {
+                    list->result = NVML_ERROR_MEMORY;
+                    return;
+                }
+            }
+            result = graphics
+                         ? NVML_CALL(nvmlDeviceGetGraphicsRunningProcesses_v3, list->device, &count, infos)
+                         : NVML_CALL(nvmlDeviceGetComputeRunningProcesses_v3, list->device, &count, infos);
+        }
+        if (result == NVML_ERROR_NOT_SUPPORTED) continue;  // e.g. no graphics on compute-only boards
+        if (result != NVML_SUCCESS) {
+            list->result = result;
+            return;
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+            if (!add_pid(list, infos[i].pid)) {
+                list->result = NVML_ERROR_MEMORY;
+                return;
+            }
+        }
+    }
+}
+
+static nvmlReturn_t set_power_limit(const nvmlDevice_t device, const unsigned int limit_mw) {
+    nvmlPowerValue_v2_t power_value_s = {0};
+    power_value_s.version = nvmlPowerValue_v2;
+    power_value_s.powerScope = NVML_POWER_SCOPE_GPU;
+    power_value_s.powerValueMw = limit_mw;
+    return NVML_CALL(nvmlDeviceSetPowerManagementLimit_v2, device, &power_value_s);
+}
+
+// what the switching task gets, a copy of the device's state it reads and writes back
+typedef struct profilesSwitch_st {
+    nvmlDevice_t device;
+    char uuid[96];
+    bool has_profile;  // else revert
+    profile_st profile;
+    unsigned int applied_fields;
+    unsigned int baseline_power_limit_mw;
+    nvmlReturn_t last_error;
+} profilesSwitch_st;
+
+/**
+ * Switches the device from whatever it has applied to the profile; runs on its context.
+ */
+static void switch_profile(void *arg) {
+    profilesSwitch_st *task = arg;
+    const profile_st *profile = task->has_profile ? &task->profile : NULL;
+    const unsigned int fields = profile != NULL ? profile->fields : 0;
+    nvmlReturn_t last = NVML_SUCCESS;
+    nvmlReturn_t result;
+
+#define TRACK(call) do { \
+        result = call; \
+        if (result != NVML_SUCCESS) { \
+            LOG_ERROR(#call " failed for %s (%s)", task->uuid, map_nvmlReturn_t_to_string(result)); \
+            last = result; \
+        } \
+    } while (0)
+
+    coalesce_forget(task->device);
+    arena_reset(arena_request());  // whatever it answered to held writes; nothing else here uses the arena
+    // the node power budget owns the limit of its devices; it restores our baseline once it lets go
+    const bool budgeted = powerctl_controls(task->device);
+    unsigned int applied_fields = fields;
+    if (budgeted && (fields & PROFILE_HAS_POWER_LIMIT)) {
+        LOG_WARNING("%s is in the node power budget, profile '%s' leaves its power limit alone", task->uuid, profile->name);
+        applied_fields &= ~PROFILE_HAS_POWER_LIMIT;
+        last = NVML_ERROR_IN_USE;
+    }
+    // undo what the previous profile changed and this one leaves alone
+    const unsigned int undo = task->applied_fields & ~applied_fields;
+    if (undo & PROFILE_HAS_GPU_LOCKED_CLOCKS) TRACK(NVML_CALL(nvmlDeviceResetGpuLockedClocks, task->device));
+    if (undo & PROFILE_HAS_MEMORY_LOCKED_CLOCKS) TRACK(NVML_CALL(nvmlDeviceResetMemoryLockedClocks, task->device));
+    if (undo & PROFILE_HAS_APPLICATIONS_CLOCKS) TRACK(NVML_CALL(nvmlDeviceResetApplicationsClocks, task->device));
+    if (undo & PROFILE_HAS_POWER_LIMIT) {
+        if (!budgeted) TRACK(set_power_limit(task->device, task->baseline_power_limit_mw));
+        powerctl_set_baseline(task->device, 0);
+    }
+
+    if ((applied_fields & PROFILE_HAS_POWER_LIMIT) && !(task->applied_fields & PROFILE_HAS_POWER_LIMIT)) {
+        TRACK(NVML_CALL(nvmlDeviceGetPowerManagementLimit, task->device, &task->baseline_power_limit_mw));
+        if (result != NVML_SUCCESS) {
+            TRACK(NVML_CALL(nvmlDeviceGetPowerManagementDefaultLimit, task->device, &task->baseline_power_limit_mw));
+        }
+        powerctl_set_baseline(task->device, task->baseline_power_limit_mw);
+    }
+    if (applied_fields & PROFILE_HAS_POWER_LIMIT) TRACK(set_power_limit(task->device, profile->power_limit_mw));
+    if (fields & PROFILE_HAS_GPU_LOCKED_CLOCKS) {
+        TRACK(NVML_CALL(nvmlDeviceSetGpuLockedClocks, task->device, profile->gpu_locked_min_mhz, profile->gpu_locked_max_mhz));
+    }
+    if (fields & PROFILE_HAS_MEMORY_LOCKED_CLOCKS) {
+        TRACK(NVML_CALL(nvmlDeviceSetMemoryLockedClocks, task->device, profile->memory_locked_min_mhz, profile->memory_locked_max_mhz));
+    }
+    if (fields & PROFILE_HAS_APPLICATIONS_CLOCKS) {
+        TRACK(NVML_CALL(nvmlDeviceSetApplicationsClocks, task->device, profile->applications_memory_mhz, profile->applications_graphics_mhz));
+    }
+#undef TRACK
+
+    // remember fields even if setting some failed, so reverting still resets them
+    task->applied_fields = applied_fields;
+    task->last_error = last;
+}
+
+/**
+ * Switches device from whatever it has applied to entry (NULL to revert) on its context; watcher_lock must be held.
+ * A degraded device keeps what it had, and is switched once it's back.
+ */
+static void apply(profilesDevice_st *device, const profilesEntry_st *entry) {
+    profilesSwitch_st task = {
+        .device = device->device, .has_profile = entry != NULL, .applied_fields = device->applied_fields,
+        .baseline_power_limit_mw = device->baseline_power_limit_mw,
+    };
+    snprintf(task.uuid, sizeof(task.uuid), "%s", device->uuid);
+    if (entry != NULL) task.profile = entry->profile;
+    const nvmlReturn_t result = watchdog_device_call(device->device, switch_profile, &task, sizeof(task));
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't switch profile of %s to '%s' (%s)", device->uuid, entry != NULL ? entry->profile.name : "",
+                  map_nvmlReturn_t_to_string(result));
+        device->last_error = result;
+        return;
+    }
+
+    LOG_INFO("Profile of %s: '%s' -> '%s'", device->uuid, device->applied, entry != NULL ? entry->profile.name : "");
+    device->applied_fields = task.applied_fields;
+    device->baseline_power_limit_mw = task.baseline_power_limit_mw;
+    snprintf(device->applied, sizeof(device->applied), "%s", entry != NULL ? entry->profile.name : "");
+    device->applied_generation = entry != NULL ? entry->generation : 0;
+    device->last_error = task.last_error;
+}
+
+/**
+ * One round over every device; watcher_lock must be held.
+ */
+static void watch(void) {
+    profilesProcess_st *process = malloc(sizeof(profilesProcess_st));
+    if (process == NULL) return;
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        profilesDevice_st *device = &devices[i];
+        if (device->device == NULL) continue;
+        if (watchdog_degraded(device->device)) {
+            // keep what's applied until it's back
+            device->last_error = NVML_ERROR_TIMEOUT;
+            continue;
+        }
+        profilesList_st list = {.device = device->device, .pids = device->pids, .pid_capacity = device->pid_capacity};
+        nvmlReturn_t result = watchdog_device_call(device->device, list_processes, &list, sizeof(list));
+        arena_reset(arena_request());  // long process lists, only read while listing w/o a context
+        if (result == NVML_SUCCESS) {
+            device->pids = list.pids;
+            device->pid_capacity = list.pid_capacity;
+            result = list.result;
+        } else if (result == NVML_ERROR_TIMEOUT) {
+            // the task that missed its deadline may still grow the buffer; it's left to it
+            device->pids = NULL;
+            device->pid_capacity = 0;
+        }
+        device->pid_count = result == NVML_SUCCESS ? list.pid_count : 0;
+        if (result != NVML_SUCCESS) {
+            // don't flap on a transient error; keep what's applied
+            device->last_error = result;
+            continue;
+        }
+
+        // the first rule matching any of the processes wins, whichever process it is
+        unsigned int best = rule_count;
+        for (unsigned int p = 0; p < device->pid_count && best > 0; ++p) {
+            describe_process(device->pids[p], process);
+            for (unsigned int r = 0; r < best; ++r) {
+                if (matches(&rules[r], process)) {
+                    best = r;
+                    break;
+                }
+            }
+        }
+        const profilesEntry_st *wanted = best < rule_count ? find_profile(rules[best].profile) : NULL;
+
+        // a budget that took the limit over restores our baseline once it lets go; the profile's limit is then due again
+        const bool budgeted = powerctl_controls(device->device);
+        if (budgeted && (device->applied_fields & PROFILE_HAS_POWER_LIMIT)) {
+            device->applied_fields &= ~PROFILE_HAS_POWER_LIMIT;
+            device->last_error = NVML_ERROR_IN_USE;
+            powerctl_set_baseline(device->device, 0);
+        }
+        const bool limit_due = wanted != NULL && (wanted->profile.fields & PROFILE_HAS_POWER_LIMIT)
+                               && !(device->applied_fields & PROFILE_HAS_POWER_LIMIT) && !budgeted;
+        const bool same = wanted == NULL
+                              ? device->applied[0] == 0
+                              : strcmp(device->applied, wanted->profile.name) == 0 && device->applied_generation == wanted->generation
+                                && !limit_due;
+        if (!same) apply(device, wanted);
+    }
+    free(process);
+}
+
+static void *watcher(void *arg) {
+    (void) arg;
+    const unsigned long long interval_ns = interval_ms * 1000000ULL;
+    unsigned long long next = monotonic_ns();
+
+    pthread_mutex_lock(&watcher_lock);
+    while (!watcher_stop) {
+        if (rule_count > 0 || profile_count > 0) watch();
+
+        // fixed rate; if a round overran, skip ahead instead of bursting to catch up
+        const unsigned long long now = monotonic_ns();
+        next += interval_ns;
+        if (next < now) next = now + interval_ns;
+        const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+        while (!watcher_stop && pthread_cond_timedwait(&watcher_wake, &watcher_lock, &deadline) != ETIMEDOUT) {}
+    }
+    pthread_mutex_unlock(&watcher_lock);
+    return NULL;
+}
+
+void profiles_start(void) {
+    const char *configured = getenv("ENVYD_PROFILES_INTERVAL_MS");
+    if (configured != NULL && strtoull(configured, NULL, 10) > 0) interval_ms = strtoull(configured, NULL, 10);
+
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), profiles disabled", map_nvmlReturn_t_to_string(result));
+        device_count = 0;
+        return;
+    }
+    devices = calloc(device_count > 0 ? device_count : 1, sizeof(profilesDevice_st));
+    if (devices == NULL) {
+        LOG_ERROR("Couldn't allocate device handles, profiles disabled");
+        device_count = 0;
+        return;
+    }
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &devices[i].device);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device by index %d (%s), no profiles for it", i, map_nvmlReturn_t_to_string(result));
+            devices[i].device = NULL;
+            continue;
+        }
+        result = NVML_CALL(nvmlDeviceGetUUID, devices[i].device, devices[i].uuid, sizeof(devices[i].uuid));
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't get uuid by index %d (%s)", i, map_nvmlReturn_t_to_string(result));
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watcher_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    watcher_stop = false;
+    if (pthread_create(&watcher_thread, NULL, watcher, NULL) != 0) {
+        LOG_ERROR("Couldn't start profile watcher thread, profiles disabled");
+        pthread_cond_destroy(&watcher_wake);
+        free(devices);
+        devices = NULL;
+        device_count = 0;
+        return;
+    }
+    watcher_running = true;
+    LOG_INFO("Watching GPU processes for profile rules every %llu ms", interval_ms);
+}
+
+void profiles_stop(void) {
+    if (!watcher_running) return;
+
+    pthread_mutex_lock(&watcher_lock);
+    watcher_stop = true;
+    pthread_cond_signal(&watcher_wake);
+    pthread_mutex_unlock(&watcher_lock);
+    pthread_join(watcher_thread, NULL);
+    watcher_running = false;
+    pthread_cond_destroy(&watcher_wake);
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (devices[i].applied[0] != 0) apply(&devices[i], NULL);
+        free(devices[i].pids);
+    }
+    free(devices);
+    devices = NULL;
+    device_count = 0;
+}
+
+nvmlReturn_t profiles_set(const profile_st *profile) {
+    if (!watcher_running) return NVML_ERROR_UNINITIALIZED;
+
+    pthread_mutex_lock(&watcher_lock);
+    profilesEntry_st *entry = (profilesEntry_st *) find_profile(profile->name);
+    if (entry == NULL) {
+        if (profile_count == PROFILES_MAX) {
+            pthread_mutex_unlock(&watcher_lock);
+            return NVML_ERROR_INSUFFICIENT_SIZE;
+        }
+        entry = &profiles[profile_count++];
+    }
+    entry->profile = *profile;
+    entry->generation = ++generation;
+    pthread_mutex_unlock(&watcher_lock);
+    LOG_INFO("Profile '%s' set (fields 0x%x)", profile->name, profile->fields);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t profiles_delete(const char *name) {
+    if (!watcher_running) return NVML_ERROR_UNINITIALIZED;
+
+    pthread_mutex_lock(&watcher_lock);
+    const profilesEntry_st *entry = find_profile(name);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&watcher_lock);
+        return NVML_ERROR_NOT_FOUND;
+    }
+    for (unsigned int r = 0; r < rule_count; ++r) {
+        if (strcmp(rules[r].profile, name) == 0) {
+            pthread_mutex_unlock(&watcher_lock);
+            return NVML_ERROR_IN_USE;
+        }
+    }
+    // keep the order, rule ranking doesn't depend on it but status output does
+    const size_t index = (size_t) (entry - profiles);
+    memmove(&profiles[index], &profiles[index + 1], (profile_count - index - 1) * sizeof(profilesEntry_st));
+    --profile_count;
+    pthread_mutex_unlock(&watcher_lock);
+    LOG_INFO("Profile '%s' deleted", name);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t profiles_set_rules(const profileRule_st *new_rules, const unsigned int count) {
+    if (!watcher_running) return NVML_ERROR_UNINITIALIZED;
+    if (count > PROFILES_MAX_RULES) return NVML_ERROR_INSUFFICIENT_SIZE;
+
+    pthread_mutex_lock(&watcher_lock);
+    for (unsigned int r = 0; r < count; ++r) {
+        if (find_profile(new_rules[r].profile) == NULL) {
+            pthread_mutex_unlock(&watcher_lock);
+            return NVML_ERROR_NOT_FOUND;
+        }
+    }
+    memcpy(rules, new_rules, count * sizeof(profileRule_st));
+    rule_count = count;
+    pthread_mutex_unlock(&watcher_lock);
+    LOG_INFO("%u profile rule(s) set", count);
+    return NVML_SUCCESS;
+}
+
+void profiles_get(profile_st profiles_out[PROFILES_MAX], unsigned int *profile_count_out,
+                  profileRule_st rules_out[PROFILES_MAX_RULES], unsigned int *rule_count_out) {
+    pthread_mutex_lock(&watcher_lock);
+    for (unsigned int p = 0; p < profile_count; ++p) profiles_out[p] = profiles[p].profile;
+    *profile_count_out = profile_count;
+    memcpy(rules_out, rules, rule_count * sizeof(profileRule_st));
+    *rule_count_out = rule_count;
+    pthread_mutex_unlock(&watcher_lock);
+}
+
+void profiles_status(FILE *out) {
+    pthread_mutex_lock(&watcher_lock);
+    fprintf(out, "{\"intervalMs\": %llu, \"profiles\": [", interval_ms);
+    for (unsigned int i = 0; i < profile_count; ++i) {
+        const profile_st *profile = &profiles[i].profile;
+        fprintf(out, "%s{\"name\": \"%s\"", i == 0 ? "" : ", ", profile->name);
+        if (profile->fields & PROFILE_HAS_POWER_LIMIT) fprintf(out, ", \"powerLimit\": %u", profile->power_limit_mw);
+        if (profile->fields & PROFILE_HAS_GPU_LOCKED_CLOCKS) {
+            fprintf(out, ", \"gpuLockedClocks\": [%u, %u]", profile->gpu_locked_min_mhz, profile->gpu_locked_max_mhz);
+        }
+        if (profile->fields & PROFILE_HAS_MEMORY_LOCKED_CLOCKS) {
+            fprintf(out, ", \"memoryLockedClocks\": [%u, %u]", profile->memory_locked_min_mhz, profile->memory_locked_max_mhz);
+        }
+        if (profile->fields & PROFILE_HAS_APPLICATIONS_CLOCKS) {
+            fprintf(out, ", \"applicationsClocks\": [%u, %u]", profile->applications_memory_mhz, profile->applications_graphics_mhz);
+        }
+        fputc('}', out);
+    }
+    fputs("], \"rules\": [", out);
+    for (unsigned int r = 0; r < rule_count; ++r) {
+        fprintf(out, "%s{\"%s\": \"%s\", \"profile\": \"%s\"}", r == 0 ? "" : ", ",
+                rules[r].match == PROFILE_MATCH_CGROUP ? "cgroup" : "process", rules[r].pattern, rules[r].profile);
+    }
+    fputs("], \"devices\": [", out);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        const profilesDevice_st *device = &devices[i];
+        fprintf(out, "%s{\"uuid\": \"%s\", \"profile\": ", i == 0 ? "" : ", ", device->uuid);
+        if (device->applied[0] != 0) fprintf(out, "\"%s\"", device->applied);
+        else fputs("null", out);
+        fputs(", \"processes\": [", out);
+        for (unsigned int p = 0; p < device->pid_count; ++p) fprintf(out, "%s%u", p == 0 ? "" : ", ", device->pids[p]);
+        fprintf(out, "], \"lastError\": \"%s\"}", map_nvmlReturn_t_to_string(device->last_error));
+    }
+    pthread_mutex_unlock(&watcher_lock);
+    fputs("]}", out);
+}
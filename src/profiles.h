@@ -0,0 +1,83 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include <stdio.h>
+#include <nvml.h>
+
+#define PROFILES_MAX 16
+#define PROFILES_MAX_RULES 32
+#define PROFILES_NAME_SIZE 64
+#define PROFILES_PATTERN_SIZE 256
+#define PROFILES_MAX_PROCESSES 64  // per device, compute and graphics each, listed w/o allocating; more go to the arena
+#define PROFILES_LIST_ATTEMPTS 3  // processes can start between asking how many there are and listing them
+#define PROFILES_DEFAULT_INTERVAL_MS 500
+
+#define PROFILE_HAS_POWER_LIMIT (1u << 0)
+#define PROFILE_HAS_GPU_LOCKED_CLOCKS (1u << 1)
+#define PROFILE_HAS_MEMORY_LOCKED_CLOCKS (1u << 2)
+#define PROFILE_HAS_APPLICATIONS_CLOCKS (1u << 3)
+
+// settings a profile doesn't have stay at the driver's defaults while it's applied
+typedef struct profile_st {
+    char name[PROFILES_NAME_SIZE];
+    unsigned int fields;  // PROFILE_HAS_*
+    unsigned int power_limit_mw;
+    unsigned int gpu_locked_min_mhz, gpu_locked_max_mhz;
+    unsigned int memory_locked_min_mhz, memory_locked_max_mhz;
+    unsigned int applications_memory_mhz, applications_graphics_mhz;
+} profile_st;
+
+typedef enum profileMatch_enum {
+    PROFILE_MATCH_PROCESS = 0,  // pattern equals /proc/<pid>/comm or the basename of argv[0]
+    PROFILE_MATCH_CGROUP,  // pattern is a substring of /proc/<pid>/cgroup
+} profileMatch_t;
+
+typedef struct profileRule_st {
+    profileMatch_t match;
+    char pattern[PROFILES_PATTERN_SIZE];
+    char profile[PROFILES_NAME_SIZE];
+} profileRule_st;
+
+/**
+ * Resolves every device and starts the watcher thread, which lists the GPU processes of every device each
+ * ENVYD_PROFILES_INTERVAL_MS (default PROFILES_DEFAULT_INTERVAL_MS) and applies the profile of the first rule any of
+ * them matches, or reverts the device once none does. NVML must be initialized.
+ */
+void profiles_start(void);
+
+/**
+ * Stops the watcher thread and reverts every device a profile was applied to. No-op if never started.
+ */
+void profiles_stop(void);
+
+/**
+ * Adds or replaces a profile; devices it's applied to get the new settings within one interval.
+ *
+ * @return NVML_ERROR_UNINITIALIZED if the watcher isn't running, NVML_ERROR_INSUFFICIENT_SIZE if PROFILES_MAX are defined
+ */
+nvmlReturn_t profiles_set(const profile_st *profile);
+
+/**
+ * @return NVML_ERROR_NOT_FOUND for unknown profiles, NVML_ERROR_IN_USE if a rule refers to it
+ */
+nvmlReturn_t profiles_delete(const char *name);
+
+/**
+ * Replaces every rule; first match wins.
+ *
+ * @return NVML_ERROR_NOT_FOUND if a rule refers to an unknown profile
+ */
+nvmlReturn_t profiles_set_rules(const profileRule_st *rules, const unsigned int count);
+
+/**
+ * Copies every profile and rule, for handing them to the next process on restart.
+ */
+void profiles_get(profile_st profiles_out[PROFILES_MAX] /*out*/, unsigned int *profile_count_out /*out*/,
+                  profileRule_st rules_out[PROFILES_MAX_RULES] /*out*/, unsigned int *rule_count_out /*out*/);
+
+/**
+ * Writes {"intervalMs": ..., "profiles": [...], "rules": [...], "devices": [...]} to out.
+ */
+void profiles_status(FILE *out);
+
+#endif
@@ -0,0 +1,392 @@
+#include "series.h"
+#include "store.h"
+#include "telemetry.h"
+#include "helpers.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SERIES_INITIAL_BLOCK_BYTES 64
+
+typedef struct seriesBucket_st {
+    uint64_t prefix;
+    unsigned int prefix_bits;
+    unsigned int field_bits;
+} seriesBucket_st;
+
+static const seriesBucket_st timestamp_buckets[] = {
+    {0b10, 2, 7}, {0b110, 3, 9}, {0b1110, 4, 12}, {0b11110, 5, 32}, {0b11111, 5, 64},
+};
+static const seriesBucket_st value_buckets[] = {
+    {0b10, 2, 6}, {0b110, 3, 12}, {0b1110, 4, 20}, {0b11110, 5, 32}, {0b11111, 5, 64},
+};
+
+// ----------------------------- BITSTREAM -----------------------------
+
+static uint64_t zigzag(const int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(const uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static bool reserve_bits(seriesBlock_st *block, const unsigned int bits) {
+    const size_t needed = (block->bit_count + bits + 7) / 8;
+    if (needed <= block->capacity) return true;
+
+    size_t capacity = block->capacity > 0 ? block->capacity : SERIES_INITIAL_BLOCK_BYTES;
+    while (capacity < needed) capacity *= 2;
+    uint8_t *grown = realloc(block->bits, capacity);
+    if (grown == NULL) return false;
+    memset(grown + block->capacity, 0, capacity - block->capacity);
+    block->bits = grown;
+    block->capacity = capacity;
+    return true;
+}
+
+/**
+ * Appends the low bits of value, most significant first; space must be reserved.
+ */
+static void put_bits(seriesBlock_st *block, const uint64_t value, const unsigned int bits) {
+    for (unsigned int idx = bits; idx > 0; --idx) {
+        if ((value >> (idx - 1)) & 1) block->bits[block->bit_count / 8] |= (uint8_t) (0x80u >> (block->bit_count % 8));
+        ++block->bit_count;
+    }
+}
+
+static uint64_t get_bits(const seriesBlock_st *block, size_t *bit, const unsigned int bits) {
+    uint64_t value = 0;
+    for (unsigned int idx = 0; idx < bits; ++idx, ++*bit) {
+        value = (value << 1) | ((block->bits[*bit / 8] >> (7 - *bit % 8)) & 1u);
+    }
+    return value;
+}
+
+static bool encode(seriesBlock_st *block, const int64_t value, const seriesBucket_st buckets[5]) {
+    if (value == 0) {
+        if (!reserve_bits(block, 1)) return false;
+        put_bits(block, 0, 1);
+        return true;
+    }
+
+    const uint64_t zz = zigzag(value);
+    const seriesBucket_st *bucket = &buckets[4];
+    for (int idx = 0; idx < 4; ++idx) {
+        if (zz < (1ULL << buckets[idx].field_bits)) {
+            bucket = &buckets[idx];
+            break;
+        }
+    }
+    if (!reserve_bits(block, bucket->prefix_bits + bucket->field_bits)) return false;
+    put_bits(block, bucket->prefix, bucket->prefix_bits);
+    put_bits(block, zz, bucket->field_bits);
+    return true;
+}
+
+static int64_t decode(const seriesBlock_st *block, size_t *bit, const seriesBucket_st buckets[5]) {
+    if (get_bits(block, bit, 1) == 0) return 0;
+
+    // prefix is 1..5 ones, terminated by a zero unless it's all five
+    unsigned int ones = 1;
+    while (ones < 5 && get_bits(block, bit, 1) == 1) ++ones;
+    return unzigzag(get_bits(block, bit, buckets[ones - 1].field_bits));
+}
+
+// ----------------------------- SERIES -----------------------------
+
+static void seal(seriesBlock_st *block) {
+    const size_t used = (block->bit_count + 7) / 8;
+    if (used == 0 || used == block->capacity) return;
+    uint8_t *shrunk = realloc(block->bits, used);
+    if (shrunk == NULL) return;
+    block->bits = shrunk;
+    block->capacity = used;
+}
+
+bool series_append(series_st *series, const int64_t timestamp, const int64_t value) {
+    seriesBlock_st *block = series->newest;
+    if (block == NULL || block->count >= SERIES_BLOCK_SAMPLES) {
+        seriesBlock_st *created = calloc(1, sizeof(seriesBlock_st));
+        if (created == NULL) return false;
+        created->first_timestamp = created->last_timestamp = timestamp;
+        created->first_value = created->last_value = value;
+        created->count = 1;
+
+        if (block != NULL) {
+            seal(block);
+            block->next = created;
+        } else {
+            series->oldest = created;
+        }
+        series->newest = created;
+        ++series->block_count;
+        ++series->sample_count;
+        return true;
+    }
+
+    // both fields are reserved up front so a failed append leaves the block decodable
+    const int64_t delta = timestamp - block->last_timestamp;
+    const size_t bit_count = block->bit_count;
+    if (!encode(block, delta - block->last_delta, timestamp_buckets) || !encode(block, value - block->last_value, value_buckets)) {
+        block->bit_count = bit_count;
+        memset(block->bits + (bit_count + 7) / 8, 0, block->capacity - (bit_count + 7) / 8);
+        if (bit_count % 8 != 0) block->bits[bit_count / 8] &= (uint8_t) (0xff00u >> (bit_count % 8));
+        return false;
+    }
+
+    block->last_timestamp = timestamp;
+    block->last_delta = delta;
+    block->last_value = value;
+    ++block->count;
+    ++series->sample_count;
+    return true;
+}
+
+void series_drop_before(series_st *series, const int64_t before) {
+    // never drop the block being appended to
+    while (series->oldest != NULL && series->oldest != series->newest && series->oldest->last_timestamp < before) {
+        seriesBlock_st *dropped = series->oldest;
+        series->oldest = dropped->next;
+        series->sample_count -= dropped->count;
+        --series->block_count;
+        free(dropped->bits);
+        free(dropped);
+    }
+}
+
+void series_free(series_st *series) {
+    while (series->oldest != NULL) {
+        seriesBlock_st *next = series->oldest->next;
+        free(series->oldest->bits);
+        free(series->oldest);
+        series->oldest = next;
+    }
+    memset(series, 0, sizeof(series_st));
+}
+
+size_t series_bytes(const series_st *series) {
+    size_t bytes = 0;
+    for (const seriesBlock_st *block = series->oldest; block != NULL; block = block->next) {
+        bytes += sizeof(seriesBlock_st) + block->capacity;
+    }
+    return bytes;
+}
+
+void series_iterator_init(seriesIterator_st *iterator, const series_st *series, const int64_t from, const int64_t to) {
+    memset(iterator, 0, sizeof(seriesIterator_st));
+    iterator->block = series->oldest;
+    iterator->from = from;
+    iterator->to = to;
+}
+
+bool series_iterator_next(seriesIterator_st *iterator, int64_t *timestamp /*out*/, int64_t *value /*out*/) {
+    while (iterator->block != NULL) {
+        const seriesBlock_st *block = iterator->block;
+        if (iterator->index == 0 && block->last_timestamp < iterator->from) {
+            iterator->block = block->next;
+            continue;
+        }
+        if (block->first_timestamp > iterator->to) break;  // blocks are in time order
+        if (iterator->index >= block->count) {
+            iterator->block = block->next;
+            iterator->index = 0;
+            continue;
+        }
+
+        if (iterator->index == 0) {
+            iterator->bit = 0;
+            iterator->timestamp = block->first_timestamp;
+            iterator->delta = 0;
+            iterator->value = block->first_value;
+        } else {
+            iterator->delta += decode(block, &iterator->bit, timestamp_buckets);
+            iterator->timestamp += iterator->delta;
+            iterator->value += decode(block, &iterator->bit, value_buckets);
+        }
+        ++iterator->index;
+
+        if (iterator->timestamp < iterator->from) continue;
+        if (iterator->timestamp > iterator->to) {
+            iterator->block = NULL;
+            break;
+        }
+        *timestamp = iterator->timestamp;
+        *value = iterator->value;
+        return true;
+    }
+    return false;
+}
+
+void series_aggregate(const series_st *series, const int64_t from, const int64_t to, seriesAggregate_st *aggregate /*out*/) {
+    memset(aggregate, 0, sizeof(seriesAggregate_st));
+    seriesIterator_st iterator;
+    series_iterator_init(&iterator, series, from, to);
+    int64_t timestamp, value;
+    while (series_iterator_next(&iterator, &timestamp, &value)) {
+        if (aggregate->count == 0 || value < aggregate->min) aggregate->min = value;
+        if (aggregate->count == 0 || value > aggregate->max) aggregate->max = value;
+        aggregate->sum += (double) value;
+        ++aggregate->count;
+    }
+}
+
+// ----------------------------- TELEMETRY -----------------------------
+
+typedef struct seriesDevice_st {
+    pthread_mutex_t lock;
+    char uuid[96];
+    series_st metrics[STORE_METRIC_COUNT];
+} seriesDevice_st;
+
+static seriesDevice_st *devices = NULL;
+static unsigned int device_count = 0;
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t retention_ms = 0;
+
+/**
+ * Telemetry listener; appends every valid metric of every sample and expires blocks past the retention.
+ */
+static void append(const envydTelemetrySlot_st *samples, const unsigned int count) {
+    if (devices == NULL) {
+        seriesDevice_st *created = calloc(count > 0 ? count : 1, sizeof(seriesDevice_st));
+        if (created == NULL) return;
+        for (unsigned int i = 0; i < count; ++i) {
+            pthread_mutex_init(&created[i].lock, NULL);
+            memcpy(created[i].uuid, samples[i].uuid, sizeof(created[i].uuid));
+        }
+        pthread_mutex_lock(&devices_lock);
+        devices = created;
+        device_count = count;
+        pthread_mutex_unlock(&devices_lock);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const int64_t now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    for (unsigned int i = 0; i < count && i < device_count; ++i) {
+        const envydTelemetrySlot_st *sample = &samples[i];
+        seriesDevice_st *device = &devices[i];
+        const struct { unsigned int flag; storeMetric_t metric; int64_t value; } values[] = {
+            {ENVYD_TELEMETRY_HAS_POWER, STORE_METRIC_POWER, sample->power_mw},
+            {ENVYD_TELEMETRY_HAS_POWER_LIMIT, STORE_METRIC_POWER_LIMIT, sample->power_limit_mw},
+            {ENVYD_TELEMETRY_HAS_TEMPERATURE, STORE_METRIC_TEMPERATURE, sample->temperature_c},
+            {ENVYD_TELEMETRY_HAS_GRAPHICS_CLOCK, STORE_METRIC_GRAPHICS_CLOCK, sample->graphics_clock_mhz},
+            {ENVYD_TELEMETRY_HAS_SM_CLOCK, STORE_METRIC_SM_CLOCK, sample->sm_clock_mhz},
+            {ENVYD_TELEMETRY_HAS_MEMORY_CLOCK, STORE_METRIC_MEMORY_CLOCK, sample->memory_clock_mhz},
+            {ENVYD_TELEMETRY_HAS_FAN_SPEED, STORE_METRIC_FAN_SPEED, sample->fan_speed_percent},
+            {ENVYD_TELEMETRY_HAS_MEMORY, STORE_METRIC_MEMORY_USED, (int64_t) sample->memory_used},
+        };
+
+        pthread_mutex_lock(&device->lock);
+        for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); ++v) {
+            if (!(sample->valid & values[v].flag)) continue;
+            series_append(&device->metrics[values[v].metric], now, values[v].value);
+            series_drop_before(&device->metrics[values[v].metric], now - retention_ms);
+        }
+        pthread_mutex_unlock(&device->lock);
+    }
+}
+
+void series_start(void) {
+    long long retention_s = SERIES_DEFAULT_RETENTION_S;
+    const char *configured = getenv("ENVYD_SERIES_RETENTION_S");
+    if (configured != NULL) retention_s = strtoll(configured, NULL, 10);
+    if (retention_s <= 0) {
+        LOG_INFO("In-memory series disabled via ENVYD_SERIES_RETENTION_S");
+        return;
+    }
+
+    retention_ms = retention_s * 1000;
+    telemetry_add_listener(append);
+    LOG_INFO("Keeping %lld s of compressed series in memory", retention_s);
+}
+
+void series_stop(void) {
+    pthread_mutex_lock(&devices_lock);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        for (int metric = 0; metric < STORE_METRIC_COUNT; ++metric) series_free(&devices[i].metrics[metric]);
+        pthread_mutex_destroy(&devices[i].lock);
+    }
+    free(devices);
+    devices = NULL;
+    device_count = 0;
+    pthread_mutex_unlock(&devices_lock);
+}
+
+static void write_bucket(FILE *out, bool *first, const int64_t bucket, const seriesAggregate_st *aggregate) {
+    if (aggregate->count == 0) return;
+    fprintf(out, "%s[%lld, %.10g, %lld, %lld, %llu]", *first ? "" : ", ", (long long) bucket,
+            aggregate->sum / (double) aggregate->count, (long long) aggregate->min, (long long) aggregate->max,
+            (unsigned long long) aggregate->count);
+    *first = false;
+}
+
+int series_query(const char *uuid, const char *metric_s, const int64_t from, const int64_t to, const int64_t step, FILE *out) {
+    const storeMetric_t metric = store_metric_from_string(metric_s);
+    if (metric == STORE_METRIC_COUNT) return -1;
+
+    pthread_mutex_lock(&devices_lock);
+    seriesDevice_st *device = NULL;
+    for (unsigned int i = 0; i < device_count; ++i) {
+        if (strcmp(devices[i].uuid, uuid) == 0) device = &devices[i];
+    }
+    if (device == NULL) {
+        pthread_mutex_unlock(&devices_lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&device->lock);
+    fprintf(out, "{\"metric\": \"%s\", \"step\": %lld, \"points\": [", metric_s, (long long) step);
+    seriesIterator_st iterator;
+    series_iterator_init(&iterator, &device->metrics[metric], from, to);
+    int64_t timestamp, value;
+    bool first = true;
+    if (step <= 0) {
+        while (series_iterator_next(&iterator, &timestamp, &value)) {
+            fprintf(out, "%s[%lld, %lld]", first ? "" : ", ", (long long) timestamp, (long long) value);
+            first = false;
+        }
+    } else {
+        // one pass; buckets are aligned to multiples of step
+        int64_t bucket = 0;
+        seriesAggregate_st aggregate = {0};
+        while (series_iterator_next(&iterator, &timestamp, &value)) {
+            const int64_t current = timestamp - timestamp % step;
+            if (current != bucket) {
+                write_bucket(out, &first, bucket, &aggregate);
+                memset(&aggregate, 0, sizeof(aggregate));
+                bucket = current;
+            }
+            if (aggregate.count == 0 || value < aggregate.min) aggregate.min = value;
+            if (aggregate.count == 0 || value > aggregate.max) aggregate.max = value;
+            aggregate.sum += (double) value;
+            ++aggregate.count;
+        }
+        write_bucket(out, &first, bucket, &aggregate);
+    }
+    fprintf(out, "]}");
+    pthread_mutex_unlock(&device->lock);
+    pthread_mutex_unlock(&devices_lock);
+    return 0;
+}
+
+void series_stats(FILE *out) {
+    uint64_t samples = 0;
+    size_t bytes = 0;
+    pthread_mutex_lock(&devices_lock);
+    for (unsigned int i = 0; i < device_count; ++i) {
+        pthread_mutex_lock(&devices[i].lock);
+        for (int metric = 0; metric < STORE_METRIC_COUNT; ++metric) {
+            samples += devices[i].metrics[metric].sample_count;
+            bytes += series_bytes(&devices[i].metrics[metric]);
+        }
+        pthread_mutex_unlock(&devices[i].lock);
+    }
+    pthread_mutex_unlock(&devices_lock);
+
+    fprintf(out, "{\"samples\": %llu, \"bytes\": %zu, \"bytesPerSample\": %.3f}",
+            (unsigned long long) samples, bytes, samples > 0 ? (double) bytes / (double) samples : 0.0);
+}
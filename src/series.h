@@ -0,0 +1,101 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SERIES_BLOCK_SAMPLES 1024  // a block is sealed (and shrunk to fit) after this many samples
+#define SERIES_DEFAULT_RETENTION_S (7 * 24 * 60 * 60)
+
+// Gorilla-style compressed block: the first sample is kept verbatim, every following one is encoded as
+//  timestamp: delta-of-delta, '0' if unchanged, else a 2-5 bit prefix selecting a 7/9/12/32/64 bit zigzag field
+//  value: delta (integers only), '0' if unchanged, else a 2-5 bit prefix selecting a 6/12/20/32/64 bit zigzag field
+// A steady sampling interval plus a slowly changing value costs 2 bits per sample.
+typedef struct seriesBlock_st {
+    int64_t first_timestamp;
+    int64_t first_value;
+    int64_t last_timestamp;  // encoder state, also bounds the block for range queries
+    int64_t last_delta;
+    int64_t last_value;
+    uint32_t count;
+    size_t bit_count;
+    size_t capacity;  // bytes allocated in bits
+    uint8_t *bits;
+    struct seriesBlock_st *next;  // newer
+} seriesBlock_st;
+
+typedef struct series_st {
+    seriesBlock_st *oldest;
+    seriesBlock_st *newest;  // the only block still being appended to
+    size_t block_count;
+    uint64_t sample_count;
+} series_st;
+
+typedef struct seriesIterator_st {
+    const seriesBlock_st *block;
+    int64_t from;
+    int64_t to;
+    // decoder state within block
+    uint32_t index;
+    size_t bit;
+    int64_t timestamp;
+    int64_t delta;
+    int64_t value;
+} seriesIterator_st;
+
+typedef struct seriesAggregate_st {
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    double sum;
+} seriesAggregate_st;
+
+/**
+ * @param timestamp must not decrease between calls
+ * @return false on allocation failure (the sample is dropped)
+ */
+bool series_append(series_st *series, const int64_t timestamp, const int64_t value);
+
+/**
+ * Frees every block whose newest sample is older than before.
+ */
+void series_drop_before(series_st *series, const int64_t before);
+void series_free(series_st *series);
+
+/**
+ * Encoded size, including block headers.
+ */
+size_t series_bytes(const series_st *series);
+
+/**
+ * Decodes [from, to] on the fly, skipping blocks entirely outside of it. The series must not be modified meanwhile.
+ */
+void series_iterator_init(seriesIterator_st *iterator, const series_st *series, const int64_t from, const int64_t to);
+bool series_iterator_next(seriesIterator_st *iterator, int64_t *timestamp /*out*/, int64_t *value /*out*/);
+
+void series_aggregate(const series_st *series, const int64_t from, const int64_t to, seriesAggregate_st *aggregate /*out*/);
+
+/**
+ * Keeps the last ENVYD_SERIES_RETENTION_S (default a week) of every sampled metric of every device in memory,
+ * as a telemetry listener (so before telemetry_start). ENVYD_SERIES_RETENTION_S=0 disables it.
+ */
+void series_start(void);
+void series_stop(void);
+
+/**
+ * Writes metric (a store.h metric name) of uuid within [from, to] (unix milliseconds) to out, as
+ * {"metric": ..., "step": ..., "points": [...]}: [timestamp, value] pairs if step is 0,
+ * otherwise one [bucket start, avg, min, max, count] per non-empty step-wide bucket.
+ *
+ * @return 0 on success, -1 if series are disabled or uuid/metric are unknown
+ */
+int series_query(const char *uuid, const char *metric, const int64_t from, const int64_t to, const int64_t step, FILE *out);
+
+/**
+ * Writes {"samples": ..., "bytes": ..., "bytesPerSample": ...} over every series to out.
+ */
+void series_stats(FILE *out);
+
+#endif
@@ -0,0 +1,208 @@
+#include "setters.h"
+#include "helpers.h"
+#include "powerctl.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <string.h>
+
+static const char *kind_names[SETTER_KIND_COUNT] = {
+    "powerLimit", "gpuLockedClocks", "memoryLockedClocks", "applicationsClocks", "clockOffset", "temperatureThreshold"
+};
+
+setterKind_t setters_kind_from_string(const char *kind) {
+    for (int i = 0; i < SETTER_KIND_COUNT; ++i) {
+        if (strcmp(kind_names[i], kind) == 0) return (setterKind_t) i;
+    }
+    return SETTER_KIND_COUNT;
+}
+
+const char *setters_kind_to_string(const setterKind_t kind) {
+    return kind < SETTER_KIND_COUNT ? kind_names[kind] : "unknown";
+}
+
+static nvmlReturn_t set_power_limit(const nvmlDevice_t device, const unsigned int limit_mw) {
+    nvmlPowerValue_v2_t power_value_s = {0};
+    power_value_s.version = nvmlPowerValue_v2;
+    power_value_s.powerScope = NVML_POWER_SCOPE_GPU;
+    power_value_s.powerValueMw = limit_mw;
+    return NVML_CALL(nvmlDeviceSetPowerManagementLimit_v2, device, &power_value_s);
+}
+
+static nvmlReturn_t set_clock_offset(const nvmlDevice_t device, const nvmlClockType_t type, const nvmlPstates_t pstate, const int offset_mhz) {
+    nvmlClockOffset_t info = {0};
+    info.version = NVML_STRUCT_VERSION(ClockOffset, 1);
+    info.type = type;
+    info.pstate = pstate;
+    info.clockOffsetMHz = offset_mhz;
+    return NVML_CALL(nvmlDeviceSetClockOffsets, device, &info);
+}
+
+static nvmlReturn_t snapshot(setterOperation_st *op) {
+    switch (op->kind) {
+        case SETTER_POWER_LIMIT:
+            return NVML_CALL(nvmlDeviceGetPowerManagementLimit, op->device, &op->snapshot.a);
+        case SETTER_GPU_LOCKED_CLOCKS:
+        case SETTER_MEMORY_LOCKED_CLOCKS:
+            // NVML has no getter for these; undoing them resets
+            return NVML_SUCCESS;
+        case SETTER_APPLICATIONS_CLOCKS: {
+            const nvmlReturn_t result = NVML_CALL(nvmlDeviceGetApplicationsClock, op->device, NVML_CLOCK_MEM, &op->snapshot.a);
+            if (result != NVML_SUCCESS) return result;
+            return NVML_CALL(nvmlDeviceGetApplicationsClock, op->device, NVML_CLOCK_GRAPHICS, &op->snapshot.b);
+        }
+        case SETTER_CLOCK_OFFSET: {
+            nvmlClockOffset_t info = {0};
+            info.version = NVML_STRUCT_VERSION(ClockOffset, 1);
+            info.type = op->clock_type;
+            info.pstate = op->pstate;
+            const nvmlReturn_t result = NVML_CALL(nvmlDeviceGetClockOffsets, op->device, &info);
+            op->snapshot.value = info.clockOffsetMHz;
+            return result;
+        }
+        case SETTER_TEMPERATURE_THRESHOLD: {
+            unsigned int temperature_c = 0;
+            const nvmlReturn_t result = NVML_CALL(nvmlDeviceGetTemperatureThreshold, op->device, op->threshold, &temperature_c);
+            op->snapshot.value = (int) temperature_c;
+            return result;
+        }
+        default:
+            return NVML_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+static nvmlReturn_t apply(setterOperation_st *op) {
+    switch (op->kind) {
+        case SETTER_POWER_LIMIT:
+            return set_power_limit(op->device, op->a);
+        case SETTER_GPU_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetGpuLockedClocks, op->device, op->a, op->b);
+        case SETTER_MEMORY_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetMemoryLockedClocks, op->device, op->a, op->b);
+        case SETTER_APPLICATIONS_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetApplicationsClocks, op->device, op->a, op->b);
+        case SETTER_CLOCK_OFFSET:
+            return set_clock_offset(op->device, op->clock_type, op->pstate, op->value);
+        case SETTER_TEMPERATURE_THRESHOLD: {
+            int temperature_c = op->value;
+            return NVML_CALL(nvmlDeviceSetTemperatureThreshold, op->device, op->threshold, &temperature_c);
+        }
+        default:
+            return NVML_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+static nvmlReturn_t undo(setterOperation_st *op) {
+    switch (op->kind) {
+        case SETTER_POWER_LIMIT:
+            return set_power_limit(op->device, op->snapshot.a);
+        case SETTER_GPU_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceResetGpuLockedClocks, op->device);
+        case SETTER_MEMORY_LOCKED_CLOCKS:
+            return NVML_CALL(nvmlDeviceResetMemoryLockedClocks, op->device);
+        case SETTER_APPLICATIONS_CLOCKS:
+            return NVML_CALL(nvmlDeviceSetApplicationsClocks, op->device, op->snapshot.a, op->snapshot.b);
+        case SETTER_CLOCK_OFFSET:
+            return set_clock_offset(op->device, op->clock_type, op->pstate, op->snapshot.value);
+        case SETTER_TEMPERATURE_THRESHOLD: {
+            int temperature_c = op->snapshot.value;
+            return NVML_CALL(nvmlDeviceSetTemperatureThreshold, op->device, op->threshold, &temperature_c);
+        }
+        default:
+            return NVML_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+typedef nvmlReturn_t (*settersStep_t)(setterOperation_st *op);
+
+// what on_device hands to the device's context
+typedef struct settersTask_st {
+    setterOperation_st op;
+    settersStep_t step;
+    nvmlReturn_t result;
+} settersTask_st;
+
+static void run_step(void *arg) {
+    settersTask_st *task = arg;
+    task->result = task->step(&task->op);
+}
+
+/**
+ * Runs step on op's device context; operations span devices, so apply isn't a request any one context runs.
+ *
+ * @return what step returned, NVML_ERROR_TIMEOUT if the device is degraded or didn't answer in time
+ */
+static nvmlReturn_t on_device(setterOperation_st *op, const settersStep_t step) {
+    settersTask_st task = {.op = *op, .step = step};
+    const nvmlReturn_t result = watchdog_device_call(op->device, run_step, &task, sizeof(task));
+    if (result != NVML_SUCCESS) return result;
+    op->snapshot = task.op.snapshot;
+    return task.result;
+}
+
+nvmlReturn_t setters_apply(setterOperation_st *operations, const unsigned int count) {
+    for (unsigned int i = 0; i < count; ++i) {
+        operations[i].attempted = false;
+        operations[i].rolled_back = false;
+        operations[i].result = NVML_SUCCESS;
+        operations[i].rollback_result = NVML_SUCCESS;
+    }
+
+    // the node power budget owns the limit of its devices
+    for (unsigned int i = 0; i < count; ++i) {
+        setterOperation_st *op = &operations[i];
+        if (op->kind != SETTER_POWER_LIMIT || !powerctl_controls(op->device)) continue;
+        LOG_ERROR("Power limit of %s belongs to the node power budget, nothing applied", op->uuid);
+        op->attempted = true;
+        op->result = NVML_ERROR_IN_USE;
+        return NVML_ERROR_IN_USE;
+    }
+
+    // every snapshot before the first change, so an operation repeated on the same setting still restores the original
+    for (unsigned int i = 0; i < count; ++i) {
+        setterOperation_st *op = &operations[i];
+        const nvmlReturn_t result = on_device(op, snapshot);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't read %s of %s before applying (%s), nothing applied", kind_names[op->kind], op->uuid,
+                      map_nvmlReturn_t_to_string(result));
+            op->attempted = true;
+            op->result = result;
+            return result;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        setterOperation_st *op = &operations[i];
+        op->attempted = true;
+        op->result = on_device(op, apply);
+        if (op->result == NVML_SUCCESS) continue;
+
+        LOG_ERROR("Couldn't apply %s to %s (%s), rolling back %u operation(s)", kind_names[op->kind], op->uuid,
+                  map_nvmlReturn_t_to_string(op->result), i);
+        for (unsigned int j = i; j-- > 0;) {
+            setterOperation_st *done = &operations[j];
+            done->rolled_back = true;
+            done->rollback_result = on_device(done, undo);
+            if (done->rollback_result != NVML_SUCCESS) {
+                LOG_ERROR("Couldn't roll back %s of %s (%s)", kind_names[done->kind], done->uuid,
+                          map_nvmlReturn_t_to_string(done->rollback_result));
+            }
+        }
+        return op->result;
+    }
+    LOG_INFO("Applied %u operation(s)", count);
+    return NVML_SUCCESS;
+}
+
+void setters_write_results(FILE *out, const setterOperation_st *operations, const unsigned int count) {
+    fputc('[', out);
+    for (unsigned int i = 0; i < count; ++i) {
+        const setterOperation_st *op = &operations[i];
+        fprintf(out, "%s{\"op\": \"%s\", \"uuid\": \"%s\", \"status\": ", i == 0 ? "" : ", ", kind_names[op->kind], op->uuid);
+        if (op->attempted) fprintf(out, "\"%s\"", map_nvmlReturn_t_to_string(op->result));
+        else fputs("null", out);
+        fprintf(out, ", \"rolledBack\": %s, \"rollbackStatus\": ", op->rolled_back ? "true" : "false");
+        if (op->rolled_back) fprintf(out, "\"%s\"}", map_nvmlReturn_t_to_string(op->rollback_result));
+        else fputs("null}", out);
+    }
+    fputc(']', out);
+}
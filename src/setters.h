@@ -0,0 +1,64 @@
+#ifndef SETTERS_H
+#define SETTERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <nvml.h>
+
+#define SETTERS_MAX_OPERATIONS 64
+
+typedef enum setterKind_enum {
+    SETTER_POWER_LIMIT = 0,  // a: mW
+    SETTER_GPU_LOCKED_CLOCKS,  // a, b: min, max MHz
+    SETTER_MEMORY_LOCKED_CLOCKS,  // a, b: min, max MHz
+    SETTER_APPLICATIONS_CLOCKS,  // a, b: memory, graphics MHz
+    SETTER_CLOCK_OFFSET,  // clock_type, pstate, value: MHz
+    SETTER_TEMPERATURE_THRESHOLD,  // threshold, value: C
+    SETTER_KIND_COUNT
+} setterKind_t;
+
+typedef struct setterOperation_st {
+    setterKind_t kind;
+    nvmlDevice_t device;
+    char uuid[96];
+
+    unsigned int a, b;
+    int value;
+    nvmlClockType_t clock_type;
+    nvmlPstates_t pstate;
+    nvmlTemperatureThresholds_t threshold;
+
+    // filled in by setters_apply
+    struct {
+        unsigned int a, b;
+        int value;
+    } snapshot;
+    bool attempted;
+    nvmlReturn_t result;
+    bool rolled_back;
+    nvmlReturn_t rollback_result;
+} setterOperation_st;
+
+/**
+ * @return SETTER_KIND_COUNT if kind is none of powerLimit, gpuLockedClocks, memoryLockedClocks, applicationsClocks,
+ *  clockOffset, temperatureThreshold
+ */
+setterKind_t setters_kind_from_string(const char *kind);
+const char *setters_kind_to_string(setterKind_t kind);
+
+/**
+ * Reads the current value behind every operation, then applies them in order. If any fails, the ones already applied
+ * are undone in reverse order, so the devices end up as they were. Locked clocks can't be read back; undoing them resets
+ * them to the driver's default.
+ *
+ * @return NVML_SUCCESS, or the result of the operation that failed (snapshotting included; nothing is applied then)
+ */
+nvmlReturn_t setters_apply(setterOperation_st *operations, unsigned int count);
+
+/**
+ * Writes [{"op": ..., "uuid": ..., "status": ..., "rolledBack": ..., "rollbackStatus": ...}, ...] to out;
+ * status is null for operations never attempted.
+ */
+void setters_write_results(FILE *out, const setterOperation_st *operations, unsigned int count);
+
+#endif
@@ -0,0 +1,298 @@
+#include "store.h"
+#include "telemetry.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const struct {
+    uint32_t resolution;
+    uint32_t capacity;
+} tier_layout[STORE_TIER_COUNT] = {
+    [STORE_TIER_RAW] = {1, 6 * 60 * 60},
+    [STORE_TIER_MINUTE] = {60, 30 * 24 * 60},
+    [STORE_TIER_HOUR] = {60 * 60, 365 * 24},
+};
+
+static const char *metric_names[STORE_METRIC_COUNT] = {
+    [STORE_METRIC_POWER] = "power",
+    [STORE_METRIC_POWER_LIMIT] = "powerLimit",
+    [STORE_METRIC_TEMPERATURE] = "temperature",
+    [STORE_METRIC_GRAPHICS_CLOCK] = "graphicsClock",
+    [STORE_METRIC_SM_CLOCK] = "smClock",
+    [STORE_METRIC_MEMORY_CLOCK] = "memoryClock",
+    [STORE_METRIC_FAN_SPEED] = "fanSpeed",
+    [STORE_METRIC_MEMORY_USED] = "memoryUsed",
+};
+
+// bucket being filled, in memory only; a partial bucket is lost on restart
+typedef struct storeAccumulator_st {
+    int64_t bucket;
+    uint32_t count;
+    uint32_t n[STORE_METRIC_COUNT];
+    double sum[STORE_METRIC_COUNT];
+    float min[STORE_METRIC_COUNT];
+    float max[STORE_METRIC_COUNT];
+} storeAccumulator_st;
+
+typedef struct storeFile_st {
+    storeHeader_st *header;  // whole file is mapped
+    size_t size;
+    storeAccumulator_st accumulators[STORE_TIER_COUNT];
+} storeFile_st;
+
+static char *directory = NULL;
+static storeFile_st *files = NULL;  // by device index; header NULL until the first sample
+static unsigned int file_count = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;  // only guards growing/tearing down files
+
+static size_t file_size(void) {
+    size_t size = STORE_HEADER_SIZE;
+    for (int tier = 0; tier < STORE_TIER_COUNT; ++tier) size += (size_t) tier_layout[tier].capacity * sizeof(storeRecord_st);
+    return size;
+}
+
+static bool header_matches(const storeHeader_st *header, const char *uuid) {
+    if (header->magic != STORE_MAGIC || header->version != STORE_VERSION) return false;
+    if (header->record_size != sizeof(storeRecord_st) || header->tier_count != STORE_TIER_COUNT) return false;
+    if (strncmp(header->uuid, uuid, sizeof(header->uuid)) != 0) return false;
+    for (int tier = 0; tier < STORE_TIER_COUNT; ++tier) {
+        if (header->tiers[tier].resolution != tier_layout[tier].resolution) return false;
+        if (header->tiers[tier].capacity != tier_layout[tier].capacity) return false;
+    }
+    return true;
+}
+
+/**
+ * Maps <directory>/<uuid>.envyd, creating (or, on a layout mismatch, recreating) it.
+ */
+static bool open_file(storeFile_st *file, const char *uuid) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.envyd", directory, uuid);
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Couldn't open store file '%s': %s", path, strerror(errno));
+        return false;
+    }
+    const size_t size = file_size();
+    struct stat st;
+    const bool fresh = fstat(fd, &st) != 0 || (size_t) st.st_size != size;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) size) != 0)) {
+        LOG_ERROR("Couldn't size store file '%s': %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Couldn't map store file '%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    storeHeader_st *header = map;
+    if (fresh || !header_matches(header, uuid)) {
+        if (!fresh) LOG_WARNING("Store file '%s' has a different layout, starting over", path);
+        memset(map, 0, STORE_HEADER_SIZE);
+        header->record_size = sizeof(storeRecord_st);
+        header->tier_count = STORE_TIER_COUNT;
+        strncpy(header->uuid, uuid, sizeof(header->uuid) - 1);
+        uint64_t offset = STORE_HEADER_SIZE;
+        for (int tier = 0; tier < STORE_TIER_COUNT; ++tier) {
+            header->tiers[tier].resolution = tier_layout[tier].resolution;
+            header->tiers[tier].capacity = tier_layout[tier].capacity;
+            header->tiers[tier].offset = offset;
+            header->tiers[tier].head = 0;
+            offset += (uint64_t) tier_layout[tier].capacity * sizeof(storeRecord_st);
+        }
+        header->version = STORE_VERSION;
+        header->magic = STORE_MAGIC;
+    } else {
+        LOG_INFO("Resuming store file '%s' (%llu raw records)", path, (unsigned long long) header->tiers[STORE_TIER_RAW].head);
+    }
+
+    file->header = header;
+    file->size = size;
+    for (int tier = 0; tier < STORE_TIER_COUNT; ++tier) file->accumulators[tier].bucket = -1;
+    return true;
+}
+
+static storeRecord_st *get_record(const storeHeader_st *header, const storeTier_t tier, const uint64_t position) {
+    const storeTierHeader_st *tier_header = &header->tiers[tier];
+    return (storeRecord_st *) ((char *) header + tier_header->offset
+                               + (position % tier_header->capacity) * sizeof(storeRecord_st));
+}
+
+static void flush_accumulator(storeHeader_st *header, const storeTier_t tier, const storeAccumulator_st *accumulator) {
+    if (accumulator->bucket < 0 || accumulator->count == 0) return;
+
+    const uint64_t head = header->tiers[tier].head;  // single writer
+    storeRecord_st *record = get_record(header, tier, head);
+    record->timestamp = accumulator->bucket;
+    record->count = accumulator->count;
+    record->valid = 0;
+    for (int metric = 0; metric < STORE_METRIC_COUNT; ++metric) {
+        if (accumulator->n[metric] == 0) {
+            record->values[metric] = (storeAggregate_st) {0};
+            continue;
+        }
+        record->valid |= 1u << metric;
+        record->values[metric].avg = (float) (accumulator->sum[metric] / accumulator->n[metric]);
+        record->values[metric].min = accumulator->min[metric];
+        record->values[metric].max = accumulator->max[metric];
+    }
+    // the record is complete before it becomes visible to store_query
+    __atomic_store_n(&header->tiers[tier].head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void accumulate(storeAccumulator_st *accumulator, const storeMetric_t metric, const bool valid, const double value) {
+    if (!valid) return;
+    const float f = (float) value;
+    if (accumulator->n[metric] == 0 || f < accumulator->min[metric]) accumulator->min[metric] = f;
+    if (accumulator->n[metric] == 0 || f > accumulator->max[metric]) accumulator->max[metric] = f;
+    accumulator->sum[metric] += value;
+    ++accumulator->n[metric];
+}
+
+static void record_sample(storeFile_st *file, const envydTelemetrySlot_st *sample, const int64_t now) {
+    for (int tier = 0; tier < STORE_TIER_COUNT; ++tier) {
+        storeAccumulator_st *accumulator = &file->accumulators[tier];
+        const int64_t bucket = now - now % tier_layout[tier].resolution;
+        if (bucket != accumulator->bucket) {
+            flush_accumulator(file->header, tier, accumulator);
+            memset(accumulator, 0, sizeof(storeAccumulator_st));
+            accumulator->bucket = bucket;
+        }
+
+        ++accumulator->count;
+        accumulate(accumulator, STORE_METRIC_POWER, sample->valid & ENVYD_TELEMETRY_HAS_POWER, sample->power_mw);
+        accumulate(accumulator, STORE_METRIC_POWER_LIMIT, sample->valid & ENVYD_TELEMETRY_HAS_POWER_LIMIT, sample->power_limit_mw);
+        accumulate(accumulator, STORE_METRIC_TEMPERATURE, sample->valid & ENVYD_TELEMETRY_HAS_TEMPERATURE, sample->temperature_c);
+        accumulate(accumulator, STORE_METRIC_GRAPHICS_CLOCK, sample->valid & ENVYD_TELEMETRY_HAS_GRAPHICS_CLOCK, sample->graphics_clock_mhz);
+        accumulate(accumulator, STORE_METRIC_SM_CLOCK, sample->valid & ENVYD_TELEMETRY_HAS_SM_CLOCK, sample->sm_clock_mhz);
+        accumulate(accumulator, STORE_METRIC_MEMORY_CLOCK, sample->valid & ENVYD_TELEMETRY_HAS_MEMORY_CLOCK, sample->memory_clock_mhz);
+        accumulate(accumulator, STORE_METRIC_FAN_SPEED, sample->valid & ENVYD_TELEMETRY_HAS_FAN_SPEED, sample->fan_speed_percent);
+        accumulate(accumulator, STORE_METRIC_MEMORY_USED, sample->valid & ENVYD_TELEMETRY_HAS_MEMORY, (double) sample->memory_used);
+    }
+}
+
+/**
+ * Telemetry listener; feeds every tier's current bucket, writing a record whenever a bucket closes.
+ */
+static void record(const envydTelemetrySlot_st *samples, const unsigned int count) {
+    if (files == NULL) {
+        storeFile_st *created = calloc(count > 0 ? count : 1, sizeof(storeFile_st));
+        if (created == NULL) return;
+        pthread_mutex_lock(&files_lock);
+        files = created;
+        file_count = count;
+        pthread_mutex_unlock(&files_lock);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    for (unsigned int i = 0; i < count && i < file_count; ++i) {
+        if (samples[i].uuid[0] == 0) continue;  // unresolved device
+        if (files[i].header == NULL) {
+            pthread_mutex_lock(&files_lock);
+            const bool opened = open_file(&files[i], samples[i].uuid);
+            pthread_mutex_unlock(&files_lock);
+            if (!opened) continue;
+        }
+        record_sample(&files[i], &samples[i], (int64_t) ts.tv_sec);
+    }
+}
+
+void store_start(void) {
+    const char *configured = getenv("ENVYD_STORE_DIR");
+    if (configured == NULL) configured = STORE_DEFAULT_DIRECTORY;
+    if (*configured == 0) {
+        LOG_INFO("Telemetry store disabled via empty ENVYD_STORE_DIR");
+        return;
+    }
+    if (mkdir(configured, 0755) != 0 && errno != EEXIST) {
+        LOG_WARNING("Couldn't create store directory '%s' (%s), telemetry store disabled", configured, strerror(errno));
+        return;
+    }
+
+    directory = strdup(configured);
+    telemetry_add_listener(record);
+    LOG_INFO("Persisting telemetry to '%s'", directory);
+}
+
+void store_stop(void) {
+    pthread_mutex_lock(&files_lock);
+    for (unsigned int i = 0; i < file_count; ++i) {
+        if (files[i].header == NULL) continue;
+        msync(files[i].header, files[i].size, MS_SYNC);
+        munmap(files[i].header, files[i].size);
+        files[i].header = NULL;
+    }
+    free(files);
+    files = NULL;
+    file_count = 0;
+    pthread_mutex_unlock(&files_lock);
+    free(directory);
+    directory = NULL;
+}
+
+storeMetric_t store_metric_from_string(const char *metric) {
+    for (int idx = 0; idx < STORE_METRIC_COUNT; ++idx) {
+        if (strcmp(metric, metric_names[idx]) == 0) return idx;
+    }
+    return STORE_METRIC_COUNT;
+}
+
+storeTier_t store_tier_from_string(const char *tier) {
+    if (strcmp(tier, "raw") == 0) return STORE_TIER_RAW;
+    if (strcmp(tier, "minute") == 0) return STORE_TIER_MINUTE;
+    if (strcmp(tier, "hour") == 0) return STORE_TIER_HOUR;
+    return STORE_TIER_COUNT;
+}
+
+int store_query(const char *uuid, const storeMetric_t metric, const int64_t from, const int64_t to,
+                storeTier_t tier, FILE *out) {
+    pthread_mutex_lock(&files_lock);
+    const storeHeader_st *header = NULL;
+    for (unsigned int i = 0; i < file_count; ++i) {
+        if (files[i].header != NULL && strcmp(files[i].header->uuid, uuid) == 0) header = files[i].header;
+    }
+    if (header == NULL) {
+        pthread_mutex_unlock(&files_lock);
+        return -1;
+    }
+
+    if (tier >= STORE_TIER_COUNT) {
+        // finest tier whose retention reaches back to from; the coarsest one otherwise
+        const int64_t now = time(NULL);
+        for (tier = STORE_TIER_RAW; tier < STORE_TIER_HOUR; ++tier) {
+            if (now - from <= (int64_t) tier_layout[tier].resolution * tier_layout[tier].capacity) break;
+        }
+    }
+
+    // the slot at head % capacity (the oldest, once wrapped) may be mid-write, skip it
+    const uint64_t head = __atomic_load_n(&header->tiers[tier].head, __ATOMIC_ACQUIRE);
+    const uint64_t capacity = header->tiers[tier].capacity;
+    const uint64_t oldest = head > capacity - 1 ? head - (capacity - 1) : 0;
+
+    fprintf(out, "{\"metric\": \"%s\", \"resolution\": %u, \"points\": [", metric_names[metric], header->tiers[tier].resolution);
+    bool first = true;
+    for (uint64_t position = oldest; position < head; ++position) {
+        const storeRecord_st *record = get_record(header, tier, position);
+        if (record->timestamp + header->tiers[tier].resolution <= from || record->timestamp > to) continue;
+        if (!(record->valid & (1u << metric))) continue;
+        fprintf(out, "%s[%lld, %.9g, %.9g, %.9g]", first ? "" : ", ", (long long) record->timestamp,
+                record->values[metric].avg, record->values[metric].min, record->values[metric].max);
+        first = false;
+    }
+    fprintf(out, "]}");
+    pthread_mutex_unlock(&files_lock);
+    return 0;
+}
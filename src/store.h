@@ -0,0 +1,95 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define STORE_DEFAULT_DIRECTORY "/var/lib/envyd"
+#define STORE_MAGIC 0x54535645u  // "EVST", little endian
+#define STORE_VERSION 1u
+#define STORE_HEADER_SIZE 4096  // records start page aligned
+
+typedef enum storeMetric_enum: unsigned char {
+    STORE_METRIC_POWER = 0,  // mW
+    STORE_METRIC_POWER_LIMIT,  // mW
+    STORE_METRIC_TEMPERATURE,  // C
+    STORE_METRIC_GRAPHICS_CLOCK,  // MHz
+    STORE_METRIC_SM_CLOCK,  // MHz
+    STORE_METRIC_MEMORY_CLOCK,  // MHz
+    STORE_METRIC_FAN_SPEED,  // %
+    STORE_METRIC_MEMORY_USED,  // bytes
+    STORE_METRIC_COUNT
+} storeMetric_t;
+
+typedef enum storeTier_enum: unsigned char {
+    STORE_TIER_RAW = 0,  // 1 s for 6 hours
+    STORE_TIER_MINUTE,  // 1 min for 30 days
+    STORE_TIER_HOUR,  // 1 h for a year
+    STORE_TIER_COUNT
+} storeTier_t;
+
+typedef struct storeAggregate_st {
+    float avg;
+    float min;
+    float max;
+} storeAggregate_st;
+
+// one bucket of one tier; fixed size, read in place from the mapping
+typedef struct storeRecord_st {
+    int64_t timestamp;  // unix seconds, start of the bucket
+    uint32_t count;  // samples aggregated into this bucket
+    uint32_t valid;  // bit (1 << storeMetric_t) set if values[metric] holds anything
+    storeAggregate_st values[STORE_METRIC_COUNT];
+} storeRecord_st;
+
+typedef struct storeTierHeader_st {
+    uint32_t resolution;  // seconds per record
+    uint32_t capacity;  // records in the ring
+    uint64_t offset;  // of the first record, from the start of the file
+    uint64_t head;  // records ever written; the next one goes to head % capacity
+} storeTierHeader_st;
+
+// start of every <uuid>.envyd file; files w/ a different layout are recreated
+typedef struct storeHeader_st {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t tier_count;
+    char uuid[96];
+    storeTierHeader_st tiers[STORE_TIER_COUNT];
+} storeHeader_st;
+
+/**
+ * Registers the recorder w/ the telemetry sampler (so before telemetry_start).
+ * Files live in ENVYD_STORE_DIR (default STORE_DEFAULT_DIRECTORY); an empty ENVYD_STORE_DIR disables the store.
+ */
+void store_start(void);
+
+/**
+ * Flushes and unmaps every file; the sampler must be stopped already.
+ */
+void store_stop(void);
+
+/**
+ * @return STORE_METRIC_COUNT if metric isn't one of "power", "powerLimit", "temperature", "graphicsClock", "smClock",
+ *  "memoryClock", "fanSpeed", "memoryUsed"
+ */
+storeMetric_t store_metric_from_string(const char *metric);
+
+/**
+ * @return STORE_TIER_COUNT if tier isn't one of "raw", "minute", "hour"
+ */
+storeTier_t store_tier_from_string(const char *tier);
+
+/**
+ * Writes the records of uuid overlapping [from, to] to out, as
+ * {"metric": "power", "resolution": 60, "points": [[timestamp, avg, min, max], ...]}.
+ * Records are read in place from the mapping.
+ *
+ * @param tier STORE_TIER_COUNT picks the finest tier whose retention reaches back to from
+ * @return 0 on success, -1 if the store is disabled or uuid has no file
+ */
+int store_query(const char *uuid, const storeMetric_t metric, const int64_t from, const int64_t to,
+                storeTier_t tier, FILE *out);
+
+#endif
@@ -0,0 +1,300 @@
+#include "telemetry.h"
+#include "envyd_telemetry.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <nvml.h>
+
+static envydTelemetryHeader_st *segment = NULL;  // NULL when not publishing, ENVYD_TELEMETRY=0
+static size_t segment_size = 0;
+static nvmlDevice_t *devices = NULL;
+static envydTelemetrySlot_st *samples = NULL;  // latest sample per device, private to the sampler thread
+static unsigned int device_count = 0;
+static unsigned long long interval_us = 0;
+
+static telemetryListener_t listeners[TELEMETRY_MAX_LISTENERS];
+static unsigned int listener_count = 0;
+
+static pthread_t sampler_thread;
+static bool sampler_running = false;
+static bool sampler_stop = false;
+static bool sampler_refresh = false;
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_wake;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static envydTelemetrySlot_st *get_slot(const unsigned int index) {
+    return (envydTelemetrySlot_st *) ((char *) segment + sizeof(envydTelemetryHeader_st) + index * sizeof(envydTelemetrySlot_st));
+}
+
+/**
+ * Does all NVML calls for one device into sample; nothing in shared memory is touched here.
+ */
+static void sample_device(const nvmlDevice_t device, envydTelemetrySlot_st *sample /*out*/) {
+    nvmlReturn_t result;
+    sample->valid = 0;
+    sample->last_error = NVML_SUCCESS;
+
+#define SAMPLE(flag, call) do { \
+        result = call; \
+        if (result == NVML_SUCCESS) sample->valid |= flag; \
+        else sample->last_error = result; \
+    } while (0)
+
+    SAMPLE(ENVYD_TELEMETRY_HAS_POWER, NVML_CALL(nvmlDeviceGetPowerUsage, device, &sample->power_mw));
+    SAMPLE(ENVYD_TELEMETRY_HAS_POWER_LIMIT, NVML_CALL(nvmlDeviceGetPowerManagementLimit, device, &sample->power_limit_mw));
+    SAMPLE(ENVYD_TELEMETRY_HAS_TEMPERATURE, NVML_CALL(nvmlDeviceGetTemperature, device, NVML_TEMPERATURE_GPU, &sample->temperature_c));
+    SAMPLE(ENVYD_TELEMETRY_HAS_GRAPHICS_CLOCK, NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_GRAPHICS, &sample->graphics_clock_mhz));
+    SAMPLE(ENVYD_TELEMETRY_HAS_SM_CLOCK, NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_SM, &sample->sm_clock_mhz));
+    SAMPLE(ENVYD_TELEMETRY_HAS_MEMORY_CLOCK, NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_MEM, &sample->memory_clock_mhz));
+    SAMPLE(ENVYD_TELEMETRY_HAS_FAN_SPEED, NVML_CALL(nvmlDeviceGetFanSpeed_v2, device, 0, &sample->fan_speed_percent));
+
+    nvmlMemory_v2_t memory = {0};
+    memory.version = NVML_STRUCT_VERSION(Memory, 2);
+    SAMPLE(ENVYD_TELEMETRY_HAS_MEMORY, NVML_CALL(nvmlDeviceGetMemoryInfo_v2, device, &memory));
+    sample->memory_total = memory.total;
+    sample->memory_used = memory.used;
+    sample->memory_free = memory.free;
+#undef SAMPLE
+
+    sample->timestamp_ns = monotonic_ns();
+}
+
+typedef struct telemetrySample_st {
+    nvmlDevice_t device;
+    envydTelemetrySlot_st sample;
+} telemetrySample_st;
+
+static void sample_task(void *arg) {
+    telemetrySample_st *task = arg;
+    sample_device(task->device, &task->sample);
+}
+
+/**
+ * Samples on the device's context, so a wedged device only leaves its own slot stale; while it's degraded its slot
+ * says so (nothing valid, NVML_ERROR_TIMEOUT) instead.
+ */
+static void sample_on_context(const nvmlDevice_t device, envydTelemetrySlot_st *sample /*in, out*/) {
+    telemetrySample_st task = {.device = device, .sample = *sample};
+    const nvmlReturn_t result = watchdog_device_call(device, sample_task, &task, sizeof(task));
+    if (result == NVML_SUCCESS) {
+        *sample = task.sample;
+        return;
+    }
+    sample->valid = 0;
+    sample->last_error = result;
+    sample->timestamp_ns = monotonic_ns();
+}
+
+/**
+ * Seqlock write: the sequence is odd for the duration of the copy, readers retry if they observe that or a change.
+ */
+static void publish(envydTelemetrySlot_st *slot, const envydTelemetrySlot_st *sample) {
+    const uint32_t sequence = slot->sequence;  // single writer
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->valid = sample->valid;
+    slot->last_error = sample->last_error;
+    slot->timestamp_ns = sample->timestamp_ns;
+    slot->sample_count = sample->sample_count;
+    slot->power_mw = sample->power_mw;
+    slot->power_limit_mw = sample->power_limit_mw;
+    slot->temperature_c = sample->temperature_c;
+    slot->graphics_clock_mhz = sample->graphics_clock_mhz;
+    slot->sm_clock_mhz = sample->sm_clock_mhz;
+    slot->memory_clock_mhz = sample->memory_clock_mhz;
+    slot->fan_speed_percent = sample->fan_speed_percent;
+    slot->memory_total = sample->memory_total;
+    slot->memory_used = sample->memory_used;
+    slot->memory_free = sample->memory_free;
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void telemetry_add_listener(const telemetryListener_t listener) {
+    assert(!sampler_running); // sanity; the list is read w/o locking by the sampler
+    assert(listener_count < TELEMETRY_MAX_LISTENERS); // sanity
+    listeners[listener_count++] = listener;
+}
+
+static void *sampler(void *arg) {
+    (void) arg;
+    const unsigned long long interval_ns = interval_us * 1000ULL;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    pthread_mutex_lock(&sampler_lock);
+    while (!sampler_stop) {
+        pthread_mutex_unlock(&sampler_lock);
+        for (unsigned int i = 0; i < device_count; ++i) {
+            if (devices[i] == NULL) continue;
+            sample_on_context(devices[i], &samples[i]);
+            ++samples[i].sample_count;
+            if (segment != NULL) publish(get_slot(i), &samples[i]);
+        }
+        for (unsigned int i = 0; i < listener_count; ++i) listeners[i](samples, device_count);
+        pthread_mutex_lock(&sampler_lock);
+
+        // fixed rate; if sampling overran, skip ahead instead of bursting to catch up
+        const unsigned long long now = monotonic_ns();
+        unsigned long long next = (unsigned long long) deadline.tv_sec * 1000000000ULL + deadline.tv_nsec + interval_ns;
+        if (next < now) next = now + interval_ns;
+        deadline.tv_sec = (time_t) (next / 1000000000ULL);
+        deadline.tv_nsec = (long) (next % 1000000000ULL);
+        while (!sampler_stop && !sampler_refresh
+               && pthread_cond_timedwait(&sampler_wake, &sampler_lock, &deadline) != ETIMEDOUT) {}
+        if (sampler_refresh) {
+            // out of band round; the next regular one is scheduled a full interval from now
+            sampler_refresh = false;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&sampler_lock);
+    return NULL;
+}
+
+/**
+ * Creates, sizes and maps the segment, then fills in slots and header from the already resolved devices.
+ */
+static void create_segment(void) {
+    segment_size = sizeof(envydTelemetryHeader_st) + device_count * sizeof(envydTelemetrySlot_st);
+    // world-readable, writable by the daemon only
+    shm_unlink(ENVYD_TELEMETRY_SHM_NAME);
+    const int fd = shm_open(ENVYD_TELEMETRY_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Couldn't create shared memory segment '%s': %s", ENVYD_TELEMETRY_SHM_NAME, strerror(errno));
+        return;
+    }
+    fchmod(fd, 0644);  // regardless of umask
+    if (ftruncate(fd, (off_t) segment_size) != 0) {
+        LOG_ERROR("Couldn't size shared memory segment: %s", strerror(errno));
+        close(fd);
+        shm_unlink(ENVYD_TELEMETRY_SHM_NAME);
+        return;
+    }
+    void *map = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Couldn't map shared memory segment: %s", strerror(errno));
+        shm_unlink(ENVYD_TELEMETRY_SHM_NAME);
+        return;
+    }
+    segment = map;
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        envydTelemetrySlot_st *slot = get_slot(i);
+        slot->index = i;
+        slot->last_error = samples[i].last_error;
+        memcpy(slot->uuid, samples[i].uuid, sizeof(slot->uuid));
+    }
+
+    // header last: readers validate magic before trusting anything else
+    segment->header_size = sizeof(envydTelemetryHeader_st);
+    segment->slot_size = sizeof(envydTelemetrySlot_st);
+    segment->slot_count = device_count;
+    segment->interval_us = (uint32_t) interval_us;
+    segment->pid = getpid();
+    segment->started_ns = monotonic_ns();
+    segment->version = ENVYD_TELEMETRY_VERSION;
+    __atomic_store_n(&segment->magic, ENVYD_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+    LOG_INFO("Publishing telemetry for %u device(s) in shm '%s'", device_count, ENVYD_TELEMETRY_SHM_NAME);
+}
+
+void telemetry_start(void) {
+    unsigned long long interval_ms = TELEMETRY_DEFAULT_INTERVAL_MS;
+    const char *interval_s = getenv("ENVYD_TELEMETRY_INTERVAL_MS");
+    if (interval_s != NULL && strtoull(interval_s, NULL, 10) > 0) interval_ms = strtoull(interval_s, NULL, 10);
+    interval_us = interval_ms * 1000ULL;
+
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &device_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), telemetry disabled", map_nvmlReturn_t_to_string(result));
+        return;
+    }
+
+    devices = calloc(device_count > 0 ? device_count : 1, sizeof(nvmlDevice_t));
+    samples = calloc(device_count > 0 ? device_count : 1, sizeof(envydTelemetrySlot_st));
+    if (devices == NULL || samples == NULL) {
+        LOG_ERROR("Couldn't allocate device handles, telemetry disabled");
+        telemetry_stop();
+        return;
+    }
+
+    for (unsigned int i = 0; i < device_count; ++i) {
+        samples[i].index = i;
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &devices[i]);
+        if (result != NVML_SUCCESS) {
+            LOG_ERROR("Couldn't get device by index %d (%s), its slot stays empty", i, map_nvmlReturn_t_to_string(result));
+            samples[i].last_error = result;
+            devices[i] = NULL;
+            continue;
+        }
+        result = NVML_CALL(nvmlDeviceGetUUID, devices[i], samples[i].uuid, sizeof(samples[i].uuid));
+        if (result != NVML_SUCCESS) LOG_ERROR("Couldn't get uuid by index %d (%s)", i, map_nvmlReturn_t_to_string(result));
+    }
+
+    const char *enabled = getenv("ENVYD_TELEMETRY");
+    if (enabled != NULL && strcmp(enabled, "0") == 0) LOG_INFO("Shared-memory telemetry disabled via ENVYD_TELEMETRY=0");
+    else create_segment();
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sampler_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    sampler_stop = false;
+    if (pthread_create(&sampler_thread, NULL, sampler, NULL) != 0) {
+        LOG_ERROR("Couldn't start telemetry sampler thread");
+        telemetry_stop();
+        return;
+    }
+    sampler_running = true;
+    LOG_INFO("Sampling %u device(s) every %llu ms", device_count, interval_ms);
+}
+
+void telemetry_refresh(void) {
+    if (!sampler_running) return;
+    pthread_mutex_lock(&sampler_lock);
+    sampler_refresh = true;
+    pthread_cond_signal(&sampler_wake);
+    pthread_mutex_unlock(&sampler_lock);
+}
+
+void telemetry_stop(void) {
+    if (sampler_running) {
+        pthread_mutex_lock(&sampler_lock);
+        sampler_stop = true;
+        pthread_cond_signal(&sampler_wake);
+        pthread_mutex_unlock(&sampler_lock);
+        pthread_join(sampler_thread, NULL);
+        sampler_running = false;
+    }
+
+    if (segment != NULL) {
+        munmap(segment, segment_size);
+        shm_unlink(ENVYD_TELEMETRY_SHM_NAME);
+        segment = NULL;
+    }
+    if (devices != NULL) {
+        free(devices);
+        devices = NULL;
+    }
+    if (samples != NULL) {
+        free(samples);
+        samples = NULL;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "envyd_telemetry.h"
+
+#define TELEMETRY_DEFAULT_INTERVAL_MS 50
+#define TELEMETRY_MAX_LISTENERS 8
+
+/**
+ * Called on the sampler thread after every sampling round, w/ the latest sample of every device (count of them,
+ * in NVML index order; valid == 0 for devices that couldn't be resolved). Must not block for long.
+ */
+typedef void (*telemetryListener_t)(const envydTelemetrySlot_st *samples, const unsigned int count);
+
+/**
+ * Registers a consumer of samples; only before telemetry_start.
+ */
+void telemetry_add_listener(const telemetryListener_t listener);
+
+/**
+ * Resolves every device and starts the sampler thread, which feeds the listeners and, unless ENVYD_TELEMETRY=0,
+ * the shared-memory segment (layout in envyd_telemetry.h). Reads ENVYD_TELEMETRY_INTERVAL_MS. NVML must be initialized.
+ */
+void telemetry_start(void);
+
+/**
+ * Wakes the sampler for an immediate round, e.g. because an NVML event says the cached samples are stale.
+ * No-op if telemetry isn't running.
+ */
+void telemetry_refresh(void);
+
+/**
+ * Stops the sampler thread and unlinks the segment; no-op if telemetry was never started.
+ */
+void telemetry_stop(void);
+
+#endif
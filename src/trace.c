@@ -0,0 +1,146 @@
+#include "trace.h"
+#include "helpers.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct traceSpan_st {
+    const char *name;
+    const char *category;
+    unsigned long long start_us;
+    unsigned long long duration_us;
+    unsigned long long request_id;
+} traceSpan_st;
+
+// one per thread, never freed: spans must outlive the thread so they can still be dumped
+typedef struct traceBuffer_st {
+    pthread_mutex_t lock;  // only contended while dumping
+    pid_t tid;
+    size_t head;  // total spans ever written; slot is head % capacity
+    traceSpan_st *spans;
+    struct traceBuffer_st *next;
+} traceBuffer_st;
+
+bool trace_enabled = false;
+
+static size_t trace_capacity = TRACE_DEFAULT_EVENTS_PER_THREAD;
+static traceBuffer_st *trace_buffers = NULL;  // intrusive list of every registered thread buffer
+static pthread_mutex_t trace_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_ullong trace_request_counter = 0;
+
+static _Thread_local traceBuffer_st *thread_buffer = NULL;
+static _Thread_local unsigned long long thread_request_id = 0;
+
+void trace_init(void) {
+    const char *enabled = getenv("ENVYD_TRACE");
+    trace_enabled = enabled != NULL && *enabled != 0 && strcmp(enabled, "0") != 0;
+
+    const char *capacity = getenv("ENVYD_TRACE_EVENTS");
+    if (capacity != NULL && strtoull(capacity, NULL, 10) > 0) trace_capacity = strtoull(capacity, NULL, 10);
+
+    if (trace_enabled) LOG_INFO("Tracing enabled, keeping the last %zu spans per thread", trace_capacity);
+}
+
+static traceBuffer_st *get_thread_buffer(void) {
+    if (thread_buffer != NULL) return thread_buffer;
+
+    traceBuffer_st *buffer = calloc(1, sizeof(traceBuffer_st));
+    if (buffer == NULL) return NULL;
+    buffer->spans = calloc(trace_capacity, sizeof(traceSpan_st));
+    if (buffer->spans == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    pthread_mutex_init(&buffer->lock, NULL);
+    buffer->tid = (pid_t) syscall(SYS_gettid);
+
+    pthread_mutex_lock(&trace_buffers_lock);
+    buffer->next = trace_buffers;
+    trace_buffers = buffer;
+    pthread_mutex_unlock(&trace_buffers_lock);
+
+    thread_buffer = buffer;
+    return buffer;
+}
+
+unsigned long long trace_begin(void) {
+    if (!trace_enabled) return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000ULL + (unsigned long long) ts.tv_nsec / 1000ULL;
+}
+
+void trace_end(const char *name, const char *category, const unsigned long long start) {
+    if (!trace_enabled) return;
+
+    const unsigned long long now = trace_begin();
+    traceBuffer_st *buffer = get_thread_buffer();
+    if (buffer == NULL) return;
+
+    pthread_mutex_lock(&buffer->lock);
+    traceSpan_st *span = &buffer->spans[buffer->head % trace_capacity];
+    span->name = name;
+    span->category = category;
+    span->start_us = start;
+    span->duration_us = now - start;
+    span->request_id = thread_request_id;
+    ++buffer->head;
+    pthread_mutex_unlock(&buffer->lock);
+}
+
+void trace_request_begin(void) {
+    if (!trace_enabled) return;
+    thread_request_id = atomic_fetch_add(&trace_request_counter, 1) + 1;
+}
+
+unsigned long long trace_current_request(void) {
+    return thread_request_id;
+}
+
+void trace_request_set(const unsigned long long id) {
+    thread_request_id = id;
+}
+
+char *trace_dump(const bool clear) {
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *stream = open_memstream(&out, &out_len);
+    if (stream == NULL) return NULL;
+
+    const pid_t pid = getpid();
+    bool first = true;
+    fprintf(stream, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    pthread_mutex_lock(&trace_buffers_lock);
+    for (traceBuffer_st *buffer = trace_buffers; buffer != NULL; buffer = buffer->next) {
+        pthread_mutex_lock(&buffer->lock);
+        fprintf(stream, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"envyd-%d\"}}",
+                first ? "" : ",", pid, buffer->tid, buffer->tid);
+        first = false;
+
+        // oldest span first; once wrapped, the oldest lives right at head
+        const size_t count = buffer->head < trace_capacity ? buffer->head : trace_capacity;
+        for (size_t idx = buffer->head - count; idx < buffer->head; ++idx) {
+            const traceSpan_st *span = &buffer->spans[idx % trace_capacity];
+            fprintf(stream, ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%llu}}",
+                    span->name, span->category, span->start_us, span->duration_us, pid, buffer->tid, span->request_id);
+        }
+        if (clear) buffer->head = 0;
+        pthread_mutex_unlock(&buffer->lock);
+    }
+    pthread_mutex_unlock(&trace_buffers_lock);
+
+    fprintf(stream, "]}");
+    if (fclose(stream) != 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include "probes.h"
+
+#define TRACE_DEFAULT_EVENTS_PER_THREAD 65536
+
+extern bool trace_enabled; // global; set once from ENVYD_TRACE before any thread is started
+
+/**
+ * Reads ENVYD_TRACE (enable when set to anything but "0") and ENVYD_TRACE_EVENTS (ring capacity per thread).
+ */
+void trace_init(void);
+
+/**
+ * Monotonic clock in microseconds; returns 0 when tracing is disabled, so callers can pass it around blindly.
+ */
+unsigned long long trace_begin(void);
+
+/**
+ * Records a complete ('X') span from start until now in the calling thread's buffer.
+ * name and category must be string literals (or otherwise outlive the trace), only the pointer is stored.
+ */
+void trace_end(const char *name, const char *category, const unsigned long long start);
+
+/**
+ * Assigns a fresh request id to the calling thread; all spans recorded afterwards are tagged with it.
+ */
+void trace_request_begin(void);
+unsigned long long trace_current_request(void);
+
+/**
+ * Tags the calling thread's spans w/ id, a request begun on another thread and handed over to this one (0 for none).
+ */
+void trace_request_set(unsigned long long id);
+
+/**
+ * Serializes every thread buffer as Chrome trace-event JSON ({"traceEvents": [...]}),
+ * loadable by chrome://tracing and ui.perfetto.dev.
+ *
+ * @param clear when true, buffers are emptied after being dumped
+ * @return malloc'd string, owned by caller; NULL on allocation failure
+ */
+char *trace_dump(const bool clear);
+
+/**
+ * Wraps an NVML call in a span (and the nvml__entry/nvml__exit probes) named after the function,
+ * evaluating to its nvmlReturn_t.
+ */
+#define NVML_CALL(fn, ...) ({ \
+    PROBE_NVML_ENTRY(#fn); \
+    const unsigned long long _nvml_span_start = trace_begin(); \
+    const nvmlReturn_t _nvml_span_result = fn(__VA_ARGS__); \
+    if (trace_enabled) trace_end(#fn, "nvml", _nvml_span_start); \
+    PROBE_NVML_EXIT(#fn, _nvml_span_result); \
+    _nvml_span_result; \
+})
+
+#endif
@@ -0,0 +1,307 @@
+#include "waits.h"
+#include "network.h"
+#include "helpers.h"
+#include "trace.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct waitsEntry_st {
+    int fd;
+    nvmlDevice_t device;
+    storeMetric_t metric;
+    waitComparison_t comparison;
+    long long threshold;
+    unsigned long long interval_ns;
+    unsigned long long started_ns;
+    unsigned long long next_check_ns;
+    unsigned long long deadline_ns;
+    bool has_value;
+    long long value;  // last one read
+} waitsEntry_st;
+
+// owned by the wait thread, so NVML calls never hold waits_lock; wait_count is only changed under it though
+static waitsEntry_st waits[WAITS_MAX];
+static unsigned int wait_count = 0;
+// handed over by waits_add, picked up by the wait thread
+static waitsEntry_st incoming[WAITS_MAX];
+static unsigned int incoming_count = 0;
+
+static pthread_t wait_thread;
+static bool wait_running = false;
+static bool wait_stop = false;
+static pthread_mutex_t waits_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t waits_wake;
+
+static const char *comparison_names[WAIT_COMPARISON_COUNT] = {"<", "<=", ">", ">=", "==", "!="};
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+waitComparison_t waits_comparison_from_string(const char *comparison) {
+    for (int i = 0; i < WAIT_COMPARISON_COUNT; ++i) {
+        if (strcmp(comparison_names[i], comparison) == 0) return (waitComparison_t) i;
+    }
+    return WAIT_COMPARISON_COUNT;
+}
+
+static bool holds(const long long value, const waitComparison_t comparison, const long long threshold) {
+    switch (comparison) {
+        case WAIT_LESS: return value < threshold;
+        case WAIT_LESS_EQUAL: return value <= threshold;
+        case WAIT_GREATER: return value > threshold;
+        case WAIT_GREATER_EQUAL: return value >= threshold;
+        case WAIT_EQUAL: return value == threshold;
+        case WAIT_NOT_EQUAL: return value != threshold;
+        default: return false;
+    }
+}
+
+/**
+ * Same units as the store: mW, C, MHz, %, bytes.
+ */
+static nvmlReturn_t read_metric(const nvmlDevice_t device, const storeMetric_t metric, long long *value /*out*/) {
+    nvmlReturn_t result = NVML_ERROR_INVALID_ARGUMENT;
+    unsigned int reading = 0;
+    switch (metric) {
+        case STORE_METRIC_POWER:
+            result = NVML_CALL(nvmlDeviceGetPowerUsage, device, &reading);
+            break;
+        case STORE_METRIC_POWER_LIMIT:
+            result = NVML_CALL(nvmlDeviceGetPowerManagementLimit, device, &reading);
+            break;
+        case STORE_METRIC_TEMPERATURE:
+            result = NVML_CALL(nvmlDeviceGetTemperature, device, NVML_TEMPERATURE_GPU, &reading);
+            break;
+        case STORE_METRIC_GRAPHICS_CLOCK:
+            result = NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_GRAPHICS, &reading);
+            break;
+        case STORE_METRIC_SM_CLOCK:
+            result = NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_SM, &reading);
+            break;
+        case STORE_METRIC_MEMORY_CLOCK:
+            result = NVML_CALL(nvmlDeviceGetClockInfo, device, NVML_CLOCK_MEM, &reading);
+            break;
+        case STORE_METRIC_FAN_SPEED:
+            result = NVML_CALL(nvmlDeviceGetFanSpeed_v2, device, 0, &reading);
+            break;
+        case STORE_METRIC_MEMORY_USED: {
+            nvmlMemory_v2_t memory = {0};
+            memory.version = NVML_STRUCT_VERSION(Memory, 2);
+            result = NVML_CALL(nvmlDeviceGetMemoryInfo_v2, device, &memory);
+            *value = (long long) memory.used;
+            return result;
+        }
+        default:
+            break;
+    }
+    *value = reading;
+    return result;
+}
+
+typedef struct waitsRead_st {
+    nvmlDevice_t device;
+    storeMetric_t metric;
+    long long value;
+    nvmlReturn_t result;
+} waitsRead_st;
+
+static void read_task(void *arg) {
+    waitsRead_st *task = arg;
+    task->result = read_metric(task->device, task->metric, &task->value);
+}
+
+/**
+ * Reads on the device's context, so a wedged device only holds up the waits on it, once.
+ * @return what read_metric returned, NVML_ERROR_TIMEOUT if the device is degraded or didn't answer in time
+ */
+static nvmlReturn_t read_on_context(const nvmlDevice_t device, const storeMetric_t metric, long long *value /*out*/) {
+    waitsRead_st task = {.device = device, .metric = metric};
+    const nvmlReturn_t result = watchdog_device_call(device, read_task, &task, sizeof(task));
+    if (result != NVML_SUCCESS) return result;
+    *value = task.value;
+    return task.result;
+}
+
+/**
+ * Moves the last wait into the place of wait i.
+ */
+static void remove_wait(const unsigned int i) {
+    pthread_mutex_lock(&waits_lock);
+    waits[i] = waits[--wait_count];
+    pthread_mutex_unlock(&waits_lock);
+}
+
+/**
+ * Answers and closes wait i, then removes it.
+ */
+static void finish(const unsigned int i, const char *status, const char *description) {
+    waitsEntry_st *wait = &waits[i];
+    const int client_fd = wait->fd;
+    char data[96];
+    if (wait->has_value) {
+        snprintf(data, sizeof(data), "{\"value\": %lld, \"waitedMs\": %llu}",
+                 wait->value, (monotonic_ns() - wait->started_ns) / 1000000ULL);
+    } else {
+        snprintf(data, sizeof(data), "{\"value\": null, \"waitedMs\": %llu}", (monotonic_ns() - wait->started_ns) / 1000000ULL);
+    }
+    RESPOND(client_fd, data, status, description);
+    arena_reset(arena_request());
+    close(client_fd);
+    remove_wait(i);
+}
+
+/**
+ * Evaluates every wait that is due; waits_lock must not be held.
+ * @return when the next one is due, ULLONG_MAX if none are pending
+ */
+static unsigned long long check_due(void) {
+    unsigned long long next = ULLONG_MAX;
+    const unsigned long long now = monotonic_ns();
+    for (unsigned int i = 0; i < wait_count;) {
+        waitsEntry_st *wait = &waits[i];
+
+        // waiters never send anything after their request, so a hangup is the only thing poll can report
+        struct pollfd pfd = {.fd = wait->fd, .events = 0};
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0) {
+            LOG_INFO("Wait on fd %d abandoned by the client", wait->fd);
+            close(wait->fd);
+            remove_wait(i);
+            continue;
+        }
+
+        if (wait->next_check_ns <= now) {
+            long long value;
+            const nvmlReturn_t result = read_on_context(wait->device, wait->metric, &value);
+            if (result != NVML_SUCCESS) {
+                LOG_ERROR("Couldn't read metric %d for wait on fd %d (%s)", wait->metric, wait->fd,
+                          map_nvmlReturn_t_to_string(result));
+                finish(i, map_nvmlReturn_t_to_string(result), "Couldn't read the metric");
+                continue;
+            }
+            wait->value = value;
+            wait->has_value = true;
+            if (holds(value, wait->comparison, wait->threshold)) {
+                finish(i, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Condition holds.");
+                continue;
+            }
+            if (now >= wait->deadline_ns) {
+                finish(i, WAIT_TIMEOUT, "Condition didn't hold before the timeout");
+                continue;
+            }
+            // don't drift, but don't burst to catch up after a slow NVML call either
+            wait->next_check_ns += wait->interval_ns;
+            if (wait->next_check_ns < now) wait->next_check_ns = now + wait->interval_ns;
+            if (wait->next_check_ns > wait->deadline_ns) wait->next_check_ns = wait->deadline_ns;
+        }
+
+        if (wait->next_check_ns < next) next = wait->next_check_ns;
+        ++i;
+    }
+    return next;
+}
+
+static void *waiter(void *arg) {
+    (void) arg;
+    unsigned long long next = ULLONG_MAX;
+    pthread_mutex_lock(&waits_lock);
+    while (!wait_stop) {
+        if (incoming_count == 0) {
+            if (next == ULLONG_MAX) {
+                pthread_cond_wait(&waits_wake, &waits_lock);
+            } else {
+                const struct timespec deadline = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+                pthread_cond_timedwait(&waits_wake, &waits_lock, &deadline);
+            }
+            if (wait_stop) break;
+        }
+        for (unsigned int i = 0; i < incoming_count; ++i) waits[wait_count++] = incoming[i];
+        incoming_count = 0;
+        pthread_mutex_unlock(&waits_lock);
+
+        next = check_due();
+
+        pthread_mutex_lock(&waits_lock);
+    }
+    pthread_mutex_unlock(&waits_lock);
+    return NULL;
+}
+
+void waits_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&waits_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    wait_stop = false;
+    if (pthread_create(&wait_thread, NULL, waiter, NULL) != 0) {
+        LOG_ERROR("Couldn't start wait thread, waitFor disabled");
+        pthread_cond_destroy(&waits_wake);
+        return;
+    }
+    wait_running = true;
+}
+
+void waits_stop(void) {
+    if (!wait_running) return;
+
+    pthread_mutex_lock(&waits_lock);
+    wait_stop = true;
+    pthread_cond_signal(&waits_wake);
+    pthread_mutex_unlock(&waits_lock);
+    pthread_join(wait_thread, NULL);
+    wait_running = false;
+
+    // clients retry these against whoever serves the socket next
+    for (unsigned int i = 0; i < incoming_count; ++i) waits[wait_count++] = incoming[i];
+    incoming_count = 0;
+    while (wait_count > 0) finish(wait_count - 1, SHUTTING_DOWN, "envyd is shutting down or restarting");
+    pthread_cond_destroy(&waits_wake);
+}
+
+bool waits_can_add(void) {
+    if (!wait_running) return false;
+    pthread_mutex_lock(&waits_lock);
+    const bool full = wait_count + incoming_count == WAITS_MAX;
+    pthread_mutex_unlock(&waits_lock);
+    return !full;
+}
+
+bool waits_add(const int fd, const nvmlDevice_t device, const storeMetric_t metric, const waitComparison_t comparison,
+               const long long threshold, const unsigned int interval_ms, const unsigned int timeout_ms) {
+    if (!wait_running) return false;
+
+    pthread_mutex_lock(&waits_lock);
+    if (wait_count + incoming_count == WAITS_MAX) {
+        pthread_mutex_unlock(&waits_lock);
+        return false;
+    }
+    const unsigned long long now = monotonic_ns();
+    waitsEntry_st *wait = &incoming[incoming_count++];
+    memset(wait, 0, sizeof(*wait));
+    wait->fd = fd;
+    wait->device = device;
+    wait->metric = metric;
+    wait->comparison = comparison;
+    wait->threshold = threshold;
+    wait->interval_ns = (unsigned long long) interval_ms * 1000000ULL;
+    wait->started_ns = now;
+    wait->next_check_ns = now;  // the first check is immediate
+    wait->deadline_ns = now + (unsigned long long) timeout_ms * 1000000ULL;
+    pthread_cond_signal(&waits_wake);
+    pthread_mutex_unlock(&waits_lock);
+    LOG_INFO("Wait on fd %d: metric %d %s %lld, every %u ms for up to %u ms", fd, metric, comparison_names[comparison],
+             threshold, interval_ms, timeout_ms);
+    return true;
+}
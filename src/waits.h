@@ -0,0 +1,57 @@
+#ifndef WAITS_H
+#define WAITS_H
+
+#include <stdbool.h>
+#include <nvml.h>
+#include "store.h"
+
+#define WAITS_MAX 64
+#define WAITS_DEFAULT_INTERVAL_MS 100
+#define WAITS_MIN_INTERVAL_MS 10
+#define WAITS_DEFAULT_TIMEOUT_MS 60000
+#define WAITS_MAX_TIMEOUT_MS (24 * 60 * 60 * 1000)
+
+typedef enum waitComparison_enum {
+    WAIT_LESS = 0,
+    WAIT_LESS_EQUAL,
+    WAIT_GREATER,
+    WAIT_GREATER_EQUAL,
+    WAIT_EQUAL,
+    WAIT_NOT_EQUAL,
+    WAIT_COMPARISON_COUNT
+} waitComparison_t;
+
+/**
+ * Starts the thread that evaluates pending waits; only waits_add makes it do any NVML calls. NVML must be initialized.
+ */
+void waits_start(void);
+
+/**
+ * Stops the thread and answers every pending wait w/ SHUTTING_DOWN (and the last value read); no-op if waits were never
+ * started.
+ */
+void waits_stop(void);
+
+/**
+ * @return WAIT_COMPARISON_COUNT if comparison isn't one of "<", "<=", ">", ">=", "==", "!="
+ */
+waitComparison_t waits_comparison_from_string(const char *comparison);
+
+/**
+ * @return false if waits aren't running or WAITS_MAX waits are pending. Waits are only ever added by the request loop,
+ *  so a true holds until its next waits_add.
+ */
+bool waits_can_add(void);
+
+/**
+ * Hands fd over to the wait thread, which reads metric of device every interval_ms until `value comparison threshold`
+ * holds, then answers w/ {"value": ..., "waitedMs": ...}. It answers WAIT_TIMEOUT (w/ the last value read, or null)
+ * once timeout_ms passed, and the NVML error if reading the metric fails. fd is closed by the wait thread,
+ * also early if the peer hangs up.
+ *
+ * @return false (and fd stays owned by the caller) if waits_can_add doesn't hold
+ */
+bool waits_add(const int fd, const nvmlDevice_t device, const storeMetric_t metric, const waitComparison_t comparison,
+               const long long threshold, const unsigned int interval_ms, const unsigned int timeout_ms);
+
+#endif
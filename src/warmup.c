@@ -0,0 +1,88 @@
+#include "warmup.h"
+#include "helpers.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct warmupWorker_st {
+    pthread_t thread;
+    unsigned int first;  // device index
+    unsigned int stride;
+    unsigned int count;  // of devices
+    unsigned int answered;
+} warmupWorker_st;
+
+static bool warm(const unsigned int index) {
+    nvmlDevice_t device;
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, index, &device);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get device by index %u (%s)", index, map_nvmlReturn_t_to_string(result));
+        return false;
+    }
+    char uuid[96];
+    result = NVML_CALL(nvmlDeviceGetUUID, device, uuid, sizeof(uuid));
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get uuid by index %u (%s)", index, map_nvmlReturn_t_to_string(result));
+        return false;
+    }
+    // requests look devices up by uuid
+    result = NVML_CALL(nvmlDeviceGetHandleByUUID, uuid, &device);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get %s by uuid (%s)", uuid, map_nvmlReturn_t_to_string(result));
+        return false;
+    }
+    unsigned int temperature_c;
+    result = NVML_CALL(nvmlDeviceGetTemperature, device, NVML_TEMPERATURE_GPU, &temperature_c);
+    if (result != NVML_SUCCESS && result != NVML_ERROR_NOT_SUPPORTED) {
+        LOG_WARNING("%s didn't answer its first query (%s)", uuid, map_nvmlReturn_t_to_string(result));
+        return false;
+    }
+    return true;
+}
+
+static void *worker(void *arg) {
+    warmupWorker_st *worker = arg;
+    for (unsigned int i = worker->first; i < worker->count; i += worker->stride) {
+        if (warm(i)) ++worker->answered;
+    }
+    return NULL;
+}
+
+unsigned int warmup_devices(void) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    unsigned int count = 0;
+    const nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), no warm-up", map_nvmlReturn_t_to_string(result));
+        return 0;
+    }
+    if (count == 0) return 0;
+
+    const unsigned int threads = count < WARMUP_MAX_THREADS ? count : WARMUP_MAX_THREADS;
+    warmupWorker_st workers[WARMUP_MAX_THREADS] = {0};
+    unsigned int answered = 0;
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers[t] = (warmupWorker_st) {.first = t, .stride = threads, .count = count};
+        if (pthread_create(&workers[t].thread, NULL, worker, &workers[t]) != 0) {
+            // this thread's share runs here instead
+            LOG_WARNING("Couldn't start warm-up thread %u, warming its devices serially", t);
+            worker(&workers[t]);
+            answered += workers[t].answered;
+            workers[t].count = 0;  // nothing to join
+        }
+    }
+    for (unsigned int t = 0; t < threads; ++t) {
+        if (workers[t].count == 0) continue;
+        pthread_join(workers[t].thread, NULL);
+        answered += workers[t].answered;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const long long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000LL + (end.tv_nsec - start.tv_nsec) / 1000000LL;
+    LOG_INFO("Warmed up %u of %u device(s) on %u thread(s) in %lld ms", answered, count, threads, elapsed_ms);
+    return answered;
+}
@@ -0,0 +1,15 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#define WARMUP_MAX_THREADS 16
+
+/**
+ * Touches every device once, up to WARMUP_MAX_THREADS at a time: handle, uuid lookup and a first query. The driver
+ * attaches a device on first use, which can take hundreds of milliseconds each w/o persistence mode; afterward the
+ * modules that enumerate devices one by one at startup find them attached. NVML must be initialized.
+ *
+ * @return number of devices that answered
+ */
+unsigned int warmup_devices(void);
+
+#endif
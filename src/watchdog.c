@@ -0,0 +1,399 @@
+#include "watchdog.h"
+#include "network.h"
+#include "helpers.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct watchdogContext_st {
+    nvmlDevice_t device;
+    char uuid[96];
+
+    pthread_t thread;
+    bool started;
+    // the request thread and the job executor both submit; each waits for its answer, so there's at most one task
+    pthread_mutex_t submit_lock;
+    pthread_mutex_t lock;  // guards everything below
+    pthread_cond_t wake;  // the context has a task, or should stop
+    pthread_cond_t finished;  // the task was run
+    // the task
+    bool pending;
+    bool done;
+    int fd;  // duplicate of the client's, closed by the context
+    const char *action;
+    watchdogHandler_t handler;  // NULL to dispatch action via assign_task
+    json_object *jobj;
+    watchdogTask_t task;  // instead of a request, w/ fd -1
+    void *task_arg;  // malloc'd copy
+    unsigned long long request_id;  // trace id of the submitting thread's request
+    // health
+    bool busy;  // in the driver
+    bool probing;  // in the driver, w/ a probe
+    bool abandoned;  // the task missed its deadline, its jobj (or task_arg) belongs to the context now
+    bool degraded;
+    bool stop;
+} watchdogContext_st;
+
+static watchdogContext_st *contexts = NULL;
+static unsigned int context_count = 0;
+static unsigned long long deadline_ms = WATCHDOG_DEFAULT_DEADLINE_MS;
+static unsigned long long probe_interval_ms = WATCHDOG_DEFAULT_PROBE_INTERVAL_MS;
+static bool running = false;
+static _Thread_local watchdogContext_st *current_context = NULL;  // set on context threads
+// serializes device calls w/o a context, as the module locks held across NVML calls used to
+static pthread_mutex_t inline_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local bool inline_running = false;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static struct timespec timespec_in(const unsigned long long ms) {
+    const unsigned long long at_ns = monotonic_ns() + ms * 1000000ULL;
+    return (struct timespec) {.tv_sec = (time_t) (at_ns / 1000000000ULL), .tv_nsec = (long) (at_ns % 1000000000ULL)};
+}
+
+static watchdogContext_st *find(const json_object *jobj) {
+    json_object *uuid_field = json_object_object_get(jobj, "uuid");
+    const char *uuid = uuid_field != NULL ? json_object_get_string(uuid_field) : NULL;
+    if (uuid == NULL) return NULL;
+    for (unsigned int i = 0; i < context_count; ++i) {
+        if (contexts[i].started && strcmp(contexts[i].uuid, uuid) == 0) return &contexts[i];
+    }
+    return NULL;
+}
+
+static watchdogContext_st *find_device(const nvmlDevice_t device) {
+    for (unsigned int i = 0; i < context_count; ++i) {
+        if (contexts[i].started && contexts[i].device == device) return &contexts[i];
+    }
+    return NULL;
+}
+
+/**
+ * A cheap call that still has to reach the device; an answer in time, whatever it is, means the device is back.
+ * Called w/o the lock.
+ */
+static bool probe(watchdogContext_st *context) {
+    const unsigned long long start_ns = monotonic_ns();
+    unsigned int temperature_c;
+    const nvmlReturn_t result = NVML_CALL(nvmlDeviceGetTemperature, context->device, NVML_TEMPERATURE_GPU, &temperature_c);
+    const unsigned long long elapsed_ms = (monotonic_ns() - start_ns) / 1000000ULL;
+    if (elapsed_ms > deadline_ms) return false;
+    return result != NVML_ERROR_GPU_IS_LOST && result != NVML_ERROR_TIMEOUT && result != NVML_ERROR_UNKNOWN;
+}
+
+static void *worker(void *arg) {
+    watchdogContext_st *context = arg;
+    current_context = context;
+    pthread_mutex_lock(&context->lock);
+    while (!context->stop) {
+        if (context->pending) {
+            const int fd = context->fd;
+            const char *action = context->action;
+            const watchdogHandler_t handler = context->handler;
+            json_object *jobj = context->jobj;
+            const watchdogTask_t task = context->task;
+            void *task_arg = context->task_arg;
+            const unsigned long long request_id = context->request_id;
+            context->pending = false;
+            const bool skip = context->abandoned;  // took us longer than the deadline just to get here
+            context->busy = !skip;
+            pthread_mutex_unlock(&context->lock);
+
+            trace_request_set(request_id);
+            if (!skip && task != NULL) task(task_arg);
+            else if (!skip && handler != NULL) handler(fd, jobj);
+            else if (!skip) assign_task(fd, action, jobj);
+            if (fd != -1) close(fd);
+            arena_reset(arena_request());
+            trace_request_set(0);
+
+            pthread_mutex_lock(&context->lock);
+            context->busy = false;
+            if (context->abandoned) {
+                context->abandoned = false;
+                if (task != NULL) free(task_arg);
+                else json_object_put(jobj);
+                LOG_WARNING("%s: call that missed its deadline returned", context->uuid);
+            } else {
+                context->done = true;
+                pthread_cond_signal(&context->finished);
+            }
+            continue;
+        }
+        if (context->degraded) {
+            const struct timespec at = timespec_in(probe_interval_ms);
+            // stopping must not find us about to probe after it decided there's no need to wait for one
+            if (pthread_cond_timedwait(&context->wake, &context->lock, &at) != ETIMEDOUT || context->stop) continue;
+            context->probing = true;
+            pthread_mutex_unlock(&context->lock);
+            const bool healthy = probe(context);
+            pthread_mutex_lock(&context->lock);
+            context->probing = false;
+            if (healthy) {
+                context->degraded = false;
+                LOG_INFO("%s answered a probe in time, no longer degraded", context->uuid);
+            }
+            continue;
+        }
+        pthread_cond_wait(&context->wake, &context->lock);
+    }
+    pthread_mutex_unlock(&context->lock);
+    return NULL;
+}
+
+void watchdog_start(void) {
+    const char *configured = getenv("ENVYD_WATCHDOG_DEADLINE_MS");
+    if (configured != NULL && *configured != 0) deadline_ms = strtoull(configured, NULL, 10);
+    if (deadline_ms == 0) {
+        LOG_INFO("Watchdog disabled, requests run on the request thread");
+        return;
+    }
+    configured = getenv("ENVYD_WATCHDOG_PROBE_INTERVAL_MS");
+    if (configured != NULL && strtoull(configured, NULL, 10) > 0) probe_interval_ms = strtoull(configured, NULL, 10);
+
+    nvmlReturn_t result = NVML_CALL(nvmlDeviceGetCount_v2, &context_count);
+    if (result != NVML_SUCCESS) {
+        LOG_ERROR("Couldn't get count of devices (%s), watchdog disabled", map_nvmlReturn_t_to_string(result));
+        context_count = 0;
+        return;
+    }
+    if (context_count > WATCHDOG_MAX_DEVICES) {
+        LOG_WARNING("Only the first %d of %u devices get a watchdog", WATCHDOG_MAX_DEVICES, context_count);
+        context_count = WATCHDOG_MAX_DEVICES;
+    }
+    contexts = calloc(context_count > 0 ? context_count : 1, sizeof(watchdogContext_st));
+    if (contexts == NULL) {
+        LOG_ERROR("Couldn't allocate execution contexts, watchdog disabled");
+        context_count = 0;
+        return;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (unsigned int i = 0; i < context_count; ++i) {
+        watchdogContext_st *context = &contexts[i];
+        result = NVML_CALL(nvmlDeviceGetHandleByIndex_v2, i, &context->device);
+        if (result == NVML_SUCCESS) {
+            result = NVML_CALL(nvmlDeviceGetUUID, context->device, context->uuid, sizeof(context->uuid));
+        }
+        if (result != NVML_SUCCESS) {
+            // its requests run on the request thread
+            LOG_ERROR("Couldn't resolve device by index %d (%s), it gets no watchdog", i, map_nvmlReturn_t_to_string(result));
+            continue;
+        }
+        pthread_mutex_init(&context->submit_lock, NULL);
+        pthread_mutex_init(&context->lock, NULL);
+        pthread_cond_init(&context->wake, &attr);
+        pthread_cond_init(&context->finished, &attr);
+        if (pthread_create(&context->thread, NULL, worker, context) != 0) {
+            LOG_ERROR("Couldn't start execution context of %s, it gets no watchdog", context->uuid);
+            pthread_cond_destroy(&context->finished);
+            pthread_cond_destroy(&context->wake);
+            pthread_mutex_destroy(&context->lock);
+            pthread_mutex_destroy(&context->submit_lock);
+            continue;
+        }
+        context->started = true;
+    }
+    pthread_condattr_destroy(&attr);
+    running = true;
+    LOG_INFO("Watchdog: %u device(s), %llu ms deadline", context_count, deadline_ms);
+}
+
+void watchdog_stop(void) {
+    if (!running) return;
+    running = false;
+
+    bool stuck = false;
+    for (unsigned int i = 0; i < context_count; ++i) {
+        watchdogContext_st *context = &contexts[i];
+        if (!context->started) continue;
+        pthread_mutex_lock(&context->lock);
+        context->stop = true;
+        const bool busy = context->busy || context->probing;
+        pthread_cond_signal(&context->wake);
+        pthread_mutex_unlock(&context->lock);
+        if (busy) {
+            // joining would hang shutdown on the same call; the context stays allocated for it
+            LOG_WARNING("%s is still stuck in the driver, leaving its context behind", context->uuid);
+            pthread_detach(context->thread);
+            stuck = true;
+            continue;
+        }
+        pthread_join(context->thread, NULL);
+        pthread_cond_destroy(&context->finished);
+        pthread_cond_destroy(&context->wake);
+        pthread_mutex_destroy(&context->lock);
+        pthread_mutex_destroy(&context->submit_lock);
+    }
+    if (!stuck) free(contexts);
+    contexts = NULL;
+    context_count = 0;
+}
+
+/**
+ * Runs the task on the calling thread.
+ */
+static void dispatch(const int client_fd, const char *action, const watchdogHandler_t handler, json_object *jobj) {
+    if (handler != NULL) handler(client_fd, jobj);
+    else assign_task(client_fd, action, jobj);
+}
+
+static bool run_on(watchdogContext_st *context, const int client_fd, const char *action, const watchdogHandler_t handler,
+                   json_object *jobj) {
+    pthread_mutex_lock(&context->submit_lock);
+    pthread_mutex_lock(&context->lock);
+    if (context->degraded) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        LOG_WARNING("%s is degraded, not running '%s'", context->uuid, action);
+        RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_TIMEOUT),
+                "Device is degraded: a call to it missed its deadline, it's being re-probed");
+        return true;
+    }
+    const int fd = fcntl(client_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        LOG_ERROR("Couldn't duplicate fd %d (%s), running '%s' w/o watchdog", client_fd, strerror(errno), action);
+        dispatch(client_fd, action, handler, jobj);
+        return true;
+    }
+    context->fd = fd;
+    context->action = action;
+    context->handler = handler;
+    context->jobj = jobj;
+    context->task = NULL;
+    context->task_arg = NULL;
+    context->request_id = trace_current_request();
+    context->done = false;
+    context->pending = true;
+    pthread_cond_signal(&context->wake);
+
+    const struct timespec at = timespec_in(deadline_ms);
+    int rc = 0;
+    while (!context->done && rc != ETIMEDOUT) rc = pthread_cond_timedwait(&context->finished, &context->lock, &at);
+    if (context->done) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        return true;
+    }
+    // action may live in jobj, which the context frees as soon as the lock is released
+    LOG_ERROR("%s didn't answer '%s' within %llu ms, marked degraded", context->uuid, action, deadline_ms);
+    context->abandoned = true;
+    context->degraded = true;
+    pthread_mutex_unlock(&context->lock);
+    pthread_mutex_unlock(&context->submit_lock);
+
+    RESPOND(client_fd, NULL, map_nvmlReturn_t_to_string(NVML_ERROR_TIMEOUT),
+            "Device didn't answer within ENVYD_WATCHDOG_DEADLINE_MS, marked degraded");
+    // whatever the stuck call responds once it returns goes nowhere
+    shutdown(client_fd, SHUT_WR);
+    return false;
+}
+
+bool watchdog_run(const int client_fd, const char *action, json_object *jobj) {
+    watchdogContext_st *context = running ? find(jobj) : NULL;
+    if (context == NULL) {
+        assign_task(client_fd, action, jobj);
+        return true;
+    }
+    return run_on(context, client_fd, action, NULL, jobj);
+}
+
+bool watchdog_call(const int client_fd, const char *action, const watchdogHandler_t handler, json_object *jobj) {
+    watchdogContext_st *context = running ? find(jobj) : NULL;
+    if (context == NULL) {
+        handler(client_fd, jobj);
+        return true;
+    }
+    return run_on(context, client_fd, action, handler, jobj);
+}
+
+nvmlReturn_t watchdog_device_call(const nvmlDevice_t device, const watchdogTask_t task, void *arg, const size_t arg_size) {
+    watchdogContext_st *context = running ? find_device(device) : NULL;
+    if (context == current_context && context != NULL) {
+        task(arg);
+        return NVML_SUCCESS;
+    }
+    if (context == NULL) {
+        // a task calling back in (e.g. a flush before a write) already holds it
+        if (inline_running) {
+            task(arg);
+            return NVML_SUCCESS;
+        }
+        pthread_mutex_lock(&inline_lock);
+        inline_running = true;
+        task(arg);
+        inline_running = false;
+        pthread_mutex_unlock(&inline_lock);
+        return NVML_SUCCESS;
+    }
+
+    pthread_mutex_lock(&context->submit_lock);
+    pthread_mutex_lock(&context->lock);
+    if (context->degraded) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        return NVML_ERROR_TIMEOUT;
+    }
+    void *copy = malloc(arg_size > 0 ? arg_size : 1);
+    if (copy == NULL) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        LOG_ERROR("Couldn't copy a task for %s", context->uuid);
+        return NVML_ERROR_MEMORY;
+    }
+    memcpy(copy, arg, arg_size);
+    context->fd = -1;
+    context->action = "task";
+    context->handler = NULL;
+    context->jobj = NULL;
+    context->task = task;
+    context->task_arg = copy;
+    context->request_id = trace_current_request();
+    context->done = false;
+    context->pending = true;
+    pthread_cond_signal(&context->wake);
+
+    const struct timespec at = timespec_in(deadline_ms);
+    int rc = 0;
+    while (!context->done && rc != ETIMEDOUT) rc = pthread_cond_timedwait(&context->finished, &context->lock, &at);
+    if (context->done) {
+        pthread_mutex_unlock(&context->lock);
+        pthread_mutex_unlock(&context->submit_lock);
+        memcpy(arg, copy, arg_size);
+        free(copy);
+        return NVML_SUCCESS;
+    }
+    LOG_ERROR("%s didn't finish a task within %llu ms, marked degraded", context->uuid, deadline_ms);
+    context->abandoned = true;
+    context->degraded = true;
+    pthread_mutex_unlock(&context->lock);
+    pthread_mutex_unlock(&context->submit_lock);
+    return NVML_ERROR_TIMEOUT;
+}
+
+bool watchdog_degraded(const nvmlDevice_t device) {
+    watchdogContext_st *context = running ? find_device(device) : NULL;
+    if (context == NULL) return false;
+    pthread_mutex_lock(&context->lock);
+    const bool degraded = context->degraded;
+    pthread_mutex_unlock(&context->lock);
+    return degraded;
+}
+
+unsigned long long watchdog_deadline_ms(void) {
+    return running ? deadline_ms : 0;
+}
@@ -0,0 +1,69 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <json-c/json.h>
+#include <nvml.h>
+
+#define WATCHDOG_MAX_DEVICES 64
+#define WATCHDOG_DEFAULT_DEADLINE_MS 3000
+#define WATCHDOG_DEFAULT_PROBE_INTERVAL_MS 1000
+
+typedef void (*watchdogHandler_t)(int client_fd, const json_object *jobj);
+typedef void (*watchdogTask_t)(void *arg);
+
+/**
+ * Starts one execution context (a thread) per device. Requests that name a device run on its context and may take
+ * ENVYD_WATCHDOG_DEADLINE_MS (default WATCHDOG_DEFAULT_DEADLINE_MS, 0 runs everything on the calling thread as before);
+ * a degraded device is re-probed every ENVYD_WATCHDOG_PROBE_INTERVAL_MS (default WATCHDOG_DEFAULT_PROBE_INTERVAL_MS).
+ * NVML must be initialized.
+ */
+void watchdog_start(void);
+
+/**
+ * Stops the contexts; one still stuck in the driver is left behind.
+ */
+void watchdog_stop(void);
+
+/**
+ * Runs assign_task(client_fd, action, jobj) on the context of the device jobj's "uuid" names, or on the calling
+ * thread if it names none. If the device doesn't answer within the deadline, it's marked degraded and client_fd is
+ * answered w/ NVML_ERROR_TIMEOUT and shut down; so are requests for it until a background probe gets an answer in time.
+ * The stuck call can't be cancelled, a setter may still take effect once the driver returns.
+ *
+ * The request thread and the job executor take turns on a context, so a request may first wait for a job's deadline.
+ *
+ * @return false if jobj went to a stuck context, which frees it; the caller must not touch it (nor action) anymore
+ */
+bool watchdog_run(int client_fd, const char *action, json_object *jobj);
+
+/**
+ * Like watchdog_run, but runs handler(client_fd, jobj) instead of dispatching action, which only names it in logs; for
+ * queued jobs, whose handler is already resolved (and their requester authorized).
+ */
+bool watchdog_call(int client_fd, const char *action, watchdogHandler_t handler, json_object *jobj);
+
+/**
+ * Runs task(arg) on the context of device, for callers that aren't requests naming it (background threads, actions
+ * over several devices); right away if the calling thread already is that context. arg (arg_size bytes) is copied to
+ * the context and back, so a task that misses the deadline keeps working on its copy: it may use NVML, its copy of arg
+ * and module state it locks (nobody may hold a lock a task takes while waiting here), nothing else.
+ * W/o a context (watchdog disabled, unresolved device) tasks run on the calling thread, one at a time across devices.
+ *
+ * @return NVML_SUCCESS once task ran, NVML_ERROR_TIMEOUT if device is degraded (task wasn't run) or missed the deadline
+ *  (now it is), NVML_ERROR_MEMORY if arg couldn't be copied
+ */
+nvmlReturn_t watchdog_device_call(nvmlDevice_t device, watchdogTask_t task, void *arg, size_t arg_size);
+
+/**
+ * @return true while device is degraded; never waits for its context
+ */
+bool watchdog_degraded(nvmlDevice_t device);
+
+/**
+ * @return how long a call may take on a device context, 0 if the watchdog isn't running
+ */
+unsigned long long watchdog_deadline_ms(void);
+
+#endif
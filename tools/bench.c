@@ -0,0 +1,528 @@
+// envyd-bench: end-to-end load generator for the envyd unix socket.
+//  Opens N concurrent clients, replays a weighted mix of actions either closed-loop (as fast as the daemon answers)
+//  or open-loop at a fixed aggregate rate, and reports throughput, latency percentiles, errors and the CPU time
+//  the daemon burned (read from /proc/<pid>/stat) while under load.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_SOCKET_PATH "/tmp/envyd.socket"
+#define DEFAULT_MIX "nvmlDeviceGetPowerUsage:70,nvmlDeviceGetTemperature:20,nvmlDeviceGetDetailsAll:10"
+#define MAX_ACTIONS 32
+#define REQUEST_BUFFER_SIZE 1024
+#define RESPONSE_BUFFER_SIZE (1024 * 1024)
+#define NSEC_PER_SEC 1000000000ULL
+
+typedef struct benchAction_st {
+    char name[128];
+    unsigned int weight;
+    int needs_uuid;
+} benchAction_st;
+
+typedef struct latencyVector_st {
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+} latencyVector_st;
+
+typedef struct actionStats_st {
+    latencyVector_st latencies;
+    unsigned long long requests;
+    unsigned long long errors_io;
+    unsigned long long errors_status;
+} actionStats_st;
+
+typedef struct benchClient_st {
+    pthread_t thread;
+    unsigned int id;
+    uint64_t rng_state;
+    actionStats_st stats[MAX_ACTIONS];
+    char *response;
+} benchClient_st;
+
+typedef struct benchConfig_st {
+    const char *socket_path;
+    const char *uuid;
+    unsigned int clients;
+    double duration_s;
+    double warmup_s;
+    unsigned long long total_requests;
+    double rate;  // aggregate requests per second; 0 for closed-loop
+    pid_t daemon_pid;
+    int json_output;
+    benchAction_st actions[MAX_ACTIONS];
+    size_t action_count;
+    unsigned int weight_total;
+} benchConfig_st;
+
+static benchConfig_st config = {
+    .socket_path = DEFAULT_SOCKET_PATH,
+    .clients = 4,
+    .duration_s = 10.0,
+};
+
+static uint64_t bench_start_ns;
+static uint64_t bench_measure_ns;  // samples before this point are warm-up and discarded
+static uint64_t bench_stop_ns;
+static volatile sig_atomic_t stop_requested = 0;  // SIGINT: stop early, still report what was measured
+static unsigned long long issued_requests = 0;  // only used w/ total_requests, guarded by issue_lock
+static pthread_mutex_t issue_lock = PTHREAD_MUTEX_INITIALIZER;
+// daemon CPU time at the first request issued at or after bench_measure_ns, so warm-up isn't billed to the window
+static long long cpu_ticks_start = -1;
+static int cpu_ticks_sampled = 0;  // guarded by issue_lock
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+static void sleep_until_ns(const uint64_t deadline) {
+    struct timespec ts = {
+        .tv_sec = (time_t) (deadline / NSEC_PER_SEC),
+        .tv_nsec = (long) (deadline % NSEC_PER_SEC),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void latency_push(latencyVector_st *vec, const uint64_t value) {
+    if (vec->count == vec->capacity) {
+        vec->capacity = vec->capacity == 0 ? 4096 : vec->capacity * 2;
+        vec->values = realloc(vec->values, vec->capacity * sizeof(uint64_t));
+        if (vec->values == NULL) {
+            fprintf(stderr, "Out of memory while recording latencies!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    vec->values[vec->count++] = value;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @param sorted latencies, sorted ascending
+ * @param p percentile within [0, 100]
+ */
+static uint64_t percentile(const latencyVector_st *sorted, const double p) {
+    if (sorted->count == 0) return 0;
+    size_t idx = (size_t) ((p / 100.0) * (double) (sorted->count - 1) + 0.5);
+    if (idx >= sorted->count) idx = sorted->count - 1;
+    return sorted->values[idx];
+}
+
+/**
+ * @param mix "action:weight,action:weight,..."
+ * @return 0 on success, != 0 on malformed input
+ */
+static int parse_mix(const char *mix) {
+    char *copy = strdup(mix);
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (config.action_count == MAX_ACTIONS) {
+            fprintf(stderr, "Too many actions in mix (max %d)\n", MAX_ACTIONS);
+            free(copy);
+            return 1;
+        }
+        char *colon = strrchr(tok, ':');
+        unsigned int weight = 1;
+        if (colon != NULL) {
+            *colon = 0;
+            char *end = NULL;
+            weight = (unsigned int) strtoul(colon + 1, &end, 10);
+            if (end == colon + 1 || *end != 0) {
+                fprintf(stderr, "Invalid weight for action '%s'\n", tok);
+                free(copy);
+                return 1;
+            }
+        }
+        if (weight == 0) continue;
+
+        benchAction_st *action = &config.actions[config.action_count++];
+        snprintf(action->name, sizeof(action->name), "%s", tok);
+        action->weight = weight;
+        // every action except the envyd specific enumeration requires a device
+        action->needs_uuid = strcmp(tok, "nvmlDeviceGetDetailsAll") != 0;
+        config.weight_total += weight;
+    }
+    free(copy);
+    return config.action_count == 0;
+}
+
+static size_t pick_action(benchClient_st *client) {
+    unsigned int roll = (unsigned int) (xorshift64(&client->rng_state) % config.weight_total);
+    for (size_t i = 0; i < config.action_count; ++i) {
+        if (roll < config.actions[i].weight) return i;
+        roll -= config.actions[i].weight;
+    }
+    return config.action_count - 1;
+}
+
+static int connect_daemon(void) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", config.socket_path);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * One request == one connection, mirroring `nc -N`: write the body, half-close, read until EOF.
+ * @return bytes read on success, -1 on any socket failure
+ */
+static ssize_t roundtrip(const char *request, const size_t request_len, char *response /*out*/, const size_t size) {
+    const int fd = connect_daemon();
+    if (fd < 0) return -1;
+
+    size_t sent = 0;
+    while (sent < request_len) {
+        const ssize_t w = write(fd, request + sent, request_len - sent);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        sent += (size_t) w;
+    }
+    shutdown(fd, SHUT_WR);
+
+    size_t total = 0;
+    for (;;) {
+        const ssize_t r = read(fd, response + total, size - 1 - total);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        if (r == 0) break;
+        total += (size_t) r;
+        if (total == size - 1) break;
+    }
+    response[total] = 0;
+    close(fd);
+    return (ssize_t) total;
+}
+
+static int response_ok(const char *response) {
+    return strstr(response, "\"status\": \"NVML_SUCCESS\"") != NULL;
+}
+
+static long long read_proc_cpu_ticks(const pid_t pid);
+
+static void on_sigint(const int signal_code) {
+    (void) signal_code;
+    stop_requested = 1;
+}
+
+static void sample_cpu_ticks_start(void) {
+    if (config.daemon_pid <= 0) return;
+    pthread_mutex_lock(&issue_lock);
+    if (!cpu_ticks_sampled) {
+        cpu_ticks_start = read_proc_cpu_ticks(config.daemon_pid);
+        cpu_ticks_sampled = 1;
+    }
+    pthread_mutex_unlock(&issue_lock);
+}
+
+static int take_request_slot(void) {
+    if (config.total_requests == 0) return 1;
+    pthread_mutex_lock(&issue_lock);
+    const int ok = issued_requests < config.total_requests;
+    if (ok) ++issued_requests;
+    pthread_mutex_unlock(&issue_lock);
+    return ok;
+}
+
+static void *client_main(void *arg) {
+    benchClient_st *client = arg;
+    char request[REQUEST_BUFFER_SIZE];
+    // open-loop: clients interleave evenly over the aggregate rate
+    const uint64_t interval_ns = config.rate > 0 ? (uint64_t) ((double) NSEC_PER_SEC * config.clients / config.rate) : 0;
+    uint64_t next_send_ns = bench_start_ns + (interval_ns / config.clients) * client->id;
+    int measuring = 0;
+
+    while (!stop_requested) {
+        if (interval_ns > 0) {
+            sleep_until_ns(next_send_ns);
+        }
+        const uint64_t issue_ns = interval_ns > 0 ? next_send_ns : now_ns();
+        if (bench_stop_ns != 0 && issue_ns >= bench_stop_ns) break;
+        if (!take_request_slot()) break;
+        if (!measuring && issue_ns >= bench_measure_ns) {
+            measuring = 1;
+            sample_cpu_ticks_start();
+        }
+
+        const size_t action_idx = pick_action(client);
+        const benchAction_st *action = &config.actions[action_idx];
+        int request_len;
+        if (action->needs_uuid) {
+            request_len = snprintf(request, sizeof(request), "{\"action\": \"%s\", \"uuid\": \"%s\"}", action->name, config.uuid);
+        } else {
+            request_len = snprintf(request, sizeof(request), "{\"action\": \"%s\"}", action->name);
+        }
+
+        const ssize_t received = roundtrip(request, (size_t) request_len, client->response, RESPONSE_BUFFER_SIZE);
+        const uint64_t done_ns = now_ns();
+        // latency is measured from the *scheduled* send time in open-loop mode, so a stalled daemon
+        //  shows up in the tail instead of silently lowering the offered load (coordinated omission)
+        if (issue_ns >= bench_measure_ns) {
+            actionStats_st *stats = &client->stats[action_idx];
+            ++stats->requests;
+            if (received < 0) {
+                ++stats->errors_io;
+            } else if (!response_ok(client->response)) {
+                ++stats->errors_status;
+            }
+            latency_push(&stats->latencies, done_ns - issue_ns);
+        }
+        next_send_ns += interval_ns;
+    }
+    return NULL;
+}
+
+/**
+ * @return utime + stime of pid in clock ticks, or -1 on failure
+ */
+static long long read_proc_cpu_ticks(const pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return -1;
+    char buff[1024];
+    const size_t n = fread(buff, 1, sizeof(buff) - 1, fp);
+    fclose(fp);
+    buff[n] = 0;
+
+    // comm may contain spaces, skip past the last ')'
+    const char *p = strrchr(buff, ')');
+    if (p == NULL) return -1;
+    unsigned long long utime, stime;
+    // fields after comm: state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) return -1;
+    return (long long) (utime + stime);
+}
+
+static pid_t find_daemon_pid(void) {
+    DIR *proc = opendir("/proc");
+    if (proc == NULL) return -1;
+    pid_t found = -1;
+    for (const struct dirent *entry = readdir(proc); entry != NULL; entry = readdir(proc)) {
+        char *end = NULL;
+        const long pid = strtol(entry->d_name, &end, 10);
+        if (*end != 0 || pid <= 0) continue;
+
+        char path[300];
+        snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) continue;
+        char comm[64] = {0};
+        if (fgets(comm, sizeof(comm), fp) != NULL) {
+            comm[strcspn(comm, "\n")] = 0;
+            if (strcmp(comm, "envyd") == 0) found = (pid_t) pid;
+        }
+        fclose(fp);
+        if (found != -1) break;
+    }
+    closedir(proc);
+    return found;
+}
+
+/**
+ * Resolves the first device uuid through nvmlDeviceGetDetailsAll, so the default mix works out of the box.
+ */
+static char *discover_uuid(void) {
+    static const char request[] = "{\"action\": \"nvmlDeviceGetDetailsAll\"}";
+    char *response = malloc(RESPONSE_BUFFER_SIZE);
+    if (roundtrip(request, sizeof(request) - 1, response, RESPONSE_BUFFER_SIZE) < 0) {
+        free(response);
+        return NULL;
+    }
+    const char *key = strstr(response, "\"uuid\":");
+    char *uuid = NULL;
+    if (key != NULL) {
+        const char *start = strchr(key + strlen("\"uuid\":"), '"');
+        const char *end = start != NULL ? strchr(start + 1, '"') : NULL;
+        if (end != NULL) uuid = strndup(start + 1, (size_t) (end - start - 1));
+    }
+    free(response);
+    return uuid;
+}
+
+static void merge_stats(actionStats_st *dst, const actionStats_st *src) {
+    dst->requests += src->requests;
+    dst->errors_io += src->errors_io;
+    dst->errors_status += src->errors_status;
+    for (size_t i = 0; i < src->latencies.count; ++i) latency_push(&dst->latencies, src->latencies.values[i]);
+}
+
+static void print_stats_text(const char *name, actionStats_st *stats, const double elapsed_s) {
+    qsort(stats->latencies.values, stats->latencies.count, sizeof(uint64_t), compare_u64);
+    printf("%-48s %10llu req %10.1f req/s  errors io=%llu status=%llu\n",
+           name, stats->requests, (double) stats->requests / elapsed_s, stats->errors_io, stats->errors_status);
+    printf("%-48s p50 %8.1fus  p90 %8.1fus  p99 %8.1fus  p99.9 %8.1fus  max %8.1fus\n", "",
+           (double) percentile(&stats->latencies, 50) / 1e3,
+           (double) percentile(&stats->latencies, 90) / 1e3,
+           (double) percentile(&stats->latencies, 99) / 1e3,
+           (double) percentile(&stats->latencies, 99.9) / 1e3,
+           (double) percentile(&stats->latencies, 100) / 1e3);
+}
+
+static void print_stats_json(const char *name, actionStats_st *stats, const double elapsed_s, const int trailing_comma) {
+    qsort(stats->latencies.values, stats->latencies.count, sizeof(uint64_t), compare_u64);
+    printf("    \"%s\": {\"requests\": %llu, \"throughput\": %.3f, \"errorsIo\": %llu, \"errorsStatus\": %llu, "
+           "\"latencyNs\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}%s\n",
+           name, stats->requests, (double) stats->requests / elapsed_s, stats->errors_io, stats->errors_status,
+           (unsigned long long) percentile(&stats->latencies, 50),
+           (unsigned long long) percentile(&stats->latencies, 90),
+           (unsigned long long) percentile(&stats->latencies, 99),
+           (unsigned long long) percentile(&stats->latencies, 99.9),
+           (unsigned long long) percentile(&stats->latencies, 100),
+           trailing_comma ? "," : "");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s PATH    daemon socket (default " DEFAULT_SOCKET_PATH ")\n"
+            "  -c N       concurrent clients (default 4)\n"
+            "  -d SEC     measured duration in seconds (default 10)\n"
+            "  -n N       stop after N requests instead of after a duration\n"
+            "  -w SEC     warm-up seconds, excluded from the results (default 0)\n"
+            "  -r RATE    fixed aggregate rate in req/s; omit for closed-loop\n"
+            "  -m MIX     action mix, 'action:weight,...' (default " DEFAULT_MIX ")\n"
+            "  -u UUID    device uuid for per-device actions (default: first device from nvmlDeviceGetDetailsAll)\n"
+            "  -p PID     daemon pid for CPU accounting (default: first process named 'envyd')\n"
+            "  -j         print results as JSON\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mix = DEFAULT_MIX;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:d:n:w:r:m:u:p:jh")) != -1) {
+        switch (opt) {
+            case 's': config.socket_path = optarg; break;
+            case 'c': config.clients = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'd': config.duration_s = strtod(optarg, NULL); break;
+            case 'n': config.total_requests = strtoull(optarg, NULL, 10); break;
+            case 'w': config.warmup_s = strtod(optarg, NULL); break;
+            case 'r': config.rate = strtod(optarg, NULL); break;
+            case 'm': mix = optarg; break;
+            case 'u': config.uuid = optarg; break;
+            case 'p': config.daemon_pid = (pid_t) strtol(optarg, NULL, 10); break;
+            case 'j': config.json_output = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (config.clients == 0 || parse_mix(mix) != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int needs_uuid = 0;
+    for (size_t i = 0; i < config.action_count; ++i) needs_uuid |= config.actions[i].needs_uuid;
+    if (needs_uuid && config.uuid == NULL) {
+        config.uuid = discover_uuid();
+        if (config.uuid == NULL) {
+            fprintf(stderr, "Couldn't discover a device uuid via %s, pass one with -u\n", config.socket_path);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config.daemon_pid == 0) config.daemon_pid = find_daemon_pid();
+
+    benchClient_st *clients = calloc(config.clients, sizeof(benchClient_st));
+    // a first Ctrl+C ends the run early w/ results, a second one kills it
+    sigaction(SIGINT, &(struct sigaction) {.sa_handler = on_sigint, .sa_flags = SA_RESETHAND}, NULL);
+    bench_start_ns = now_ns();
+    bench_measure_ns = bench_start_ns + (uint64_t) (config.warmup_s * (double) NSEC_PER_SEC);
+    if (config.total_requests == 0) bench_stop_ns = bench_measure_ns + (uint64_t) (config.duration_s * (double) NSEC_PER_SEC);
+
+    for (unsigned int i = 0; i < config.clients; ++i) {
+        clients[i].id = i;
+        clients[i].rng_state = 0x9E3779B97F4A7C15ULL * (i + 1);
+        clients[i].response = malloc(RESPONSE_BUFFER_SIZE);
+        if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0) {
+            fprintf(stderr, "Couldn't start client thread %u\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    for (unsigned int i = 0; i < config.clients; ++i) pthread_join(clients[i].thread, NULL);
+
+    const uint64_t end_ns = now_ns();
+    const long long cpu_ticks_end = config.daemon_pid > 0 ? read_proc_cpu_ticks(config.daemon_pid) : -1;
+    const double elapsed_s = (double) (end_ns - (bench_measure_ns < end_ns ? bench_measure_ns : bench_start_ns)) / 1e9;
+    const double cpu_s = cpu_ticks_start >= 0 && cpu_ticks_end >= 0
+                             ? (double) (cpu_ticks_end - cpu_ticks_start) / (double) sysconf(_SC_CLK_TCK)
+                             : -1.0;
+
+    actionStats_st total = {0};
+    actionStats_st per_action[MAX_ACTIONS] = {0};
+    for (unsigned int i = 0; i < config.clients; ++i) {
+        for (size_t a = 0; a < config.action_count; ++a) {
+            merge_stats(&per_action[a], &clients[i].stats[a]);
+            merge_stats(&total, &clients[i].stats[a]);
+        }
+    }
+
+    if (config.json_output) {
+        printf("{\n  \"clients\": %u,\n  \"mode\": \"%s\",\n  \"rate\": %.3f,\n  \"elapsedSec\": %.3f,\n",
+               config.clients, config.rate > 0 ? "open-loop" : "closed-loop", config.rate, elapsed_s);
+        printf("  \"daemonPid\": %d,\n  \"daemonCpuSec\": %.3f,\n", config.daemon_pid, cpu_s);
+        printf("  \"actions\": {\n");
+        for (size_t a = 0; a < config.action_count; ++a) {
+            print_stats_json(config.actions[a].name, &per_action[a], elapsed_s, a + 1 < config.action_count);
+        }
+        printf("  },\n  \"total\": {\n");
+        print_stats_json("all", &total, elapsed_s, 0);
+        printf("  }\n}\n");
+    } else {
+        printf("envyd-bench: %u clients, %s, %.2fs measured\n",
+               config.clients, config.rate > 0 ? "open-loop" : "closed-loop", elapsed_s);
+        for (size_t a = 0; a < config.action_count; ++a) print_stats_text(config.actions[a].name, &per_action[a], elapsed_s);
+        print_stats_text("TOTAL", &total, elapsed_s);
+        if (cpu_s >= 0) {
+            printf("daemon pid %d cpu %.3fs (%.1f%% of one core), %.1fus cpu/request\n",
+                   config.daemon_pid, cpu_s, 100.0 * cpu_s / elapsed_s,
+                   total.requests > 0 ? cpu_s * 1e6 / (double) total.requests : 0.0);
+        } else {
+            printf("daemon cpu: unavailable (pass -p PID)\n");
+        }
+    }
+
+    for (unsigned int i = 0; i < config.clients; ++i) {
+        for (size_t a = 0; a < config.action_count; ++a) free(clients[i].stats[a].latencies.values);
+        free(clients[i].response);
+    }
+    free(clients);
+    return total.errors_io + total.errors_status > 0 ? 2 : EXIT_SUCCESS;
+}
@@ -0,0 +1,353 @@
+// envyd-microbench: CPU-only microbenchmarks of the request path (parse -> dispatch -> serialize).
+//  None of the benchmarks below end up calling into NVML, so this runs on GPU-less machines as long as
+//  libnvidia-ml.so.1 can be loaded (the CUDA toolkit stubs are enough). The exception are the ones prefixed
+//  w/ "nvml/", which are skipped unless nvmlInit_v2 succeeds; run them against the mock, e.g.
+//  ENVYD_MOCK_DEVICES=400 ENVYD_MOCK_LATENCY_US=50 envyd-microbench -f nvml/
+//  Every benchmark is calibrated to a minimum time per repetition, warmed up, repeated, and summarized as JSON.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <nvml.h>
+#include <json-c/json.h>
+#include "helpers.h"
+#include "network.h"
+
+// globals that normally live in main.c
+char *so_buffer = NULL;
+_Thread_local nvmlReturn_t gl_nvml_result;
+logLevel_t current_log_level;
+char *log_buffer = NULL;
+
+#define NSEC_PER_SEC 1000000000ULL
+
+typedef void (*benchFn_t)(void *ctx, unsigned long long iterations);
+
+typedef struct microbench_st {
+    const char *name;
+    benchFn_t fn;
+    void *ctx;
+} microbench_st;
+
+typedef struct benchOptions_st {
+    unsigned int repetitions;
+    unsigned int warmup;
+    unsigned long long min_rep_ns;
+    const char *filter;
+} benchOptions_st;
+
+static benchOptions_st options = {
+    .repetitions = 15,
+    .warmup = 3,
+    .min_rep_ns = 10 * 1000 * 1000ULL,
+    .filter = NULL,
+};
+
+static volatile uintptr_t sink;  // defeats dead code elimination
+static int null_fd = -1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// ----------------------------- BENCHMARKS -----------------------------
+
+static void bench_rstrip(void *ctx, const unsigned long long iterations) {
+    const char *input = ctx;
+    const size_t len = strlen(input) + 1;
+    char buffer[256];
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        memcpy(buffer, input, len);
+        rstrip(buffer);
+        sink += (uintptr_t) buffer[0];
+    }
+}
+
+static void bench_json_parse(void *ctx, const unsigned long long iterations) {
+    const char *input = ctx;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        enum json_tokener_error error;
+        json_object *jobj = json_tokener_parse_verbose(input, &error);
+        sink += (uintptr_t) jobj;
+        json_object_put(jobj);
+    }
+}
+
+static void bench_json_parse_reused(void *ctx, const unsigned long long iterations) {
+    const char *input = ctx;
+    // what process does: one tokener, reset per request
+    json_tokener *tokener = json_tokener_new();
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        json_tokener_reset(tokener);
+        json_object *jobj = json_tokener_parse_ex(tokener, input, -1);
+        sink += (uintptr_t) jobj;
+        json_object_put(jobj);
+    }
+    json_tokener_free(tokener);
+}
+
+static void bench_assign_task(void *ctx, const unsigned long long iterations) {
+    const char *input = ctx;
+    enum json_tokener_error error;
+    json_object *jobj = json_tokener_parse_verbose(input, &error);
+    const char *action = json_object_get_string(json_object_object_get(jobj, "action"));
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        assign_task(null_fd, action, jobj);
+        arena_reset(arena_request());  // as process does once the response is written
+    }
+    json_object_put(jobj);
+}
+
+static void bench_map_to_enum(void *ctx, const unsigned long long iterations) {
+    (void) ctx;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        // worst case for every mapper: the last entry of each chain
+        sink += map_nvmlRestrictedAPI_t_to_enum("NVML_RESTRICTED_API_SET_AUTO_BOOSTED_CLOCKS");
+        sink += map_nvmlClockId_t_to_enum("NVML_CLOCK_ID_CUSTOMER_BOOST_MAX");
+        sink += map_nvmlClockType_t_to_enum("NVML_CLOCK_VIDEO");
+        sink += map_nvmlPstates_t_to_enum("NVML_PSTATE_15");
+        sink += map_nvmlPowerScopeType_t_to_enum("NVML_POWER_SCOPE_MEMORY");
+        sink += map_nvmlTemperatureThresholds_t_to_enum("NVML_TEMPERATURE_THRESHOLD_GPS_CURR");
+    }
+}
+
+static void bench_map_pstate_first(void *ctx, const unsigned long long iterations) {
+    (void) ctx;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        sink += map_nvmlPstates_t_to_enum("NVML_PSTATE_0");
+    }
+}
+
+static void bench_map_to_string(void *ctx, const unsigned long long iterations) {
+    (void) ctx;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        sink += (uintptr_t) map_nvmlReturn_t_to_string((nvmlReturn_t) (i % 30));
+    }
+}
+
+static void bench_respond(void *ctx, const unsigned long long iterations) {
+    const char *datum = ctx;
+    const int client_fd = null_fd;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        RESPOND(client_fd, datum, map_nvmlReturn_t_to_string(NVML_SUCCESS), "Successfully retrieved temperature!");
+        arena_reset(arena_request());
+    }
+}
+
+static void bench_logl(void *ctx, const unsigned long long iterations) {
+    const logLevel_t level = (logLevel_t) (uintptr_t) ctx;
+    const logLevel_t previous = current_log_level;
+    current_log_level = level;
+    for (unsigned long long i = 0; i < iterations; ++i) {
+        LOG_TRACE("Got action '%s', length %lu", "nvmlDeviceGetPowerUsage", 23UL);
+    }
+    current_log_level = previous;
+}
+
+static void bench_details_build(void *ctx, const unsigned long long iterations) {
+    const unsigned int device_count = (unsigned int) (uintptr_t) ctx;
+    deviceDetails_st *details = calloc(device_count, sizeof(deviceDetails_st));
+    for (unsigned int i = 0; i < device_count; ++i) {
+        snprintf(details[i].uuid, sizeof(details[i].uuid), "GPU-%08x-eaaa-36de-0ec6-02c0be62ddef", i);
+        snprintf(details[i].name, sizeof(details[i].name), "NVIDIA GeForce RTX 2070 SUPER");
+        snprintf(details[i].gsp_version, sizeof(details[i].gsp_version), "560.35.03");
+        details[i].gsp_mode = details[i].default_mode = 1;
+    }
+    // same arena-backed stream the handler builds
+    for (unsigned long long it = 0; it < iterations; ++it) {
+        FILE *stream = arena_stream_open();
+        fprintf(stream, "{\"count\": %u, \"devices\": [", device_count);
+        for (unsigned int i = 0; i < device_count; ++i) write_device_details(stream, &details[i], DETAILS_FIELDS_ALL, i == 0);
+        fputs("]}", stream);
+        size_t buffer_len = 0;
+        const char *buffer = arena_stream_close(stream, &buffer_len);
+        sink += (uintptr_t) buffer[buffer_len - 1];
+        arena_reset(arena_request());
+    }
+    free(details);
+}
+
+typedef struct detailsCollect_st {
+    unsigned int fields;
+    unsigned int max_workers;
+} detailsCollect_st;
+
+static void bench_details_collect(void *ctx, const unsigned long long iterations) {
+    const detailsCollect_st *config = ctx;
+    unsigned int device_count = 0;
+    nvmlDeviceGetCount_v2(&device_count);
+    deviceDetails_st *details = calloc(device_count > 0 ? device_count : 1, sizeof(deviceDetails_st));
+    for (unsigned long long it = 0; it < iterations; ++it) {
+        collect_device_details(details, device_count, config->fields, config->max_workers);
+        sink += (uintptr_t) details[0].result;
+    }
+    free(details);
+}
+
+#define REQUEST_DETAILS_ALL "{\"action\": \"nvmlDeviceGetDetailsAll\"}"
+#define REQUEST_POWER_USAGE "{\"action\": \"nvmlDeviceGetPowerUsage\", \"uuid\": \"GPU-06358cc0-eaaa-36de-0ec6-02c0be62ddef\"}"
+#define REQUEST_SET_POWER_LIMIT "{\"bearer\": \"token\", \"action\": \"nvmlDeviceSetPowerManagementLimit\", " \
+    "\"uuid\": \"GPU-06358cc0-eaaa-36de-0ec6-02c0be62ddef\", \"powerScope\": \"NVML_POWER_SCOPE_GPU\", \"powerValueMw\": 200000}"
+
+static microbench_st benchmarks[] = {
+    {"rstrip/no_trailing", bench_rstrip, REQUEST_POWER_USAGE},
+    {"rstrip/trailing_newline", bench_rstrip, REQUEST_POWER_USAGE "  \r\n"},
+    {"json_parse/details_all", bench_json_parse, REQUEST_DETAILS_ALL},
+    {"json_parse/power_usage", bench_json_parse, REQUEST_POWER_USAGE},
+    {"json_parse/set_power_limit", bench_json_parse, REQUEST_SET_POWER_LIMIT},
+    {"json_parse_reused/power_usage", bench_json_parse_reused, REQUEST_POWER_USAGE},
+    // first action in the chain; no uuid, so the handler bails out w/ INVALID_JSON_SCHEMA before touching NVML
+    {"assign_task/first_action", bench_assign_task, "{\"action\": \"nvmlDeviceGetAdaptiveClockInfoStatus\"}"},
+    // walks every comparison in the chain and falls through to UNDEFINED_INVALID_ACTION
+    {"assign_task/fallthrough", bench_assign_task, "{\"action\": \"nvmlDeviceGetNonExistent\"}"},
+    {"map_to_enum/last_entries", bench_map_to_enum, NULL},
+    {"map_to_enum/pstate_first", bench_map_pstate_first, NULL},
+    {"map_to_string/nvmlReturn_t", bench_map_to_string, NULL},
+    {"respond/null_data", bench_respond, NULL},
+    {"respond/small_object", bench_respond, "{ \"temperature\": 54}"},
+    {"logl/filtered", bench_logl, (void *) (uintptr_t) ERROR},
+    {"logl/emitted", bench_logl, (void *) (uintptr_t) TRACE},
+    {"details_all_build/1", bench_details_build, (void *) (uintptr_t) 1},
+    {"details_all_build/8", bench_details_build, (void *) (uintptr_t) 8},
+    {"details_all_build/400", bench_details_build, (void *) (uintptr_t) 400},
+    // every device NVML reports, every field, one after another as the handler used to
+    {"nvml/details_all_collect/serial", bench_details_collect, &(detailsCollect_st){DETAILS_FIELDS_ALL, 1}},
+    {"nvml/details_all_collect/parallel", bench_details_collect, &(detailsCollect_st){DETAILS_FIELDS_ALL, DETAILS_MAX_WORKERS}},
+    {"nvml/details_all_collect/uuid_only", bench_details_collect, &(detailsCollect_st){DETAILS_FIELD_UUID, DETAILS_MAX_WORKERS}},
+};
+
+// ----------------------------- RUNNER -----------------------------
+
+static double run_once(const microbench_st *bench, const unsigned long long iterations) {
+    const uint64_t start = now_ns();
+    bench->fn(bench->ctx, iterations);
+    return (double) (now_ns() - start);
+}
+
+static unsigned long long calibrate(const microbench_st *bench) {
+    unsigned long long iterations = 1;
+    for (;;) {
+        const double elapsed = run_once(bench, iterations);
+        if (elapsed >= (double) options.min_rep_ns || iterations >= (1ULL << 40)) break;
+        // aim slightly past the target so the next round is usually the last
+        const double scale = elapsed > 0 ? (double) options.min_rep_ns * 1.2 / elapsed : 10.0;
+        iterations = (unsigned long long) ((double) iterations * (scale > 10.0 ? 10.0 : scale)) + 1;
+    }
+    return iterations;
+}
+
+static void run_benchmark(FILE *out, const microbench_st *bench, const int trailing_comma) {
+    const unsigned long long iterations = calibrate(bench);
+    for (unsigned int i = 0; i < options.warmup; ++i) run_once(bench, iterations);
+
+    double *samples = calloc(options.repetitions, sizeof(double));
+    double sum = 0;
+    for (unsigned int i = 0; i < options.repetitions; ++i) {
+        samples[i] = run_once(bench, iterations) / (double) iterations;
+        sum += samples[i];
+    }
+    qsort(samples, options.repetitions, sizeof(double), compare_double);
+
+    const double mean = sum / options.repetitions;
+    double variance = 0;
+    for (unsigned int i = 0; i < options.repetitions; ++i) variance += (samples[i] - mean) * (samples[i] - mean);
+    variance = options.repetitions > 1 ? variance / (options.repetitions - 1) : 0;
+    const double median = options.repetitions % 2 == 1
+                              ? samples[options.repetitions / 2]
+                              : (samples[options.repetitions / 2 - 1] + samples[options.repetitions / 2]) / 2;
+
+    fprintf(out,
+            "    {\"name\": \"%s\", \"iterations\": %llu, \"repetitions\": %u, \"unit\": \"ns/op\", "
+            "\"min\": %.2f, \"median\": %.2f, \"mean\": %.2f, \"max\": %.2f, \"stddev\": %.2f, \"cv\": %.4f}%s\n",
+            bench->name, iterations, options.repetitions,
+            samples[0], median, mean, samples[options.repetitions - 1], sqrt(variance),
+            mean > 0 ? sqrt(variance) / mean : 0,
+            trailing_comma ? "," : "");
+    fflush(out);
+    free(samples);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -r N     measured repetitions per benchmark (default 15)\n"
+            "  -w N     warm-up repetitions per benchmark (default 3)\n"
+            "  -t MS    minimum duration of a single repetition in ms (default 10)\n"
+            "  -f STR   only run benchmarks whose name contains STR\n"
+            "  -l       list benchmarks and exit\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t bench_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:t:f:lh")) != -1) {
+        switch (opt) {
+            case 'r': options.repetitions = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'w': options.warmup = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 't': options.min_rep_ns = strtoull(optarg, NULL, 10) * 1000 * 1000ULL; break;
+            case 'f': options.filter = optarg; break;
+            case 'l':
+                for (size_t i = 0; i < bench_count; ++i) printf("%s\n", benchmarks[i].name);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (options.repetitions == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // results go to the original stdout; everything the daemon code prints (logging) goes to /dev/null
+    null_fd = open("/dev/null", O_WRONLY);
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    if (null_fd < 0 || out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Couldn't redirect output to /dev/null\n");
+        return EXIT_FAILURE;
+    }
+    current_log_level = ERROR;
+
+    size_t selected[sizeof(benchmarks) / sizeof(benchmarks[0])];
+    size_t selected_count = 0;
+    int nvml_state = 0;  // 0: not tried yet, 1: initialized, -1: unavailable
+    for (size_t i = 0; i < bench_count; ++i) {
+        if (options.filter != NULL && strstr(benchmarks[i].name, options.filter) == NULL) continue;
+        if (strncmp(benchmarks[i].name, "nvml/", strlen("nvml/")) == 0) {
+            if (nvml_state == 0) nvml_state = nvmlInit_v2() == NVML_SUCCESS ? 1 : -1;
+            if (nvml_state < 0) {
+                fprintf(stderr, "Skipping %s, NVML couldn't be initialized\n", benchmarks[i].name);
+                continue;
+            }
+        }
+        selected[selected_count++] = i;
+    }
+
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < selected_count; ++i) {
+        run_benchmark(out, &benchmarks[selected[i]], i + 1 < selected_count);
+    }
+    fprintf(out, "  ]\n}\n");
+
+    fclose(out);
+    if (nvml_state > 0) nvmlShutdown();
+    close(null_fd);
+    free(so_buffer);
+    free(log_buffer);
+    arena_free(arena_request());
+    return EXIT_SUCCESS;
+}